@@ -0,0 +1,51 @@
+#ifndef __LIBBITC_ARENA_H__
+#define __LIBBITC_ARENA_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	BITC_ARENA_ALIGN	= 16,
+	BITC_ARENA_MIN_CHUNK	= 4096,
+};
+
+struct bitc_arena_chunk {
+	struct bitc_arena_chunk	*next;
+	size_t			used;		// bytes handed out
+	size_t			alloc;		// usable bytes in data[]
+	unsigned char		data[] __attribute__((aligned(BITC_ARENA_ALIGN)));
+};
+
+/* bump allocator; individual allocations are never freed, the
+ * whole arena is released (or recycled) at once
+ */
+struct bitc_arena {
+	struct bitc_arena_chunk	*head;		// current chunk, others follow
+	size_t			chunk_sz;	// default size of new chunks
+	size_t			total;		// bytes handed out, all chunks
+};
+
+extern void bitc_arena_init(struct bitc_arena *arena, size_t chunk_sz);
+extern void *bitc_arena_alloc(struct bitc_arena *arena, size_t sz);
+extern void *bitc_arena_calloc(struct bitc_arena *arena, size_t nmemb, size_t sz);
+extern void bitc_arena_reset(struct bitc_arena *arena);
+extern void bitc_arena_free(struct bitc_arena *arena);
+
+static inline size_t bitc_arena_used(const struct bitc_arena *arena)
+{
+	return arena->total;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_ARENA_H__ */
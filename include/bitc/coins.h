@@ -0,0 +1,133 @@
+#ifndef __LIBBITC_COINS_H__
+#define __LIBBITC_COINS_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/arena.h>                 // for bitc_arena
+#include <bitc/cstr.h>                  // for cstring
+#include <bitc/flatmap.h>               // for bitc_flatmap
+#include <bitc/primitives/transaction.h> // for bitc_outpt, bitc_tx, etc
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for int64_t, uint32_t
+#include <string.h>                     // for memset
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Unspent output set keyed by outpoint.  Each output is one packed
+ * record holding its amount, height, coinbase flag and compressed
+ * scriptPubKey; records live in an arena and are recycled through
+ * per-size free lists when spent.  Outputs that can never be spent
+ * (OP_RETURN, oversized scripts) are not stored.
+ */
+
+enum {
+	BITC_COINS_KEY_SZ	= 32 + 4,	// txid, output index
+	BITC_COINS_SZ_CLASSES	= 640,		// 16-byte record size classes
+	BITC_COIN_PACKED_MAX	= 8 + 4 + 1 + 10000,	// see bitc_coin_unpack
+};
+
+/* an unpacked output, as returned by lookup and spend */
+struct bitc_coin {
+	int64_t		nValue;
+	uint32_t	height;
+	bool		is_coinbase;
+	cstring		*scriptPubKey;	// allocated on demand, then reused
+};
+
+static inline void bitc_coin_init(struct bitc_coin *coin)
+{
+	memset(coin, 0, sizeof(*coin));
+}
+
+static inline void bitc_coin_free(struct bitc_coin *coin)
+{
+	if (coin->scriptPubKey)
+		cstr_free(coin->scriptPubKey, true);
+	coin->scriptPubKey = NULL;
+}
+
+struct bitc_coins {
+	struct bitc_flatmap	*map;		// outpoint -> record pointer
+	struct bitc_arena	arena;		// record storage
+
+	void		*free_rec[BITC_COINS_SZ_CLASSES];	// spent records
+	size_t		free_bytes;	// recycled bytes, part of arena use
+};
+
+extern bool bitc_coins_init(struct bitc_coins *coins);
+extern void bitc_coins_free(struct bitc_coins *coins);
+extern void bitc_coins_clear(struct bitc_coins *coins);
+
+static inline size_t bitc_coins_size(const struct bitc_coins *coins)
+{
+	return bitc_flatmap_size(coins->map);
+}
+
+/* heap bytes held: table, live records and recycled record space */
+static inline size_t bitc_coins_memory(const struct bitc_coins *coins)
+{
+	return sizeof(*coins) + bitc_flatmap_memory(coins->map) +
+	       bitc_arena_used(&coins->arena);
+}
+
+/* add one output, replacing any existing coin at outpt */
+extern bool bitc_coins_add(struct bitc_coins *coins,
+			   const struct bitc_outpt *outpt,
+			   const struct bitc_txout *txout,
+			   bool is_coinbase, uint32_t height);
+
+/* add every spendable output of tx; tx->sha256 must be valid */
+extern bool bitc_coins_add_tx(struct bitc_coins *coins,
+			      const struct bitc_tx *tx,
+			      bool is_coinbase, uint32_t height);
+
+extern bool bitc_coins_have(const struct bitc_coins *coins,
+			    const struct bitc_outpt *outpt);
+
+/* fill coin (if non-NULL) from the output at outpt */
+extern bool bitc_coins_lookup(const struct bitc_coins *coins,
+			      const struct bitc_outpt *outpt,
+			      struct bitc_coin *coin);
+
+/* like lookup, also removing the output from the set */
+extern bool bitc_coins_spend(struct bitc_coins *coins,
+			     const struct bitc_outpt *outpt,
+			     struct bitc_coin *coin);
+
+/* table key of an outpoint: txid, then little-endian output index */
+extern void bitc_coins_key(unsigned char *key, const struct bitc_outpt *outpt);
+
+/*
+ * Packed form of one output, for storage: little-endian 64-bit amount,
+ * little-endian 32-bit height << 1 | is_coinbase, compressed script.
+ */
+typedef bool (*bitc_coins_func)(const unsigned char *key, const void *val,
+				size_t val_len, void *priv);
+
+/* call f with each output in packed form, stopping if it returns false */
+extern bool bitc_coins_iter_packed(const struct bitc_coins *coins,
+				   bitc_coins_func f, void *priv);
+extern bool bitc_coin_unpack(struct bitc_coin *coin, const void *val,
+			     size_t val_len);
+
+/* scriptPubKey compression, exposed for tests and storage layers.
+ * out needs room for len + 1 bytes; if NULL, only the compressed
+ * length is returned.
+ */
+extern size_t bitc_script_compress(unsigned char *out,
+				   const unsigned char *script, size_t len);
+extern bool bitc_script_decompress(cstring *s,
+				   const unsigned char *comp, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_COINS_H__ */
@@ -13,6 +13,9 @@ enum {
     /** The maximum allowed weight for a block, see BIP 141 (network rule) */
     MAX_BLOCK_WEIGHT	= 4000000,
 
+    /** The maximum allowed number of signature check operations in a block, weighted as for MAX_BLOCK_WEIGHT (network rule) */
+    MAX_BLOCK_SIGOPS_COST	= 80000,
+
     /** Coinbase transaction outputs can only be spent after this number of new blocks (network rule) */
 	COINBASE_MATURITY	= 100,
 
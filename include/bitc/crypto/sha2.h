@@ -35,6 +35,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -70,6 +71,29 @@ char* sha512_End(SHA512_CTX*, char[SHA512_DIGEST_STRING_LENGTH]);
 void sha512_Raw(const void*, size_t, uint8_t[SHA512_DIGEST_LENGTH]);
 char* sha512_Data(const void*, size_t, char[SHA512_DIGEST_STRING_LENGTH]);
 
+/* Block transform in use: "sha-ni" (x86 SHA extensions), "armv8" (ARMv8
+ * cryptography extensions) or "portable".  The fastest one the CPU
+ * supports is chosen at first use; *_select() forces a specific one and
+ * returns false if it is unknown or unsupported by this CPU.
+ */
+const char *sha256_impl(void);
+bool sha256_select(const char *name);
+const char *sha512_impl(void);
+bool sha512_select(const char *name);
+
+/* Compress whole SHA256_BLOCK_LENGTH blocks into context->state with
+ * the "sha-ni" or "armv8" transform regardless of the one in use,
+ * leaving the bit count and buffer alone; for callers such as sha256d64
+ * that pad their own messages and check the CPU on their own.  Each is
+ * only built on its own architecture and must only be called on a CPU
+ * with those instructions.
+ */
+void sha256_Transform_shani(SHA256_CTX*, const uint8_t*, size_t);
+void sha256_Transform_armv8(SHA256_CTX*, const uint8_t*, size_t);
+
+/* SHA-256 round constants */
+extern const uint32_t sha256_K[64];
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,33 @@
+#ifndef __LIBBITC_CRYPTO_SHA256D64_H__
+#define __LIBBITC_CRYPTO_SHA256D64_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Batched double-SHA256 of n independent 64-byte messages, such as
+ * merkle tree node pairs: out[32*i] = SHA256(SHA256(in[64*i..64*i+63])).
+ * The fastest kernel the CPU supports is chosen at first use.
+ */
+extern void sha256d64(unsigned char *out, const unsigned char *in, size_t n);
+
+/* name of the kernel in use: "sha-ni", "armv8", "avx2", "sse4.1" or
+ * "scalar"
+ */
+extern const char *sha256d64_impl(void);
+
+/* force a specific kernel; false if unknown or unsupported by this CPU */
+extern bool sha256d64_select(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_CRYPTO_SHA256D64_H__ */
@@ -42,6 +42,8 @@ struct chaindb {
 	struct bitc_hashtab *blocks;
 
 	struct blkinfo	*best_chain;
+
+	bool		hdrs_only;	/* header index: kept out of the db */
 };
 
 extern struct blkinfo *bi_new(void);
@@ -51,8 +53,23 @@ extern bool chaindb_init(struct chaindb *db, const unsigned char *netmagic,
 		       const bu256_t *genesis_block);
 extern void chaindb_free(struct chaindb *db);
 extern bool chaindb_read(struct chaindb *db, const char *idx_fn);
+
+/* rebuild db from the stored block index; false if absent or damaged */
+extern bool chaindb_load(struct chaindb *db);
 extern bool chaindb_add(struct chaindb *db, struct blkinfo *bi,
 		      struct chaindb_reorg *reorg_info);
+
+/* start an empty header index at a copy of bi, which need not be the
+ * genesis block; its height and work are taken as given
+ */
+extern bool chaindb_add_root(struct chaindb *db, const struct blkinfo *bi);
+
+/* undo the chaindb_add of bi, given its reorg_info, before anything is
+ * added on top of it; bi is freed.  False if its stored records could
+ * not all be deleted.
+ */
+extern bool chaindb_remove(struct chaindb *db, struct blkinfo *bi,
+			   const struct chaindb_reorg *reorg_info);
 extern void chaindb_locator(struct chaindb *db, struct blkinfo *bi,
 		   struct bitc_locator *locator);
 
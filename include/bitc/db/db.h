@@ -6,12 +6,15 @@
  */
 
 #include <bitc/buint.h>                 // for bu256_t
+#include <bitc/coins.h>                 // for bitc_coins, bitc_coin
 #include <bitc/core.h>                  // for bp_block
+#include <bitc/flatmap.h>               // for bitc_flatmap
 
 #include <lmdb.h>                       // for MDB_dbi, MDB_env
 
 #include <stdbool.h>                    // for bool
 #include <stddef.h>                     // for size_t
+#include <time.h>                       // for time_t
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,12 +32,44 @@ enum db_list {
 	METADB,
 	BLOCKDB,
 	BLOCKHEIGHTDB,
+	UTXODB,
+	BLOCKIDXDB,
 	MAX_NUM_DBS,
 };
 
 enum metadb_key {
 	NETMAGIC_KEY,
 	GENESIS_KEY,
+	UTXO_BEST_KEY,
+};
+
+enum {
+	UTXODB_FLUSH_BLOCKS	= 2000,			// default blocks per flush
+	UTXODB_MAX_CACHE	= 512 * 1024 * 1024,	// default cache bytes
+};
+
+enum {
+	DB_BATCH_WRITES		= 4096,			// default records per commit
+	DB_BATCH_BYTES		= 64 * 1024 * 1024,	// default bytes per commit
+	DB_BATCH_SECS		= 30,			// default seconds per commit
+	DB_BATCH_IDLE		= 2,			// seconds without a write
+};
+
+/*
+ * Write batching.  While a batch is active, blockdb, blockheightdb and
+ * utxodb writes share one LMDB write transaction, committed once any
+ * non-zero limit below is reached, on db_batch_commit() or db_sync(),
+ * and on db_close().  The max_secs limit, and a batch that has seen no
+ * write for DB_BATCH_IDLE seconds, are also committed by db_batch_idle(),
+ * which a quiet process should call every so often.  A crash loses at
+ * most the uncommitted batch; the database stays consistent.
+ */
+struct db_batch_policy {
+	unsigned int	max_writes;	// records per commit
+	size_t		max_bytes;	// bytes written per commit
+	unsigned int	max_secs;	// seconds since the batch opened
+	bool		nosync;		// MDB_NOSYNC: no fsync at commit
+	bool		writemap;	// MDB_WRITEMAP, set before metadb_init
 };
 
 struct db_handle {
@@ -46,8 +81,18 @@ struct db_handle {
 struct db_info {
 	MDB_env				*env;
 	struct db_handle	handle[MAX_NUM_DBS];
+
+	struct db_batch_policy	policy;
+	bool			batching;	// db_batch_begin() called
+	MDB_txn			*batch_txn;	// open batch, if any
+	unsigned int		batch_writes;
+	size_t			batch_bytes;
+	time_t			batch_start;
+	time_t			batch_last;	// last write joined the batch
 };
 
+extern struct db_info dbinfo;
+
 extern bool metadb_init(const unsigned char *netmagic,
 		       const bu256_t *genesis_block);
 
@@ -56,8 +101,82 @@ extern bool blockdb_add(bu256_t *hash, struct const_buffer *buf);
 
 extern bool blockheightdb_init(void);
 extern bool blockheightdb_add(int height, bu256_t *hash);
+extern bool blockheightdb_get(int height, bu256_t *hash);
+extern bool blockheightdb_del(int height, const bu256_t *hash);
 extern bool blockheightdb_getall(bool (*read_block)(void *p, size_t len));
 
+extern bool blockdb_get(const bu256_t *hash,
+			bool (*read_block)(void *p, size_t len));
+
+/* block index: one record per chaindb entry, keyed by block hash */
+extern bool blockidxdb_init(void);
+extern bool blockidxdb_add(const bu256_t *hash, const void *rec, size_t len);
+extern bool blockidxdb_del(const bu256_t *hash);
+extern bool blockidxdb_getall(bool (*read_idx)(const bu256_t *hash,
+					       const void *p, size_t len,
+					       void *priv),
+			      void *priv);
+
+/*
+ * UTXO database fronted by a write-back cache.  Outputs created since
+ * the last flush live only in memory; spends of outputs already on disk
+ * are kept as pending deletions.  A flush writes both, together with
+ * the best block marker, in a single LMDB write transaction, so the
+ * database always reflects the UTXO set as of a whole block.
+ *
+ * The changes a block makes are logged until utxodb_block_done; if
+ * the block turns out invalid, utxodb_block_abort undoes them, so no
+ * flush ever writes part of a block.
+ */
+struct utxodb_undo;
+
+struct utxodb {
+	struct bitc_coins	cache;		// outputs not yet on disk
+	struct bitc_flatmap	*spent;		// on-disk outputs spent since
+	MDB_txn			*rtxn;		// reused read transaction
+	bool			rtxn_live;
+
+	unsigned int		flush_blocks;	// flush after this many blocks
+	size_t			max_cache;	// or once the cache is this big
+	unsigned int		n_blocks;	// blocks applied since flush
+
+	bu256_t			best_hash;	// last block applied
+	int			best_height;	// -1 if none
+
+	/* the block being applied */
+	struct utxodb_undo	*undo;		// its changes, in order
+	size_t			n_undo;
+	size_t			undo_alloc;
+	struct bitc_coins	undo_coins;	// cache outputs it spent
+};
+
+extern bool utxodb_init(struct utxodb *udb, unsigned int flush_blocks,
+			size_t max_cache);
+extern bool utxodb_close(struct utxodb *udb);
+extern void utxodb_free(struct utxodb *udb);
+extern bool utxodb_lookup(struct utxodb *udb, const struct bitc_outpt *outpt,
+			  struct bitc_coin *coin);
+extern bool utxodb_spend(struct utxodb *udb, const struct bitc_outpt *outpt,
+			 struct bitc_coin *coin);
+extern bool utxodb_add_tx(struct utxodb *udb, const struct bitc_tx *tx,
+			  bool is_coinbase, unsigned int height);
+extern bool utxodb_block_done(struct utxodb *udb, const bu256_t *hash,
+			      int height);
+extern bool utxodb_block_abort(struct utxodb *udb);
+extern bool utxodb_flush(struct utxodb *udb);
+
+static inline size_t utxodb_cache_memory(const struct utxodb *udb)
+{
+	return bitc_coins_memory(&udb->cache) + bitc_flatmap_memory(udb->spent);
+}
+
+extern void db_set_policy(const struct db_batch_policy *policy);
+extern void db_batch_begin(void);
+extern bool db_batch_commit(void);
+extern bool db_batch_end(void);
+extern bool db_batch_idle(void);
+extern bool db_sync(void);
+
 extern void db_close(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,115 @@
+#ifndef __LIBBITC_FLATMAP_H__
+#define __LIBBITC_FLATMAP_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/buint.h>                 // for bu256_t, bu160_t
+#include <bitc/hashtab.h>               // for bitc_kvu_func
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for uint8_t, uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open-addressing hash table for fixed-size keys and values, both stored
+ * inline in one flat slot array.  Meant for 256-bit and 160-bit hash keys
+ * (txids, block hashes, pubkey hashes) where bitc_hashtab would spend a
+ * malloc and several pointer hops per entry.
+ *
+ * Each slot has a control byte holding a 7-bit tag of the key hash, or
+ * BITC_FM_EMPTY.  Lookups compare a group of 16 control bytes at once
+ * (SSE2 or NEON where available) and only touch slots whose tag matches.
+ * Collisions are resolved by linear probing; deletion shifts following
+ * entries back, so the table never holds tombstones.
+ *
+ * Value pointers returned by get/insert are 8-byte aligned and stay
+ * valid only until the next put, insert, del, reserve or clear.
+ */
+
+enum {
+	BITC_FM_GROUP		= 16,	// control bytes probed at once
+	BITC_FM_MIN_CAP		= 16,	// smallest slot count
+	BITC_FM_EMPTY		= 0x80,	// control byte of a free slot
+};
+
+struct bitc_flatmap {
+	size_t		size;		// entry count
+	size_t		cap;		// slot count, a power of two
+	size_t		growth_left;	// inserts left before next resize
+
+	unsigned int	key_len;	// key bytes
+	unsigned int	val_len;	// value bytes, may be zero (a set)
+	unsigned int	val_off;	// value offset within a slot
+	unsigned int	slot_len;	// bytes per slot
+
+	uint64_t	salt;		// per-table hash key
+
+	uint8_t		*ctrl;		// cap + BITC_FM_GROUP control bytes
+	uint8_t		*slots;		// cap * slot_len bytes
+};
+
+extern struct bitc_flatmap *bitc_flatmap_new(unsigned int key_len,
+					     unsigned int val_len);
+extern void bitc_flatmap_free(struct bitc_flatmap *fm);
+extern void bitc_flatmap_clear(struct bitc_flatmap *fm);
+extern bool bitc_flatmap_reserve(struct bitc_flatmap *fm, size_t n);
+
+static inline struct bitc_flatmap *bitc_flatmap_new_bu256(unsigned int val_len)
+{
+	return bitc_flatmap_new(sizeof(bu256_t), val_len);
+}
+
+static inline struct bitc_flatmap *bitc_flatmap_new_bu160(unsigned int val_len)
+{
+	return bitc_flatmap_new(sizeof(bu160_t), val_len);
+}
+
+static inline size_t bitc_flatmap_size(const struct bitc_flatmap *fm)
+{
+	return fm->size;
+}
+
+/* heap bytes held by the table */
+static inline size_t bitc_flatmap_memory(const struct bitc_flatmap *fm)
+{
+	return sizeof(*fm) + fm->cap * fm->slot_len + fm->cap + BITC_FM_GROUP;
+}
+
+/* value of key, or NULL if absent */
+extern void *bitc_flatmap_get(const struct bitc_flatmap *fm, const void *key);
+
+static inline bool bitc_flatmap_has(const struct bitc_flatmap *fm,
+				    const void *key)
+{
+	return bitc_flatmap_get(fm, key) != NULL;
+}
+
+/* value slot of key, adding a zero-filled entry if absent; *inserted
+ * tells which.  NULL on allocation failure.
+ */
+extern void *bitc_flatmap_insert(struct bitc_flatmap *fm, const void *key,
+				 bool *inserted);
+
+/* add or overwrite; val may be NULL when val_len is zero */
+extern bool bitc_flatmap_put(struct bitc_flatmap *fm, const void *key,
+			     const void *val);
+
+/* remove key, copying its value to val_out if non-NULL */
+extern bool bitc_flatmap_del(struct bitc_flatmap *fm, const void *key,
+			     void *val_out);
+
+/* the table must not be modified from within the callback */
+extern void bitc_flatmap_iter(const struct bitc_flatmap *fm, bitc_kvu_func f,
+			      void *priv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_FLATMAP_H__ */
@@ -38,6 +38,13 @@ extern bool bitc_sign(const struct bitc_key *key, const void *data, size_t data_
 	     void **sig_, size_t *sig_len_);
 extern bool bitc_verify(const struct bitc_key *key, const void *data, size_t data_len,
 	       const void *sig, size_t sig_len);
+/* bitc_verify in two steps: parse a lax-DER signature, normalized to
+ * low S, then check it against a 32-byte hash
+ */
+extern bool bitc_sig_parse(secp256k1_ecdsa_signature *sig, const void *sig_,
+			   size_t sig_len);
+extern bool bitc_verify_parsed(const struct bitc_key *key, const void *data32,
+			       const secp256k1_ecdsa_signature *sig);
 extern bool bitc_key_add_secret(struct bitc_key *out,
 			      const struct bitc_key *key,
 			      const uint8_t *tweak32);
@@ -45,6 +45,28 @@ extern cstring *message_str(const unsigned char netmagic[4],
 		     const char *command_,
 		     const void *data, uint32_t data_len);
 
+/*
+ * A wire message, header and payload, built and checksummed once and
+ * then shared read-only by every connection it is queued to.  The
+ * last p2p_msgbuf_unref frees it.
+ */
+struct p2p_msgbuf {
+	unsigned int	refs;		/* atomic */
+	uint32_t	len;		/* of data */
+	unsigned char	data[];		/* P2P_HDR_SZ + payload */
+};
+
+extern struct p2p_msgbuf *p2p_msgbuf_new(const unsigned char netmagic[4],
+					 const char *command,
+					 const void *data, uint32_t data_len);
+extern void p2p_msgbuf_unref(struct p2p_msgbuf *mb);
+
+static inline struct p2p_msgbuf *p2p_msgbuf_ref(struct p2p_msgbuf *mb)
+{
+	__atomic_add_fetch(&mb->refs, 1, __ATOMIC_RELAXED);
+	return mb;
+}
+
 struct msg_addr {
 	parr	*addrs;		/* of bitc_address */
 };
@@ -82,6 +104,10 @@ static inline void msg_getblocks_free(struct msg_getblocks *gb)
 	bitc_locator_free(&gb->locator);
 }
 
+enum {
+	MAX_HEADERS_RESULTS	= 2000,		/* per "headers" message */
+};
+
 struct msg_headers {
 	parr	*headers;
 };
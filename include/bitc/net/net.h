@@ -7,6 +7,7 @@
 
 #include <bitc/buint.h>                // for bu256_t
 #include <bitc/clist.h>                // for clist
+#include <bitc/hashtab.h>              // for bitc_hashtab
 #include <bitc/message.h>              // for P2P_HDR_SZ, p2p_message
 #include <bitc/parr.h>                 // for parr
 #include <bitc/primitives/block.h>     // for bitc_block
@@ -29,7 +30,17 @@ extern "C" {
 #endif
 
 enum {
-	NC_MAX_CONN	= 8,
+	NC_MAX_CONN	= 8,		/* default max_conns */
+	NC_RX_BUF_SZ	= 256 * 1024,	/* holds a full "headers" reply */
+	NC_WRITE_IOV	= 64,		/* queued messages per writev */
+	NC_LOOP_QUEUE	= 1024,		/* messages queued by each loop */
+	NC_DL_WINDOW	= 128,		/* blocks past our tip fetched */
+	NC_DL_PER_PEER	= 16,		/* blocks in flight per peer */
+	NC_DL_TICK	= 1,		/* secs between download checks */
+	NC_DL_STALL	= 2,		/* secs the window may wait on one block */
+	NC_DL_TIMEOUT	= 30,		/* secs a peer may send no block */
+	NC_HDRS_TIMEOUT	= 30,		/* secs a peer may take on getheaders */
+	NC_HDRS_SEED	= 2016,		/* blocks of ours put in hdr_db */
 };
 
 enum netcmds {
@@ -42,6 +53,8 @@ enum netcmds {
 
 struct net_settings *net_settings;
 
+struct nc_loop;
+
 struct net_child_info {
 	int			read_fd;
 	int			write_fd;
@@ -59,6 +72,29 @@ struct net_child_info {
 
 	bool			running;
 
+	unsigned int		max_conns;	/* 0: NC_MAX_CONN */
+	unsigned int		dl_window;	/* 0: NC_DL_WINDOW */
+	unsigned int		dl_per_peer;	/* 0: NC_DL_PER_PEER */
+
+	/* set up by nc_loops_start */
+	unsigned int		n_loops;
+	struct nc_loop		*loops;
+	unsigned int		next_loop;	/* round-robin for new conns */
+	int			wake_pipe[2];	/* loops to eb */
+	struct event		*wake_ev;
+	bool			wake_pending;	/* (atomic) */
+
+	/* set up by nc_hdrs_start */
+	struct chaindb		*hdr_db;	/* valid headers, from near tip */
+	parr			*hdr_chain;	/* hdr_db best chain, by height */
+	struct nc_conn		*hdr_conn;	/* getheaders outstanding */
+	time_t			hdr_requested;	/* of hdr_conn, last */
+	struct bitc_hashtab	*dl_blocks;	/* window blocks being fetched */
+	unsigned int		dl_next_conn;	/* round-robin for requests */
+	struct event		*dl_timer;
+	uint64_t		dl_best_rate;	/* of any peer, bytes/sec */
+	bool			dl_forked;	/* best headers fork below tip */
+
 	bool (*inv_block_process)(bu256_t *hash);
 	bool (*block_process)(struct bitc_block *block,
                           struct const_buffer *buf);
@@ -77,20 +113,41 @@ struct nc_conn {
 	struct event		*ev;
 	struct net_child_info	*nci;
 
+	/* I/O thread, if any; it alone touches ev and the write and
+	 * receive state, while nci->eb owns the rest
+	 */
+	struct nc_loop		*loop;
+	bool			detached;	/* loop has let go; may free */
+	bool			loop_dead;	/* killed, seen by the loop */
+
 	struct event		*write_ev;
-	clist			*write_q;	/* of struct buffer */
+	clist			*write_q;	/* of struct p2p_msgbuf */
 	unsigned int		write_partial;
+	struct iovec		*write_iov;	/* NC_WRITE_IOV entries */
+
+	struct p2p_message	msg;		/* being handled */
 
-	struct p2p_message	msg;
+	/* received bytes; messages are framed and handled in place */
+	unsigned char		*rx_buf;	/* NC_RX_BUF_SZ bytes */
+	unsigned int		rx_start;
+	unsigned int		rx_end;
 
+	/* rest of a body too big for rx_buf, read into rx_msg.data */
+	struct p2p_message	rx_msg;
 	void			*msg_p;
 	unsigned int		expected;
-	bool			reading_hdr;
-	unsigned char		hdrbuf[P2P_HDR_SZ];
 
 	bool			seen_version;
 	bool			seen_verack;
 	uint32_t		protover;
+
+	int			best_height;	/* as far as we know */
+	unsigned int		blocks_in_flight;
+	time_t			dl_last;	/* last block, or first request */
+	uint64_t		dl_bytes;	/* block bytes since last tick */
+	uint64_t		dl_rate;	/* block bytes/sec, smoothed */
+	bool			dl_rated;	/* dl_rate measured */
+	bool			dl_stalled;	/* held up the window */
 };
 
 struct net_engine {
@@ -106,7 +163,45 @@ struct net_engine {
 
 struct net_engine *neteng_new_start(void (*network_child)(int read_fd, int write_fd));
 
+extern bool nc_conn_send_msg(struct nc_conn *conn, struct p2p_msgbuf *mb);
+extern void nc_conns_send_all(struct net_child_info *nci,
+			      struct p2p_msgbuf *mb);
 extern void nc_conns_process(struct net_child_info *nci);
+
+/*
+ * Spread connection I/O over n_loops threads, each running its own
+ * event loop over the connections it is given.  They frame incoming
+ * messages and verify their checksums, then pass them through a
+ * lock-free queue per loop to nci->eb, where messages are handled as
+ * before.  Sends from handlers go back to the owning loop.  Start
+ * before opening any connections; nc_loops_stop frees them all.
+ */
+extern bool nc_loops_start(struct net_child_info *nci, unsigned int n_loops);
+extern void nc_loops_stop(struct net_child_info *nci);
+
+/*
+ * Headers-first sync.  Headers are fetched from one peer at a time,
+ * MAX_HEADERS_RESULTS per getheaders, and checked for proof of work
+ * and linkage into hdr_db, an empty header-only index that starts out
+ * with the top NC_HDRS_SEED headers of the chain in nci->db; those of
+ * a chain parting from ours further down do not connect.  Block bodies
+ * on the best header chain are then fetched from all peers, no further
+ * than dl_window past the tip of nci->db, and passed to block_process
+ * in order.  Should the best header chain fork below that tip, which
+ * would take a reorg, fetching stops.
+ *
+ * Each block goes to the peer expected to deliver it soonest, judged
+ * by its measured throughput and what it already has in flight; a
+ * peer gets up to dl_per_peer blocks, fewer the slower it is next to
+ * the fastest.  A peer whose block holds up a full window for
+ * NC_DL_STALL secs has its requests handed to others, and gets no more
+ * until it sends a block; one that sends nothing for NC_DL_TIMEOUT
+ * secs with blocks in flight is dropped.  Headers are asked of another
+ * peer if one leaves getheaders unanswered for NC_HDRS_TIMEOUT secs.
+ * Without nc_hdrs_start, blocks are fetched as announced by inv.
+ */
+extern bool nc_hdrs_start(struct net_child_info *nci, struct chaindb *hdr_db);
+extern void nc_hdrs_stop(struct net_child_info *nci);
 extern void nc_conns_gc(struct net_child_info *nci, bool free_all);
 extern void nc_pipe_evt(int fd, short events, void *priv);
 extern void neteng_free(struct net_engine *neteng);
@@ -5,13 +5,17 @@
  * file COPYING or http://www.opensource.org/licenses/mit-license.php.
  */
 
+#include <bitc/arena.h>                 // for bitc_arena
 #include <bitc/buffer.h>                // for const_buffer
 #include <bitc/buint.h>                 // for bu256_t
-#include <bitc/coredefs.h>              // for ::COIN
+#include <bitc/coredefs.h>              // for ::COIN, etc
 #include <bitc/cstr.h>                  // for cstring
 #include <bitc/parr.h>                  // for parr
+#include <bitc/primitives/transaction.h>  // for bitc_tx_view
+#include <bitc/serialize.h>             // for bitc_sink
 
 #include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
 #include <stdint.h>                     // for uint32_t, int64_t
 #include <string.h>                     // for memcpy, NULL
 
@@ -34,9 +38,45 @@ struct bitc_block {
 	bu256_t		sha256;
 };
 
+/* Sizes and signature operations of a block, as counted against the
+ * consensus limits.  The _stats parsers fill these in on the way
+ * through the wire bytes; bitc_block_stats_calc does the same for a
+ * block built in memory.  P2SH and witness sigops depend on the
+ * outputs spent, and are only added by bitc_block_stats_spend.
+ */
+struct bitc_block_stats {
+	size_t		base_size;	// without witness data
+	size_t		total_size;	// with witness data
+	size_t		weight;
+	unsigned int	sigops_legacy;
+	unsigned int	sigops_p2sh;
+	unsigned int	sigops_witness;
+};
+
+static inline size_t bitc_block_stats_sigop_cost(
+	const struct bitc_block_stats *stats)
+{
+	return (size_t) (stats->sigops_legacy + stats->sigops_p2sh) *
+		WITNESS_SCALE_FACTOR + stats->sigops_witness;
+}
+
 extern void bitc_block_init(struct bitc_block *block);
 extern bool deser_bitc_block(struct bitc_block *block, struct const_buffer *buf);
+extern bool deser_bitc_block_stats(struct bitc_block *block,
+				   struct const_buffer *buf,
+				   struct bitc_block_stats *stats);
+extern void bitc_block_stats_calc(struct bitc_block_stats *stats,
+				  const struct bitc_block *block);
+/* count the sigops of txin spending an output locked by scriptPubKey,
+ * under SCRIPT_VERIFY_P2SH and SCRIPT_VERIFY_WITNESS in flags
+ */
+extern void bitc_block_stats_spend(struct bitc_block_stats *stats,
+				   const struct bitc_txin *txin,
+				   const cstring *scriptPubKey,
+				   unsigned int flags);
 extern void ser_bitc_block(cstring *s, const struct bitc_block *block);
+extern void ser_sink_bitc_block(struct bitc_sink *sink,
+				const struct bitc_block *block);
 extern void bitc_block_free(struct bitc_block *block);
 extern void bitc_block_freep(void *bitc_block_p);
 extern void bitc_block_vtx_free(struct bitc_block *block);
@@ -48,10 +88,48 @@ extern parr *bitc_block_merkle_branch(const struct bitc_block *block,
 			       unsigned int txidx);
 extern void bitc_check_merkle_branch(bu256_t *hash, const bu256_t *txhash_in,
 			    const parr *mrkbranch, unsigned int txidx);
+/* proof of work and timestamp; all that can be checked of a header alone */
+extern bool bitc_block_valid_hdr(struct bitc_block *block);
 extern bool bitc_block_valid(struct bitc_block *block);
+/* bitc_block_valid, checking the limits against stats from the parse */
+extern bool bitc_block_valid_stats(struct bitc_block *block,
+				   const struct bitc_block_stats *stats);
 extern unsigned int bitc_block_ser_size(const struct bitc_block *block);
 extern void bitc_block_free_cb(void *data);
 
+/* Read-only block view: every transaction, input and output of the
+ * block is carved out of one per-block arena, and scripts point
+ * straight into the source buffer, which must outlive the view.
+ */
+struct bitc_block_view {
+	/* serialized */
+	uint32_t	nVersion;
+	bu256_t		hashPrevBlock;
+	bu256_t		hashMerkleRoot;
+	uint32_t	nTime;
+	uint32_t	nBits;
+	uint32_t	nNonce;
+	unsigned int	n_tx;
+	struct bitc_tx_view	*vtx;
+
+	/* used at runtime */
+	bool		sha256_valid;
+	bu256_t		sha256;
+
+	struct bitc_arena	arena;
+};
+
+extern void bitc_block_view_init(struct bitc_block_view *block);
+extern bool deser_bitc_block_view(struct bitc_block_view *block,
+				  struct const_buffer *buf);
+extern bool deser_bitc_block_view_stats(struct bitc_block_view *block,
+					struct const_buffer *buf,
+					struct bitc_block_stats *stats);
+extern void bitc_block_view_free(struct bitc_block_view *block);
+extern void bitc_block_view_calc_sha256(struct bitc_block_view *block);
+extern void bitc_block_view_copy_hdr(struct bitc_block *dest,
+				     const struct bitc_block_view *src);
+
 static inline void bitc_block_copy_hdr(struct bitc_block *dest,
 				     const struct bitc_block *src)
 {
@@ -5,11 +5,14 @@
  * file COPYING or http://www.opensource.org/licenses/mit-license.php.
  */
 
+#include <bitc/arena.h>                 // for bitc_arena
+#include <bitc/buffer.h>                // for const_buffer
 #include <bitc/buint.h>                 // for bu256_t, bu256_equal, etc
 #include <bitc/core.h>                  // for bitc_valid_value
 #include <bitc/cstr.h>                  // for cstring
 #include <bitc/hashtab.h>               // for bitc_hashtab_get, etc
 #include <bitc/parr.h>                  // for parr, parr_idx
+#include <bitc/serialize.h>             // for bitc_sink
 
 #include <stdbool.h>                    // for bool, false, true
 #include <stdint.h>                     // for uint32_t, int64_t
@@ -47,6 +50,8 @@ struct bitc_outpt {
 extern void bitc_outpt_init(struct bitc_outpt *outpt);
 extern bool deser_bitc_outpt(struct bitc_outpt *outpt, struct const_buffer *buf);
 extern void ser_bitc_outpt(cstring *s, const struct bitc_outpt *outpt);
+extern void ser_sink_bitc_outpt(struct bitc_sink *sink,
+				const struct bitc_outpt *outpt);
 static inline void bitc_outpt_free(struct bitc_outpt *outpt) {}
 
 static inline bool bitc_outpt_null(const struct bitc_outpt *outpt)
@@ -76,6 +81,8 @@ struct bitc_txin {
 extern void bitc_txin_init(struct bitc_txin *txin);
 extern bool deser_bitc_txin(struct bitc_txin *txin, struct const_buffer *buf);
 extern void ser_bitc_txin(cstring *s, const struct bitc_txin *txin);
+extern void ser_sink_bitc_txin(struct bitc_sink *sink,
+			       const struct bitc_txin *txin);
 extern void bitc_txin_free(struct bitc_txin *txin);
 extern void bitc_txin_freep(void *data);
 static inline bool bitc_txin_valid(const struct bitc_txin *txin) { return true; }
@@ -89,6 +96,8 @@ struct bitc_txout {
 extern void bitc_txout_init(struct bitc_txout *txout);
 extern bool deser_bitc_txout(struct bitc_txout *txout, struct const_buffer *buf);
 extern void ser_bitc_txout(cstring *s, const struct bitc_txout *txout);
+extern void ser_sink_bitc_txout(struct bitc_sink *sink,
+				const struct bitc_txout *txout);
 extern void bitc_txout_free(struct bitc_txout *txout);
 extern void bitc_txout_freep(void *data);
 extern void bitc_txout_set_null(struct bitc_txout *txout);
@@ -110,19 +119,56 @@ struct bitc_tx {
 	parr	*vout;			/* of bitc_txout */
 	uint32_t	nLockTime;
 
-	/* used at runtime */
+	/* used at runtime; deser_bitc_tx() fills these in from the wire
+	 * bytes, so anything mutating a parsed tx must invalidate them
+	 */
 	bool		sha256_valid;
 	bu256_t		sha256;
+	bool		wtxid_valid;
+	bu256_t		wtxid;
+};
+
+/* Location of a transaction within the buffer it was parsed from.  The
+ * non-witness serialization is the 4-byte nVersion, the body (vin and
+ * vout arrays) and the trailing 4-byte nLockTime.
+ */
+struct bitc_tx_span {
+	const unsigned char	*p;		// entire tx, as on the wire
+	size_t			len;
+	size_t			body_off;	// offset of the vin count
+	size_t			body_len;
 };
 
+static inline bool bitc_tx_span_witness(const struct bitc_tx_span *span)
+{
+	/* marker and flag bytes sit between nVersion and the body */
+	return span->body_off > sizeof(uint32_t);
+}
+
+/* bytes outside the witness data, as counted for block weight */
+static inline size_t bitc_tx_span_base_size(const struct bitc_tx_span *span)
+{
+	if (!bitc_tx_span_witness(span))
+		return span->len;
+	return 2 * sizeof(uint32_t) + span->body_len;
+}
+
+extern void bitc_tx_span_txid(bu256_t *vo, const struct bitc_tx_span *span);
+extern void bitc_tx_span_wtxid(bu256_t *vo, const struct bitc_tx_span *span);
+
 extern void bitc_tx_init(struct bitc_tx *tx);
 extern bool deser_bitc_tx(struct bitc_tx *tx, struct const_buffer *buf);
+/* deser_bitc_tx, also returning where tx lay in buf */
+extern bool deser_bitc_tx_span(struct bitc_tx *tx, struct const_buffer *buf,
+			       struct bitc_tx_span *span);
 extern void ser_bitc_tx(cstring *s, const struct bitc_tx *tx);
+extern void ser_sink_bitc_tx(struct bitc_sink *sink, const struct bitc_tx *tx);
 extern void bitc_tx_free_vout(struct bitc_tx *tx);
 extern void bitc_tx_free(struct bitc_tx *tx);
 extern void bitc_tx_freep(void *bitc_tx_p);
 extern bool bitc_tx_valid(const struct bitc_tx *tx);
 extern void bitc_tx_calc_sha256(struct bitc_tx *tx);
+extern void bitc_tx_calc_wtxid(struct bitc_tx *tx);
 extern unsigned int bitc_tx_ser_size(const struct bitc_tx *tx);
 extern void bitc_tx_copy(struct bitc_tx *dest, const struct bitc_tx *src);
 
@@ -138,6 +184,55 @@ static inline bool bitc_tx_coinbase(const struct bitc_tx *tx)
 	return true;
 }
 
+/* Read-only transaction view.  Scripts and witness items are slices of
+ * the buffer the view was parsed from, which must outlive the view;
+ * everything else lives in the caller's arena.
+ */
+struct bitc_txin_view {
+	struct bitc_outpt	prevout;
+	struct const_buffer	scriptSig;
+	uint32_t		nSequence;
+
+	unsigned int		n_witness;
+	struct const_buffer	*scriptWitness;
+};
+
+struct bitc_txout_view {
+	int64_t			nValue;
+	struct const_buffer	scriptPubKey;
+};
+
+struct bitc_tx_view {
+	/* serialized */
+	uint32_t		nVersion;
+	unsigned int		n_vin;
+	struct bitc_txin_view	*vin;
+	unsigned int		n_vout;
+	struct bitc_txout_view	*vout;
+	uint32_t		nLockTime;
+
+	/* used at runtime */
+	struct bitc_tx_span	span;
+	bool			sha256_valid;
+	bu256_t			sha256;
+	bool			wtxid_valid;
+	bu256_t			wtxid;
+};
+
+extern bool deser_bitc_tx_view(struct bitc_tx_view *tx, struct const_buffer *buf,
+			       struct bitc_arena *arena);
+extern void ser_bitc_tx_view(cstring *s, const struct bitc_tx_view *tx);
+extern void ser_sink_bitc_tx_view(struct bitc_sink *sink,
+				  const struct bitc_tx_view *tx);
+extern void bitc_tx_view_calc_sha256(struct bitc_tx_view *tx);
+extern void bitc_tx_view_calc_wtxid(struct bitc_tx_view *tx);
+extern void bitc_tx_from_view(struct bitc_tx *dest, const struct bitc_tx_view *src);
+
+static inline bool bitc_tx_view_coinbase(const struct bitc_tx_view *tx)
+{
+	return (tx->n_vin == 1) && bitc_outpt_null(&tx->vin[0].prevout);
+}
+
 struct bitc_utxo {
 	bu256_t		hash;
 
@@ -0,0 +1,124 @@
+#ifndef __LIBBITC_SCRIPT_CHECKQUEUE_H__
+#define __LIBBITC_SCRIPT_CHECKQUEUE_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/arena.h>                 // for bitc_arena
+#include <bitc/cstr.h>                  // for cstring
+#include <bitc/primitives/transaction.h> // for bitc_tx
+#include <bitc/script/interpreter.h>    // for bitc_txdata
+#include <bitc/script/sigbatch.h>       // for bitc_sigbatch
+
+#include <pthread.h>                    // for pthread_mutex_t, etc
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for int64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Parallel script verification.  The block connect loop queues one
+ * check per input as it spends coins; a pool of worker threads runs
+ * them, each taking from its own deque and stealing from the others
+ * when that runs dry.  bitc_checkq_wait gives a single verdict for
+ * everything queued since bitc_checkq_begin.  After the first failure
+ * the remaining checks are dropped without being run.
+ *
+ * Signatures of standard spends are not verified by the checks but
+ * gathered in a batch, which the pool verifies once every script has
+ * run.
+ *
+ * Checks and their script copies live in an arena that is recycled
+ * per batch, so the coin a check was made from may be reused at once.
+ * Only one thread may queue checks.
+ */
+
+struct bitc_check {
+	const struct bitc_tx	*tx;
+	struct bitc_txdata	*txdata;	// shared by the checks of tx
+	cstring			scriptPubKey;	// view into the arena
+	unsigned int		nIn;
+	unsigned int		flags;
+	int64_t			amount;
+};
+
+/* per-worker double-ended queue; the owner pops at the tail,
+ * thieves take from the head
+ */
+struct bitc_checkq_deque {
+	pthread_mutex_t		lock;
+	struct bitc_check	**ring;
+	size_t			cap;		// power of 2
+	size_t			head;
+	size_t			tail;
+};
+
+struct bitc_checkq;
+
+struct bitc_checkq_worker {
+	struct bitc_checkq	*q;
+	unsigned int		id;		// index of own deque
+	pthread_t		thread;
+};
+
+struct bitc_checkq {
+	unsigned int		n_workers;	// 0: checks run inline
+	struct bitc_checkq_worker *workers;
+	struct bitc_checkq_deque *deques;	// n_workers + 1, last is ours
+	unsigned int		next;		// round-robin deque for add
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cv;	// checks queued, or quit
+	pthread_cond_t		done_cv;	// pending reached zero
+	bool			quit;
+
+	unsigned int		queued;		// in deques (atomic)
+	unsigned int		pending;	// queued or running (atomic)
+	bool			failed;		// (atomic)
+
+	struct bitc_sigbatch	batch;		// deferred signatures
+	bool			sig_phase;	// scripts done, batch running
+	unsigned int		sig_workers;	// workers in the batch
+
+	struct bitc_arena	arena;		// checks, scripts, txdata
+};
+
+/* start n_workers threads; BITC_CHECKQ_AUTO sizes the pool to the
+ * online CPUs, leaving one for the caller, which helps in wait
+ */
+#define BITC_CHECKQ_AUTO	(~0U)
+
+extern bool bitc_checkq_init(struct bitc_checkq *q, unsigned int n_workers);
+extern void bitc_checkq_free(struct bitc_checkq *q);
+
+/* start a new batch; the previous one must have been waited for */
+extern void bitc_checkq_begin(struct bitc_checkq *q);
+
+/* txdata for tx with its BIP143 hashes already filled in, so that
+ * workers only ever read it; valid until the next bitc_checkq_begin
+ */
+extern struct bitc_txdata *bitc_checkq_txdata(struct bitc_checkq *q,
+					      const struct bitc_tx *tx);
+
+/* queue verification of input nIn of tx against scriptPubKey, which
+ * is copied; false once any check of this batch has failed
+ */
+extern bool bitc_checkq_add(struct bitc_checkq *q, const struct bitc_tx *tx,
+			    struct bitc_txdata *txdata, unsigned int nIn,
+			    const cstring *scriptPubKey, unsigned int flags,
+			    int64_t amount);
+
+/* run queued checks, then their deferred signatures, alongside the
+ * workers until all are done; true if every check passed
+ */
+extern bool bitc_checkq_wait(struct bitc_checkq *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_SCRIPT_CHECKQUEUE_H__ */
@@ -5,6 +5,7 @@
  * file COPYING or http://www.opensource.org/licenses/mit-license.php.
  */
 
+#include <bitc/buffer.h>                // for buffer
 #include <bitc/buint.h>                 // for bu256_t
 #include <bitc/cstr.h>                  // for cstring
 #include <bitc/parr.h>                  // for parr
@@ -12,6 +13,7 @@
 
 #include <stdbool.h>                    // for bool
 #include <stdint.h>                     // for int64_t
+#include <string.h>                     // for memset
 
 #ifdef __cplusplus
 extern "C" {
@@ -111,20 +113,65 @@ enum SigVersion {
         SIGVERSION_WITNESS_V0 = 1,
 };
 
+/*
+ * BIP143 hashes shared by every input of one transaction.  Each is
+ * computed on first use; pass the same bitc_txdata when verifying all
+ * inputs of tx so they are computed once rather than once per input.
+ * A NULL bitc_txdata is accepted and costs one computation per call.
+ */
+struct bitc_txdata {
+	const struct bitc_tx	*tx;
+	bool			have_prevouts;
+	bool			have_sequence;
+	bool			have_outputs;
+	bu256_t			hashPrevouts;
+	bu256_t			hashSequence;
+	bu256_t			hashOutputs;
+};
+
+static inline void bitc_txdata_init(struct bitc_txdata *txdata,
+				    const struct bitc_tx *tx)
+{
+	memset(txdata, 0, sizeof(*txdata));
+	txdata->tx = tx;
+}
+
+/* compute the hashes up front if tx has witness inputs, after which
+ * txdata is only read and may be shared between threads
+ */
+extern void bitc_txdata_fill(struct bitc_txdata *txdata);
+
 /*
  * script validation
  */
 
+/* FindAndDelete: remove each push of buf from s that starts on an
+ * opcode boundary; returns the number of pushes removed
+ */
+extern unsigned int bitc_script_find_del(cstring *s, const struct buffer *buf);
+
 extern void bitc_tx_sighash(bu256_t* hash, const cstring* scriptCode,
         const struct bitc_tx* txTo, unsigned int nIn, int nHashType,
-        int64_t amount, enum SigVersion sigversion);
+        int64_t amount, enum SigVersion sigversion,
+        struct bitc_txdata *txdata);
 extern bool bitc_script_verify(const cstring* scriptSig,
         const cstring* scriptPubKey, parr** witness,
         const struct bitc_tx* txTo, unsigned int nIn,
-        unsigned int flags, int64_t amount);
+        unsigned int flags, int64_t amount, struct bitc_txdata *txdata);
+
+/* bitc_script_verify, leaving the signatures of standard spends that
+ * are not in the signature cache to batch; the verdict only holds if
+ * the whole batch verifies
+ */
+struct bitc_sigbatch;
+extern bool bitc_script_verify_deferred(const cstring* scriptSig,
+        const cstring* scriptPubKey, parr** witness,
+        const struct bitc_tx* txTo, unsigned int nIn, unsigned int flags,
+        int64_t amount, struct bitc_txdata *txdata,
+        struct bitc_sigbatch *batch);
 extern bool bitc_verify_sig(const struct bitc_utxo* txFrom,
         const struct bitc_tx* txTo, unsigned int nIn,
-        unsigned int flags, int64_t amount);
+        unsigned int flags, int64_t amount, struct bitc_txdata *txdata);
 
 #ifdef __cplusplus
 }
@@ -223,12 +223,22 @@ extern enum opcodetype GetOpType(const char *opname);
 
 extern bool bsp_getop(struct bscript_op *op, struct bscript_parser *bp);
 extern unsigned int bsp_get_sigopcount(struct const_buffer* buf, bool fAccurate);
+/* sigops of the redeemScript or witness program spending scriptPubKey;
+ * 0 if it is not a P2SH or witness output
+ */
+extern unsigned int bsp_get_p2sh_sigopcount(struct const_buffer *scriptPubKey,
+					    struct const_buffer *scriptSig);
+extern unsigned int bsp_get_witness_sigopcount(struct const_buffer *scriptPubKey,
+					       struct const_buffer *scriptSig,
+					       const parr *witness);
 extern parr *bsp_parse_all(const void *data_, size_t data_len);
 extern enum txnouttype bsp_classify(parr *ops);
 extern bool bsp_addr_parse(struct bscript_addr *addr,
 		    const void *data, size_t data_len);
 extern void bsp_addr_free(struct bscript_addr *addr);
-extern bool is_bsp_witnessprogram(const cstring* s, int* version, cstring* program);
+/* program points into s */
+extern bool is_bsp_witnessprogram(const cstring* s, int* version,
+				  struct const_buffer* program);
 extern bool is_bsp_pushonly(struct const_buffer *buf);
 extern bool is_bsp_pubkey(parr *ops);
 extern bool is_bsp_pubkeyhash(parr *ops);
@@ -261,6 +271,32 @@ static inline bool is_bsp_p2wsh(struct const_buffer* buf)
         return (buf->len == 34 && vch[0] == OP_0 && vch[1] == 0x20);
 }
 
+static inline bool is_bsp_p2pkh(struct const_buffer *buf)
+{
+	const unsigned char *vch = (const unsigned char *)(buf->p);
+	return	(buf->len == 25 &&
+		 vch[0] == OP_DUP &&
+		 vch[1] == OP_HASH160 &&
+		 vch[2] == 0x14 &&
+		 vch[23] == OP_EQUALVERIFY &&
+		 vch[24] == OP_CHECKSIG);
+}
+
+static inline bool is_bsp_p2wpkh(struct const_buffer *buf)
+{
+	const unsigned char *vch = (const unsigned char *)(buf->p);
+	return (buf->len == 22 && vch[0] == OP_0 && vch[1] == 0x14);
+}
+
+/* <33 or 65 byte pubkey> OP_CHECKSIG */
+static inline bool is_bsp_p2pk(struct const_buffer *buf)
+{
+	const unsigned char *vch = (const unsigned char *)(buf->p);
+	return	((buf->len == 35 || buf->len == 67) &&
+		 vch[0] == buf->len - 2 &&
+		 vch[buf->len - 1] == OP_CHECKSIG);
+}
+
 static inline void bsp_start(struct bscript_parser *bp,
 			     struct const_buffer *buf)
 {
@@ -268,6 +304,22 @@ static inline void bsp_start(struct bscript_parser *bp,
 	bp->error = false;
 }
 
+/*
+ * script numbers (CScriptNum): little-endian sign-magnitude, the sign
+ * in the top bit of the last byte.  Arithmetic operands are at most
+ * 4 bytes and lock times 5, so every value and result fits an int64.
+ */
+
+typedef int64_t scriptnum;
+
+enum {
+	SCRIPTNUM_MAX_SIZE	= 9,		// encoding of any int64/uint64
+};
+
+extern bool scriptnum_decode(scriptnum *vo, const struct buffer *buf,
+			     bool fRequireMinimal, size_t nMaxNumSize);
+extern size_t scriptnum_encode(unsigned char *out, scriptnum v);
+
 /*
  * script signing
  */
@@ -0,0 +1,91 @@
+#ifndef __LIBBITC_SCRIPT_SIGBATCH_H__
+#define __LIBBITC_SCRIPT_SIGBATCH_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/buffer.h>                // for buffer
+#include <bitc/buint.h>                 // for bu256_t
+
+#include <pthread.h>                    // for pthread_mutex_t
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for uint8_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Deferred signature verification.  A script whose only possible
+ * outcome of a failed signature check is failure may queue the
+ * (sighash, pubkey, signature) triple here and carry on as if it
+ * passed; a block is then valid only if the whole batch is.
+ *
+ * Entries are claimed BITC_SIGBATCH_CHUNK at a time by any number of
+ * threads in bitc_sigbatch_run, which parses and normalizes the keys
+ * and signatures of a chunk together before verifying them.  Every
+ * entry keeps its own verdict, and valid ones go to the signature
+ * cache.  Adding is thread-safe but must be finished before the batch
+ * is run.
+ */
+
+enum {
+	BITC_SIGBATCH_CHUNK	= 32,
+	BITC_SIGBATCH_MAX_PUBKEY = 65,
+	BITC_SIGBATCH_MAX_SIG	= 72,		// DER, without hash type
+};
+
+struct bitc_sigbatch_entry {
+	bu256_t		sighash;
+	uint8_t		pubkey_len;
+	uint8_t		sig_len;
+	bool		valid;			// set by bitc_sigbatch_run
+	unsigned char	pubkey[BITC_SIGBATCH_MAX_PUBKEY];
+	unsigned char	sig[BITC_SIGBATCH_MAX_SIG];
+};
+
+struct bitc_sigbatch {
+	pthread_mutex_t		lock;		// for add
+	struct bitc_sigbatch_entry *entries;
+	size_t			len;
+	size_t			alloc;
+
+	size_t			next;		// first unclaimed entry (atomic)
+	size_t			done;		// entries verified (atomic)
+	bool			failed;		// some entry invalid (atomic)
+};
+
+extern void bitc_sigbatch_init(struct bitc_sigbatch *b);
+extern void bitc_sigbatch_free(struct bitc_sigbatch *b);
+
+/* drop all entries, keeping the memory */
+extern void bitc_sigbatch_reset(struct bitc_sigbatch *b);
+
+/* queue sig (without hash type) by pubkey over sighash; false if it
+ * can't be queued, and must be verified by the caller
+ */
+extern bool bitc_sigbatch_add(struct bitc_sigbatch *b, const bu256_t *sighash,
+			      const struct buffer *pubkey,
+			      const struct buffer *sig);
+
+/* verify unclaimed entries until there are none; may be called from
+ * several threads at once
+ */
+extern void bitc_sigbatch_run(struct bitc_sigbatch *b);
+
+/* true once every entry has been verified */
+static inline bool bitc_sigbatch_done(const struct bitc_sigbatch *b)
+{
+	return __atomic_load_n(&b->done, __ATOMIC_ACQUIRE) == b->len;
+}
+
+/* run the batch in this thread; true if every entry is valid */
+extern bool bitc_sigbatch_verify(struct bitc_sigbatch *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_SCRIPT_SIGBATCH_H__ */
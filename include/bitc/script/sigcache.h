@@ -0,0 +1,71 @@
+#ifndef __LIBBITC_SCRIPT_SIGCACHE_H__
+#define __LIBBITC_SCRIPT_SIGCACHE_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/buffer.h>                // for buffer
+#include <bitc/buint.h>                 // for bu256_t
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cache of signatures known to be valid, consulted by CHECKSIG and
+ * CHECKMULTISIG before running ECDSA.  Entries are a salted SHA-256 of
+ * (sighash, pubkey, signature); only successful checks are stored, so
+ * a hit can never turn an invalid signature valid.
+ *
+ * The table is a fixed-size cuckoo hash: each entry has
+ * BITC_SIGCACHE_WAYS candidate slots, and inserting into a full set
+ * relocates the occupant to one of its own alternatives, up to a
+ * bounded number of moves, after which the last entry displaced is
+ * dropped.  Readers never block; each slot carries a sequence count
+ * that writers make odd while they update it, and a reader that sees
+ * it change treats the slot as a miss.
+ *
+ * The cache is process-wide and off until bitc_sigcache_init.
+ */
+
+enum {
+	BITC_SIGCACHE_WAYS	= 4,
+	BITC_SIGCACHE_KICKS	= 8,		// relocations per insert
+	BITC_SIGCACHE_DEFAULT_MB = 32,
+};
+
+struct bitc_sigcache_stats {
+	uint64_t	hits;
+	uint64_t	misses;
+	uint64_t	inserts;
+	uint64_t	evictions;		// entries dropped when full
+	size_t		slots;
+	size_t		memory;			// table bytes
+};
+
+/* (re)create the cache using at most max_bytes; 0 disables it */
+extern bool bitc_sigcache_init(size_t max_bytes);
+extern void bitc_sigcache_free(void);
+
+extern bool bitc_sigcache_enabled(void);
+
+/* true if sig by pubkey over sighash was stored as valid */
+extern bool bitc_sigcache_get(const bu256_t *sighash,
+			      const struct buffer *pubkey,
+			      const struct buffer *sig);
+extern void bitc_sigcache_add(const bu256_t *sighash,
+			      const struct buffer *pubkey,
+			      const struct buffer *sig);
+
+extern void bitc_sigcache_stats(struct bitc_sigcache_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_SCRIPT_SIGCACHE_H__ */
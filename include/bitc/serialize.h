@@ -8,6 +8,7 @@
 #include <bitc/buffer.h>                // for const_buffer
 #include <bitc/buint.h>                 // for bu256_t
 #include <bitc/cstr.h>                  // for cstring
+#include <bitc/crypto/sha2.h>           // for SHA256_CTX
 #include <bitc/parr.h>                  // for parr
 
 #include <gmp.h>                        // for mpz_t
@@ -35,6 +36,7 @@ static inline void ser_u256(cstring *s, const bu256_t *v_)
 extern void ser_varlen(cstring *s, uint32_t vlen);
 extern void ser_str(cstring *s, const char *s_in, size_t maxlen);
 extern void ser_varstr(cstring *s, cstring *s_in);
+extern void ser_varslice(cstring *s, const struct const_buffer *buf);
 
 static inline void ser_s32(cstring *s, int32_t v_)
 {
@@ -64,6 +66,8 @@ static inline bool deser_u256(bu256_t *vo, struct const_buffer *buf)
 extern bool deser_varlen(uint32_t *lo, struct const_buffer *buf);
 extern bool deser_str(char *so, struct const_buffer *buf, size_t maxlen);
 extern bool deser_varstr(cstring **so, struct const_buffer *buf);
+extern bool deser_slice(struct const_buffer *so, struct const_buffer *buf, size_t len);
+extern bool deser_varslice(struct const_buffer *so, struct const_buffer *buf);
 
 static inline bool deser_s64(int64_t *vo, struct const_buffer *buf)
 {
@@ -75,6 +79,53 @@ extern bool deser_varlen_array(parr **ao, struct const_buffer *buf);
 
 extern void u256_from_compact(mpz_t vo, uint32_t c);
 
+/* Serializer sink: the ser_sink_* family writes through one of these
+ * rather than to a cstring, so that callers can hash or merely measure
+ * a serialization without materializing the bytes.
+ */
+struct bitc_sink {
+	void		(*write)(struct bitc_sink *sink, const void *p,
+				 size_t len);	// NULL for counting sink
+	void		*ctx;			// cstring or SHA256_CTX
+	size_t		len;			// bytes written so far
+};
+
+extern void bitc_sink_cstr_init(struct bitc_sink *sink, cstring *s);
+extern void bitc_sink_sha256_init(struct bitc_sink *sink, SHA256_CTX *ctx);
+extern void bitc_sink_count_init(struct bitc_sink *sink);
+extern void bitc_sink_sha256d(struct bitc_sink *sink, unsigned char *md256);
+
+static inline void ser_sink_bytes(struct bitc_sink *sink, const void *p,
+				  size_t len)
+{
+	sink->len += len;
+	if (sink->write)
+		sink->write(sink, p, len);
+}
+
+extern void ser_sink_u16(struct bitc_sink *sink, uint16_t v_);
+extern void ser_sink_u32(struct bitc_sink *sink, uint32_t v_);
+extern void ser_sink_u64(struct bitc_sink *sink, uint64_t v_);
+extern void ser_sink_varlen(struct bitc_sink *sink, uint32_t vlen);
+extern void ser_sink_varstr(struct bitc_sink *sink, const cstring *s_in);
+extern void ser_sink_varslice(struct bitc_sink *sink,
+			      const struct const_buffer *buf);
+
+static inline void ser_sink_u256(struct bitc_sink *sink, const bu256_t *v_)
+{
+	ser_sink_bytes(sink, v_, sizeof(bu256_t));
+}
+
+static inline void ser_sink_s32(struct bitc_sink *sink, int32_t v_)
+{
+	ser_sink_u32(sink, (uint32_t) v_);
+}
+
+static inline void ser_sink_s64(struct bitc_sink *sink, int64_t v_)
+{
+	ser_sink_u64(sink, (uint64_t) v_);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,76 @@
+#ifndef __LIBBITC_SPSCQ_H__
+#define __LIBBITC_SPSCQ_H__
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t, NULL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free queue of pointers between exactly one producer
+ * thread and one consumer thread.  Each index is written by one side
+ * only, and kept on its own cache line.
+ */
+
+enum {
+	BITC_SPSCQ_LINE		= 64,
+};
+
+struct bitc_spscq {
+	void		**slots;
+	size_t		mask;		// slots - 1, a power of 2 less one
+
+	size_t		head __attribute__((aligned(BITC_SPSCQ_LINE)));
+					// next to pop; consumer's (atomic)
+	size_t		tail __attribute__((aligned(BITC_SPSCQ_LINE)));
+					// next to push; producer's (atomic)
+};
+
+/* room for at least size entries */
+extern bool bitc_spscq_init(struct bitc_spscq *q, size_t size);
+extern void bitc_spscq_free(struct bitc_spscq *q);
+
+/* false if full */
+static inline bool bitc_spscq_push(struct bitc_spscq *q, void *p)
+{
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+		return false;
+
+	q->slots[tail & q->mask] = p;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* for the producer; stays false until it pushes again */
+static inline bool bitc_spscq_full(const struct bitc_spscq *q)
+{
+	return __atomic_load_n(&q->tail, __ATOMIC_RELAXED) -
+	       __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask;
+}
+
+/* NULL if empty */
+static inline void *bitc_spscq_pop(struct bitc_spscq *q)
+{
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	void *p = q->slots[head & q->mask];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return p;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBITC_SPSCQ_H__ */
@@ -0,0 +1,115 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/arena.h>                 // for bitc_arena, etc
+
+#include <stdint.h>                     // for SIZE_MAX
+#include <stdlib.h>                     // for malloc, free
+#include <string.h>                     // for memset, NULL
+
+static inline size_t arena_align(size_t sz)
+{
+	return (sz + (BITC_ARENA_ALIGN - 1)) & ~((size_t) BITC_ARENA_ALIGN - 1);
+}
+
+static struct bitc_arena_chunk *arena_chunk_new(size_t sz)
+{
+	struct bitc_arena_chunk *chunk;
+
+	chunk = malloc(sizeof(*chunk) + sz);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->used = 0;
+	chunk->alloc = sz;
+
+	return chunk;
+}
+
+void bitc_arena_init(struct bitc_arena *arena, size_t chunk_sz)
+{
+	memset(arena, 0, sizeof(*arena));
+
+	if (chunk_sz < BITC_ARENA_MIN_CHUNK)
+		chunk_sz = BITC_ARENA_MIN_CHUNK;
+	arena->chunk_sz = arena_align(chunk_sz);
+}
+
+void *bitc_arena_alloc(struct bitc_arena *arena, size_t sz)
+{
+	if (sz > SIZE_MAX - BITC_ARENA_ALIGN)
+		return NULL;
+
+	sz = arena_align(sz ? sz : 1);
+
+	struct bitc_arena_chunk *chunk = arena->head;
+	if (!chunk || (chunk->alloc - chunk->used) < sz) {
+		size_t chunk_sz = arena->chunk_sz;
+		if (chunk_sz < sz)
+			chunk_sz = sz;
+
+		chunk = arena_chunk_new(chunk_sz);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = arena->head;
+		arena->head = chunk;
+	}
+
+	void *p = chunk->data + chunk->used;
+	chunk->used += sz;
+	arena->total += sz;
+
+	return p;
+}
+
+void *bitc_arena_calloc(struct bitc_arena *arena, size_t nmemb, size_t sz)
+{
+	if (sz && nmemb > SIZE_MAX / sz)
+		return NULL;
+
+	void *p = bitc_arena_alloc(arena, nmemb * sz);
+	if (p)
+		memset(p, 0, nmemb * sz);
+
+	return p;
+}
+
+/* release everything but the most recent chunk, which is kept for reuse */
+void bitc_arena_reset(struct bitc_arena *arena)
+{
+	struct bitc_arena_chunk *chunk = arena->head;
+	if (!chunk)
+		return;
+
+	struct bitc_arena_chunk *tmp = chunk->next;
+	while (tmp) {
+		struct bitc_arena_chunk *next = tmp->next;
+		free(tmp);
+		tmp = next;
+	}
+
+	chunk->next = NULL;
+	chunk->used = 0;
+	arena->total = 0;
+}
+
+void bitc_arena_free(struct bitc_arena *arena)
+{
+	if (!arena)
+		return;
+
+	struct bitc_arena_chunk *chunk = arena->head;
+	while (chunk) {
+		struct bitc_arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->head = NULL;
+	arena->total = 0;
+}
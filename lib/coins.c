@@ -0,0 +1,425 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/coins.h>                 // for bitc_coins, etc
+#include <bitc/endian.h>                // for htole32, le32toh, etc
+#include <bitc/script/script.h>         // for OP_RETURN, MAX_SCRIPT_SIZE, etc
+
+#include <assert.h>                     // for assert
+#include <stddef.h>                     // for offsetof
+#include <stdlib.h>                     // for malloc, free
+#include <string.h>                     // for memcpy, memset
+
+/* compressed scriptPubKey type, the first byte of the compressed form */
+enum {
+	COMP_P2PKH	= 0,	// OP_DUP OP_HASH160 <20> OP_EQUALVERIFY OP_CHECKSIG
+	COMP_P2SH	= 1,	// OP_HASH160 <20> OP_EQUAL
+	COMP_P2PK_EVEN	= 2,	// <33-byte pubkey, 02 prefix> OP_CHECKSIG
+	COMP_P2PK_ODD	= 3,	// <33-byte pubkey, 03 prefix> OP_CHECKSIG
+	COMP_P2WPKH	= 4,	// OP_0 <20>
+	COMP_P2WSH	= 5,	// OP_0 <32>
+	COMP_P2TR	= 6,	// OP_1 <32>
+	COMP_RAW	= 7,	// anything else, stored as is
+};
+
+/* packed output record; allocations are rounded to 16 bytes */
+struct coin_rec {
+	int64_t		nValue;
+	uint32_t	code;		// height << 1 | is_coinbase
+	uint16_t	script_len;	// bytes in script[]
+	unsigned char	script[];	// compressed scriptPubKey
+};
+
+static inline size_t rec_class(size_t script_len)
+{
+	return (offsetof(struct coin_rec, script) + script_len + 15) / 16;
+}
+
+static unsigned int script_comp_type(const unsigned char *s, size_t len)
+{
+	if (len == 25 && s[0] == OP_DUP && s[1] == OP_HASH160 &&
+	    s[2] == 20 && s[23] == OP_EQUALVERIFY && s[24] == OP_CHECKSIG)
+		return COMP_P2PKH;
+	if (len == 23 && s[0] == OP_HASH160 && s[1] == 20 &&
+	    s[22] == OP_EQUAL)
+		return COMP_P2SH;
+	if (len == 35 && s[0] == 33 && (s[1] == 0x02 || s[1] == 0x03) &&
+	    s[34] == OP_CHECKSIG)
+		return (s[1] == 0x02) ? COMP_P2PK_EVEN : COMP_P2PK_ODD;
+	if (len == 22 && s[0] == OP_0 && s[1] == 20)
+		return COMP_P2WPKH;
+	if (len == 34 && (s[0] == OP_0 || s[0] == OP_1) && s[1] == 32)
+		return (s[0] == OP_0) ? COMP_P2WSH : COMP_P2TR;
+
+	return COMP_RAW;
+}
+
+/* bytes of the script payload kept after the type byte */
+static const struct {
+	unsigned char	off;	// payload offset in the full script
+	unsigned char	len;
+} comp_payload[COMP_RAW] = {
+	[COMP_P2PKH]		= { 3, 20 },
+	[COMP_P2SH]		= { 2, 20 },
+	[COMP_P2PK_EVEN]	= { 2, 32 },
+	[COMP_P2PK_ODD]		= { 2, 32 },
+	[COMP_P2WPKH]		= { 2, 20 },
+	[COMP_P2WSH]		= { 2, 32 },
+	[COMP_P2TR]		= { 2, 32 },
+};
+
+/* if out is NULL, only the compressed length is returned */
+size_t bitc_script_compress(unsigned char *out, const unsigned char *s,
+			    size_t len)
+{
+	unsigned int type = script_comp_type(s, len);
+	size_t off = 0;
+
+	if (type != COMP_RAW) {
+		off = comp_payload[type].off;
+		len = comp_payload[type].len;
+	}
+
+	if (out) {
+		out[0] = type;
+		memcpy(out + 1, s + off, len);
+	}
+	return len + 1;
+}
+
+bool bitc_script_decompress(cstring *s, const unsigned char *comp,
+			    size_t len)
+{
+	unsigned char *p;
+
+	if (len < 1)
+		return false;
+
+	switch (comp[0]) {
+	case COMP_P2PKH:
+		if (len != 21 || !cstr_resize(s, 25))
+			return false;
+		p = (unsigned char *) s->str;
+		p[0] = OP_DUP;
+		p[1] = OP_HASH160;
+		p[2] = 20;
+		memcpy(p + 3, comp + 1, 20);
+		p[23] = OP_EQUALVERIFY;
+		p[24] = OP_CHECKSIG;
+		return true;
+
+	case COMP_P2SH:
+		if (len != 21 || !cstr_resize(s, 23))
+			return false;
+		p = (unsigned char *) s->str;
+		p[0] = OP_HASH160;
+		p[1] = 20;
+		memcpy(p + 2, comp + 1, 20);
+		p[22] = OP_EQUAL;
+		return true;
+
+	case COMP_P2PK_EVEN:
+	case COMP_P2PK_ODD:
+		if (len != 33 || !cstr_resize(s, 35))
+			return false;
+		p = (unsigned char *) s->str;
+		p[0] = 33;
+		p[1] = (comp[0] == COMP_P2PK_EVEN) ? 0x02 : 0x03;
+		memcpy(p + 2, comp + 1, 32);
+		p[34] = OP_CHECKSIG;
+		return true;
+
+	case COMP_P2WPKH:
+		if (len != 21 || !cstr_resize(s, 22))
+			return false;
+		p = (unsigned char *) s->str;
+		p[0] = OP_0;
+		p[1] = 20;
+		memcpy(p + 2, comp + 1, 20);
+		return true;
+
+	case COMP_P2WSH:
+	case COMP_P2TR:
+		if (len != 33 || !cstr_resize(s, 34))
+			return false;
+		p = (unsigned char *) s->str;
+		p[0] = (comp[0] == COMP_P2WSH) ? OP_0 : OP_1;
+		p[1] = 32;
+		memcpy(p + 2, comp + 1, 32);
+		return true;
+
+	case COMP_RAW:
+		if (!cstr_resize(s, len - 1))
+			return false;
+		memcpy(s->str, comp + 1, len - 1);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void bitc_coins_key(unsigned char *key, const struct bitc_outpt *outpt)
+{
+	uint32_t n = htole32(outpt->n);
+
+	memcpy(key, &outpt->hash, sizeof(outpt->hash));
+	memcpy(key + sizeof(outpt->hash), &n, sizeof(n));
+}
+
+static struct coin_rec *rec_alloc(struct bitc_coins *coins, size_t script_len)
+{
+	size_t cls = rec_class(script_len);
+	struct coin_rec *rec;
+
+	assert(cls < BITC_COINS_SZ_CLASSES);
+
+	/* a free record keeps the list link in its first bytes */
+	rec = coins->free_rec[cls];
+	if (rec) {
+		memcpy(&coins->free_rec[cls], rec, sizeof(void *));
+		coins->free_bytes -= cls * 16;
+		return rec;
+	}
+
+	return bitc_arena_alloc(&coins->arena, cls * 16);
+}
+
+static void rec_release(struct bitc_coins *coins, struct coin_rec *rec)
+{
+	size_t cls = rec_class(rec->script_len);
+
+	memcpy(rec, &coins->free_rec[cls], sizeof(void *));
+	coins->free_rec[cls] = rec;
+	coins->free_bytes += cls * 16;
+}
+
+bool bitc_coins_init(struct bitc_coins *coins)
+{
+	memset(coins, 0, sizeof(*coins));
+
+	coins->map = bitc_flatmap_new(BITC_COINS_KEY_SZ, sizeof(void *));
+	if (!coins->map)
+		return false;
+
+	bitc_arena_init(&coins->arena, 1024 * 1024);
+	return true;
+}
+
+void bitc_coins_free(struct bitc_coins *coins)
+{
+	if (!coins)
+		return;
+
+	bitc_flatmap_free(coins->map);
+	bitc_arena_free(&coins->arena);
+	memset(coins, 0, sizeof(*coins));
+}
+
+void bitc_coins_clear(struct bitc_coins *coins)
+{
+	bitc_flatmap_clear(coins->map);
+	bitc_arena_reset(&coins->arena);
+	memset(coins->free_rec, 0, sizeof(coins->free_rec));
+	coins->free_bytes = 0;
+}
+
+static bool coin_unspendable(const struct bitc_txout *txout)
+{
+	const cstring *s = txout->scriptPubKey;
+
+	if (s->len > MAX_SCRIPT_SIZE)
+		return true;
+	return (s->len > 0) && ((unsigned char) s->str[0] == OP_RETURN);
+}
+
+bool bitc_coins_add(struct bitc_coins *coins, const struct bitc_outpt *outpt,
+		    const struct bitc_txout *txout, bool is_coinbase,
+		    uint32_t height)
+{
+	const unsigned char *script;
+	unsigned char key[BITC_COINS_KEY_SZ];
+	size_t script_len, comp_len;
+	struct coin_rec *rec, **slot;
+	bool inserted;
+
+	if (coin_unspendable(txout))
+		return true;
+
+	script = (const unsigned char *) txout->scriptPubKey->str;
+	script_len = txout->scriptPubKey->len;
+	comp_len = bitc_script_compress(NULL, script, script_len);
+
+	rec = rec_alloc(coins, comp_len);
+	if (!rec)
+		return false;
+
+	rec->nValue = txout->nValue;
+	rec->code = (height << 1) | (is_coinbase ? 1 : 0);
+	rec->script_len = comp_len;
+	bitc_script_compress(rec->script, script, script_len);
+
+	bitc_coins_key(key, outpt);
+	slot = bitc_flatmap_insert(coins->map, key, &inserted);
+	if (!slot) {
+		rec_release(coins, rec);
+		return false;
+	}
+
+	/* duplicate txids (BIP 30) overwrite the older coin */
+	if (!inserted)
+		rec_release(coins, *slot);
+	*slot = rec;
+
+	return true;
+}
+
+bool bitc_coins_add_tx(struct bitc_coins *coins, const struct bitc_tx *tx,
+		       bool is_coinbase, uint32_t height)
+{
+	struct bitc_outpt outpt;
+	unsigned int i;
+
+	assert(tx->sha256_valid == true);
+
+	bu256_copy(&outpt.hash, &tx->sha256);
+
+	for (i = 0; i < tx->vout->len; i++) {
+		outpt.n = i;
+		if (!bitc_coins_add(coins, &outpt, parr_idx(tx->vout, i),
+				    is_coinbase, height))
+			return false;
+	}
+
+	return true;
+}
+
+static bool coin_fill(struct bitc_coin *coin, const struct coin_rec *rec)
+{
+	coin->nValue = rec->nValue;
+	coin->height = rec->code >> 1;
+	coin->is_coinbase = rec->code & 1;
+
+	if (!coin->scriptPubKey) {
+		coin->scriptPubKey = cstr_new_sz(rec->script_len + 2);
+		if (!coin->scriptPubKey)
+			return false;
+	}
+
+	return bitc_script_decompress(coin->scriptPubKey, rec->script,
+				      rec->script_len);
+}
+
+bool bitc_coins_have(const struct bitc_coins *coins,
+		     const struct bitc_outpt *outpt)
+{
+	unsigned char key[BITC_COINS_KEY_SZ];
+
+	bitc_coins_key(key, outpt);
+	return bitc_flatmap_has(coins->map, key);
+}
+
+bool bitc_coins_lookup(const struct bitc_coins *coins,
+		       const struct bitc_outpt *outpt, struct bitc_coin *coin)
+{
+	unsigned char key[BITC_COINS_KEY_SZ];
+	struct coin_rec **slot;
+
+	bitc_coins_key(key, outpt);
+	slot = bitc_flatmap_get(coins->map, key);
+	if (!slot)
+		return false;
+
+	return !coin || coin_fill(coin, *slot);
+}
+
+bool bitc_coins_spend(struct bitc_coins *coins, const struct bitc_outpt *outpt,
+		      struct bitc_coin *coin)
+{
+	unsigned char key[BITC_COINS_KEY_SZ];
+	struct coin_rec *rec;
+	bool rc = true;
+
+	bitc_coins_key(key, outpt);
+	if (!bitc_flatmap_del(coins->map, key, &rec))
+		return false;
+
+	if (coin)
+		rc = coin_fill(coin, rec);
+
+	rec_release(coins, rec);
+	return rc;
+}
+
+struct packed_iter {
+	bitc_coins_func	f;
+	void		*priv;
+	bool		ok;
+	unsigned char	buf[BITC_COIN_PACKED_MAX];
+};
+
+static void packed_iter_cb(void *key, void *value, void *priv)
+{
+	struct packed_iter *it = priv;
+	const struct coin_rec *rec = *(struct coin_rec **) value;
+	uint64_t v = htole64((uint64_t) rec->nValue);
+	uint32_t code = htole32(rec->code);
+
+	if (!it->ok)
+		return;
+
+	memcpy(it->buf, &v, sizeof(v));
+	memcpy(it->buf + 8, &code, sizeof(code));
+	memcpy(it->buf + 12, rec->script, rec->script_len);
+
+	it->ok = it->f(key, it->buf, 12 + rec->script_len, it->priv);
+}
+
+bool bitc_coins_iter_packed(const struct bitc_coins *coins,
+			    bitc_coins_func f, void *priv)
+{
+	struct packed_iter *it = malloc(sizeof(*it));
+	bool rc;
+
+	if (!it)
+		return false;
+
+	it->f = f;
+	it->priv = priv;
+	it->ok = true;
+
+	bitc_flatmap_iter(coins->map, packed_iter_cb, it);
+
+	rc = it->ok;
+	free(it);
+	return rc;
+}
+
+bool bitc_coin_unpack(struct bitc_coin *coin, const void *val, size_t val_len)
+{
+	const unsigned char *p = val;
+	uint64_t v;
+	uint32_t code;
+
+	if (val_len < 13 || val_len > BITC_COIN_PACKED_MAX)
+		return false;
+
+	memcpy(&v, p, sizeof(v));
+	memcpy(&code, p + 8, sizeof(code));
+	code = le32toh(code);
+
+	coin->nValue = (int64_t) le64toh(v);
+	coin->height = code >> 1;
+	coin->is_coinbase = code & 1;
+
+	if (!coin->scriptPubKey) {
+		coin->scriptPubKey = cstr_new_sz(val_len);
+		if (!coin->scriptPubKey)
+			return false;
+	}
+
+	return bitc_script_decompress(coin->scriptPubKey, p + 12, val_len - 12);
+}
@@ -32,6 +32,23 @@
 #include <stdint.h>
 #include <bitc/crypto/sha2.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA2_X86_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && \
+    (defined(__linux__) || defined(__APPLE__))
+#define SHA2_ARMV8_CE 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#else
+#include <sys/sysctl.h>
+#endif
+#endif
+
 /*
  * ASSERT NOTE:
  * Some sanity checking code is included using assert().  On my FreeBSD
@@ -50,6 +67,12 @@
  *
  *   #define SHA2_UNROLL_TRANSFORM
  *
+ * HARDWARE TRANSFORM NOTE:
+ * On x86 CPUs with the SHA extensions and on ARMv8 CPUs with the
+ * cryptography extensions, the block transforms run on the dedicated
+ * instructions instead.  The transform is picked at first use, see
+ * sha256_select() and sha512_select() at the end of this file.
+ *
  */
 
 
@@ -177,11 +200,13 @@ typedef uint64_t sha2_word64;	/* Exactly 8 bytes */
 void sha512_Last(SHA512_CTX*);
 void sha256_Transform(SHA256_CTX*, const sha2_word32*);
 void sha512_Transform(SHA512_CTX*, const sha2_word64*);
+static void sha256_Transform_n(SHA256_CTX*, const sha2_byte*, size_t);
+static void sha512_Transform_n(SHA512_CTX*, const sha2_byte*, size_t);
 
 
 /*** SHA-XYZ INITIAL HASH VALUES AND CONSTANTS ************************/
 /* Hash constant words K for SHA-256: */
-static const sha2_word32 K256[64] = {
+const sha2_word32 sha256_K[64] = {
 	0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
 	0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
 	0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
@@ -294,7 +319,7 @@ void sha256_Init(SHA256_CTX* context) {
 #define ROUND256_0_TO_15(a,b,c,d,e,f,g,h)	\
 	REVERSE32(*data++, W256[j]); \
 	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + \
-             K256[j] + W256[j]; \
+             sha256_K[j] + W256[j]; \
 	(d) += T1; \
 	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
 	j++
@@ -304,7 +329,7 @@ void sha256_Init(SHA256_CTX* context) {
 
 #define ROUND256_0_TO_15(a,b,c,d,e,f,g,h)	\
 	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + \
-	     K256[j] + (W256[j] = *data++); \
+	     sha256_K[j] + (W256[j] = *data++); \
 	(d) += T1; \
 	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
 	j++
@@ -316,7 +341,7 @@ void sha256_Init(SHA256_CTX* context) {
 	s0 = sigma0_256(s0); \
 	s1 = W256[(j+14)&0x0f]; \
 	s1 = sigma1_256(s1); \
-	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + K256[j] + \
+	T1 = (h) + Sigma1_256(e) + Ch((e), (f), (g)) + sha256_K[j] + \
 	     (W256[j&0x0f] += s1 + W256[(j+9)&0x0f] + s0); \
 	(d) += T1; \
 	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
@@ -403,10 +428,10 @@ void sha256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 		/* Copy data while converting to host byte order */
 		REVERSE32(*data++,W256[j]);
 		/* Apply the SHA-256 compression function to update a..h */
-		T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] + W256[j];
+		T1 = h + Sigma1_256(e) + Ch(e, f, g) + sha256_K[j] + W256[j];
 #else /* BYTE_ORDER == LITTLE_ENDIAN */
 		/* Apply the SHA-256 compression function to update a..h with copy */
-		T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] + (W256[j] = *data++);
+		T1 = h + Sigma1_256(e) + Ch(e, f, g) + sha256_K[j] + (W256[j] = *data++);
 #endif /* BYTE_ORDER == LITTLE_ENDIAN */
 		T2 = Sigma0_256(a) + Maj(a, b, c);
 		h = g;
@@ -429,7 +454,7 @@ void sha256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 		s1 = sigma1_256(s1);
 
 		/* Apply the SHA-256 compression function to update a..h */
-		T1 = h + Sigma1_256(e) + Ch(e, f, g) + K256[j] +
+		T1 = h + Sigma1_256(e) + Ch(e, f, g) + sha256_K[j] +
 		     (W256[j&0x0f] += s1 + W256[(j+9)&0x0f] + s0);
 		T2 = Sigma0_256(a) + Maj(a, b, c);
 		h = g;
@@ -480,7 +505,7 @@ void sha256_Update(SHA256_CTX* context, const void *data_p, size_t len) {
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			sha256_Transform(context, (sha2_word32*)context->buffer);
+			sha256_Transform_n(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -490,12 +515,13 @@ void sha256_Update(SHA256_CTX* context, const void *data_p, size_t len) {
 			return;
 		}
 	}
-	while (len >= SHA256_BLOCK_LENGTH) {
+	if (len >= SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		sha256_Transform(context, (sha2_word32*)data);
-		context->bitcount += SHA256_BLOCK_LENGTH << 3;
-		len -= SHA256_BLOCK_LENGTH;
-		data += SHA256_BLOCK_LENGTH;
+		size_t blocks = len / SHA256_BLOCK_LENGTH;
+		sha256_Transform_n(context, data, blocks);
+		context->bitcount += (sha2_word64)blocks * SHA256_BLOCK_LENGTH << 3;
+		len -= blocks * SHA256_BLOCK_LENGTH;
+		data += blocks * SHA256_BLOCK_LENGTH;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -529,7 +555,7 @@ void sha256_Final(sha2_byte digest[], SHA256_CTX* context) {
 					MEMSET_BZERO(&context->buffer[usedspace], SHA256_BLOCK_LENGTH - usedspace);
 				}
 				/* Do second-to-last transform: */
-				sha256_Transform(context, (sha2_word32*)context->buffer);
+				sha256_Transform_n(context, context->buffer, 1);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, SHA256_SHORT_BLOCK_LENGTH);
@@ -546,7 +572,7 @@ void sha256_Final(sha2_byte digest[], SHA256_CTX* context) {
 		*t = context->bitcount;
 
 		/* Final transform: */
-		sha256_Transform(context, (sha2_word32*)context->buffer);
+		sha256_Transform_n(context, context->buffer, 1);
 
 #if BYTE_ORDER == LITTLE_ENDIAN
 		{
@@ -802,7 +828,7 @@ void sha512_Update(SHA512_CTX* context, const void *data_p, size_t len) {
 			ADDINC128(context->bitcount, freespace << 3);
 			len -= freespace;
 			data += freespace;
-			sha512_Transform(context, (sha2_word64*)context->buffer);
+			sha512_Transform_n(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -812,12 +838,13 @@ void sha512_Update(SHA512_CTX* context, const void *data_p, size_t len) {
 			return;
 		}
 	}
-	while (len >= SHA512_BLOCK_LENGTH) {
+	if (len >= SHA512_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		sha512_Transform(context, (sha2_word64*)data);
-		ADDINC128(context->bitcount, SHA512_BLOCK_LENGTH << 3);
-		len -= SHA512_BLOCK_LENGTH;
-		data += SHA512_BLOCK_LENGTH;
+		size_t blocks = len / SHA512_BLOCK_LENGTH;
+		sha512_Transform_n(context, data, blocks);
+		ADDINC128(context->bitcount, (sha2_word64)blocks * SHA512_BLOCK_LENGTH << 3);
+		len -= blocks * SHA512_BLOCK_LENGTH;
+		data += blocks * SHA512_BLOCK_LENGTH;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -849,7 +876,7 @@ void sha512_Last(SHA512_CTX* context) {
 				MEMSET_BZERO(&context->buffer[usedspace], SHA512_BLOCK_LENGTH - usedspace);
 			}
 			/* Do second-to-last transform: */
-			sha512_Transform(context, (sha2_word64*)context->buffer);
+			sha512_Transform_n(context, context->buffer, 1);
 
 			/* And set-up for the last transform: */
 			MEMSET_BZERO(context->buffer, SHA512_BLOCK_LENGTH - 2);
@@ -869,7 +896,7 @@ void sha512_Last(SHA512_CTX* context) {
 	*t = context->bitcount[0];
 
 	/* Final transform: */
-	sha512_Transform(context, (sha2_word64*)context->buffer);
+	sha512_Transform_n(context, context->buffer, 1);
 }
 
 void sha512_Final(sha2_byte digest[], SHA512_CTX* context) {
@@ -932,3 +959,348 @@ char* sha512_Data(const void* data, size_t len, char digest[SHA512_DIGEST_STRING
 	sha512_Update(&context, data, len);
 	return sha512_End(&context, digest);
 }
+
+
+/*** HARDWARE TRANSFORMS: *********************************************/
+/*
+ * Each transform processes whole 64-byte (SHA-256) or 128-byte (SHA-512)
+ * big-endian blocks straight into context->state.  Unlike the portable
+ * transforms they do not use context->buffer as scratch space.
+ */
+
+static void sha256_Transform_portable(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	for (; blocks > 0; blocks--, data += SHA256_BLOCK_LENGTH)
+		sha256_Transform(context, (const sha2_word32*)data);
+}
+
+static void sha512_Transform_portable(SHA512_CTX* context, const sha2_byte* data, size_t blocks) {
+	for (; blocks > 0; blocks--, data += SHA512_BLOCK_LENGTH)
+		sha512_Transform(context, (const sha2_word64*)data);
+}
+
+enum {
+	SHA2_CPU_SHANI		= (1U << 0),	/* x86 SHA + SSE4.1 */
+	SHA2_CPU_ARMV8_SHA2	= (1U << 1),	/* ARMv8 SHA-256 */
+	SHA2_CPU_ARMV8_SHA512	= (1U << 2),	/* ARMv8.2 SHA-512 */
+};
+
+#ifdef SHA2_X86_SHANI
+
+void __attribute__((target("sha,sse4.1")))
+sha256_Transform_shani(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i st0, st1, tmp, msg, abef, cdgh;
+	__m128i m0, m1, m2, m3;
+
+	/* state is ABCD EFGH; the instructions want ABEF CDGH */
+	tmp = _mm_loadu_si128((const __m128i*)&context->state[0]);
+	st1 = _mm_loadu_si128((const __m128i*)&context->state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1);
+	st1 = _mm_shuffle_epi32(st1, 0x1B);
+	st0 = _mm_alignr_epi8(tmp, st1, 8);
+	st1 = _mm_blend_epi16(st1, tmp, 0xF0);
+
+	for (; blocks > 0; blocks--, data += SHA256_BLOCK_LENGTH) {
+		abef = st0;
+		cdgh = st1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), MASK);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), MASK);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), MASK);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), MASK);
+
+/* four rounds on W[4i..4i+3] held in M */
+#define SHANI_ROUNDS(i, M) do { \
+	msg = _mm_add_epi32((M), _mm_loadu_si128((const __m128i*)&sha256_K[(i) * 4])); \
+	st1 = _mm_sha256rnds2_epu32(st1, st0, msg); \
+	msg = _mm_shuffle_epi32(msg, 0x0E); \
+	st0 = _mm_sha256rnds2_epu32(st0, st1, msg); \
+} while (0)
+
+/* W[4i..4i+3] into M, from W[4i-16..4i-1] held in M, MA, MB, MC */
+#define SHANI_SCHEDULE(M, MA, MB, MC) do { \
+	tmp = _mm_alignr_epi8((MC), (MB), 4); \
+	(M) = _mm_sha256msg1_epu32((M), (MA)); \
+	(M) = _mm_add_epi32((M), tmp); \
+	(M) = _mm_sha256msg2_epu32((M), (MC)); \
+} while (0)
+
+		SHANI_ROUNDS(0, m0);
+		SHANI_ROUNDS(1, m1);
+		SHANI_ROUNDS(2, m2);
+		SHANI_ROUNDS(3, m3);
+		SHANI_SCHEDULE(m0, m1, m2, m3); SHANI_ROUNDS(4, m0);
+		SHANI_SCHEDULE(m1, m2, m3, m0); SHANI_ROUNDS(5, m1);
+		SHANI_SCHEDULE(m2, m3, m0, m1); SHANI_ROUNDS(6, m2);
+		SHANI_SCHEDULE(m3, m0, m1, m2); SHANI_ROUNDS(7, m3);
+		SHANI_SCHEDULE(m0, m1, m2, m3); SHANI_ROUNDS(8, m0);
+		SHANI_SCHEDULE(m1, m2, m3, m0); SHANI_ROUNDS(9, m1);
+		SHANI_SCHEDULE(m2, m3, m0, m1); SHANI_ROUNDS(10, m2);
+		SHANI_SCHEDULE(m3, m0, m1, m2); SHANI_ROUNDS(11, m3);
+		SHANI_SCHEDULE(m0, m1, m2, m3); SHANI_ROUNDS(12, m0);
+		SHANI_SCHEDULE(m1, m2, m3, m0); SHANI_ROUNDS(13, m1);
+		SHANI_SCHEDULE(m2, m3, m0, m1); SHANI_ROUNDS(14, m2);
+		SHANI_SCHEDULE(m3, m0, m1, m2); SHANI_ROUNDS(15, m3);
+
+#undef SHANI_SCHEDULE
+#undef SHANI_ROUNDS
+
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+	}
+
+	/* back to ABCD EFGH */
+	tmp = _mm_shuffle_epi32(st0, 0x1B);
+	st1 = _mm_shuffle_epi32(st1, 0xB1);
+	st0 = _mm_blend_epi16(tmp, st1, 0xF0);
+	st1 = _mm_alignr_epi8(st1, tmp, 8);
+
+	_mm_storeu_si128((__m128i*)&context->state[0], st0);
+	_mm_storeu_si128((__m128i*)&context->state[4], st1);
+}
+
+static unsigned int sha2_cpu_features(void) {
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	if (!(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+		return 0;
+	if (__get_cpuid_max(0, (unsigned int*)0) < 7)
+		return 0;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & (1U << 29)) ? SHA2_CPU_SHANI : 0;	/* SHA */
+}
+
+#elif defined(SHA2_ARMV8_CE)
+
+void __attribute__((target("arch=armv8-a+crypto")))
+sha256_Transform_armv8(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	uint32x4_t st0, st1, abcd, efgh, tmp, msg;
+	uint32x4_t m[4];
+	int i;
+
+	st0 = vld1q_u32(&context->state[0]);
+	st1 = vld1q_u32(&context->state[4]);
+
+	for (; blocks > 0; blocks--, data += SHA256_BLOCK_LENGTH) {
+		abcd = st0;
+		efgh = st1;
+
+		for (i = 0; i < 4; i++)
+			m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+		for (i = 0; i < 16; i++) {
+			msg = vaddq_u32(m[i & 3], vld1q_u32(&sha256_K[i * 4]));
+			tmp = st0;
+			st0 = vsha256hq_u32(st0, st1, msg);
+			st1 = vsha256h2q_u32(st1, tmp, msg);
+
+			/* W[4i+16..4i+19] replaces W[4i..4i+3] */
+			if (i < 12)
+				m[i & 3] = vsha256su1q_u32(
+					vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]),
+					m[(i + 2) & 3], m[(i + 3) & 3]);
+		}
+
+		st0 = vaddq_u32(st0, abcd);
+		st1 = vaddq_u32(st1, efgh);
+	}
+
+	vst1q_u32(&context->state[0], st0);
+	vst1q_u32(&context->state[4], st1);
+}
+
+static void __attribute__((target("arch=armv8.2-a+sha3")))
+sha512_Transform_armv8(SHA512_CTX* context, const sha2_byte* data, size_t blocks) {
+	uint64x2_t st[4], save[4], m[8];
+	uint64x2_t sum, im, ab, cd, ef, gh;
+	int i, r;
+
+	/* AB CD EF GH */
+	for (i = 0; i < 4; i++)
+		st[i] = vld1q_u64(&context->state[i * 2]);
+
+	for (; blocks > 0; blocks--, data += SHA512_BLOCK_LENGTH) {
+		for (i = 0; i < 4; i++)
+			save[i] = st[i];
+
+		for (i = 0; i < 8; i++)
+			m[i] = vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(data + i * 16)));
+
+		/* two rounds per step; the register holding AB moves
+		 * one place down the st[] ring each step */
+		for (r = 0; r < 40; r++) {
+			ab = st[(0 - r) & 3];
+			cd = st[(1 - r) & 3];
+			ef = st[(2 - r) & 3];
+			gh = st[(3 - r) & 3];
+
+			sum = vaddq_u64(m[r & 7], vld1q_u64(&K512[r * 2]));
+			sum = vaddq_u64(vextq_u64(sum, sum, 1), gh);
+			im = vsha512hq_u64(sum, vextq_u64(ef, gh, 1),
+					   vextq_u64(cd, ef, 1));
+			st[(3 - r) & 3] = vsha512h2q_u64(im, cd, ab);
+			st[(1 - r) & 3] = vaddq_u64(cd, im);
+
+			/* W[2r+16..2r+17] replaces W[2r..2r+1] */
+			if (r < 32)
+				m[r & 7] = vsha512su1q_u64(
+					vsha512su0q_u64(m[r & 7], m[(r + 1) & 7]),
+					m[(r + 7) & 7],
+					vextq_u64(m[(r + 4) & 7], m[(r + 5) & 7], 1));
+		}
+
+		for (i = 0; i < 4; i++)
+			st[i] = vaddq_u64(st[i], save[i]);
+	}
+
+	for (i = 0; i < 4; i++)
+		vst1q_u64(&context->state[i * 2], st[i]);
+}
+
+static unsigned int sha2_cpu_features(void) {
+	unsigned int features = 0;
+
+#if defined(__linux__)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	if (hwcap & (1UL << 6))		/* HWCAP_SHA2 */
+		features |= SHA2_CPU_ARMV8_SHA2;
+	if (hwcap & (1UL << 21))	/* HWCAP_SHA512 */
+		features |= SHA2_CPU_ARMV8_SHA512;
+#else
+	int val = 0;
+	size_t len = sizeof(val);
+
+	/* every Apple arm64 core has the SHA-256 instructions */
+	features |= SHA2_CPU_ARMV8_SHA2;
+	if (sysctlbyname("hw.optional.armv8_2_sha512", &val, &len,
+			 (void*)0, 0) == 0 && val)
+		features |= SHA2_CPU_ARMV8_SHA512;
+#endif
+
+	return features;
+}
+
+#else /* !SHA2_X86_SHANI && !SHA2_ARMV8_CE */
+
+static unsigned int sha2_cpu_features(void) {
+	return 0;
+}
+
+#endif
+
+struct sha256_kernel {
+	const char	*name;
+	void		(*fn)(SHA256_CTX*, const sha2_byte*, size_t);
+	unsigned int	features;	/* required CPU features */
+};
+
+struct sha512_kernel {
+	const char	*name;
+	void		(*fn)(SHA512_CTX*, const sha2_byte*, size_t);
+	unsigned int	features;	/* required CPU features */
+};
+
+/* in order of preference */
+static const struct sha256_kernel sha256_kernels[] = {
+#ifdef SHA2_X86_SHANI
+	{ "sha-ni", sha256_Transform_shani, SHA2_CPU_SHANI },
+#endif
+#ifdef SHA2_ARMV8_CE
+	{ "armv8", sha256_Transform_armv8, SHA2_CPU_ARMV8_SHA2 },
+#endif
+	{ "portable", sha256_Transform_portable, 0 },
+};
+
+static const struct sha512_kernel sha512_kernels[] = {
+#ifdef SHA2_ARMV8_CE
+	{ "armv8", sha512_Transform_armv8, SHA2_CPU_ARMV8_SHA512 },
+#endif
+	{ "portable", sha512_Transform_portable, 0 },
+};
+
+#define SHA2_ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+static const struct sha256_kernel *sha256_kernel;
+static const struct sha512_kernel *sha512_kernel;
+
+static void sha2_select_default(void) {
+	unsigned int features = sha2_cpu_features();
+	unsigned int i;
+
+	/* racing initializers all store the same values */
+	for (i = 0; i < SHA2_ARRAY_SIZE(sha256_kernels); i++) {
+		if ((sha256_kernels[i].features & features) == sha256_kernels[i].features) {
+			sha256_kernel = &sha256_kernels[i];
+			break;
+		}
+	}
+	for (i = 0; i < SHA2_ARRAY_SIZE(sha512_kernels); i++) {
+		if ((sha512_kernels[i].features & features) == sha512_kernels[i].features) {
+			sha512_kernel = &sha512_kernels[i];
+			break;
+		}
+	}
+}
+
+static void sha256_Transform_n(SHA256_CTX* context, const sha2_byte* data, size_t blocks) {
+	if (!sha256_kernel)
+		sha2_select_default();
+	sha256_kernel->fn(context, data, blocks);
+}
+
+static void sha512_Transform_n(SHA512_CTX* context, const sha2_byte* data, size_t blocks) {
+	if (!sha512_kernel)
+		sha2_select_default();
+	sha512_kernel->fn(context, data, blocks);
+}
+
+const char *sha256_impl(void) {
+	if (!sha256_kernel)
+		sha2_select_default();
+	return sha256_kernel->name;
+}
+
+const char *sha512_impl(void) {
+	if (!sha512_kernel)
+		sha2_select_default();
+	return sha512_kernel->name;
+}
+
+bool sha256_select(const char *name) {
+	unsigned int features = sha2_cpu_features();
+	unsigned int i;
+
+	for (i = 0; i < SHA2_ARRAY_SIZE(sha256_kernels); i++) {
+		if (strcmp(sha256_kernels[i].name, name))
+			continue;
+		if ((sha256_kernels[i].features & features) != sha256_kernels[i].features)
+			return false;
+
+		sha256_kernel = &sha256_kernels[i];
+		return true;
+	}
+
+	return false;
+}
+
+bool sha512_select(const char *name) {
+	unsigned int features = sha2_cpu_features();
+	unsigned int i;
+
+	for (i = 0; i < SHA2_ARRAY_SIZE(sha512_kernels); i++) {
+		if (strcmp(sha512_kernels[i].name, name))
+			continue;
+		if ((sha512_kernels[i].features & features) != sha512_kernels[i].features)
+			return false;
+
+		sha512_kernel = &sha512_kernels[i];
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,352 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/crypto/sha256d64.h>      // for sha256d64
+#include <bitc/crypto/sha2.h>           // for sha256_Transform_shani, etc
+
+#include <stdint.h>                     // for uint32_t
+#include <string.h>                     // for memcpy, strcmp, NULL
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256D64_X86 1
+#include <cpuid.h>                      // for __get_cpuid, etc
+#endif
+
+/* same conditions under which sha2.c builds sha256_Transform_armv8 */
+#if defined(__GNUC__) && defined(__aarch64__) && \
+    (defined(__linux__) || defined(__APPLE__))
+#define SHA256D64_ARMV8 1
+#if defined(__linux__)
+#include <sys/auxv.h>                   // for getauxval, AT_HWCAP
+#endif
+#endif
+
+/* Every message is exactly 64 bytes, so both hashes have fixed shapes:
+ * the first is the message block plus a constant padding block, the
+ * second is a single block holding the 32-byte digest and its padding.
+ */
+
+static void sha256d64_scalar(unsigned char *out, const unsigned char *in,
+			     size_t n)
+{
+	unsigned char md1[SHA256_DIGEST_LENGTH];
+
+	for (; n > 0; n--, in += 64, out += SHA256_DIGEST_LENGTH) {
+		sha256_Raw(in, 64, md1);
+		sha256_Raw(md1, SHA256_DIGEST_LENGTH, out);
+	}
+}
+
+static const uint32_t IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+/* padding blocks following a 64-byte and a 32-byte message */
+static const unsigned char pad64[64] = {
+	[0] = 0x80, [62] = 0x02,
+};
+static const unsigned char pad32[32] = {
+	[0] = 0x80, [30] = 0x01,
+};
+
+static inline uint32_t read_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return __builtin_bswap32(v);
+}
+
+static inline void write_be32(unsigned char *p, uint32_t v)
+{
+	v = __builtin_bswap32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+/* one message at a time through a hardware block transform, which
+ * only pays off over the 8-way kernels with the SHA instructions
+ */
+static inline __attribute__((always_inline))
+void sha256d64_transform(unsigned char *out, const unsigned char *in,
+			 size_t n,
+			 void (*transform)(SHA256_CTX *, const uint8_t *,
+					   size_t))
+{
+	SHA256_CTX ctx;
+	unsigned char blk[64];
+	unsigned int i;
+
+	memcpy(blk + SHA256_DIGEST_LENGTH, pad32, sizeof(pad32));
+
+	for (; n > 0; n--, in += 64, out += SHA256_DIGEST_LENGTH) {
+		memcpy(ctx.state, IV, sizeof(ctx.state));
+		transform(&ctx, in, 1);
+		transform(&ctx, pad64, 1);
+
+		for (i = 0; i < 8; i++)
+			write_be32(blk + i * 4, ctx.state[i]);
+
+		memcpy(ctx.state, IV, sizeof(ctx.state));
+		transform(&ctx, blk, 1);
+
+		for (i = 0; i < 8; i++)
+			write_be32(out + i * 4, ctx.state[i]);
+	}
+}
+
+#ifdef SHA256D64_X86
+
+/*
+ * 8-way kernel, written with GCC generic vectors.  The same source is
+ * compiled for AVX2 (one ymm register per lane group) and for SSE4.1
+ * (pairs of xmm registers), each lane hashing an independent message.
+ */
+
+typedef uint32_t v8u __attribute__((vector_size(32)));
+
+#define V_ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define V_CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define V_MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define V_S0(x)		(V_ROTR(x, 2) ^ V_ROTR(x, 13) ^ V_ROTR(x, 22))
+#define V_S1(x)		(V_ROTR(x, 6) ^ V_ROTR(x, 11) ^ V_ROTR(x, 25))
+#define V_s0(x)		(V_ROTR(x, 7) ^ V_ROTR(x, 18) ^ ((x) >> 3))
+#define V_s1(x)		(V_ROTR(x, 17) ^ V_ROTR(x, 19) ^ ((x) >> 10))
+
+#define V_ROUND(i) do {						\
+	v8u t1 = h + V_S1(e) + V_CH(e, f, g) + sha256_K[i] +		\
+		 w[(i) & 15];						\
+	v8u t2 = V_S0(a) + V_MAJ(a, b, c);				\
+	h = g; g = f; f = e; e = d + t1;				\
+	d = c; c = b; b = a; a = t1 + t2;				\
+} while (0)
+
+static inline __attribute__((always_inline))
+void transform_8way(v8u *s, v8u *w)
+{
+	v8u a = s[0], b = s[1], c = s[2], d = s[3];
+	v8u e = s[4], f = s[5], g = s[6], h = s[7];
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		V_ROUND(i);
+
+	for (; i < 64; i++) {
+		w[i & 15] += V_s1(w[(i - 2) & 15]) + w[(i - 7) & 15] +
+			     V_s0(w[(i - 15) & 15]);
+		V_ROUND(i);
+	}
+
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+	s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+static inline __attribute__((always_inline))
+void load_8way(v8u *w, const unsigned char *p, size_t stride)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < 16; i++)
+		for (j = 0; j < 8; j++)
+			w[i][j] = read_be32(p + j * stride + i * 4);
+}
+
+static inline __attribute__((always_inline))
+void sha256d64_8way(unsigned char *out, const unsigned char *in)
+{
+	v8u s[8], w[16];
+	unsigned int i, j;
+
+	/* first hash: message block, then padding block */
+	for (i = 0; i < 8; i++)
+		s[i] = (v8u){ 0 } + IV[i];
+	load_8way(w, in, 64);
+	transform_8way(s, w);
+
+	load_8way(w, pad64, 0);
+	transform_8way(s, w);
+
+	/* second hash: digest words are already in lane order */
+	for (i = 0; i < 8; i++) {
+		w[i] = s[i];
+		s[i] = (v8u){ 0 } + IV[i];
+	}
+	for (i = 8; i < 16; i++)
+		w[i] = (v8u){ 0 } + read_be32(pad32 + (i - 8) * 4);
+	transform_8way(s, w);
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++)
+			write_be32(out + j * SHA256_DIGEST_LENGTH + i * 4,
+				   s[i][j]);
+}
+
+static void __attribute__((target("avx2")))
+sha256d64_avx2(unsigned char *out, const unsigned char *in, size_t n)
+{
+	for (; n >= 8; n -= 8, in += 8 * 64, out += 8 * SHA256_DIGEST_LENGTH)
+		sha256d64_8way(out, in);
+
+	sha256d64_scalar(out, in, n);
+}
+
+static void __attribute__((target("sse4.1")))
+sha256d64_sse41(unsigned char *out, const unsigned char *in, size_t n)
+{
+	for (; n >= 8; n -= 8, in += 8 * 64, out += 8 * SHA256_DIGEST_LENGTH)
+		sha256d64_8way(out, in);
+
+	sha256d64_scalar(out, in, n);
+}
+
+static void sha256d64_shani(unsigned char *out, const unsigned char *in,
+			    size_t n)
+{
+	sha256d64_transform(out, in, n, sha256_Transform_shani);
+}
+
+enum {
+	CPU_SSE41	= (1U << 0),
+	CPU_AVX2	= (1U << 1),
+	CPU_SHANI	= (1U << 2),
+};
+
+static unsigned int cpu_features(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int features = 0;
+	bool ymm_ok = false, ssse3_ok;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	ssse3_ok = (ecx & bit_SSSE3) != 0;
+
+	if (ecx & bit_SSE4_1)
+		features |= CPU_SSE41;
+
+	/* AVX state must also be enabled by the OS */
+	if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+		uint32_t xcr0_lo, xcr0_hi;
+		__asm__ volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi)
+				  : "c" (0));
+		ymm_ok = ((xcr0_lo & 6) == 6);
+	}
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return features;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (ymm_ok && (ebx & bit_AVX2))
+		features |= CPU_AVX2;
+
+	/* sha256_Transform_shani also needs SSSE3 and SSE4.1 */
+	if (ssse3_ok && (features & CPU_SSE41) && (ebx & (1U << 29)))
+		features |= CPU_SHANI;
+
+	return features;
+}
+
+#elif defined(SHA256D64_ARMV8)
+
+static void sha256d64_armv8(unsigned char *out, const unsigned char *in,
+			    size_t n)
+{
+	sha256d64_transform(out, in, n, sha256_Transform_armv8);
+}
+
+enum {
+	CPU_ARMV8_SHA2	= (1U << 0),
+};
+
+static unsigned int cpu_features(void)
+{
+#if defined(__linux__)
+	if (getauxval(AT_HWCAP) & (1UL << 6))	/* HWCAP_SHA2 */
+		return CPU_ARMV8_SHA2;
+	return 0;
+#else
+	/* every Apple arm64 core has the SHA-256 instructions */
+	return CPU_ARMV8_SHA2;
+#endif
+}
+
+#else /* !SHA256D64_X86 && !SHA256D64_ARMV8 */
+
+static unsigned int cpu_features(void)
+{
+	return 0;
+}
+
+#endif /* SHA256D64_X86, SHA256D64_ARMV8 */
+
+struct sha256d64_kernel {
+	const char	*name;
+	void		(*fn)(unsigned char *out, const unsigned char *in,
+			      size_t n);
+	unsigned int	features;	// required CPU features
+};
+
+/* in order of preference */
+static const struct sha256d64_kernel kernels[] = {
+#ifdef SHA256D64_X86
+	{ "sha-ni", sha256d64_shani, CPU_SHANI },
+	{ "avx2", sha256d64_avx2, CPU_AVX2 },
+	{ "sse4.1", sha256d64_sse41, CPU_SSE41 },
+#endif
+#ifdef SHA256D64_ARMV8
+	{ "armv8", sha256d64_armv8, CPU_ARMV8_SHA2 },
+#endif
+	{ "scalar", sha256d64_scalar, 0 },
+};
+
+static const struct sha256d64_kernel *kernel;
+
+static const struct sha256d64_kernel *sha256d64_kernel(void)
+{
+	/* racing initializers all store the same value */
+	if (!kernel) {
+		unsigned int features = cpu_features();
+		unsigned int i;
+
+		for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+			if ((kernels[i].features & features) ==
+			    kernels[i].features) {
+				kernel = &kernels[i];
+				break;
+			}
+		}
+	}
+
+	return kernel;
+}
+
+void sha256d64(unsigned char *out, const unsigned char *in, size_t n)
+{
+	sha256d64_kernel()->fn(out, in, n);
+}
+
+const char *sha256d64_impl(void)
+{
+	return sha256d64_kernel()->name;
+}
+
+bool sha256d64_select(const char *name)
+{
+	unsigned int features = cpu_features();
+	unsigned int i;
+
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if (strcmp(kernels[i].name, name))
+			continue;
+		if ((kernels[i].features & features) != kernels[i].features)
+			return false;
+
+		kernel = &kernels[i];
+		return true;
+	}
+
+	return false;
+}
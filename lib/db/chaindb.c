@@ -6,17 +6,20 @@
 #include <bitc/buint.h>                 // for bu256_hex, bu256_copy, etc
 #include <bitc/core.h>                  // for bitc_block, bitc_locator_push, etc
 #include <bitc/db/chaindb.h>            // for blkinfo, chaindb, etc
-#include <bitc/db/db.h>                 // for blockheightdb_add
+#include <bitc/cstr.h>                  // for cstring, cstr_new_sz, etc
+#include <bitc/db/db.h>                 // for blockheightdb_add, etc
+#include <bitc/endian.h>                // for htole32, le32toh
 #include <bitc/hashtab.h>               // for bitc_hashtab_new_ext, etc
-#include <bitc/log.h>                   // for log_debug, log_info
+#include <bitc/log.h>                   // for log_debug, log_info, etc
 #include <bitc/parr.h>                  // for parr
 #include <bitc/serialize.h>             // for u256_from_compact
 
 #include <gmp.h>                        // for mpz_clear, mpz_init, etc
 
 #include <stddef.h>                     // for NULL
+#include <stdint.h>                     // for uint32_t
 #include <stdlib.h>                     // for calloc, free
-#include <string.h>                     // for memset
+#include <string.h>                     // for memcpy, memset
 #include <stdbool.h>                    // for bool, true, false
 
 struct logging *log_state;
@@ -47,6 +50,120 @@ void bi_free(struct blkinfo *bi)
 	free(bi);
 }
 
+/*
+ * Block index record, as stored in blockidxdb: the 80-byte header,
+ * little-endian 32-bit height, and 32 bytes of little-endian
+ * cumulative work.
+ */
+enum {
+	BI_REC_HDR	= 80,
+	BI_REC_WORK	= 32,
+	BI_REC_SZ	= BI_REC_HDR + 4 + BI_REC_WORK,
+};
+
+static bool bi_write(const struct blkinfo *bi)
+{
+	unsigned char rec[BI_REC_SZ];
+	uint32_t height = htole32(bi->height);
+	size_t count = 0;
+	cstring *s;
+
+	if (mpz_sizeinbase(bi->work, 256) > BI_REC_WORK)
+		return false;
+
+	s = cstr_new_sz(BI_REC_HDR);
+	if (!s)
+		return false;
+	ser_bitc_block(s, &bi->hdr);		/* header only, no vtx */
+	memcpy(rec, s->str, BI_REC_HDR);
+	cstr_free(s, true);
+
+	memcpy(rec + BI_REC_HDR, &height, 4);
+	memset(rec + BI_REC_HDR + 4, 0, BI_REC_WORK);
+	mpz_export(rec + BI_REC_HDR + 4, &count, -1, 1, 0, 0, bi->work);
+
+	return blockidxdb_add(&bi->hash, rec, sizeof(rec));
+}
+
+static bool bi_read(const bu256_t *hash, const void *p, size_t len,
+		    void *priv)
+{
+	struct chaindb *db = priv;
+	struct const_buffer buf = { p, BI_REC_HDR };
+	uint32_t height;
+
+	if (len != BI_REC_SZ)
+		return false;
+	if (chaindb_lookup(db, hash))
+		return true;
+
+	struct blkinfo *bi = bi_new();
+	if (!bi || !deser_bitc_block(&bi->hdr, &buf)) {
+		bi_free(bi);
+		return false;
+	}
+
+	/* the key is the header hash; trust it rather than rehash */
+	bu256_copy(&bi->hash, hash);
+	bu256_copy(&bi->hdr.sha256, hash);
+	bi->hdr.sha256_valid = true;
+
+	memcpy(&height, (const unsigned char *) p + BI_REC_HDR, 4);
+	bi->height = le32toh(height);
+	mpz_import(bi->work, BI_REC_WORK, -1, 1, 0, 0,
+		   (const unsigned char *) p + BI_REC_HDR + 4);
+
+	bitc_hashtab_put(db->blocks, &bi->hash, bi);
+	return true;
+}
+
+struct chaindb_link {
+	struct chaindb	*db;
+	bool		ok;
+};
+
+static void bi_link(void *key, void *value, void *priv)
+{
+	struct chaindb_link *link = priv;
+	struct chaindb *db = link->db;
+	struct blkinfo *bi = value;
+
+	if (bi->height == 0) {
+		if (!bu256_equal(&bi->hash, &db->block0))
+			link->ok = false;
+	} else {
+		bi->prev = chaindb_lookup(db, &bi->hdr.hashPrevBlock);
+		if (!bi->prev || bi->prev->height + 1 != bi->height)
+			link->ok = false;
+	}
+
+	if (!db->best_chain || mpz_cmp(bi->work, db->best_chain->work) > 0)
+		db->best_chain = bi;
+}
+
+bool chaindb_load(struct chaindb *db)
+{
+	struct chaindb_link link = { db, true };
+	char hexstr[BU256_STRSZ];
+
+	if (!blockidxdb_getall(bi_read, db))
+		link.ok = false;
+	else
+		bitc_hashtab_iter(db->blocks, bi_link, &link);
+
+	if (!link.ok || !db->best_chain) {
+		log_info("chaindb: Block index unusable, %s", link.ok ? "empty" : "corrupt");
+		bitc_hashtab_clear(db->blocks);
+		db->best_chain = NULL;
+		return false;
+	}
+
+	bu256_hex(hexstr, &db->best_chain->hash);
+	log_info("chaindb: Loaded %u blocks, best = %s Height = %i",
+		 bitc_hashtab_size(db->blocks), hexstr, db->best_chain->height);
+	return true;
+}
+
 bool chaindb_init(struct chaindb *db, const unsigned char *netmagic,
 		const bu256_t *genesis_block)
 {
@@ -105,9 +222,17 @@ bool chaindb_add(struct chaindb *db, struct blkinfo *bi,
 			best_chain = true;
 	}
 
-	/* add to block map */
+	/* store, then add to block map; a restart rebuilds from the index */
+	if (!db->hdrs_only) {
+		blockheightdb_add(bi->height, &bi->hash);
+		if (!bi_write(bi)) {
+			bu256_hex(hexstr, &bi->hash);
+			log_error("chaindb: Block index write failed for %s",
+				  hexstr);
+			goto out;
+		}
+	}
 	bitc_hashtab_put(db->blocks, &bi->hash, bi);
-	blockheightdb_add(bi->height, &bi->hash);
 
 	/* if new best chain found, update pointers */
 	if (best_chain) {
@@ -150,7 +275,12 @@ bool chaindb_add(struct chaindb *db, struct blkinfo *bi,
 		db->best_chain = bi;
 
 		bu256_hex(hexstr, &db->best_chain->hdr.sha256);
-		log_info("chaindb: New best = %s Height = %i",hexstr, bi->height);
+		if (db->hdrs_only) {
+			log_debug("chaindb: New best header = %s Height = %i",
+				  hexstr, bi->height);
+		} else {
+			log_info("chaindb: New best = %s Height = %i",hexstr, bi->height);
+		}
 	}
 	rc = true;
 	bu256_hex(hexstr, &bi->hdr.sha256);
@@ -161,6 +291,44 @@ out:
 	return rc;
 }
 
+bool chaindb_add_root(struct chaindb *db, const struct blkinfo *bi)
+{
+	char hexstr[BU256_STRSZ];
+
+	if (!db->hdrs_only || bitc_hashtab_size(db->blocks) != 0)
+		return false;
+
+	struct blkinfo *root = bi_new();
+
+	bitc_block_copy_hdr(&root->hdr, &bi->hdr);
+	bu256_copy(&root->hash, &bi->hash);
+	mpz_set(root->work, bi->work);
+	root->height = bi->height;
+
+	bitc_hashtab_put(db->blocks, &root->hash, root);
+	db->best_chain = root;
+
+	bu256_hex(hexstr, &root->hash);
+	log_debug("chaindb: Root %s Height = %i", hexstr, root->height);
+	return true;
+}
+
+bool chaindb_remove(struct chaindb *db, struct blkinfo *bi,
+		    const struct chaindb_reorg *reorg_info)
+{
+	bool rc = true;
+
+	if (db->best_chain == bi)
+		db->best_chain = reorg_info->old_best;
+	/* both records chaindb_add wrote; try each, whatever the other did */
+	if (!db->hdrs_only) {
+		rc = blockidxdb_del(&bi->hash);
+		rc = blockheightdb_del(bi->height, &bi->hash) && rc;
+	}
+
+	bitc_hashtab_del(db->blocks, &bi->hash);
+	return rc;
+}
 
 void chaindb_free(struct chaindb *db)
 {
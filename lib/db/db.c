@@ -6,17 +6,23 @@
 #include <bitc/db/db.h>                 // for db_handle, db_info, etc
 
 #include <bitc/coredefs.h>              // for chain_find_by_netmagic, etc
+#include <bitc/endian.h>                // for htole32, le32toh
 #include <bitc/log.h>                   // for log_info, log_error, etc
 
-#include <stdint.h>                     // for uint8_t
+#include <errno.h>                      // for ENOMEM
+#include <stdlib.h>                     // for free, realloc
+#include <stdint.h>                     // for uint8_t, uint32_t
 #include <stdio.h>                      // for snprintf
-#include <string.h>                     // for memcmp, strlen
+#include <string.h>                     // for memcmp, memcpy, strlen
+#include <time.h>                       // for time
 #include <unistd.h>                     // for sysconf, _SC_PAGESIZE
 
 struct db_info dbinfo = {NULL,
 	{[METADB] = {"metadb", (MDB_dbi) 0, false},
 	[BLOCKDB] = {"blockdb", (MDB_dbi) 0, false},
-	[BLOCKHEIGHTDB] = {"blockheightdb", (MDB_dbi) 0, false},}
+	[BLOCKHEIGHTDB] = {"blockheightdb", (MDB_dbi) 0, false},
+	[UTXODB] = {"utxodb", (MDB_dbi) 0, false},
+	[BLOCKIDXDB] = {"blockidxdb", (MDB_dbi) 0, false},}
 };
 
 long get_pagesize()
@@ -29,6 +35,135 @@ long get_pagesize()
 #endif
 }
 
+void db_set_policy(const struct db_batch_policy *policy)
+{
+	dbinfo.policy = *policy;
+
+	if (dbinfo.env)
+		mdb_env_set_flags(dbinfo.env, MDB_NOSYNC, policy->nosync);
+}
+
+void db_batch_begin(void)
+{
+	dbinfo.batching = true;
+}
+
+/* commit the open batch, if any */
+static int db_batch_commit_rc(void)
+{
+	int mdb_rc;
+
+	if (!dbinfo.batch_txn)
+		return MDB_SUCCESS;
+
+	mdb_rc = mdb_txn_commit(dbinfo.batch_txn);
+	dbinfo.batch_txn = NULL;
+
+	if (mdb_rc == MDB_SUCCESS)
+		log_debug("db: Committed batch of %u writes, %zu bytes", dbinfo.batch_writes, dbinfo.batch_bytes);
+	return mdb_rc;
+}
+
+bool db_batch_commit(void)
+{
+	int mdb_rc = db_batch_commit_rc();
+
+	if (mdb_rc != MDB_SUCCESS) {
+		log_error("db: Batch commit error '%s'", mdb_strerror(mdb_rc));
+		return false;
+	}
+	return true;
+}
+
+bool db_batch_end(void)
+{
+	dbinfo.batching = false;
+	return db_batch_commit();
+}
+
+bool db_batch_idle(void)
+{
+	const struct db_batch_policy *p = &dbinfo.policy;
+	time_t now = time(NULL);
+
+	if (!dbinfo.batch_txn)
+		return true;
+
+	if (now - dbinfo.batch_last < DB_BATCH_IDLE &&
+	    !(p->max_secs && now - dbinfo.batch_start >= p->max_secs))
+		return true;
+
+	return db_batch_commit();
+}
+
+bool db_sync(void)
+{
+	int mdb_rc;
+
+	if (!db_batch_commit())
+		return false;
+	if (!dbinfo.env)
+		return true;
+
+	/* a no-op unless commits skipped the fsync */
+	if ((mdb_rc = mdb_env_sync(dbinfo.env, 1)) != MDB_SUCCESS) {
+		log_error("db: Sync error '%s'", mdb_strerror(mdb_rc));
+		return false;
+	}
+	return true;
+}
+
+/* write txn for one update: the open batch, or a txn of its own */
+static int db_write_begin(MDB_txn **txn)
+{
+	int mdb_rc;
+
+	if (!dbinfo.batching)
+		return mdb_txn_begin(dbinfo.env, NULL, 0, txn);
+
+	if (!dbinfo.batch_txn) {
+		if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, 0, &dbinfo.batch_txn)) != MDB_SUCCESS)
+			return mdb_rc;
+		dbinfo.batch_writes = 0;
+		dbinfo.batch_bytes = 0;
+		dbinfo.batch_start = time(NULL);
+	}
+
+	*txn = dbinfo.batch_txn;
+	return MDB_SUCCESS;
+}
+
+/* finish an update of n records totalling bytes; force commits a batch */
+static int db_write_commit(MDB_txn *txn, unsigned int n, size_t bytes, bool force)
+{
+	const struct db_batch_policy *p = &dbinfo.policy;
+
+	if (txn != dbinfo.batch_txn)
+		return mdb_txn_commit(txn);
+
+	dbinfo.batch_writes += n;
+	dbinfo.batch_bytes += bytes;
+	dbinfo.batch_last = time(NULL);
+
+	if (force ||
+	    (p->max_writes && dbinfo.batch_writes >= p->max_writes) ||
+	    (p->max_bytes && dbinfo.batch_bytes >= p->max_bytes) ||
+	    (p->max_secs && dbinfo.batch_last - dbinfo.batch_start >= p->max_secs))
+		return db_batch_commit_rc();
+
+	return MDB_SUCCESS;
+}
+
+static void db_write_abort(MDB_txn *txn)
+{
+	/* LMDB txns are unusable after a failed write: the batch is lost */
+	if (txn == dbinfo.batch_txn) {
+		log_error("db: Aborting batch of %u writes", dbinfo.batch_writes);
+		dbinfo.batch_txn = NULL;
+	}
+	mdb_txn_abort(txn);
+}
+
 bool metadb_init(const unsigned char *netmagic,
 		const bu256_t *genesis_block)
 {
@@ -55,7 +190,11 @@ bool metadb_init(const unsigned char *netmagic,
 	if ((mdb_rc = mdb_env_set_mapsize(dbinfo.env,(size_t)(((MAX_DB_SIZE - 1) | (get_pagesize() - 1)) + 1))) != MDB_SUCCESS) goto err_out;
 	if ((mdb_rc = mdb_env_set_maxdbs(dbinfo.env, (MDB_dbi) MAX_NUM_DBS)) != MDB_SUCCESS) goto err_out;
 	log_debug("db: Opening database file '%s'", db_filename);
-	if ((mdb_rc = mdb_env_open(dbinfo.env, db_filename, MDB_NOSUBDIR, 0664)) != MDB_SUCCESS) goto err_out;
+	/* MDB_NOTLS: utxodb keeps its own read txn next to other readers */
+	unsigned int env_flags = MDB_NOSUBDIR | MDB_NOTLS;
+	if (dbinfo.policy.nosync) env_flags |= MDB_NOSYNC;
+	if (dbinfo.policy.writemap) env_flags |= MDB_WRITEMAP;
+	if ((mdb_rc = mdb_env_open(dbinfo.env, db_filename, env_flags, 0664)) != MDB_SUCCESS) goto err_out;
 	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, 0, &txn)) != MDB_SUCCESS) goto err_out;
 
 	if ((mdb_rc = mdb_dbi_open(txn, dbinfo.handle[METADB].name, MDB_INTEGERKEY, &dbinfo.handle[METADB].dbi)) == MDB_SUCCESS) {
@@ -143,7 +282,7 @@ bool blockdb_add(bu256_t *hash, struct const_buffer *buf)
 	data_block.mv_size = buf->len;
 	data_block.mv_data = (void *)buf->p;
 
-	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, 0, &txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = db_write_begin(&txn)) != MDB_SUCCESS) goto err_out;
 	if (((mdb_rc = mdb_put(txn, dbinfo.handle[BLOCKDB].dbi, &key_hash, &data_block, MDB_NOOVERWRITE)) != MDB_SUCCESS) && (mdb_rc != MDB_KEYEXIST)) goto err_abort;
 	bu256_hex(hexstr, key_hash.mv_data);
 	if (mdb_rc == MDB_SUCCESS) {
@@ -152,12 +291,12 @@ bool blockdb_add(bu256_t *hash, struct const_buffer *buf)
 		log_debug("db: Block %s already exists in %s database", hexstr, dbinfo.handle[BLOCKDB].name);
 	}
 
-	if ((mdb_rc = mdb_txn_commit(txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = db_write_commit(txn, 1, buf->len, false)) != MDB_SUCCESS) goto err_out;
 
 	return true;
 
 err_abort:
-	mdb_txn_abort(txn);
+	db_write_abort(txn);
 err_out:
 	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKDB].name, mdb_strerror(mdb_rc));
 	return false;
@@ -200,17 +339,49 @@ bool blockheightdb_add(int height, bu256_t *hash)
 	data_hash.mv_size = sizeof(bu256_t);
 	data_hash.mv_data = hash;
 
-	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, 0, &txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = db_write_begin(&txn)) != MDB_SUCCESS) goto err_out;
 	if (((mdb_rc = mdb_put(txn, dbinfo.handle[BLOCKHEIGHTDB].dbi, &key_height, &data_hash, MDB_APPEND)) != MDB_SUCCESS) && (mdb_rc != MDB_KEYEXIST)) goto err_abort;
 	if (mdb_rc == MDB_SUCCESS) {
 		log_debug("db: Adding %s with height %i to %s database", hexstr, *(int *)key_height.mv_data, dbinfo.handle[BLOCKHEIGHTDB].name);
 	} else if (mdb_rc == MDB_KEYEXIST) {
 		log_debug("db: Updating block height %i with hash %s in %s database", *(int *)key_height.mv_data, hexstr, dbinfo.handle[BLOCKHEIGHTDB].name);
 	}
-	if ((mdb_rc = mdb_txn_commit(txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = db_write_commit(txn, 1, sizeof(bu256_t), false)) != MDB_SUCCESS) goto err_out;
 
 	return true;
 
+err_abort:
+	db_write_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKHEIGHTDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool blockheightdb_get(int height, bu256_t *hash)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_val key_height, data_hash;
+
+	key_height.mv_size = sizeof(int);
+	key_height.mv_data = &height;
+
+	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS) goto err_out;
+	mdb_rc = mdb_get(txn, dbinfo.handle[BLOCKHEIGHTDB].dbi, &key_height, &data_hash);
+	if (mdb_rc == MDB_NOTFOUND) {
+		mdb_txn_abort(txn);
+		return false;
+	}
+	if (mdb_rc != MDB_SUCCESS) goto err_abort;
+	if (data_hash.mv_size != sizeof(bu256_t)) {
+		mdb_txn_abort(txn);
+		return false;
+	}
+
+	memcpy(hash, data_hash.mv_data, sizeof(bu256_t));
+	mdb_txn_abort(txn);
+	return true;
+
 err_abort:
 	mdb_txn_abort(txn);
 err_out:
@@ -218,6 +389,33 @@ err_out:
 	return false;
 }
 
+/* a height row is only deleted while it still names hash */
+bool blockheightdb_del(int height, const bu256_t *hash)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_val key_height, data_hash;
+
+	key_height.mv_size = sizeof(int);
+	key_height.mv_data = &height;
+
+	if ((mdb_rc = db_write_begin(&txn)) != MDB_SUCCESS) goto err_out;
+	mdb_rc = mdb_get(txn, dbinfo.handle[BLOCKHEIGHTDB].dbi, &key_height, &data_hash);
+	if (mdb_rc == MDB_SUCCESS && data_hash.mv_size == sizeof(bu256_t) &&
+	    !memcmp(data_hash.mv_data, hash, sizeof(bu256_t)))
+		mdb_rc = mdb_del(txn, dbinfo.handle[BLOCKHEIGHTDB].dbi, &key_height, NULL);
+	if ((mdb_rc != MDB_SUCCESS) && (mdb_rc != MDB_NOTFOUND)) goto err_abort;
+	if ((mdb_rc = db_write_commit(txn, 1, 0, false)) != MDB_SUCCESS) goto err_out;
+
+	return true;
+
+err_abort:
+	db_write_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKHEIGHTDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
 bool blockheightdb_getall(bool (*read_block)(void *p, size_t len))
 {
 	int mdb_rc;
@@ -247,11 +445,573 @@ err_out:
 	return false;
 }
 
+bool blockdb_get(const bu256_t *hash, bool (*read_block)(void *p, size_t len))
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_val key_hash, data_block;
+	bool rc;
+
+	key_hash.mv_size = sizeof(bu256_t);
+	key_hash.mv_data = (bu256_t *) hash;
+
+	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = mdb_get(txn, dbinfo.handle[BLOCKDB].dbi, &key_hash, &data_block)) != MDB_SUCCESS) goto err_abort;
+
+	rc = read_block(data_block.mv_data, data_block.mv_size);
+	mdb_txn_abort(txn);
+	return rc;
+
+err_abort:
+	mdb_txn_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool blockidxdb_init(void)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+
+	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, 0, &txn)) != MDB_SUCCESS) goto err_out;
+
+	log_info("db: Opening %s database", dbinfo.handle[BLOCKIDXDB].name);
+	if ((mdb_rc = mdb_dbi_open(txn, dbinfo.handle[BLOCKIDXDB].name, MDB_CREATE, &dbinfo.handle[BLOCKIDXDB].dbi)) != MDB_SUCCESS) goto err_abort;
+	dbinfo.handle[BLOCKIDXDB].open = true;
+
+	if ((mdb_rc = mdb_txn_commit(txn)) != MDB_SUCCESS) goto err_close;
+
+	return true;
+
+err_abort:
+	mdb_txn_abort(txn);
+err_close:
+	db_close();
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKIDXDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool blockidxdb_add(const bu256_t *hash, const void *rec, size_t len)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_val key_hash, data_rec;
+
+	key_hash.mv_size = sizeof(bu256_t);
+	key_hash.mv_data = (bu256_t *) hash;
+	data_rec.mv_size = len;
+	data_rec.mv_data = (void *) rec;
+
+	if ((mdb_rc = db_write_begin(&txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = mdb_put(txn, dbinfo.handle[BLOCKIDXDB].dbi, &key_hash, &data_rec, 0)) != MDB_SUCCESS) goto err_abort;
+	if ((mdb_rc = db_write_commit(txn, 1, len, false)) != MDB_SUCCESS) goto err_out;
+
+	return true;
+
+err_abort:
+	db_write_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKIDXDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool blockidxdb_del(const bu256_t *hash)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_val key_hash;
+
+	key_hash.mv_size = sizeof(bu256_t);
+	key_hash.mv_data = (bu256_t *) hash;
+
+	if ((mdb_rc = db_write_begin(&txn)) != MDB_SUCCESS) goto err_out;
+	if (((mdb_rc = mdb_del(txn, dbinfo.handle[BLOCKIDXDB].dbi, &key_hash, NULL)) != MDB_SUCCESS) && (mdb_rc != MDB_NOTFOUND)) goto err_abort;
+	if ((mdb_rc = db_write_commit(txn, 1, 0, false)) != MDB_SUCCESS) goto err_out;
+
+	return true;
+
+err_abort:
+	db_write_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKIDXDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool blockidxdb_getall(bool (*read_idx)(const bu256_t *hash, const void *p,
+					size_t len, void *priv),
+		       void *priv)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_cursor_op op = MDB_FIRST;
+	MDB_val key_hash, data_rec;
+
+	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS) goto err_out;
+	if ((mdb_rc = mdb_cursor_open(txn, dbinfo.handle[BLOCKIDXDB].dbi, &cursor)) != MDB_SUCCESS) goto err_abort;
+
+	log_info("db: Reading %s database", dbinfo.handle[BLOCKIDXDB].name);
+	while ((mdb_rc = mdb_cursor_get(cursor, &key_hash, &data_rec, op)) == MDB_SUCCESS) {
+		if (key_hash.mv_size != sizeof(bu256_t) ||
+		    !read_idx(key_hash.mv_data, data_rec.mv_data, data_rec.mv_size, priv)) {
+			mdb_cursor_close(cursor);
+			mdb_txn_abort(txn);
+			return false;
+		}
+		op = MDB_NEXT;
+	}
+
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	return mdb_rc == MDB_NOTFOUND;
+
+err_abort:
+	mdb_txn_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[BLOCKIDXDB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+static bool utxodb_read_best(struct utxodb *udb)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+	MDB_val key_best, data_best;
+	enum metadb_key key = UTXO_BEST_KEY;
+	uint32_t height;
+
+	key_best.mv_size = sizeof(enum metadb_key);
+	key_best.mv_data = &key;
+
+	udb->best_height = -1;
+
+	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS) goto err_out;
+	mdb_rc = mdb_get(txn, dbinfo.handle[METADB].dbi, &key_best, &data_best);
+	if (mdb_rc == MDB_SUCCESS && data_best.mv_size == sizeof(bu256_t) + 4) {
+		memcpy(&udb->best_hash, data_best.mv_data, sizeof(bu256_t));
+		memcpy(&height, (uint8_t *) data_best.mv_data + sizeof(bu256_t), 4);
+		udb->best_height = le32toh(height);
+	} else if (mdb_rc != MDB_SUCCESS && mdb_rc != MDB_NOTFOUND)
+		goto err_abort;
+	mdb_txn_abort(txn);
+
+	return true;
+
+err_abort:
+	mdb_txn_abort(txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[METADB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool utxodb_init(struct utxodb *udb, unsigned int flush_blocks, size_t max_cache)
+{
+	int mdb_rc;
+	MDB_txn *txn;
+
+	memset(udb, 0, sizeof(*udb));
+	udb->flush_blocks = flush_blocks ? flush_blocks : UTXODB_FLUSH_BLOCKS;
+	udb->max_cache = max_cache ? max_cache : UTXODB_MAX_CACHE;
+	udb->best_height = -1;
+
+	if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, 0, &txn)) != MDB_SUCCESS) goto err_out;
+
+	log_info("db: Opening %s database", dbinfo.handle[UTXODB].name);
+	if ((mdb_rc = mdb_dbi_open(txn, dbinfo.handle[UTXODB].name, MDB_CREATE, &dbinfo.handle[UTXODB].dbi)) != MDB_SUCCESS) goto err_abort;
+	dbinfo.handle[UTXODB].open = true;
+
+	if ((mdb_rc = mdb_txn_commit(txn)) != MDB_SUCCESS) goto err_close;
+
+	if (!utxodb_read_best(udb))
+		return false;
+
+	if (!bitc_coins_init(&udb->cache))
+		return false;
+	if (!bitc_coins_init(&udb->undo_coins)) {
+		bitc_coins_free(&udb->cache);
+		return false;
+	}
+	udb->spent = bitc_flatmap_new(BITC_COINS_KEY_SZ, 0);
+	if (!udb->spent) {
+		bitc_coins_free(&udb->undo_coins);
+		bitc_coins_free(&udb->cache);
+		return false;
+	}
+
+	if (udb->best_height >= 0) {
+		char hexstr[BU256_STRSZ];
+		bu256_hex(hexstr, &udb->best_hash);
+		log_info("db: %s database at height %d, block %s", dbinfo.handle[UTXODB].name, udb->best_height, hexstr);
+	}
+
+	return true;
+
+err_abort:
+	mdb_txn_abort(txn);
+err_close:
+	db_close();
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[UTXODB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+/* end the read txn, so the next read sees the latest commit */
+static void utxodb_rtxn_release(struct utxodb *udb, bool abort)
+{
+	if (!udb->rtxn)
+		return;
+
+	if (abort) {
+		mdb_txn_abort(udb->rtxn);
+		udb->rtxn = NULL;
+	} else if (udb->rtxn_live)
+		mdb_txn_reset(udb->rtxn);
+	udb->rtxn_live = false;
+}
+
+bool utxodb_close(struct utxodb *udb)
+{
+	/* a block left half applied is not written */
+	bool rc = utxodb_block_abort(udb);
+
+	rc = utxodb_flush(udb) && rc;
+
+	utxodb_rtxn_release(udb, true);
+	return rc;
+}
+
+void utxodb_free(struct utxodb *udb)
+{
+	if (!udb)
+		return;
+
+	utxodb_rtxn_release(udb, true);
+	bitc_coins_free(&udb->cache);
+	bitc_coins_free(&udb->undo_coins);
+	bitc_flatmap_free(udb->spent);
+	udb->spent = NULL;
+	free(udb->undo);
+	udb->undo = NULL;
+	udb->n_undo = udb->undo_alloc = 0;
+}
+
+static bool utxodb_read(struct utxodb *udb, const unsigned char *key,
+			struct bitc_coin *coin)
+{
+	int mdb_rc;
+	MDB_val key_outpt, data_coin;
+
+	key_outpt.mv_size = BITC_COINS_KEY_SZ;
+	key_outpt.mv_data = (void *) key;
+
+	if (!udb->rtxn) {
+		if ((mdb_rc = mdb_txn_begin(dbinfo.env, NULL, MDB_RDONLY, &udb->rtxn)) != MDB_SUCCESS) goto err_out;
+		udb->rtxn_live = true;
+	} else if (!udb->rtxn_live) {
+		if ((mdb_rc = mdb_txn_renew(udb->rtxn)) != MDB_SUCCESS) goto err_out;
+		udb->rtxn_live = true;
+	}
+
+	mdb_rc = mdb_get(udb->rtxn, dbinfo.handle[UTXODB].dbi, &key_outpt, &data_coin);
+	if (mdb_rc == MDB_NOTFOUND)
+		return false;
+	if (mdb_rc != MDB_SUCCESS)
+		goto err_out;
+
+	return !coin || bitc_coin_unpack(coin, data_coin.mv_data, data_coin.mv_size);
+
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[UTXODB].name, mdb_strerror(mdb_rc));
+	return false;
+}
+
+bool utxodb_lookup(struct utxodb *udb, const struct bitc_outpt *outpt,
+		   struct bitc_coin *coin)
+{
+	unsigned char key[BITC_COINS_KEY_SZ];
+
+	if (bitc_coins_lookup(&udb->cache, outpt, coin))
+		return true;
+
+	bitc_coins_key(key, outpt);
+	if (bitc_flatmap_has(udb->spent, key))
+		return false;
+
+	return utxodb_read(udb, key, coin);
+}
+
+enum utxodb_undo_op {
+	UTXODB_UNDO_ADD,		// outputs 0..n-1 of tx hash added
+	UTXODB_UNDO_SPEND,		// cache output spent, in undo_coins
+	UTXODB_UNDO_SPEND_DISK,		// on-disk output marked spent
+};
+
+struct utxodb_undo {
+	struct bitc_outpt	outpt;
+	enum utxodb_undo_op	op;
+};
+
+/* room for one more undo record */
+static bool utxodb_undo_reserve(struct utxodb *udb)
+{
+	struct utxodb_undo *undo;
+	size_t n;
+
+	if (udb->n_undo < udb->undo_alloc)
+		return true;
+
+	n = udb->undo_alloc ? udb->undo_alloc * 2 : 256;
+	undo = realloc(udb->undo, n * sizeof(*undo));
+	if (!undo)
+		return false;
+
+	udb->undo = undo;
+	udb->undo_alloc = n;
+	return true;
+}
+
+static void utxodb_undo_push(struct utxodb *udb,
+			     const struct bitc_outpt *outpt,
+			     enum utxodb_undo_op op)
+{
+	struct utxodb_undo *u = &udb->undo[udb->n_undo++];
+
+	bitc_outpt_copy(&u->outpt, outpt);
+	u->op = op;
+}
+
+/* forget the undo records of a block that is in for good */
+static void utxodb_undo_clear(struct utxodb *udb)
+{
+	udb->n_undo = 0;
+	if (bitc_coins_size(&udb->undo_coins))
+		bitc_coins_clear(&udb->undo_coins);
+}
+
+bool utxodb_spend(struct utxodb *udb, const struct bitc_outpt *outpt,
+		  struct bitc_coin *coin)
+{
+	unsigned char key[BITC_COINS_KEY_SZ];
+	struct bitc_coin tmp;
+	bool rc = false;
+
+	if (!utxodb_undo_reserve(udb))
+		return false;
+
+	bitc_coin_init(&tmp);
+	if (!coin)
+		coin = &tmp;
+
+	/* outputs created since the last flush never reached the disk;
+	 * keep a copy for utxodb_block_abort
+	 */
+	if (bitc_coins_spend(&udb->cache, outpt, coin)) {
+		struct bitc_txout txout = { coin->nValue, coin->scriptPubKey };
+
+		if (bitc_coins_add(&udb->undo_coins, outpt, &txout,
+				   coin->is_coinbase, coin->height)) {
+			utxodb_undo_push(udb, outpt, UTXODB_UNDO_SPEND);
+			rc = true;
+		} else
+			bitc_coins_add(&udb->cache, outpt, &txout,
+				       coin->is_coinbase, coin->height);
+		goto out;
+	}
+
+	bitc_coins_key(key, outpt);
+	if (bitc_flatmap_has(udb->spent, key))
+		goto out;
+
+	if (!utxodb_read(udb, key, coin))
+		goto out;
+
+	if (!bitc_flatmap_put(udb->spent, key, NULL))
+		goto out;
+
+	utxodb_undo_push(udb, outpt, UTXODB_UNDO_SPEND_DISK);
+	rc = true;
+
+out:
+	bitc_coin_free(&tmp);
+	return rc;
+}
+
+bool utxodb_add_tx(struct utxodb *udb, const struct bitc_tx *tx,
+		   bool is_coinbase, unsigned int height)
+{
+	struct bitc_outpt outpt;
+
+	if (!utxodb_undo_reserve(udb))
+		return false;
+
+	/* logged first: a partial add is undone like a whole one */
+	bu256_copy(&outpt.hash, &tx->sha256);
+	outpt.n = tx->vout ? tx->vout->len : 0;
+	utxodb_undo_push(udb, &outpt, UTXODB_UNDO_ADD);
+
+	return bitc_coins_add_tx(&udb->cache, tx, is_coinbase, height);
+}
+
+bool utxodb_block_done(struct utxodb *udb, const bu256_t *hash, int height)
+{
+	utxodb_undo_clear(udb);
+
+	bu256_copy(&udb->best_hash, hash);
+	udb->best_height = height;
+	udb->n_blocks++;
+
+	if (udb->n_blocks < udb->flush_blocks &&
+	    utxodb_cache_memory(udb) < udb->max_cache)
+		return true;
+
+	return utxodb_flush(udb);
+}
+
+/* undo, newest first, what the block being applied has done so far */
+bool utxodb_block_abort(struct utxodb *udb)
+{
+	unsigned char key[BITC_COINS_KEY_SZ];
+	struct bitc_coin coin;
+	bool rc = true;
+
+	bitc_coin_init(&coin);
+
+	while (udb->n_undo > 0) {
+		struct utxodb_undo *u = &udb->undo[--udb->n_undo];
+		struct bitc_outpt outpt;
+		unsigned int i;
+
+		bitc_outpt_copy(&outpt, &u->outpt);
+
+		switch (u->op) {
+		case UTXODB_UNDO_ADD:
+			for (i = 0; i < u->outpt.n; i++) {
+				outpt.n = i;
+				bitc_coins_spend(&udb->cache, &outpt, NULL);
+			}
+			break;
+
+		case UTXODB_UNDO_SPEND:
+			if (bitc_coins_spend(&udb->undo_coins, &outpt, &coin)) {
+				struct bitc_txout txout = { coin.nValue,
+							    coin.scriptPubKey };
+
+				if (bitc_coins_add(&udb->cache, &outpt, &txout,
+						   coin.is_coinbase,
+						   coin.height))
+					break;
+			}
+			rc = false;
+			break;
+
+		case UTXODB_UNDO_SPEND_DISK:
+			bitc_coins_key(key, &outpt);
+			bitc_flatmap_del(udb->spent, key, NULL);
+			break;
+		}
+	}
+
+	bitc_coin_free(&coin);
+	utxodb_undo_clear(udb);
+
+	if (!rc) {
+		log_error("db: %s cache lost outputs undoing a block", dbinfo.handle[UTXODB].name);
+	}
+	return rc;
+}
+
+struct utxodb_write {
+	MDB_txn		*txn;
+	int		mdb_rc;
+};
+
+static void utxodb_write_del(void *key, void *value, void *priv)
+{
+	struct utxodb_write *w = priv;
+	MDB_val key_outpt = { BITC_COINS_KEY_SZ, key };
+
+	if (w->mdb_rc != MDB_SUCCESS)
+		return;
+
+	w->mdb_rc = mdb_del(w->txn, dbinfo.handle[UTXODB].dbi, &key_outpt, NULL);
+	if (w->mdb_rc == MDB_NOTFOUND)
+		w->mdb_rc = MDB_SUCCESS;
+}
+
+static bool utxodb_write_put(const unsigned char *key, const void *val,
+			     size_t val_len, void *priv)
+{
+	struct utxodb_write *w = priv;
+	MDB_val key_outpt = { BITC_COINS_KEY_SZ, (void *) key };
+	MDB_val data_coin = { val_len, (void *) val };
+
+	w->mdb_rc = mdb_put(w->txn, dbinfo.handle[UTXODB].dbi, &key_outpt, &data_coin, 0);
+	return w->mdb_rc == MDB_SUCCESS;
+}
+
+bool utxodb_flush(struct utxodb *udb)
+{
+	struct utxodb_write w = { NULL, MDB_SUCCESS };
+	MDB_val key_best, data_best;
+	enum metadb_key key = UTXO_BEST_KEY;
+	uint8_t best[sizeof(bu256_t) + 4];
+	uint32_t height = htole32(udb->best_height);
+	size_t n_add = bitc_coins_size(&udb->cache);
+	size_t n_del = bitc_flatmap_size(udb->spent);
+
+	if (udb->n_blocks == 0)
+		return true;
+
+	memcpy(best, &udb->best_hash, sizeof(bu256_t));
+	memcpy(best + sizeof(bu256_t), &height, 4);
+	key_best.mv_size = sizeof(enum metadb_key);
+	key_best.mv_data = &key;
+	data_best.mv_size = sizeof(best);
+	data_best.mv_data = best;
+
+	utxodb_rtxn_release(udb, false);
+
+	if ((w.mdb_rc = db_write_begin(&w.txn)) != MDB_SUCCESS) goto err_out;
+
+	/* deletions first: a re-created output is put back below */
+	bitc_flatmap_iter(udb->spent, utxodb_write_del, &w);
+	if (w.mdb_rc != MDB_SUCCESS) goto err_abort;
+	if (!bitc_coins_iter_packed(&udb->cache, utxodb_write_put, &w)) {
+		if (w.mdb_rc == MDB_SUCCESS)
+			w.mdb_rc = ENOMEM;
+		goto err_abort;
+	}
+
+	if ((w.mdb_rc = mdb_put(w.txn, dbinfo.handle[METADB].dbi, &key_best, &data_best, 0)) != MDB_SUCCESS) goto err_abort;
+	/* always commit: the read txn must see what left the cache */
+	if ((w.mdb_rc = db_write_commit(w.txn, n_add + n_del + 1, 0, true)) != MDB_SUCCESS) goto err_out;
+
+	log_info("db: Flushed %zu outputs, %zu spends at height %d to %s database", n_add, n_del, udb->best_height, dbinfo.handle[UTXODB].name);
+
+	bitc_coins_clear(&udb->cache);
+	bitc_flatmap_clear(udb->spent);
+	udb->n_blocks = 0;
+	return true;
+
+err_abort:
+	db_write_abort(w.txn);
+err_out:
+	log_error("db: Database %s error '%s'", dbinfo.handle[UTXODB].name, mdb_strerror(w.mdb_rc));
+	return false;
+}
+
 void db_close(void) {
 
 	uint8_t i;
 	log_info("db: Closing databases");
 
+	/* durability barrier: commit and sync whatever is pending */
+	db_batch_end();
+	if (dbinfo.env && dbinfo.policy.nosync)
+		mdb_env_sync(dbinfo.env, 1);
+
 	for(i=METADB; i < MAX_NUM_DBS; i++) {
 		if (dbinfo.handle[i].open) {
 			mdb_dbi_close(dbinfo.env, dbinfo.handle[i].dbi);
@@ -261,6 +1021,7 @@ void db_close(void) {
 	}
 
 	mdb_env_close(dbinfo.env);
+	dbinfo.env = NULL;
 
 	return;
 }
@@ -0,0 +1,389 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/flatmap.h>               // for bitc_flatmap, etc
+#include <bitc/crypto/prng.h>           // for prng_get_random_bytes
+
+#include <assert.h>                     // for assert
+#include <stdlib.h>                     // for calloc, free, malloc
+#include <string.h>                     // for memcpy, memset, memcmp
+
+#if defined(__SSE2__)
+#include <emmintrin.h>                  // for _mm_movemask_epi8, etc
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>                   // for vceqq_u8, etc
+#endif
+
+#define FM_ALIGN8(n)	(((n) + 7U) & ~7U)
+
+/*
+ * Group matching: a bitmask with FM_LANE_BITS bits per control byte,
+ * set where the byte equals the probe value.
+ */
+#if defined(__SSE2__)
+
+#define FM_LANE_BITS	1
+
+static inline uint64_t fm_group_match(const uint8_t *ctrl, uint8_t v)
+{
+	__m128i g = _mm_loadu_si128((const __m128i *) ctrl);
+	return (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(v)));
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#define FM_LANE_BITS	4
+
+static inline uint64_t fm_group_match(const uint8_t *ctrl, uint8_t v)
+{
+	uint8x16_t eq = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(v));
+	uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(nib), 0);
+}
+
+#else
+
+#define FM_LANE_BITS	1
+
+static inline uint64_t fm_group_match(const uint8_t *ctrl, uint8_t v)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < BITC_FM_GROUP; i++)
+		if (ctrl[i] == v)
+			mask |= 1ULL << i;
+	return mask;
+}
+
+#endif
+
+static inline unsigned int fm_mask_first(uint64_t mask)
+{
+	return __builtin_ctzll(mask) / FM_LANE_BITS;
+}
+
+static inline uint64_t fm_mask_next(uint64_t mask)
+{
+	unsigned int lane = fm_mask_first(mask);
+	return mask & ~(((1ULL << FM_LANE_BITS) - 1) << (lane * FM_LANE_BITS));
+}
+
+static inline uint64_t fm_hash(const struct bitc_flatmap *fm, const uint8_t *key)
+{
+	uint64_t h = fm->salt, w;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= fm->key_len; i += 8) {
+		memcpy(&w, key + i, sizeof(w));
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 32;
+	}
+	for (; i < fm->key_len; i += 4) {
+		uint32_t w32 = 0;
+		memcpy(&w32, key + i, fm->key_len - i < 4 ? fm->key_len - i : 4);
+		h = (h ^ w32) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 32;
+	}
+
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint8_t fm_tag(uint64_t hash)
+{
+	return hash & 0x7f;
+}
+
+static inline size_t fm_home(const struct bitc_flatmap *fm, uint64_t hash)
+{
+	return (hash >> 7) & (fm->cap - 1);
+}
+
+static inline uint8_t *fm_slot(const struct bitc_flatmap *fm, size_t idx)
+{
+	return fm->slots + idx * fm->slot_len;
+}
+
+static inline bool fm_key_equal(const struct bitc_flatmap *fm,
+				const uint8_t *a, const uint8_t *b)
+{
+	/* constant sizes let the compiler inline the common cases */
+	switch (fm->key_len) {
+	case sizeof(bu256_t):
+		return memcmp(a, b, sizeof(bu256_t)) == 0;
+	case sizeof(bu160_t):
+		return memcmp(a, b, sizeof(bu160_t)) == 0;
+	default:
+		return memcmp(a, b, fm->key_len) == 0;
+	}
+}
+
+static inline void fm_set_ctrl(struct bitc_flatmap *fm, size_t idx, uint8_t v)
+{
+	fm->ctrl[idx] = v;
+
+	/* the first group is mirrored past the end, for wrapping loads */
+	if (idx < BITC_FM_GROUP)
+		fm->ctrl[fm->cap + idx] = v;
+}
+
+static inline size_t fm_max_load(size_t cap)
+{
+	return cap - cap / 8;
+}
+
+static bool fm_alloc(struct bitc_flatmap *fm, size_t cap)
+{
+	uint8_t *ctrl = malloc(cap + BITC_FM_GROUP);
+	uint8_t *slots = malloc(cap * fm->slot_len);
+
+	if (!ctrl || !slots) {
+		free(ctrl);
+		free(slots);
+		return false;
+	}
+
+	memset(ctrl, BITC_FM_EMPTY, cap + BITC_FM_GROUP);
+
+	fm->ctrl = ctrl;
+	fm->slots = slots;
+	fm->cap = cap;
+	fm->size = 0;
+	fm->growth_left = fm_max_load(cap);
+	return true;
+}
+
+struct bitc_flatmap *bitc_flatmap_new(unsigned int key_len,
+				      unsigned int val_len)
+{
+	assert(key_len > 0);
+
+	struct bitc_flatmap *fm = calloc(1, sizeof(*fm));
+	if (!fm)
+		return NULL;
+
+	fm->key_len = key_len;
+	fm->val_len = val_len;
+	fm->val_off = FM_ALIGN8(key_len);
+	fm->slot_len = FM_ALIGN8(fm->val_off + val_len);
+
+	prng_get_random_bytes((uint8_t *) &fm->salt, sizeof(fm->salt));
+
+	if (!fm_alloc(fm, BITC_FM_MIN_CAP)) {
+		free(fm);
+		return NULL;
+	}
+
+	return fm;
+}
+
+void bitc_flatmap_free(struct bitc_flatmap *fm)
+{
+	if (!fm)
+		return;
+
+	free(fm->ctrl);
+	free(fm->slots);
+
+	memset(fm, 0, sizeof(*fm));
+	free(fm);
+}
+
+void bitc_flatmap_clear(struct bitc_flatmap *fm)
+{
+	memset(fm->ctrl, BITC_FM_EMPTY, fm->cap + BITC_FM_GROUP);
+	fm->size = 0;
+	fm->growth_left = fm_max_load(fm->cap);
+}
+
+/* slot index of key, or fm->cap if absent */
+static size_t fm_find(const struct bitc_flatmap *fm, const uint8_t *key,
+		      uint64_t hash)
+{
+	size_t mask = fm->cap - 1;
+	size_t pos = fm_home(fm, hash);
+	uint8_t tag = fm_tag(hash);
+
+	for (;;) {
+		uint64_t m = fm_group_match(fm->ctrl + pos, tag);
+
+		for (; m; m = fm_mask_next(m)) {
+			size_t idx = (pos + fm_mask_first(m)) & mask;
+			if (fm_key_equal(fm, fm_slot(fm, idx), key))
+				return idx;
+		}
+
+		/* an entry never lies past a free slot on its probe path */
+		if (fm_group_match(fm->ctrl + pos, BITC_FM_EMPTY))
+			return fm->cap;
+
+		pos = (pos + BITC_FM_GROUP) & mask;
+	}
+}
+
+/* first free slot on the probe path of hash */
+static size_t fm_find_free(const struct bitc_flatmap *fm, uint64_t hash)
+{
+	size_t mask = fm->cap - 1;
+	size_t pos = fm_home(fm, hash);
+
+	for (;;) {
+		uint64_t m = fm_group_match(fm->ctrl + pos, BITC_FM_EMPTY);
+		if (m)
+			return (pos + fm_mask_first(m)) & mask;
+
+		pos = (pos + BITC_FM_GROUP) & mask;
+	}
+}
+
+static bool fm_rehash(struct bitc_flatmap *fm, size_t new_cap)
+{
+	uint8_t *old_ctrl = fm->ctrl;
+	uint8_t *old_slots = fm->slots;
+	size_t old_cap = fm->cap;
+	size_t old_size = fm->size;
+	size_t i;
+
+	if (!fm_alloc(fm, new_cap))
+		return false;
+
+	for (i = 0; i < old_cap; i++) {
+		if (old_ctrl[i] == BITC_FM_EMPTY)
+			continue;
+
+		const uint8_t *slot = old_slots + i * fm->slot_len;
+		uint64_t hash = fm_hash(fm, slot);
+		size_t idx = fm_find_free(fm, hash);
+
+		fm_set_ctrl(fm, idx, fm_tag(hash));
+		memcpy(fm_slot(fm, idx), slot, fm->slot_len);
+	}
+
+	fm->size = old_size;
+	fm->growth_left -= old_size;
+
+	free(old_ctrl);
+	free(old_slots);
+	return true;
+}
+
+bool bitc_flatmap_reserve(struct bitc_flatmap *fm, size_t n)
+{
+	size_t cap = fm->cap;
+
+	while (fm_max_load(cap) < n)
+		cap *= 2;
+
+	if (cap == fm->cap)
+		return true;
+
+	return fm_rehash(fm, cap);
+}
+
+void *bitc_flatmap_get(const struct bitc_flatmap *fm, const void *key)
+{
+	size_t idx = fm_find(fm, key, fm_hash(fm, key));
+	if (idx == fm->cap)
+		return NULL;
+
+	return fm_slot(fm, idx) + fm->val_off;
+}
+
+void *bitc_flatmap_insert(struct bitc_flatmap *fm, const void *key,
+			  bool *inserted)
+{
+	uint64_t hash = fm_hash(fm, key);
+	size_t idx = fm_find(fm, key, hash);
+
+	if (idx != fm->cap) {
+		if (inserted)
+			*inserted = false;
+		return fm_slot(fm, idx) + fm->val_off;
+	}
+
+	if (fm->growth_left == 0 && !fm_rehash(fm, fm->cap * 2))
+		return NULL;
+
+	idx = fm_find_free(fm, hash);
+	fm_set_ctrl(fm, idx, fm_tag(hash));
+	fm->size++;
+	fm->growth_left--;
+
+	uint8_t *slot = fm_slot(fm, idx);
+	memcpy(slot, key, fm->key_len);
+	memset(slot + fm->key_len, 0, fm->slot_len - fm->key_len);
+
+	if (inserted)
+		*inserted = true;
+	return slot + fm->val_off;
+}
+
+bool bitc_flatmap_put(struct bitc_flatmap *fm, const void *key,
+		      const void *val)
+{
+	void *slot_val = bitc_flatmap_insert(fm, key, NULL);
+	if (!slot_val)
+		return false;
+
+	if (fm->val_len)
+		memcpy(slot_val, val, fm->val_len);
+	return true;
+}
+
+bool bitc_flatmap_del(struct bitc_flatmap *fm, const void *key,
+		      void *val_out)
+{
+	size_t mask = fm->cap - 1;
+	size_t i = fm_find(fm, key, fm_hash(fm, key));
+	size_t j;
+
+	if (i == fm->cap)
+		return false;
+
+	if (val_out && fm->val_len)
+		memcpy(val_out, fm_slot(fm, i) + fm->val_off, fm->val_len);
+
+	/*
+	 * Backward-shift deletion: walk the run following the hole and
+	 * pull back every entry whose home position does not lie
+	 * (cyclically) between the hole and its current slot, so probe
+	 * paths stay unbroken without leaving a tombstone.
+	 */
+	for (j = (i + 1) & mask; fm->ctrl[j] != BITC_FM_EMPTY;
+	     j = (j + 1) & mask) {
+		size_t home = fm_home(fm, fm_hash(fm, fm_slot(fm, j)));
+		bool stays = (i <= j) ? (i < home && home <= j)
+				      : (i < home || home <= j);
+		if (stays)
+			continue;
+
+		fm_set_ctrl(fm, i, fm->ctrl[j]);
+		memcpy(fm_slot(fm, i), fm_slot(fm, j), fm->slot_len);
+		i = j;
+	}
+
+	fm_set_ctrl(fm, i, BITC_FM_EMPTY);
+	fm->size--;
+	fm->growth_left++;
+	return true;
+}
+
+void bitc_flatmap_iter(const struct bitc_flatmap *fm, bitc_kvu_func f,
+		       void *priv)
+{
+	size_t i;
+
+	for (i = 0; i < fm->cap; i++) {
+		if (fm->ctrl[i] == BITC_FM_EMPTY)
+			continue;
+
+		uint8_t *slot = fm_slot(fm, i);
+		f(slot, slot + fm->val_off, priv);
+	}
+}
@@ -11,38 +11,54 @@
 #include <lax_der_parsing.c>
 #include <lax_der_privatekey_parsing.c>  // for ec_privkey_export_der, etc
 
+#include <pthread.h>                    // for pthread_mutex_lock, etc
 #include <string.h>                     // for NULL, memcpy, memset
 
+/* created once and then only read: secp256k1 allows concurrent use of
+ * a context for everything but randomization, which happens here
+ */
 static secp256k1_context *s_context = NULL;
+static pthread_mutex_t s_context_lock = PTHREAD_MUTEX_INITIALIZER;
+
 secp256k1_context *get_secp256k1_context()
 {
+	secp256k1_context *ctx = __atomic_load_n(&s_context, __ATOMIC_ACQUIRE);
+	if (ctx)
+		return ctx;
+
+	pthread_mutex_lock(&s_context_lock);
+
 	if (!s_context) {
-		secp256k1_context *ctx = secp256k1_context_create(
+		ctx = secp256k1_context_create(
 			SECP256K1_CONTEXT_VERIFY | SECP256K1_CONTEXT_SIGN);
 
-		if (!ctx) {
-			return NULL;
-		}
+		if (!ctx)
+			goto out;
 
 		uint8_t seed[32];
 		if ((prng_get_random_bytes(seed, sizeof(seed)) < 0) ||
 			!secp256k1_context_randomize(ctx, seed)) {
 			secp256k1_context_destroy(ctx);
-			return NULL;
+			goto out;
 		}
 
-		s_context = ctx;
+		__atomic_store_n(&s_context, ctx, __ATOMIC_RELEASE);
 	}
 
-	return s_context;
+out:
+	ctx = s_context;
+	pthread_mutex_unlock(&s_context_lock);
+	return ctx;
 }
 
 void bitc_key_static_shutdown()
 {
+	pthread_mutex_lock(&s_context_lock);
 	if (s_context) {
 		secp256k1_context_destroy(s_context);
 		s_context = NULL;
 	}
+	pthread_mutex_unlock(&s_context_lock);
 }
 
 void bitc_key_init(struct bitc_key *key)
@@ -243,25 +259,44 @@ bool bitc_sign(const struct bitc_key *key, const void *data, size_t data_len,
 	return true;
 }
 
-bool bitc_verify(const struct bitc_key *key, const void *data, size_t data_len,
-	       const void *sig_, size_t sig_len)
+bool bitc_sig_parse(secp256k1_ecdsa_signature *sig, const void *sig_,
+		    size_t sig_len)
 {
-	if (32 != data_len) {
+	secp256k1_context *ctx = get_secp256k1_context();
+	if (!ctx) {
 		return false;
 	}
 
-	secp256k1_ecdsa_signature sig;
+	if (!ecdsa_signature_parse_der_lax(ctx, sig, sig_, sig_len)) {
+		return false;
+	}
+
+	secp256k1_ecdsa_signature_normalize(ctx, sig, sig);
+	return true;
+}
+
+bool bitc_verify_parsed(const struct bitc_key *key, const void *data32,
+			const secp256k1_ecdsa_signature *sig)
+{
 	secp256k1_context *ctx = get_secp256k1_context();
 	if (!ctx) {
 		return false;
 	}
 
-	if (ecdsa_signature_parse_der_lax(ctx, &sig, sig_, sig_len)) {
-		secp256k1_ecdsa_signature_normalize(ctx, &sig, &sig);
-		return secp256k1_ecdsa_verify(ctx, &sig, data, &key->pubkey);
+	return secp256k1_ecdsa_verify(ctx, sig, data32, &key->pubkey);
+}
+
+bool bitc_verify(const struct bitc_key *key, const void *data, size_t data_len,
+	       const void *sig_, size_t sig_len)
+{
+	if (32 != data_len) {
+		return false;
 	}
 
-	return false;
+	secp256k1_ecdsa_signature sig;
+
+	return bitc_sig_parse(&sig, sig_, sig_len) &&
+	       bitc_verify_parsed(key, data, &sig);
 }
 
 bool bitc_key_add_secret(struct bitc_key *out,
@@ -43,30 +43,36 @@ bool message_valid(const struct p2p_message *msg)
 	return true;
 }
 
-cstring *message_str(const unsigned char netmagic[4],
-		     const char *command_,
-		     const void *data, uint32_t data_len)
+static void message_hdr_fill(unsigned char *hdr,
+			     const unsigned char netmagic[4],
+			     const char *command_,
+			     const void *data, uint32_t data_len)
 {
-	cstring *s = cstr_new_sz(P2P_HDR_SZ + data_len);
-
 	/* network identifier (magic number) */
-	cstr_append_buf(s, netmagic, 4);
+	memcpy(hdr, netmagic, 4);
 
 	/* command string */
 	char command[12] = {};
 	strncpy(command, command_, 12);
-	cstr_append_buf(s, command, 12);
+	memcpy(hdr + 4, command, 12);
 
 	/* data length */
 	uint32_t data_len_le = htole32(data_len);
-	cstr_append_buf(s, &data_len_le, 4);
+	memcpy(hdr + 16, &data_len_le, 4);
 
 	/* data checksum */
-	unsigned char md32[4];
+	bu_Hash4(hdr + 20, data, data_len);
+}
 
-	bu_Hash4(md32, data, data_len);
+cstring *message_str(const unsigned char netmagic[4],
+		     const char *command_,
+		     const void *data, uint32_t data_len)
+{
+	cstring *s = cstr_new_sz(P2P_HDR_SZ + data_len);
+	unsigned char hdr[P2P_HDR_SZ];
 
-	cstr_append_buf(s, &md32[0], 4);
+	message_hdr_fill(hdr, netmagic, command_, data, data_len);
+	cstr_append_buf(s, hdr, sizeof(hdr));
 
 	/* data payload */
 	if (data_len > 0)
@@ -75,6 +81,29 @@ cstring *message_str(const unsigned char netmagic[4],
 	return s;
 }
 
+struct p2p_msgbuf *p2p_msgbuf_new(const unsigned char netmagic[4],
+				  const char *command,
+				  const void *data, uint32_t data_len)
+{
+	struct p2p_msgbuf *mb = malloc(sizeof(*mb) + P2P_HDR_SZ + data_len);
+	if (!mb)
+		return NULL;
+
+	mb->refs = 1;
+	mb->len = P2P_HDR_SZ + data_len;
+	message_hdr_fill(mb->data, netmagic, command, data, data_len);
+	if (data_len > 0)
+		memcpy(mb->data + P2P_HDR_SZ, data, data_len);
+
+	return mb;
+}
+
+void p2p_msgbuf_unref(struct p2p_msgbuf *mb)
+{
+	if (mb && __atomic_sub_fetch(&mb->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(mb);
+}
+
 bool deser_msg_addr(unsigned int protover, struct msg_addr *ma,
 		    struct const_buffer *buf)
 {
@@ -166,6 +195,7 @@ bool deser_msg_headers(struct msg_headers *mh, struct const_buffer *buf)
 
 	uint32_t vlen;
 	if (!deser_varlen(&vlen, buf)) return false;
+	if (vlen > MAX_HEADERS_RESULTS) return false;
 
 	mh->headers = parr_new(vlen, bitc_block_freep);
 
@@ -15,6 +15,7 @@
 #include <bitc/hashtab.h>              // for bitc_hashtab_size
 #include <bitc/log.h>                  // for log_info, log_debug, etc
 #include <bitc/parr.h>                 // for parr, parr_idx, parr_add, etc
+#include <bitc/spscq.h>                // for bitc_spscq_push, etc
 #include <bitc/util.h>                 // for MIN
 
 #include <event.h>                     // for event_del, event_add, etc
@@ -22,6 +23,7 @@
 #include <assert.h>                     // for assert
 #include <errno.h>                      // for errno, EAGAIN, EWOULDBLOCK, etc
 #include <fcntl.h>                      // for fcntl
+#include <pthread.h>                    // for pthread_create, etc
 #include <signal.h>                     // for kill, SIGTERM
 #include <stddef.h>                     // for size_t
 #include <stdlib.h>                     // for free, calloc, malloc
@@ -36,73 +38,123 @@
 #include <netinet/in.h>                 // for sockaddr_in, sockaddr_in6, etc
 #include <poll.h>                       // for poll, POLLIN, pollfd
 #include <sys/socket.h>                 // for AF_INET, AF_INET6, connect, etc
-#include <sys/uio.h>                    // for iovec, writev
+#include <sys/uio.h>                    // for iovec, readv, writev
 #endif
 
+/*
+ * With nc_loops_start, each loop thread owns the sockets of its
+ * connections.  It sends nci->eb struct nc_loop_msg entries through
+ * rx_q, which it alone pushes: framed messages, and the end of a
+ * connect or of the connection itself.  nci->eb sends commands back
+ * through the locked cmd list.  A connection is freed only by its
+ * loop, on NC_LOOP_FREE.  That command is queued once NC_LOOP_DEAD
+ * has shown that nothing more about it is on the way.
+ */
+struct nc_loop {
+	struct net_child_info	*nci;
+	pthread_t		thread;
+	struct event_base	*eb;
+	bool			stop;		/* (atomic) */
+
+	struct bitc_spscq	rx_q;		/* of struct nc_loop_msg */
+	pthread_mutex_t		rx_lock;
+	pthread_cond_t		rx_cv;		/* rx_q drained, or stop */
+	bool			rx_blocked;	/* under rx_lock */
+
+	pthread_mutex_t		cmd_lock;
+	struct nc_loop_cmd	*cmd_head;
+	struct nc_loop_cmd	*cmd_tail;
+	int			cmd_pipe[2];
+	struct event		*cmd_ev;
+};
+
+enum nc_loop_evt {
+	NC_LOOP_MSG,
+	NC_LOOP_CONNECTED,
+	NC_LOOP_DEAD,
+};
+
+struct nc_loop_msg {
+	struct nc_conn		*conn;
+	enum nc_loop_evt	type;
+	struct p2p_message	msg;		/* data may point to body */
+	unsigned char		body[];
+};
+
+enum nc_loop_op {
+	NC_LOOP_ADD,
+	NC_LOOP_SEND,
+	NC_LOOP_KILL,
+	NC_LOOP_FREE,
+};
+
+struct nc_loop_cmd {
+	struct nc_loop_cmd	*next;
+	struct nc_conn		*conn;
+	enum nc_loop_op		op;
+	struct p2p_msgbuf	*mb;		/* for NC_LOOP_SEND */
+};
+
 static void nc_conn_kill(struct nc_conn *conn);
+static void nc_conn_close(struct nc_conn *conn);
 static bool nc_conn_read_enable(struct nc_conn *conn);
 static bool nc_conn_read_disable(struct nc_conn *conn);
 static bool nc_conn_write_enable(struct nc_conn *conn);
 static bool nc_conn_write_disable(struct nc_conn *conn);
+static bool nc_loop_cmd(struct nc_loop *loop, struct nc_conn *conn,
+			enum nc_loop_op op, struct p2p_msgbuf *mb);
+static bool nc_loop_post(struct nc_loop *loop, struct nc_conn *conn,
+			 enum nc_loop_evt type, struct p2p_message *msg,
+			 bool owned);
 
 void net_set(struct net_settings *_net_settings)
 {
 	net_settings = _net_settings;
 }
 
-static void nc_conn_build_iov(clist *write_q, unsigned int partial,
-			      struct iovec **iov_, unsigned int *iov_len_)
+static unsigned int nc_conn_build_iov(struct nc_conn *conn)
 {
-	*iov_ = NULL;
-	*iov_len_ = 0;
-
-	unsigned int i, iov_len = clist_length(write_q);
-	struct iovec *iov = calloc(iov_len, sizeof(struct iovec));
-
-	clist *tmp = write_q;
-
-	i = 0;
-	while (tmp) {
-		struct buffer *buf = tmp->data;
-
-		iov[i].iov_base = buf->p;
-		iov[i].iov_len = buf->len;
+	struct iovec *iov = conn->write_iov;
+	unsigned int i = 0;
+	clist *tmp;
 
-		if (i == 0) {
-			iov[0].iov_base += partial;
-			iov[0].iov_len -= partial;
-		}
+	for (tmp = conn->write_q; tmp && i < NC_WRITE_IOV; tmp = tmp->next) {
+		struct p2p_msgbuf *mb = tmp->data;
 
-		tmp = tmp->next;
+		iov[i].iov_base = mb->data;
+		iov[i].iov_len = mb->len;
 		i++;
 	}
 
-	*iov_ = iov;
-	*iov_len_ = iov_len;
+	if (i) {
+		iov[0].iov_base += conn->write_partial;
+		iov[0].iov_len -= conn->write_partial;
+	}
+
+	return i;
 }
 
 static void nc_conn_written(struct nc_conn *conn, size_t bytes)
 {
 	while (bytes > 0) {
 		clist *tmp;
-		struct buffer *buf;
+		struct p2p_msgbuf *mb;
 		unsigned int left;
 
 		tmp = conn->write_q;
-		buf = tmp->data;
-		left = buf->len - conn->write_partial;
+		mb = tmp->data;
+		left = mb->len - conn->write_partial;
 
-		/* buffer fully written; free */
+		/* message fully written; drop our reference */
 		if (bytes >= left) {
-			free(buf->p);
-			free(buf);
+			p2p_msgbuf_unref(mb);
 			conn->write_partial = 0;
 			conn->write_q = clist_delete(tmp, tmp);
 
 			bytes -= left;
 		}
 
-		/* buffer partially written; store state */
+		/* message partially written; store state */
 		else {
 			conn->write_partial += bytes;
 			break;
@@ -113,16 +165,12 @@ static void nc_conn_written(struct nc_conn *conn, size_t bytes)
 static void nc_conn_write_evt(int fd, short events, void *priv)
 {
 	struct nc_conn *conn = priv;
-	struct iovec *iov = NULL;
-	unsigned int iov_len = 0;
 
 	/* build list of outgoing data buffers */
-	nc_conn_build_iov(conn->write_q, conn->write_partial, &iov, &iov_len);
+	unsigned int iov_len = nc_conn_build_iov(conn);
 
 	/* send data to network */
-	ssize_t wrc = writev(conn->fd, iov, iov_len);
-
-	free(iov);
+	ssize_t wrc = writev(conn->fd, conn->write_iov, iov_len);
 
 	if (wrc < 0) {
 		if (errno != EAGAIN && errno != EWOULDBLOCK)
@@ -145,50 +193,33 @@ err_out:
 	nc_conn_kill(conn);
 }
 
-static bool nc_conn_send(struct nc_conn *conn, const char *command,
-			 const void *data, size_t data_len)
+static bool nc_conn_write_msg(struct nc_conn *conn, struct p2p_msgbuf *mb)
 {
-	/* build wire message */
-	cstring *msg = message_str(conn->nci->chain->netmagic, command, data, data_len);
-	if (!msg)
-		return false;
-
-	/* buffer now owns message data */
-	struct buffer *buf = calloc(1, sizeof(struct buffer));
-	buf->p = msg->str;
-	buf->len = msg->len;
-
-	cstr_free(msg, false);
-
 	/* if write q exists, write_evt will handle output */
 	if (conn->write_q) {
-		conn->write_q = clist_append(conn->write_q, buf);
+		conn->write_q = clist_append(conn->write_q,
+					     p2p_msgbuf_ref(mb));
 		return true;
 	}
 
 	/* attempt optimistic write */
-	ssize_t wrc = write(conn->fd, buf->p, buf->len);
+	ssize_t wrc = write(conn->fd, mb->data, mb->len);
 
 	if (wrc < 0) {
-		if (errno != EAGAIN && errno != EWOULDBLOCK) {
-			free(buf->p);
-			free(buf);
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
 			return false;
-		}
 
-		conn->write_q = clist_append(conn->write_q, buf);
+		conn->write_q = clist_append(conn->write_q,
+					     p2p_msgbuf_ref(mb));
 		goto out_wrstart;
 	}
 
 	/* message fully sent */
-	if (wrc == buf->len) {
-		free(buf->p);
-		free(buf);
+	if (wrc == mb->len)
 		return true;
-	}
 
 	/* message partially sent; pause read; poll for writable */
-	conn->write_q = clist_append(conn->write_q, buf);
+	conn->write_q = clist_append(conn->write_q, p2p_msgbuf_ref(mb));
 	conn->write_partial = wrc;
 
 out_wrstart:
@@ -197,6 +228,614 @@ out_wrstart:
 	return true;
 }
 
+/* queue mb to conn, which takes its own reference */
+bool nc_conn_send_msg(struct nc_conn *conn, struct p2p_msgbuf *mb)
+{
+	if (!conn->loop)
+		return nc_conn_write_msg(conn, mb);
+
+	if (conn->dead)
+		return false;
+
+	return nc_loop_cmd(conn->loop, conn, NC_LOOP_SEND,
+			   p2p_msgbuf_ref(mb));
+}
+
+static bool nc_conn_send(struct nc_conn *conn, const char *command,
+			 const void *data, size_t data_len)
+{
+	/* build wire message */
+	struct p2p_msgbuf *mb = p2p_msgbuf_new(conn->nci->chain->netmagic,
+					       command, data, data_len);
+	if (!mb)
+		return false;
+
+	bool rc = nc_conn_send_msg(conn, mb);
+
+	p2p_msgbuf_unref(mb);
+	return rc;
+}
+
+/* queue mb to every peer past the version handshake */
+void nc_conns_send_all(struct net_child_info *nci, struct p2p_msgbuf *mb)
+{
+	unsigned int i;
+	for (i = 0; i < nci->conns->len; i++) {
+		struct nc_conn *conn = parr_idx(nci->conns, i);
+
+		if (conn->dead || !conn->seen_verack)
+			continue;
+
+		if (!nc_conn_send_msg(conn, mb))
+			nc_conn_close(conn);
+	}
+}
+
+/*
+ * headers-first sync; see nc_hdrs_start
+ */
+
+struct nc_dlblock {
+	struct blkinfo		*bi;		/* in nci->hdr_db */
+	struct nc_conn		*conn;		/* requested from, if any */
+	struct buffer		*data;		/* arrived ahead of its parent */
+	time_t			requested;
+};
+
+static void nc_dlblock_free(void *p)
+{
+	struct nc_dlblock *dl = p;
+
+	buffer_freep(dl->data);
+	free(dl);
+}
+
+static struct blkinfo *nc_hdr_add(struct chaindb *db,
+				  const struct bitc_block *hdr)
+{
+	struct blkinfo *bi = bi_new();
+	struct chaindb_reorg reorg;
+
+	bitc_block_copy_hdr(&bi->hdr, hdr);
+	bitc_block_calc_sha256(&bi->hdr);
+	bu256_copy(&bi->hash, &bi->hdr.sha256);
+
+	if (!chaindb_add(db, bi, &reorg)) {
+		bi_free(bi);
+		return NULL;
+	}
+
+	return bi;
+}
+
+/* make hdr_chain follow the best header chain, from where they part */
+static bool nc_hdr_chain_update(struct net_child_info *nci)
+{
+	struct blkinfo *bi = nci->hdr_db->best_chain;
+
+	if (!parr_resize(nci->hdr_chain, bi->height + 1))
+		return false;
+
+	while (bi && parr_idx(nci->hdr_chain, bi->height) != bi) {
+		parr_idx(nci->hdr_chain, bi->height) = bi;
+		bi = bi->prev;
+	}
+
+	return true;
+}
+
+static bool nc_conn_getheaders(struct nc_conn *conn, struct blkinfo *from)
+{
+	struct msg_getblocks gh;
+	msg_getblocks_init(&gh);
+	chaindb_locator(conn->nci->hdr_db, from, &gh.locator);
+	cstring *s = ser_msg_getblocks(&gh);
+
+	bool rc = nc_conn_send(conn, "getheaders", s->str, s->len);
+
+	cstr_free(s, true);
+	msg_getblocks_free(&gh);
+
+	return rc;
+}
+
+/* unless already at it, fetch headers from a peer claiming more */
+static void nc_hdrs_next(struct net_child_info *nci)
+{
+	unsigned int i;
+
+	if (nci->hdr_conn)
+		return;
+
+	for (i = 0; i < nci->conns->len; i++) {
+		struct nc_conn *conn = parr_idx(nci->conns, i);
+
+		if (!conn->seen_verack || conn->dead ||
+		    conn->best_height <= nci->hdr_db->best_chain->height)
+			continue;
+
+		if (!nc_conn_getheaders(conn, NULL)) {
+			nc_conn_close(conn);
+			continue;
+		}
+
+		nci->hdr_conn = conn;
+		nci->hdr_requested = time(NULL);
+		return;
+	}
+}
+
+static void nc_dl_release(void *key, void *value, void *priv)
+{
+	struct nc_dlblock *dl = value;
+
+	if (dl->conn == priv)
+		dl->conn = NULL;
+}
+
+/* conn is going away; others may fetch what it was asked for */
+static void nc_hdrs_conn_gone(struct net_child_info *nci,
+			      struct nc_conn *conn)
+{
+	if (!nci->hdr_db)
+		return;
+
+	if (conn->blocks_in_flight)
+		bitc_hashtab_iter(nci->dl_blocks, nc_dl_release, conn);
+	if (nci->hdr_conn == conn)
+		nci->hdr_conn = NULL;
+}
+
+static unsigned int nc_dl_window(const struct net_child_info *nci)
+{
+	return nci->dl_window ? nci->dl_window : NC_DL_WINDOW;
+}
+
+/* dl_per_peer, scaled down by how much slower conn is than the best */
+static unsigned int nc_dl_limit(const struct net_child_info *nci,
+				const struct nc_conn *conn)
+{
+	uint64_t limit = nci->dl_per_peer ? nci->dl_per_peer : NC_DL_PER_PEER;
+
+	if (conn->dl_rated && nci->dl_best_rate)
+		limit = limit * conn->dl_rate / nci->dl_best_rate;
+
+	return limit ? limit : 1;
+}
+
+/* index of the peer with room that would deliver the block at height
+ * soonest, other than skip; -1 if none.  Untried peers are taken to be
+ * as fast as the best, and ties go round-robin.
+ */
+static int nc_dl_pick(struct net_child_info *nci, int height,
+		      const struct nc_conn *skip)
+{
+	unsigned int n_conns = nci->conns->len, i;
+	uint64_t best_rate = 0, best_n = 0;
+	int best = -1;
+
+	for (i = 0; i < n_conns; i++) {
+		unsigned int idx = (nci->dl_next_conn + i) % n_conns;
+		struct nc_conn *c = parr_idx(nci->conns, idx);
+		uint64_t rate;
+
+		if (c == skip || !c->seen_verack || c->dead || c->dl_stalled ||
+		    c->best_height < height ||
+		    c->blocks_in_flight >= nc_dl_limit(nci, c))
+			continue;
+
+		rate = c->dl_rated ? c->dl_rate : nci->dl_best_rate;
+		if (!rate)
+			rate = 1;
+
+		/* (in flight + 1) / rate, the smaller the sooner */
+		if (best < 0 ||
+		    (c->blocks_in_flight + 1) * best_rate < best_n * rate) {
+			best = idx;
+			best_n = c->blocks_in_flight + 1;
+			best_rate = rate;
+		}
+	}
+
+	return best;
+}
+
+static void nc_dl_assign(struct nc_dlblock *dl, struct nc_conn *conn,
+			 time_t now)
+{
+	if (!conn->blocks_in_flight)
+		conn->dl_last = now;
+	conn->blocks_in_flight++;
+
+	dl->conn = conn;
+	dl->requested = now;
+}
+
+static void nc_dl_send(struct nc_conn *conn, struct msg_vinv *reqs)
+{
+	if (reqs->invs && reqs->invs->len) {
+		cstring *s = ser_msg_vinv(reqs);
+
+		if (!nc_conn_send(conn, "getdata", s->str, s->len))
+			nc_conn_close(conn);
+
+		cstr_free(s, true);
+	}
+}
+
+/* request window blocks not yet asked for, lowest first, each from
+ * the peer that would deliver it soonest
+ */
+static void nc_dl_schedule(struct net_child_info *nci)
+{
+	struct blkinfo *tip = nci->db->best_chain;
+	unsigned int n_conns = nci->conns->len, i;
+	time_t now = time(NULL);
+	struct msg_vinv *reqs;
+	int height, end;
+
+	if (!tip || !n_conns)
+		return;
+
+	/* our chain can only grow along the best header chain */
+	if (tip->height >= nci->hdr_chain->len ||
+	    parr_idx(nci->hdr_chain, tip->height) !=
+	    chaindb_lookup(nci->hdr_db, &tip->hash)) {
+		if (!nci->dl_forked) {
+			log_error("net: best headers fork below our tip at %d; not fetching blocks",
+				  tip->height);
+		}
+		nci->dl_forked = true;
+		return;
+	}
+	nci->dl_forked = false;
+
+	reqs = calloc(n_conns, sizeof(*reqs));
+	if (!reqs)
+		return;
+
+	end = MIN(nci->hdr_chain->len, tip->height + 1 + nc_dl_window(nci));
+	for (height = tip->height + 1; height < end; height++) {
+		struct blkinfo *bi = parr_idx(nci->hdr_chain, height);
+		struct nc_dlblock *dl = bitc_hashtab_get(nci->dl_blocks,
+							 &bi->hash);
+		int idx;
+
+		if (dl && (dl->conn || dl->data))
+			continue;
+
+		/* later blocks are no more likely to find one */
+		idx = nc_dl_pick(nci, height, NULL);
+		if (idx < 0)
+			break;
+		nci->dl_next_conn = idx + 1;
+
+		if (!dl) {
+			dl = calloc(1, sizeof(*dl));
+			if (!dl)
+				break;
+			dl->bi = bi;
+			bitc_hashtab_put(nci->dl_blocks, &bi->hash, dl);
+		}
+
+		nc_dl_assign(dl, parr_idx(nci->conns, idx), now);
+		msg_vinv_push(&reqs[idx], MSG_BLOCK, &bi->hash);
+	}
+
+	for (i = 0; i < n_conns; i++) {
+		nc_dl_send(parr_idx(nci->conns, i), &reqs[i]);
+		msg_vinv_free(&reqs[i]);
+	}
+
+	free(reqs);
+}
+
+/* if the next block is late and nothing past it can be asked for,
+ * hand all that its peer was asked for to others, and ask it for no
+ * more until it sends a block
+ */
+static void nc_dl_unstall(struct net_child_info *nci, time_t now)
+{
+	struct blkinfo *tip = nci->db->best_chain;
+	int height = tip->height + 1, end, h;
+	struct nc_dlblock *dl = NULL;
+	struct nc_conn *slow;
+
+	end = tip->height + 1 + nc_dl_window(nci);
+	if (end > nci->hdr_chain->len)
+		return;
+
+	for (h = height; h < end; h++) {
+		struct blkinfo *bi = parr_idx(nci->hdr_chain, h);
+		struct nc_dlblock *d = bitc_hashtab_get(nci->dl_blocks,
+							&bi->hash);
+		if (!d || (!d->conn && !d->data))
+			return;
+		if (h == height)
+			dl = d;
+	}
+
+	if (!dl->conn || now - dl->requested < NC_DL_STALL ||
+	    nc_dl_pick(nci, height, dl->conn) < 0)
+		return;
+
+	slow = dl->conn;
+	log_debug("net: %s stalls block %d", slow->addr_str, height);
+
+	bitc_hashtab_iter(nci->dl_blocks, nc_dl_release, slow);
+	slow->blocks_in_flight = 0;
+	slow->dl_stalled = true;
+}
+
+/* measure each peer's throughput, drop those that went quiet, and
+ * keep the window moving
+ */
+static void nc_dl_tick(int fd, short events, void *priv)
+{
+	struct net_child_info *nci = priv;
+	struct timeval tv = { NC_DL_TICK, };
+	time_t now = time(NULL);
+	uint64_t best = 0;
+	unsigned int i;
+
+	for (i = 0; i < nci->conns->len; i++) {
+		struct nc_conn *conn = parr_idx(nci->conns, i);
+		uint64_t rate = conn->dl_bytes / NC_DL_TICK;
+
+		/* idle is not slow; only rate peers we wait on */
+		if (conn->blocks_in_flight || conn->dl_bytes) {
+			conn->dl_rate = conn->dl_rated ?
+				(3 * conn->dl_rate + rate) / 4 : rate;
+			conn->dl_rated = true;
+		}
+		conn->dl_bytes = 0;
+
+		if (conn->dl_rated && conn->dl_rate > best)
+			best = conn->dl_rate;
+
+		if (conn->blocks_in_flight && !conn->dead &&
+		    now - conn->dl_last > NC_DL_TIMEOUT) {
+			log_info("net: %s sent no block in %d secs",
+				 conn->addr_str, NC_DL_TIMEOUT);
+			nc_conn_close(conn);
+		}
+	}
+	nci->dl_best_rate = best;
+
+	/* a header peer that went quiet; don't pick it again */
+	if (nci->hdr_conn && now - nci->hdr_requested > NC_HDRS_TIMEOUT) {
+		struct nc_conn *conn = nci->hdr_conn;
+
+		log_info("net: %s sent no headers in %d secs",
+			 conn->addr_str, NC_HDRS_TIMEOUT);
+		conn->best_height = MIN(conn->best_height,
+					nci->hdr_db->best_chain->height);
+		nci->hdr_conn = NULL;
+		nc_hdrs_next(nci);
+	}
+
+	nc_dl_unstall(nci, now);
+	nc_dl_schedule(nci);
+
+	if (event_add(nci->dl_timer, &tv) != 0) {
+		log_error("net: download timer lost");
+	}
+}
+
+/* pass on, in order, blocks that arrived ahead of their parent */
+static void nc_dl_drain(struct net_child_info *nci)
+{
+	for (;;) {
+		struct blkinfo *tip = nci->db->best_chain;
+		int height = tip->height + 1;
+
+		if (height >= nci->hdr_chain->len)
+			break;
+
+		struct blkinfo *bi = parr_idx(nci->hdr_chain, height);
+		struct nc_dlblock *dl = bitc_hashtab_get(nci->dl_blocks,
+							 &bi->hash);
+		if (!dl || !dl->data ||
+		    !bu256_equal(&bi->hdr.hashPrevBlock, &tip->hash))
+			break;
+
+		struct buffer *data = dl->data;
+		dl->data = NULL;
+		bitc_hashtab_del(nci->dl_blocks, &bi->hash);
+
+		struct bitc_block block;
+		struct const_buffer buf = { data->p, data->len };
+		struct const_buffer ser_data = buf;
+		bitc_block_init(&block);
+
+		/* checked on arrival */
+		bool rc = deser_bitc_block(&block, &buf);
+		if (rc) {
+			bitc_block_calc_sha256(&block);
+			rc = nci->block_process(&block, &ser_data);
+		}
+
+		bitc_block_free(&block);
+		buffer_freep(data);
+
+		if (!rc) {
+			log_info("net: block at height %d rejected", height);
+			break;
+		}
+	}
+}
+
+static bool nc_dl_block(struct nc_conn *conn, struct bitc_block *block,
+			struct const_buffer *buf)
+{
+	struct net_child_info *nci = conn->nci;
+	struct blkinfo *bi = chaindb_lookup(nci->hdr_db, &block->sha256);
+	struct nc_dlblock *dl = NULL;
+	bool rc = true;
+
+	conn->dl_bytes += buf->len;
+	conn->dl_last = time(NULL);
+	conn->dl_stalled = false;
+
+	/* we only ask for blocks whose headers we have */
+	if (!bi)
+		return true;
+
+	dl = bitc_hashtab_get(nci->dl_blocks, &bi->hash);
+	if (dl && dl->conn) {
+		dl->conn->blocks_in_flight--;
+		dl->conn = NULL;
+	}
+
+	/* next on our chain: process now, then any it lets through */
+	if (bi->height < nci->hdr_chain->len &&
+	    parr_idx(nci->hdr_chain, bi->height) == bi &&
+	    bu256_equal(&block->hashPrevBlock,
+			&nci->db->best_chain->hash)) {
+		if (dl)
+			bitc_hashtab_del(nci->dl_blocks, &bi->hash);
+
+		rc = nci->block_process(block, buf);
+		if (rc)
+			nc_dl_drain(nci);
+	}
+
+	/* further ahead: keep it until its parent is in */
+	else if (dl && !dl->data)
+		dl->data = buffer_copy(buf->p, buf->len);
+
+	nc_dl_schedule(nci);
+	return rc;
+}
+
+bool nc_hdrs_start(struct net_child_info *nci, struct chaindb *hdr_db)
+{
+	struct timeval tv = { NC_DL_TICK, };
+	struct blkinfo *tip = nci->db->best_chain, *bi, **chain;
+	int i, n;
+	bool rc;
+
+	if (!tip)
+		return false;
+
+	/* headers start out as the top of the chain we have; a locator
+	 * from there finds where peers' chains part from ours
+	 */
+	n = MIN(tip->height + 1, NC_HDRS_SEED);
+	chain = calloc(n, sizeof(*chain));
+	if (!chain)
+		return false;
+	for (bi = tip, i = n; i > 0; bi = bi->prev)
+		chain[--i] = bi;
+
+	nci->hdr_db = hdr_db;
+	nci->hdr_chain = parr_new(tip->height + 1, NULL);
+	nci->dl_blocks = bitc_hashtab_new_ext(bu256_hash, bu256_equal_,
+					      NULL, nc_dlblock_free);
+	nci->dl_timer = event_new(nci->eb, -1, 0, nc_dl_tick, nci);
+
+	rc = nci->hdr_chain && nci->dl_blocks && nci->dl_timer &&
+	     event_add(nci->dl_timer, &tv) == 0 &&
+	     chaindb_add_root(hdr_db, chain[0]);
+	for (i = 1; rc && i < n; i++)
+		rc = (nc_hdr_add(hdr_db, &chain[i]->hdr) != NULL);
+
+	free(chain);
+
+	if (!rc || !nc_hdr_chain_update(nci)) {
+		log_error("net: headers-first sync init failed");
+		nc_hdrs_stop(nci);
+		return false;
+	}
+
+	log_info("net: headers-first sync from height %d", tip->height);
+	return true;
+}
+
+void nc_hdrs_stop(struct net_child_info *nci)
+{
+	if (nci->dl_timer) {
+		event_del(nci->dl_timer);
+		event_free(nci->dl_timer);
+	}
+	if (nci->dl_blocks)
+		bitc_hashtab_unref(nci->dl_blocks);
+	parr_free(nci->hdr_chain, true);
+
+	nci->hdr_db = NULL;
+	nci->hdr_chain = NULL;
+	nci->hdr_conn = NULL;
+	nci->dl_blocks = NULL;
+	nci->dl_timer = NULL;
+	nci->dl_best_rate = 0;
+	nci->dl_forked = false;
+}
+
+static bool nc_msg_headers(struct nc_conn *conn)
+{
+	struct net_child_info *nci = conn->nci;
+	struct const_buffer buf = { conn->msg.data, conn->msg.hdr.data_len };
+	struct msg_headers mh;
+	struct blkinfo *last = NULL;
+	bool rc = false;
+	unsigned int i;
+
+	/* only asked for in headers-first mode */
+	if (!nci->hdr_db)
+		return true;
+
+	msg_headers_init(&mh);
+
+	if (!deser_msg_headers(&mh, &buf))
+		goto out;
+
+	log_debug("net: %s headers (%zu sz)",
+		conn->addr_str, mh.headers->len);
+
+	for (i = 0; i < mh.headers->len; i++) {
+		struct bitc_block *hdr = parr_idx(mh.headers, i);
+
+		if (!bitc_block_valid_hdr(hdr)) {
+			log_info("net: %s invalid header",
+				conn->addr_str);
+			goto out;
+		}
+
+		last = chaindb_lookup(nci->hdr_db, &hdr->sha256);
+		if (!last && !(last = nc_hdr_add(nci->hdr_db, hdr))) {
+			log_info("net: %s header does not connect",
+				conn->addr_str);
+			goto out;
+		}
+	}
+
+	if (last && last->height > conn->best_height)
+		conn->best_height = last->height;
+	if (!nc_hdr_chain_update(nci))
+		goto out;
+
+	/* a full batch means there are more */
+	if (mh.headers->len == MAX_HEADERS_RESULTS) {
+		if (!nc_conn_getheaders(conn, last))
+			goto out;
+		if (nci->hdr_conn == conn)
+			nci->hdr_requested = time(NULL);
+	} else if (nci->hdr_conn == conn) {
+		/* it has no more; don't pick it again */
+		conn->best_height = MIN(conn->best_height,
+					nci->hdr_db->best_chain->height);
+		nci->hdr_conn = NULL;
+		nc_hdrs_next(nci);
+	}
+
+	nc_dl_schedule(nci);
+	rc = true;
+
+out:
+	msg_headers_free(&mh);
+	return rc;
+}
+
 static bool nc_msg_version(struct nc_conn *conn)
 {
 	if (conn->seen_version)
@@ -233,6 +872,7 @@ static bool nc_msg_version(struct nc_conn *conn)
 		goto out;
 
 	conn->protover = MIN(mv.nVersion, PROTOCOL_VERSION);
+	conn->best_height = mv.nStartingHeight;
 
 	/* acknowledge version receipt */
 	if (!nc_conn_send(conn, "verack", NULL, 0))
@@ -312,6 +952,13 @@ static bool nc_msg_verack(struct nc_conn *conn)
 	    (!nc_conn_send(conn, "getaddr", NULL, 0)))
 		return false;
 
+	/* request headers, then blocks, as peers allow */
+	if (conn->nci->hdr_db) {
+		nc_hdrs_next(conn->nci);
+		nc_dl_schedule(conn->nci);
+		return true;
+	}
+
 	/* request blocks */
 	bool rc = true;
 	time_t now = time(NULL);
@@ -369,12 +1016,24 @@ static bool nc_msg_inv(struct nc_conn *conn)
 		goto out_ok;
 
 	/* scan incoming inv's for interesting material */
+	struct chaindb *hdr_db = conn->nci->hdr_db;
+	bool want_headers = false;
 	unsigned int i;
 	for (i = 0; i < mv.invs->len; i++) {
 		struct bitc_inv *inv = parr_idx(mv.invs, i);
+		struct blkinfo *bi;
+
 		switch (inv->type) {
 		case MSG_BLOCK:
-			if (conn->nci->inv_block_process(&inv->hash))
+			/* headers-first: new blocks come by their header */
+			if (hdr_db) {
+				bi = chaindb_lookup(hdr_db, &inv->hash);
+				if (!bi)
+					want_headers = true;
+				else if (bi->height > conn->best_height)
+					conn->best_height = bi->height;
+			}
+			else if (conn->nci->inv_block_process(&inv->hash))
 				msg_vinv_push(&mv_out, MSG_BLOCK, &inv->hash);
 			break;
 
@@ -384,6 +1043,11 @@ static bool nc_msg_inv(struct nc_conn *conn)
 		}
 	}
 
+	if (want_headers && !nc_conn_getheaders(conn, NULL))
+		goto out;
+	if (hdr_db)
+		nc_dl_schedule(conn->nci);
+
 	/* send getdata, if they have anything we want */
 	if (mv_out.invs && mv_out.invs->len) {
 		cstring *s = ser_msg_vinv(&mv_out);
@@ -406,11 +1070,12 @@ static bool nc_msg_block(struct nc_conn *conn)
 {
 	struct const_buffer buf = { conn->msg.data, conn->msg.hdr.data_len };
 	struct bitc_block block;
+	struct bitc_block_stats stats;
 	bitc_block_init(&block);
 
 	bool rc = false;
 
-	if (!deser_bitc_block(&block, &buf))
+	if (!deser_bitc_block_stats(&block, &buf, &stats))
 		goto out;
 	bitc_block_calc_sha256(&block);
 	char hexstr[BU256_STRSZ];
@@ -419,7 +1084,7 @@ static bool nc_msg_block(struct nc_conn *conn)
 	log_debug("net: %s block %s",
 			conn->addr_str, hexstr);
 
-	if (!bitc_block_valid(&block)) {
+	if (!bitc_block_valid_stats(&block, &stats)) {
 		log_info("net: %s invalid block %s",
 			conn->addr_str, hexstr);
 		goto out;
@@ -427,6 +1092,11 @@ static bool nc_msg_block(struct nc_conn *conn)
 
     struct const_buffer ser_data = { conn->msg.data, conn->msg.hdr.data_len };
 
+	if (conn->nci->hdr_db) {
+		rc = nc_dl_block(conn, &block, &ser_data);
+		goto out;
+	}
+
     if (!conn->nci->block_process(&block, &ser_data))
     goto out;
 
@@ -482,6 +1152,10 @@ static bool nc_conn_message(struct nc_conn *conn)
 	else if (!strncmp(command, "block", 12))
 		return nc_msg_block(conn);
 
+	/* incoming message: headers */
+	else if (!strncmp(command, "headers", 12))
+		return nc_msg_headers(conn);
+
 	log_debug("net: %s unknown message %s",
 		conn->addr_str,
 		command);
@@ -535,39 +1209,74 @@ static struct nc_conn *nc_conn_new(const struct peer *peer)
 
 	conn->fd = -1;
 
+	conn->rx_buf = malloc(NC_RX_BUF_SZ);
+	conn->write_iov = calloc(NC_WRITE_IOV, sizeof(struct iovec));
+	if (!conn->rx_buf || !conn->write_iov) {
+		free(conn->rx_buf);
+		free(conn->write_iov);
+		free(conn);
+		return NULL;
+	}
+
 	peer_copy(&conn->peer, peer);
 	bn_address_str(conn->addr_str, sizeof(conn->addr_str), conn->peer.addr.ip);
 
 	return conn;
 }
 
+static struct event_base *nc_conn_eb(const struct nc_conn *conn)
+{
+	return conn->loop ? conn->loop->eb : conn->nci->eb;
+}
+
+/* I/O failed; on a loop thread, let go and tell nci->eb */
 static void nc_conn_kill(struct nc_conn *_conn)
 {
 	struct nc_conn *conn = _conn;
 
+	if (conn->loop) {
+		if (conn->loop_dead)
+			return;
+		conn->loop_dead = true;
+
+		nc_conn_read_disable(conn);
+		nc_conn_write_disable(conn);
+		nc_loop_post(conn->loop, conn, NC_LOOP_DEAD, NULL, false);
+		return;
+	}
+
 	assert(conn->dead == false);
 
 	conn->dead = true;
 	event_base_loopbreak(conn->nci->eb);
 }
 
+/* drop conn from nci->eb, e.g. after a bad message */
+static void nc_conn_close(struct nc_conn *conn)
+{
+	if (!conn->loop) {
+		nc_conn_kill(conn);
+		return;
+	}
+
+	if (conn->dead)
+		return;
+	conn->dead = true;
+
+	/* if this fails, the loop still kills it on stop */
+	nc_loop_cmd(conn->loop, conn, NC_LOOP_KILL, NULL);
+}
+
 static void nc_conn_free(struct nc_conn *conn)
 {
 	if (!conn)
 		return;
 
 	if (conn->write_q) {
-		clist *tmp = conn->write_q;
-
-		while (tmp) {
-			struct buffer *buf;
-
-			buf = tmp->data;
-			tmp = tmp->next;
+		clist *tmp;
 
-			free(buf->p);
-			free(buf);
-		}
+		for (tmp = conn->write_q; tmp; tmp = tmp->next)
+			p2p_msgbuf_unref(tmp->data);
 
 		clist_free(conn->write_q);
 	}
@@ -584,7 +1293,9 @@ static void nc_conn_free(struct nc_conn *conn)
 	if (conn->fd >= 0)
 		close(conn->fd);
 
-	free(conn->msg.data);
+	free(conn->rx_msg.data);
+	free(conn->rx_buf);
+	free(conn->write_iov);
 
 	memset(conn, 0, sizeof(*conn));
 	free(conn);
@@ -652,46 +1363,96 @@ static bool nc_conn_start(struct nc_conn *conn)
 	return true;
 }
 
-static bool nc_conn_got_header(struct nc_conn *conn)
+/* pass on the whole message in rx_msg, whose data conn owns if owned
+ * and otherwise lies in rx_buf
+ */
+static bool nc_conn_got_msg(struct nc_conn *conn, bool owned)
 {
-	parse_message_hdr(&conn->msg.hdr, conn->hdrbuf);
+	bool rc = false;
 
-	unsigned int data_len = conn->msg.hdr.data_len;
+	if (!message_valid(&conn->rx_msg)) {
+		log_info("llnet: %s invalid message",
+			conn->addr_str);
+		goto out;
+	}
 
-	if (data_len > (16 * 1024 * 1024)) {
-		free(conn->msg.data);
-		conn->msg.data = NULL;
-		return false;
+	if (conn->loop) {
+		rc = nc_loop_post(conn->loop, conn, NC_LOOP_MSG,
+				  &conn->rx_msg, owned);
+		conn->rx_msg.data = NULL;
+		return rc;
 	}
 
-	conn->msg.data = malloc(data_len);
+	conn->msg = conn->rx_msg;
+	rc = nc_conn_message(conn);
+	conn->msg.data = NULL;
 
-	/* switch to read-body state */
-	conn->msg_p = conn->msg.data;
-	conn->expected = data_len;
-	conn->reading_hdr = false;
+out:
+	if (owned)
+		free(conn->rx_msg.data);
+	conn->rx_msg.data = NULL;
+	return rc;
+}
 
-	return true;
+/* conn was let go of, by its handler or its loop; a loop reads only
+ * loop_dead, as dead belongs to nci->eb
+ */
+static bool nc_conn_dropped(const struct nc_conn *conn)
+{
+	return conn->loop ? conn->loop_dead : conn->dead;
 }
 
-static bool nc_conn_got_msg(struct nc_conn *conn)
+/* handle every whole message in rx_buf; stop at a partial one, or once
+ * a message gets conn dropped
+ */
+static bool nc_conn_rx_frame(struct nc_conn *conn)
 {
-	if (!message_valid(&conn->msg)) {
-		log_info("llnet: %s invalid message",
-			conn->addr_str);
-		return false;
-	}
+	while (conn->rx_end - conn->rx_start >= P2P_HDR_SZ) {
+		unsigned char *p = conn->rx_buf + conn->rx_start;
+		unsigned int avail = conn->rx_end - conn->rx_start - P2P_HDR_SZ;
 
-	if (!nc_conn_message(conn))
-		return false;
+		parse_message_hdr(&conn->rx_msg.hdr, p);
 
-	free(conn->msg.data);
-	conn->msg.data = NULL;
+		unsigned int data_len = conn->rx_msg.hdr.data_len;
+
+		if (data_len > (16 * 1024 * 1024))
+			return false;
+
+		/* body won't fit; continue reading it into its own buffer */
+		if (data_len > NC_RX_BUF_SZ - P2P_HDR_SZ) {
+			conn->rx_msg.data = malloc(data_len);
+			if (!conn->rx_msg.data)
+				return false;
+
+			memcpy(conn->rx_msg.data, p + P2P_HDR_SZ, avail);
+			conn->msg_p = conn->rx_msg.data + avail;
+			conn->expected = data_len - avail;
+			conn->rx_start = conn->rx_end = 0;
+			break;
+		}
 
-	/* switch to read-header state */
-	conn->msg_p = conn->hdrbuf;
-	conn->expected = P2P_HDR_SZ;
-	conn->reading_hdr = true;
+		if (avail < data_len)
+			break;
+
+		conn->rx_msg.data = p + P2P_HDR_SZ;
+		bool ok = nc_conn_got_msg(conn, false);
+
+		/* already killed; the rest of rx_buf is moot */
+		if (nc_conn_dropped(conn))
+			return true;
+		if (!ok)
+			return false;
+
+		conn->rx_start += P2P_HDR_SZ + data_len;
+	}
+
+	/* move a partial message to the front, making room behind it */
+	if (conn->rx_start) {
+		memmove(conn->rx_buf, conn->rx_buf + conn->rx_start,
+			conn->rx_end - conn->rx_start);
+		conn->rx_end -= conn->rx_start;
+		conn->rx_start = 0;
+	}
 
 	return true;
 }
@@ -699,10 +1460,24 @@ static bool nc_conn_got_msg(struct nc_conn *conn)
 static void nc_conn_read_evt(int fd, short events, void *priv)
 {
 	struct nc_conn *conn = priv;
+	struct iovec iov[2];
+	unsigned int iov_len = 0;
+
+	/* finish any large body, and take whatever follows it too */
+	if (conn->expected) {
+		iov[iov_len].iov_base = conn->msg_p;
+		iov[iov_len].iov_len = conn->expected;
+		iov_len++;
+	}
+	iov[iov_len].iov_base = conn->rx_buf + conn->rx_end;
+	iov[iov_len].iov_len = NC_RX_BUF_SZ - conn->rx_end;
+	iov_len++;
 
-	ssize_t rrc = read(fd, conn->msg_p, conn->expected);
+	ssize_t rrc = readv(fd, iov, iov_len);
 	if (rrc <= 0) {
 		if (rrc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
 			log_info("llnet: %s read: %s",
 				conn->addr_str,
 				strerror(errno));
@@ -711,23 +1486,30 @@ static void nc_conn_read_evt(int fd, short events, void *priv)
 		goto err_out;
 	}
 
-	conn->msg_p += rrc;
-	conn->expected -= rrc;
+	size_t got = rrc;
 
-	/* execute our state machine at most twice */
-	unsigned int i;
-	for (i = 0; i < 2; i++) {
-		if (conn->expected == 0) {
-			if (conn->reading_hdr) {
-				if (!nc_conn_got_header(conn))
-					goto err_out;
-			} else {
-				if (!nc_conn_got_msg(conn))
-					goto err_out;
-			}
-		}
+	if (conn->expected) {
+		size_t n = MIN(got, conn->expected);
+
+		conn->msg_p += n;
+		conn->expected -= n;
+		got -= n;
+		if (conn->expected)
+			return;
+
+		bool ok = nc_conn_got_msg(conn, true);
+
+		if (nc_conn_dropped(conn))
+			return;
+		if (!ok)
+			goto err_out;
 	}
 
+	conn->rx_end += got;
+
+	if (!nc_conn_rx_frame(conn))
+		goto err_out;
+
 	return;
 
 err_out:
@@ -755,12 +1537,25 @@ static cstring *nc_version_build(struct nc_conn *conn)
 	return rs;
 }
 
+static bool nc_conn_send_version(struct nc_conn *conn)
+{
+	cstring *msg_data = nc_version_build(conn);
+	bool rc = nc_conn_send(conn, "version", msg_data->str, msg_data->len);
+	cstr_free(msg_data, true);
+
+	if (!rc) {
+		log_info("net: %s !conn_send", conn->addr_str);
+	}
+
+	return rc;
+}
+
 static bool nc_conn_read_enable(struct nc_conn *conn)
 {
 	if (conn->ev)
 		return true;
 
-	conn->ev = event_new(conn->nci->eb, conn->fd, EV_READ | EV_PERSIST,
+	conn->ev = event_new(nc_conn_eb(conn), conn->fd, EV_READ | EV_PERSIST,
 			     nc_conn_read_evt, conn);
 	if (!conn->ev)
 		return false;
@@ -792,7 +1587,7 @@ static bool nc_conn_write_enable(struct nc_conn *conn)
 	if (conn->write_ev)
 		return true;
 
-	conn->write_ev = event_new(conn->nci->eb, conn->fd,
+	conn->write_ev = event_new(nc_conn_eb(conn), conn->fd,
 				   EV_WRITE | EV_PERSIST,
 				   nc_conn_write_evt, conn);
 	if (!conn->write_ev)
@@ -848,20 +1643,13 @@ static void nc_conn_evt_connected(int fd, short events, void *priv)
 	event_free(conn->ev);
 	conn->ev = NULL;
 
-	/* build and send "version" message */
-	cstring *msg_data = nc_version_build(conn);
-	bool rc = nc_conn_send(conn, "version", msg_data->str, msg_data->len);
-	cstr_free(msg_data, true);
-
-	if (!rc) {
-		log_info("net: %s !conn_send", conn->addr_str);
+	/* build and send "version" message; nci->eb does it for a loop */
+	if (conn->loop) {
+		if (!nc_loop_post(conn->loop, conn, NC_LOOP_CONNECTED,
+				  NULL, false))
+			goto err_out;
+	} else if (!nc_conn_send_version(conn))
 		goto err_out;
-	}
-
-	/* switch to read-header state */
-	conn->msg_p = conn->hdrbuf;
-	conn->expected = P2P_HDR_SZ;
-	conn->reading_hdr = true;
 
 	if (!nc_conn_read_enable(conn)) {
 		log_info("net: %s read not enabled", conn->addr_str);
@@ -883,16 +1671,30 @@ void nc_conns_gc(struct net_child_info *nci, bool free_all)
 	unsigned int i;
 	for (i = 0; i < nci->conns->len; i++) {
 		struct nc_conn *conn = parr_idx(nci->conns, i);
-		if (free_all || conn->dead)
+		if (free_all ||
+		    (conn->dead && (!conn->loop || conn->detached)))
 			dead = clist_prepend(dead, conn);
 	}
 
-	/* remove and free dead connections */
+	/* remove and free dead connections; a loop frees its own */
 	clist *tmp = dead;
 	while (tmp) {
 		struct nc_conn *conn = tmp->data;
 		tmp = tmp->next;
 
+		if (!free_all && conn->loop) {
+			/* commands for conn may still be queued; retry
+			 * next time if even this one can't be
+			 */
+			if (!nc_loop_cmd(conn->loop, conn, NC_LOOP_FREE, NULL))
+				continue;
+			nc_hdrs_conn_gone(nci, conn);
+			parr_remove(nci->conns, conn);
+			n_gc++;
+			continue;
+		}
+
+		nc_hdrs_conn_gone(nci, conn);
 		parr_remove(nci->conns, conn);
 		nc_conn_free(conn);
 		n_gc++;
@@ -900,17 +1702,46 @@ void nc_conns_gc(struct net_child_info *nci, bool free_all)
 
 	clist_free(dead);
 
+	/* hand on what the dead were doing */
+	if (n_gc && !free_all && nci->hdr_db) {
+		nc_hdrs_next(nci);
+		nc_dl_schedule(nci);
+	}
+
 	log_debug("net: gc'd %u connections", n_gc);
 }
 
+static bool nc_conn_connect_watch(struct nc_conn *conn)
+{
+	/* add to our list of monitored event sources */
+	conn->ev = event_new(nc_conn_eb(conn), conn->fd, EV_WRITE,
+			     nc_conn_evt_connected, conn);
+	if (!conn->ev) {
+		log_info("net: event_new failed on %s",
+			conn->addr_str);
+		return false;
+	}
+
+	struct timeval timeout = { conn->nci->net_conn_timeout, };
+	if (event_add(conn->ev, &timeout) != 0) {
+		log_info("net: event_add failed on %s",
+			conn->addr_str);
+		return false;
+	}
+
+	return true;
+}
+
 static void nc_conns_open(struct net_child_info *nci)
 {
+	size_t max_conns = nci->max_conns ? nci->max_conns : NC_MAX_CONN;
+
 	log_debug("net: open connections (have %zu, want %zu more)",
 		nci->conns->len,
-		NC_MAX_CONN - nci->conns->len);
+		max_conns - nci->conns->len);
 
 	while ((bitc_hashtab_size(nci->peers->map_addr) > 0) &&
-	       (nci->conns->len < NC_MAX_CONN)) {
+	       (nci->conns->len < max_conns)) {
 
 		/* delete peer from front of address list.  it will be
 		 * re-added before writing peer file, if successful
@@ -946,21 +1777,23 @@ static void nc_conns_open(struct net_child_info *nci)
 			goto err_loop;
 		}
 
-		/* add to our list of monitored event sources */
-		conn->ev = event_new(nci->eb, conn->fd, EV_WRITE,
-				     nc_conn_evt_connected, conn);
-		if (!conn->ev) {
-			log_info("net: event_new failed on %s",
-				conn->addr_str);
-			goto err_loop;
+		/* hand it to the next loop, which watches connect(2) */
+		if (nci->n_loops) {
+			struct nc_loop *loop = &nci->loops[nci->next_loop++ %
+							   nci->n_loops];
+
+			conn->loop = loop;
+			if (!nc_loop_cmd(loop, conn, NC_LOOP_ADD, NULL)) {
+				conn->loop = NULL;
+				goto err_loop;
+			}
+
+			parr_add(nci->conns, conn);
+			continue;
 		}
 
-		struct timeval timeout = { conn->nci->net_conn_timeout, };
-		if (event_add(conn->ev, &timeout) != 0) {
-			log_info("net: event_add failed on %s",
-				conn->addr_str);
+		if (!nc_conn_connect_watch(conn))
 			goto err_loop;
-		}
 
 		/* add to our list of active connections */
 		parr_add(nci->conns, conn);
@@ -978,6 +1811,414 @@ void nc_conns_process(struct net_child_info *nci)
 	nc_conns_open(nci);
 }
 
+static void nc_loop_wake(int fd)
+{
+	uint8_t v = 0;
+
+	/* the pipe is non-blocking; if full, a wakeup is already due */
+	if (write(fd, &v, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		log_error("net: pipe write: %s", strerror(errno));
+	}
+}
+
+static void nc_loop_drain_pipe(int fd)
+{
+	uint8_t buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+/*
+ * Each side stores, fences, then loads what the other side stores.
+ * A loop pushes an item, fences, then sets wake_pending here;
+ * nc_loop_wake_evt clears wake_pending, fences, then pops.  Without
+ * both fences, each load can miss the other's store: the loop sees a
+ * wakeup still pending while nci->eb sees an empty queue, and the item
+ * waits for the next wakeup.
+ */
+static void nc_loop_wake_nci(struct net_child_info *nci)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_exchange_n(&nci->wake_pending, true, __ATOMIC_ACQ_REL))
+		nc_loop_wake(nci->wake_pipe[1]);
+}
+
+/* called by loop; posts a copy of msg unless owned, when its data is
+ * taken over.  Blocks while nci->eb catches up.
+ */
+static bool nc_loop_post(struct nc_loop *loop, struct nc_conn *conn,
+			 enum nc_loop_evt type, struct p2p_message *msg,
+			 bool owned)
+{
+	size_t body_len = (msg && !owned) ? msg->hdr.data_len : 0;
+	struct nc_loop_msg *item = malloc(sizeof(*item) + body_len);
+
+	if (!item) {
+		if (owned)
+			free(msg->data);
+		return false;
+	}
+
+	item->conn = conn;
+	item->type = type;
+	memset(&item->msg, 0, sizeof(item->msg));
+	if (msg) {
+		item->msg = *msg;
+		if (!owned) {
+			memcpy(item->body, msg->data, body_len);
+			item->msg.data = item->body;
+		}
+	}
+
+	while (!bitc_spscq_push(&loop->rx_q, item)) {
+		pthread_mutex_lock(&loop->rx_lock);
+		loop->rx_blocked = true;
+		nc_loop_wake_nci(loop->nci);
+
+		/* nci->eb takes rx_lock after popping, to signal */
+		while (!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE) &&
+		       bitc_spscq_full(&loop->rx_q))
+			pthread_cond_wait(&loop->rx_cv, &loop->rx_lock);
+		loop->rx_blocked = false;
+		pthread_mutex_unlock(&loop->rx_lock);
+
+		if (__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE)) {
+			if (item->msg.data != item->body)
+				free(item->msg.data);
+			free(item);
+			return false;
+		}
+	}
+
+	nc_loop_wake_nci(loop->nci);
+	return true;
+}
+
+static void nc_loop_msg_free(struct nc_loop_msg *item)
+{
+	if (item->msg.data != item->body)
+		free(item->msg.data);
+	free(item);
+}
+
+/* called by nci->eb */
+static void nc_loop_handle(struct nc_loop_msg *item)
+{
+	struct nc_conn *conn = item->conn;
+
+	switch (item->type) {
+	case NC_LOOP_MSG:
+		if (conn->dead)
+			break;
+
+		conn->msg = item->msg;
+		if (!nc_conn_message(conn))
+			nc_conn_close(conn);
+		conn->msg.data = NULL;
+		break;
+
+	case NC_LOOP_CONNECTED:
+		if (!conn->dead && !nc_conn_send_version(conn))
+			nc_conn_close(conn);
+		break;
+
+	case NC_LOOP_DEAD:
+		conn->dead = true;
+		conn->detached = true;
+		event_base_loopbreak(conn->nci->eb);
+		break;
+	}
+
+	nc_loop_msg_free(item);
+}
+
+static void nc_loop_wake_evt(int fd, short events, void *priv)
+{
+	struct net_child_info *nci = priv;
+	unsigned int i;
+	bool more = false;
+
+	nc_loop_drain_pipe(fd);
+	__atomic_store_n(&nci->wake_pending, false, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);	/* see nc_loop_wake_nci */
+
+	for (i = 0; i < nci->n_loops; i++) {
+		struct nc_loop *loop = &nci->loops[i];
+		struct nc_loop_msg *item;
+		unsigned int n;
+
+		/* bounded, so that one busy loop can't starve the rest */
+		for (n = 0; n < NC_LOOP_QUEUE; n++) {
+			item = bitc_spscq_pop(&loop->rx_q);
+			if (!item)
+				break;
+			nc_loop_handle(item);
+		}
+		if (n == NC_LOOP_QUEUE)
+			more = true;
+
+		if (n > 0) {
+			pthread_mutex_lock(&loop->rx_lock);
+			if (loop->rx_blocked)
+				pthread_cond_signal(&loop->rx_cv);
+			pthread_mutex_unlock(&loop->rx_lock);
+		}
+	}
+
+	if (more)
+		nc_loop_wake_nci(nci);
+}
+
+/* called by nci->eb; takes over mb's reference, even on failure */
+static bool nc_loop_cmd(struct nc_loop *loop, struct nc_conn *conn,
+			enum nc_loop_op op, struct p2p_msgbuf *mb)
+{
+	struct nc_loop_cmd *cmd = malloc(sizeof(*cmd));
+
+	if (!cmd) {
+		if (mb)
+			p2p_msgbuf_unref(mb);
+		return false;
+	}
+
+	cmd->next = NULL;
+	cmd->conn = conn;
+	cmd->op = op;
+	cmd->mb = mb;
+
+	pthread_mutex_lock(&loop->cmd_lock);
+	bool was_empty = (loop->cmd_head == NULL);
+	if (loop->cmd_tail)
+		loop->cmd_tail->next = cmd;
+	else
+		loop->cmd_head = cmd;
+	loop->cmd_tail = cmd;
+	pthread_mutex_unlock(&loop->cmd_lock);
+
+	if (was_empty)
+		nc_loop_wake(loop->cmd_pipe[1]);
+	return true;
+}
+
+static struct nc_loop_cmd *nc_loop_cmds_take(struct nc_loop *loop)
+{
+	pthread_mutex_lock(&loop->cmd_lock);
+	struct nc_loop_cmd *cmds = loop->cmd_head;
+	loop->cmd_head = loop->cmd_tail = NULL;
+	pthread_mutex_unlock(&loop->cmd_lock);
+
+	return cmds;
+}
+
+/* called by loop */
+static void nc_loop_cmd_evt(int fd, short events, void *priv)
+{
+	struct nc_loop *loop = priv;
+	struct nc_loop_cmd *cmd, *next;
+
+	nc_loop_drain_pipe(fd);
+
+	for (cmd = nc_loop_cmds_take(loop); cmd; cmd = next) {
+		struct nc_conn *conn = cmd->conn;
+
+		next = cmd->next;
+
+		switch (cmd->op) {
+		case NC_LOOP_ADD:
+			if (!nc_conn_connect_watch(conn))
+				nc_conn_kill(conn);
+			break;
+		case NC_LOOP_SEND:
+			if (!conn->loop_dead && !nc_conn_write_msg(conn, cmd->mb))
+				nc_conn_kill(conn);
+			p2p_msgbuf_unref(cmd->mb);
+			break;
+		case NC_LOOP_KILL:
+			nc_conn_kill(conn);
+			break;
+		case NC_LOOP_FREE:
+			nc_conn_free(conn);
+			break;
+		}
+
+		free(cmd);
+	}
+
+	if (__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE))
+		event_base_loopbreak(loop->eb);
+}
+
+static void *nc_loop_main(void *priv)
+{
+	struct nc_loop *loop = priv;
+
+	while (!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE))
+		event_base_dispatch(loop->eb);
+
+	return NULL;
+}
+
+static bool nc_pipe_open(int fds[2])
+{
+	if (pipe(fds) < 0)
+		return false;
+
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	return true;
+}
+
+static bool nc_loop_init(struct nc_loop *loop, struct net_child_info *nci)
+{
+	loop->nci = nci;
+	loop->cmd_pipe[0] = loop->cmd_pipe[1] = -1;
+	pthread_mutex_init(&loop->rx_lock, NULL);
+	pthread_cond_init(&loop->rx_cv, NULL);
+	pthread_mutex_init(&loop->cmd_lock, NULL);
+
+	if (!bitc_spscq_init(&loop->rx_q, NC_LOOP_QUEUE))
+		return false;
+	if (!nc_pipe_open(loop->cmd_pipe))
+		return false;
+
+	loop->eb = event_base_new();
+	if (!loop->eb)
+		return false;
+
+	loop->cmd_ev = event_new(loop->eb, loop->cmd_pipe[0],
+				 EV_READ | EV_PERSIST, nc_loop_cmd_evt, loop);
+	if (!loop->cmd_ev || event_add(loop->cmd_ev, NULL) != 0)
+		return false;
+
+	return true;
+}
+
+static void nc_loop_free(struct nc_loop *loop)
+{
+	if (loop->cmd_ev) {
+		event_del(loop->cmd_ev);
+		event_free(loop->cmd_ev);
+	}
+	if (loop->eb)
+		event_base_free(loop->eb);
+	if (loop->cmd_pipe[0] >= 0) {
+		close(loop->cmd_pipe[0]);
+		close(loop->cmd_pipe[1]);
+	}
+	bitc_spscq_free(&loop->rx_q);
+	pthread_mutex_destroy(&loop->cmd_lock);
+	pthread_cond_destroy(&loop->rx_cv);
+	pthread_mutex_destroy(&loop->rx_lock);
+}
+
+bool nc_loops_start(struct net_child_info *nci, unsigned int n_loops)
+{
+	unsigned int i;
+
+	assert(nci->n_loops == 0 && nci->conns->len == 0);
+
+	if (n_loops == 0)
+		return true;
+
+	nci->wake_pipe[0] = nci->wake_pipe[1] = -1;
+	nci->loops = calloc(n_loops, sizeof(*nci->loops));
+	if (!nci->loops || !nc_pipe_open(nci->wake_pipe))
+		goto err_out;
+
+	nci->wake_ev = event_new(nci->eb, nci->wake_pipe[0],
+				 EV_READ | EV_PERSIST, nc_loop_wake_evt, nci);
+	if (!nci->wake_ev || event_add(nci->wake_ev, NULL) != 0)
+		goto err_out;
+
+	for (i = 0; i < n_loops; i++) {
+		struct nc_loop *loop = &nci->loops[i];
+
+		/* counted first, so that nc_loops_stop frees it */
+		nci->n_loops++;
+		if (!nc_loop_init(loop, nci) ||
+		    pthread_create(&loop->thread, NULL, nc_loop_main, loop)) {
+			loop->thread = 0;
+			goto err_out;
+		}
+	}
+
+	log_info("net: %u I/O threads", n_loops);
+	return true;
+
+err_out:
+	log_error("net: failed to start I/O threads");
+	nc_loops_stop(nci);
+	return false;
+}
+
+void nc_loops_stop(struct net_child_info *nci)
+{
+	unsigned int i;
+
+	if (!nci->loops)
+		return;
+
+	for (i = 0; i < nci->n_loops; i++) {
+		struct nc_loop *loop = &nci->loops[i];
+
+		__atomic_store_n(&loop->stop, true, __ATOMIC_RELEASE);
+		pthread_mutex_lock(&loop->rx_lock);
+		pthread_cond_signal(&loop->rx_cv);
+		pthread_mutex_unlock(&loop->rx_lock);
+		if (loop->cmd_pipe[1] >= 0)
+			nc_loop_wake(loop->cmd_pipe[1]);
+	}
+
+	for (i = 0; i < nci->n_loops; i++) {
+		struct nc_loop *loop = &nci->loops[i];
+		struct nc_loop_cmd *cmd, *next;
+		struct nc_loop_msg *item;
+
+		if (loop->thread)
+			pthread_join(loop->thread, NULL);
+
+		/* the rest is ours now; connections still listed in
+		 * nci->conns are freed by nc_conns_gc below
+		 */
+		for (cmd = nc_loop_cmds_take(loop); cmd; cmd = next) {
+			next = cmd->next;
+			if (cmd->op == NC_LOOP_FREE)
+				nc_conn_free(cmd->conn);
+			else if (cmd->mb)
+				p2p_msgbuf_unref(cmd->mb);
+			free(cmd);
+		}
+		if (loop->rx_q.slots)
+			while ((item = bitc_spscq_pop(&loop->rx_q)) != NULL)
+				nc_loop_msg_free(item);
+	}
+
+	nc_conns_gc(nci, true);
+
+	for (i = 0; i < nci->n_loops; i++)
+		nc_loop_free(&nci->loops[i]);
+
+	if (nci->wake_ev) {
+		event_del(nci->wake_ev);
+		event_free(nci->wake_ev);
+	}
+	if (nci->wake_pipe[0] >= 0) {
+		close(nci->wake_pipe[0]);
+		close(nci->wake_pipe[1]);
+	}
+
+	free(nci->loops);
+	nci->loops = NULL;
+	nci->n_loops = 0;
+	nci->wake_ev = NULL;
+}
+
 static void pipwr(int fd, const void *buf, size_t len)
 {
 	while (len > 0) {
@@ -4,16 +4,20 @@
  */
 #include "libbitc-config.h"
 
+#include <bitc/arena.h>                 // for bitc_arena_init, etc
 #include <bitc/buffer.h>                // for const_buffer
 #include <bitc/buint.h>                 // for bu256_t, bu256_new, etc
 #include <bitc/core.h>                  // for bitc_valid_value
+#include <bitc/crypto/sha256d64.h>      // for sha256d64
 #include <bitc/coredefs.h>              // for ::MAX_BLOCK_WEIGHT, etc
 #include <bitc/cstr.h>                  // for cstring, cstr_free, etc
 #include <bitc/parr.h>                  // for parr, parr_idx, parr_add, etc
 #include <bitc/primitives/block.h>      // for bitc_block
 #include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_txin, etc
+#include <bitc/script/interpreter.h>    // for ::SCRIPT_VERIFY_P2SH, etc
+#include <bitc/script/script.h>         // for bsp_get_sigopcount, etc
 #include <bitc/serialize.h>             // for deser_u32, ser_u32, etc
-#include <bitc/util.h>                  // for bu_Hash_, MIN, bu_Hash
+#include <bitc/util.h>                  // for MIN
 
 #include <gmp.h>                        // for mpz_clear, mpz_init, mpz_t, etc
 
@@ -24,15 +28,78 @@
 #include <time.h>                       // for time, time_t
 
 
+enum {
+	MIN_TX_SZ	= 4 + 1 + 1 + 4,	/* version, 2 x count, locktime */
+};
 
 void bitc_block_init(struct bitc_block *block)
 {
 	memset(block, 0, sizeof(*block));
 }
 
+static unsigned int tx_legacy_sigops(const struct bitc_tx *tx)
+{
+	unsigned int n = 0, i;
+
+	for (i = 0; i < tx->vin->len; i++) {
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+		struct const_buffer script = { txin->scriptSig->str,
+					       txin->scriptSig->len };
+
+		n += bsp_get_sigopcount(&script, false);
+	}
+	for (i = 0; i < tx->vout->len; i++) {
+		struct bitc_txout *txout = parr_idx(tx->vout, i);
+		struct const_buffer script = { txout->scriptPubKey->str,
+					       txout->scriptPubKey->len };
+
+		n += bsp_get_sigopcount(&script, false);
+	}
+
+	return n;
+}
+
+static unsigned int tx_view_legacy_sigops(const struct bitc_tx_view *tx)
+{
+	unsigned int n = 0, i;
+
+	for (i = 0; i < tx->n_vin; i++) {
+		struct const_buffer script = tx->vin[i].scriptSig;
+
+		n += bsp_get_sigopcount(&script, false);
+	}
+	for (i = 0; i < tx->n_vout; i++) {
+		struct const_buffer script = tx->vout[i].scriptPubKey;
+
+		n += bsp_get_sigopcount(&script, false);
+	}
+
+	return n;
+}
+
+static void block_stats_sizes(struct bitc_block_stats *stats,
+			      size_t total_size, size_t witness_size)
+{
+	stats->total_size = total_size;
+	stats->base_size = total_size - witness_size;
+	stats->weight = stats->base_size * (WITNESS_SCALE_FACTOR - 1) +
+			total_size;
+}
+
 bool deser_bitc_block(struct bitc_block *block, struct const_buffer *buf)
 {
+	return deser_bitc_block_stats(block, buf, NULL);
+}
+
+bool deser_bitc_block_stats(struct bitc_block *block, struct const_buffer *buf,
+			    struct bitc_block_stats *stats)
+{
+	const unsigned char *start = buf->p;
+	size_t witness_size = 0;
+
 	bitc_block_free(block);
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
 
 	if (!deser_u32(&block->nVersion, buf)) return false;
 	if (!deser_u256(&block->hashPrevBlock, buf)) return false;
@@ -43,7 +110,7 @@ bool deser_bitc_block(struct bitc_block *block, struct const_buffer *buf)
 
 	/* permit header-only blocks */
 	if (buf->len == 0)
-		return true;
+		goto out;
 
 	block->vtx = parr_new(512, bitc_tx_freep);
 
@@ -52,18 +119,28 @@ bool deser_bitc_block(struct bitc_block *block, struct const_buffer *buf)
 
 	unsigned int i;
 	for (i = 0; i < vlen; i++) {
+		struct bitc_tx_span span;
 		struct bitc_tx *tx;
 
 		tx = calloc(1, sizeof(*tx));
 		bitc_tx_init(tx);
-		if (!deser_bitc_tx(tx, buf)) {
+		if (!deser_bitc_tx_span(tx, buf, &span)) {
 			free(tx);
 			goto err_out;
 		}
 
 		parr_add(block->vtx, tx);
+
+		if (stats) {
+			witness_size += span.len - bitc_tx_span_base_size(&span);
+			stats->sigops_legacy += tx_legacy_sigops(tx);
+		}
 	}
 
+out:
+	if (stats)
+		block_stats_sizes(stats, (const unsigned char *) buf->p - start,
+				  witness_size);
 	return true;
 
 err_out:
@@ -71,32 +148,40 @@ err_out:
 	return false;
 }
 
-static void ser_bitc_block_hdr(cstring *s, const struct bitc_block *block)
+static void ser_sink_bitc_block_hdr(struct bitc_sink *sink,
+				    const struct bitc_block *block)
 {
-	ser_u32(s, block->nVersion);
-	ser_u256(s, &block->hashPrevBlock);
-	ser_u256(s, &block->hashMerkleRoot);
-	ser_u32(s, block->nTime);
-	ser_u32(s, block->nBits);
-	ser_u32(s, block->nNonce);
+	ser_sink_u32(sink, block->nVersion);
+	ser_sink_u256(sink, &block->hashPrevBlock);
+	ser_sink_u256(sink, &block->hashMerkleRoot);
+	ser_sink_u32(sink, block->nTime);
+	ser_sink_u32(sink, block->nBits);
+	ser_sink_u32(sink, block->nNonce);
 }
 
-void ser_bitc_block(cstring *s, const struct bitc_block *block)
+void ser_sink_bitc_block(struct bitc_sink *sink, const struct bitc_block *block)
 {
-	ser_bitc_block_hdr(s, block);
+	ser_sink_bitc_block_hdr(sink, block);
 
 	unsigned int i;
 	if (block->vtx) {
-		ser_varlen(s, block->vtx->len);
+		ser_sink_varlen(sink, block->vtx->len);
 
 		for (i = 0; i < block->vtx->len; i++) {
 			struct bitc_tx *tx;
 
 			tx = parr_idx(block->vtx, i);
-			ser_bitc_tx(s, tx);
+			ser_sink_bitc_tx(sink, tx);
 		}
 	}
 }
+
+void ser_bitc_block(cstring *s, const struct bitc_block *block)
+{
+	struct bitc_sink sink;
+	bitc_sink_cstr_init(&sink, s);
+	ser_sink_bitc_block(&sink, block);
+}
 void bitc_block_vtx_free(struct bitc_block *block)
 {
 	if (!block || !block->vtx)
@@ -143,31 +228,206 @@ void bitc_block_calc_sha256(struct bitc_block *block)
 	if (block->sha256_valid)
 		return;
 
-	/* TODO: introduce hashing-only serialization mode */
+	SHA256_CTX ctx;
+	struct bitc_sink sink;
+	bitc_sink_sha256_init(&sink, &ctx);
 
-	cstring *s = cstr_new_sz(10 * 1024);
-	ser_bitc_block_hdr(s, block);
+	ser_sink_bitc_block_hdr(&sink, block);
 
-	bu_Hash((unsigned char *)&block->sha256, s->str, s->len);
+	bitc_sink_sha256d(&sink, (unsigned char *)&block->sha256);
 	block->sha256_valid = true;
-
-	cstr_free(s, true);
 }
 
 unsigned int bitc_block_ser_size(const struct bitc_block *block)
 {
-	unsigned int block_ser_size;
+	struct bitc_sink sink;
+	bitc_sink_count_init(&sink);
+
+	ser_sink_bitc_block(&sink, block);
+
+	return sink.len;
+}
+
+/* marker, flag and witness stacks, if tx is sent with them */
+static size_t tx_witness_size(const struct bitc_tx *tx)
+{
+	struct bitc_sink sink;
+	bool has_witness = false;
+	unsigned int i, j;
+
+	for (i = 0; i < tx->vin->len && !has_witness; i++) {
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+
+		has_witness = txin->scriptWitness && txin->scriptWitness->len;
+	}
+	if (!has_witness)
+		return 0;
+
+	bitc_sink_count_init(&sink);
+	ser_sink_bytes(&sink, NULL, 2);
+
+	for (i = 0; i < tx->vin->len; i++) {
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+		const parr *witness = txin->scriptWitness;
+
+		ser_sink_varlen(&sink, witness ? witness->len : 0);
+		for (j = 0; witness && j < witness->len; j++) {
+			struct buffer *item = parr_idx(witness, j);
+
+			ser_sink_varlen(&sink, item->len);
+			ser_sink_bytes(&sink, NULL, item->len);
+		}
+	}
+
+	return sink.len;
+}
+
+void bitc_block_stats_calc(struct bitc_block_stats *stats,
+			   const struct bitc_block *block)
+{
+	size_t witness_size = 0;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; block->vtx && i < block->vtx->len; i++) {
+		struct bitc_tx *tx = parr_idx(block->vtx, i);
 
-	/* TODO: introduce a counting-only serialization mode */
+		witness_size += tx_witness_size(tx);
+		stats->sigops_legacy += tx_legacy_sigops(tx);
+	}
 
-	cstring *s = cstr_new_sz(200 * 1024);
-	ser_bitc_block(s, block);
+	block_stats_sizes(stats, bitc_block_ser_size(block) + witness_size,
+			  witness_size);
+}
 
-	block_ser_size = s->len;
+void bitc_block_stats_spend(struct bitc_block_stats *stats,
+			    const struct bitc_txin *txin,
+			    const cstring *scriptPubKey, unsigned int flags)
+{
+	struct const_buffer spk = { scriptPubKey->str, scriptPubKey->len };
+	struct const_buffer sig = { txin->scriptSig->str,
+				    txin->scriptSig->len };
+
+	if (flags & SCRIPT_VERIFY_P2SH)
+		stats->sigops_p2sh += bsp_get_p2sh_sigopcount(&spk, &sig);
+	if (flags & SCRIPT_VERIFY_WITNESS)
+		stats->sigops_witness +=
+			bsp_get_witness_sigopcount(&spk, &sig,
+						   txin->scriptWitness);
+}
 
-	cstr_free(s, true);
+void bitc_block_view_init(struct bitc_block_view *block)
+{
+	memset(block, 0, sizeof(*block));
+}
 
-	return block_ser_size;
+bool deser_bitc_block_view(struct bitc_block_view *block,
+			   struct const_buffer *buf)
+{
+	return deser_bitc_block_view_stats(block, buf, NULL);
+}
+
+bool deser_bitc_block_view_stats(struct bitc_block_view *block,
+				 struct const_buffer *buf,
+				 struct bitc_block_stats *stats)
+{
+	const unsigned char *start = buf->p;
+	size_t witness_size = 0;
+
+	bitc_block_view_free(block);
+	block->sha256_valid = false;
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+
+	if (!deser_u32(&block->nVersion, buf)) return false;
+	if (!deser_u256(&block->hashPrevBlock, buf)) return false;
+	if (!deser_u256(&block->hashMerkleRoot, buf)) return false;
+	if (!deser_u32(&block->nTime, buf)) return false;
+	if (!deser_u32(&block->nBits, buf)) return false;
+	if (!deser_u32(&block->nNonce, buf)) return false;
+
+	/* permit header-only blocks */
+	if (buf->len == 0)
+		goto out;
+
+	uint32_t vlen;
+	if (!deser_varlen(&vlen, buf)) return false;
+	if (vlen > buf->len / MIN_TX_SZ)
+		return false;
+
+	/* decoded structures are about the size of the wire data */
+	bitc_arena_init(&block->arena, buf->len);
+
+	block->vtx = bitc_arena_calloc(&block->arena, vlen,
+				       sizeof(struct bitc_tx_view));
+	if (vlen && !block->vtx)
+		goto err_out;
+
+	unsigned int i;
+	for (i = 0; i < vlen; i++) {
+		struct bitc_tx_view *tx = &block->vtx[i];
+
+		if (!deser_bitc_tx_view(tx, buf, &block->arena))
+			goto err_out;
+
+		if (stats) {
+			witness_size += tx->span.len -
+					bitc_tx_span_base_size(&tx->span);
+			stats->sigops_legacy += tx_view_legacy_sigops(tx);
+		}
+	}
+
+	block->n_tx = vlen;
+
+out:
+	if (stats)
+		block_stats_sizes(stats, (const unsigned char *) buf->p - start,
+				  witness_size);
+	return true;
+
+err_out:
+	bitc_block_view_free(block);
+	return false;
+}
+
+void bitc_block_view_free(struct bitc_block_view *block)
+{
+	if (!block)
+		return;
+
+	bitc_arena_free(&block->arena);
+	block->vtx = NULL;
+	block->n_tx = 0;
+}
+
+void bitc_block_view_copy_hdr(struct bitc_block *dest,
+			      const struct bitc_block_view *src)
+{
+	memset(dest, 0, sizeof(*dest));
+
+	dest->nVersion = src->nVersion;
+	bu256_copy(&dest->hashPrevBlock, &src->hashPrevBlock);
+	bu256_copy(&dest->hashMerkleRoot, &src->hashMerkleRoot);
+	dest->nTime = src->nTime;
+	dest->nBits = src->nBits;
+	dest->nNonce = src->nNonce;
+
+	dest->sha256_valid = src->sha256_valid;
+	bu256_copy(&dest->sha256, &src->sha256);
+}
+
+void bitc_block_view_calc_sha256(struct bitc_block_view *block)
+{
+	if (block->sha256_valid)
+		return;
+
+	struct bitc_block hdr;
+	bitc_block_view_copy_hdr(&hdr, block);
+	bitc_block_calc_sha256(&hdr);
+
+	bu256_copy(&block->sha256, &hdr.sha256);
+	block->sha256_valid = true;
 }
 
 parr *bitc_block_merkle_tree(const struct bitc_block *block)
@@ -175,7 +435,19 @@ parr *bitc_block_merkle_tree(const struct bitc_block *block)
 	if (!block->vtx || !block->vtx->len)
 		return NULL;
 
-	parr *arr = parr_new(0, bu256_freep);
+	/* Build the tree level by level in one flat array.  Sibling pairs
+	 * are adjacent, so each level is a single batched sha256d64() call
+	 * straight over the level below; only an odd last node needs to be
+	 * paired with a copy of itself.
+	 */
+	unsigned int n_nodes = 0, nSize;
+	for (nSize = block->vtx->len; nSize > 1; nSize = (nSize + 1) / 2)
+		n_nodes += nSize;
+	n_nodes++;
+
+	bu256_t *tree = malloc(n_nodes * sizeof(bu256_t));
+	if (!tree)
+		return NULL;
 
 	unsigned int i;
 	for (i = 0; i < block->vtx->len; i++) {
@@ -184,24 +456,33 @@ parr *bitc_block_merkle_tree(const struct bitc_block *block)
 		tx = parr_idx(block->vtx, i);
 		bitc_tx_calc_sha256(tx);
 
-		parr_add(arr, bu256_new(&tx->sha256));
+		bu256_copy(&tree[i], &tx->sha256);
 	}
 
-	unsigned int j = 0, nSize;
+	unsigned int j = 0;
 	for (nSize = block->vtx->len; nSize > 1; nSize = (nSize + 1) / 2) {
-		for (i = 0; i < nSize; i += 2) {
-			unsigned int i2 = MIN(i+1, nSize-1);
-			bu256_t hash;
-			bu_Hash_((unsigned char *) &hash,
-			   parr_idx(arr, j+i), sizeof(bu256_t),
-			   parr_idx(arr, j+i2),sizeof(bu256_t));
-
-			parr_add(arr, bu256_new(&hash));
+		bu256_t *level = &tree[j];
+		bu256_t *parent = &tree[j + nSize];
+
+		sha256d64((unsigned char *) parent, (unsigned char *) level,
+			  nSize / 2);
+
+		if (nSize & 1) {
+			bu256_t pair[2];
+			bu256_copy(&pair[0], &level[nSize - 1]);
+			bu256_copy(&pair[1], &level[nSize - 1]);
+			sha256d64((unsigned char *) &parent[nSize / 2],
+				  (unsigned char *) pair, 1);
 		}
 
 		j += nSize;
 	}
 
+	parr *arr = parr_new(n_nodes, bu256_freep);
+	for (i = 0; i < n_nodes; i++)
+		parr_add(arr, bu256_new(&tree[i]));
+
+	free(tree);
 	return arr;
 }
 
@@ -246,17 +527,14 @@ void bitc_check_merkle_branch(bu256_t *hash, const bu256_t *txhash_in,
 {
 	bu256_copy(hash, txhash_in);
 
+	bu256_t pair[2];
 	unsigned int i;
 	for (i = 0; i < mrkbranch->len; i++) {
 		const bu256_t *otherside = parr_idx(mrkbranch, i);
-		if (txidx & 1)
-			bu_Hash_((unsigned char *)hash,
-				 otherside, sizeof(bu256_t),
-				 hash, sizeof(bu256_t));
-		else
-			bu_Hash_((unsigned char *)hash,
-				 hash, sizeof(bu256_t),
-				 otherside, sizeof(bu256_t));
+
+		bu256_copy(&pair[txidx & 1], hash);
+		bu256_copy(&pair[!(txidx & 1)], otherside);
+		sha256d64((unsigned char *) hash, (unsigned char *) pair, 1);
 
 		txidx >>= 1;
 	}
@@ -291,8 +569,29 @@ static bool bitc_block_valid_merkle(struct bitc_block *block)
 	return bu256_equal(&merkle, &block->hashMerkleRoot);
 }
 
+bool bitc_block_valid_hdr(struct bitc_block *block)
+{
+	bitc_block_calc_sha256(block);
+
+	if (!bitc_block_valid_target(block)) return false;
+
+	time_t now = time(NULL);
+	if (block->nTime > (now + (2 * 60 * 60)))
+		return false;
+
+	return true;
+}
+
 bool bitc_block_valid(struct bitc_block *block)
 {
+	return bitc_block_valid_stats(block, NULL);
+}
+
+bool bitc_block_valid_stats(struct bitc_block *block,
+			    const struct bitc_block_stats *stats)
+{
+	struct bitc_block_stats calc;
+
 	bitc_block_calc_sha256(block);
 
 	if (!block->vtx || !block->vtx->len)
@@ -301,15 +600,21 @@ bool bitc_block_valid(struct bitc_block *block)
 	if (block->vtx->len * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
 		return false;
 
-	if (bitc_block_ser_size(block) * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
-		return false;
+	if (!stats) {
+		bitc_block_stats_calc(&calc, block);
+		stats = &calc;
+	}
 
-	if (!bitc_block_valid_target(block)) return false;
+	if (stats->base_size * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT ||
+	    stats->weight > MAX_BLOCK_WEIGHT)
+		return false;
 
-	time_t now = time(NULL);
-	if (block->nTime > (now + (2 * 60 * 60)))
+	// only the legacy count is known before the inputs are looked up
+	if (stats->sigops_legacy * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
 		return false;
 
+	if (!bitc_block_valid_hdr(block)) return false;
+
 	if (!bitc_block_valid_merkle(block)) return false;
 
 	unsigned int i;
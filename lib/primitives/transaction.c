@@ -4,11 +4,21 @@
  */
 #include "libbitc-config.h"
 
+#include <bitc/arena.h>                 // for bitc_arena_calloc
 #include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_txin, etc
 #include <bitc/serialize.h>             // for deser_u32, deser_varlen, etc
 #include <bitc/util.h>                  // for bu_Hash
 
-#include <string.h>                     // for memset, NULL
+#include <stdlib.h>                     // for malloc, qsort, free
+#include <string.h>                     // for memcmp, memset, NULL
+
+enum {
+	/* smallest possible wire encodings, used to sanity check
+	 * element counts before allocating for them
+	 */
+	MIN_TXIN_SZ	= 32 + 4 + 1 + 4,
+	MIN_TXOUT_SZ	= 8 + 1,
+};
 
 
 void bitc_outpt_init(struct bitc_outpt *outpt)
@@ -25,10 +35,18 @@ bool deser_bitc_outpt(struct bitc_outpt *outpt, struct const_buffer *buf)
 	return true;
 }
 
+void ser_sink_bitc_outpt(struct bitc_sink *sink,
+			 const struct bitc_outpt *outpt)
+{
+	ser_sink_u256(sink, &outpt->hash);
+	ser_sink_u32(sink, outpt->n);
+}
+
 void ser_bitc_outpt(cstring *s, const struct bitc_outpt *outpt)
 {
-	ser_u256(s, &outpt->hash);
-	ser_u32(s, outpt->n);
+	struct bitc_sink sink;
+	bitc_sink_cstr_init(&sink, s);
+	ser_sink_bitc_outpt(&sink, outpt);
 }
 
 void bitc_txin_init(struct bitc_txin *txin)
@@ -47,11 +65,18 @@ bool deser_bitc_txin(struct bitc_txin *txin, struct const_buffer *buf)
 	return true;
 }
 
+void ser_sink_bitc_txin(struct bitc_sink *sink, const struct bitc_txin *txin)
+{
+	ser_sink_bitc_outpt(sink, &txin->prevout);
+	ser_sink_varstr(sink, txin->scriptSig);
+	ser_sink_u32(sink, txin->nSequence);
+}
+
 void ser_bitc_txin(cstring *s, const struct bitc_txin *txin)
 {
-	ser_bitc_outpt(s, &txin->prevout);
-	ser_varstr(s, txin->scriptSig);
-	ser_u32(s, txin->nSequence);
+	struct bitc_sink sink;
+	bitc_sink_cstr_init(&sink, s);
+	ser_sink_bitc_txin(&sink, txin);
 }
 
 void bitc_txin_free(struct bitc_txin *txin)
@@ -122,10 +147,18 @@ bool deser_bitc_txout(struct bitc_txout *txout, struct const_buffer *buf)
 	return true;
 }
 
+void ser_sink_bitc_txout(struct bitc_sink *sink,
+			 const struct bitc_txout *txout)
+{
+	ser_sink_s64(sink, txout->nValue);
+	ser_sink_varstr(sink, txout->scriptPubKey);
+}
+
 void ser_bitc_txout(cstring *s, const struct bitc_txout *txout)
 {
-	ser_s64(s, txout->nValue);
-	ser_varstr(s, txout->scriptPubKey);
+	struct bitc_sink sink;
+	bitc_sink_cstr_init(&sink, s);
+	ser_sink_bitc_txout(&sink, txout);
 }
 
 void bitc_txout_free(struct bitc_txout *txout)
@@ -173,18 +206,49 @@ void bitc_txout_copy(struct bitc_txout *dest, const struct bitc_txout *src)
 	}
 }
 
+void bitc_tx_span_txid(bu256_t *vo, const struct bitc_tx_span *span)
+{
+	SHA256_CTX ctx;
+	unsigned char md1[SHA256_DIGEST_LENGTH];
+
+	/* nVersion | body | nLockTime, skipping marker, flag and witness */
+	sha256_Init(&ctx);
+	sha256_Update(&ctx, span->p, sizeof(uint32_t));
+	sha256_Update(&ctx, span->p + span->body_off, span->body_len);
+	sha256_Update(&ctx, span->p + span->len - sizeof(uint32_t),
+		      sizeof(uint32_t));
+	sha256_Final(md1, &ctx);
+
+	sha256_Raw(md1, SHA256_DIGEST_LENGTH, (unsigned char *) vo);
+}
+
+void bitc_tx_span_wtxid(bu256_t *vo, const struct bitc_tx_span *span)
+{
+	if (!bitc_tx_span_witness(span)) {
+		bitc_tx_span_txid(vo, span);
+		return;
+	}
+
+	bu_Hash((unsigned char *) vo, span->p, span->len);
+}
+
 void bitc_tx_init(struct bitc_tx *tx)
 {
 	memset(tx, 0, sizeof(*tx));
 	tx->nVersion = 1;
 }
 
-bool deser_bitc_tx(struct bitc_tx *tx, struct const_buffer *buf)
+bool deser_bitc_tx_span(struct bitc_tx *tx, struct const_buffer *buf,
+			struct bitc_tx_span *span)
 {
 	bitc_tx_free(tx);
 
+	const unsigned char *start = buf->p;
+
 	if (!deser_u32(&tx->nVersion, buf)) return false;
 
+	const unsigned char *body = buf->p;
+
 	unsigned char flags = 0;
 	tx->vin = parr_new(8, bitc_txin_freep);
 	tx->vout = parr_new(8, bitc_txout_freep);
@@ -210,6 +274,7 @@ bool deser_bitc_tx(struct bitc_tx *tx, struct const_buffer *buf)
         /* We read a dummy or an empty vin. */
         deser_bytes(&flags, buf, 1);
         if (flags != 0) {
+            body = buf->p;
             if (!deser_varlen(&vlen, buf)) return false;
             for (i = 0; i < vlen; i++) {
                 struct bitc_txin *txin;
@@ -255,6 +320,7 @@ bool deser_bitc_tx(struct bitc_tx *tx, struct const_buffer *buf)
             parr_add(tx->vout, txout);;
         }
     }
+    const unsigned char *body_end = buf->p;
     if (flags & 1) {
         /* The witness flag is present, and we support witnesses. */
         flags ^= 1;
@@ -269,6 +335,22 @@ bool deser_bitc_tx(struct bitc_tx *tx, struct const_buffer *buf)
         goto err_out;
     }
 	if (!deser_u32(&tx->nLockTime, buf)) return false;
+
+	/* hash the wire bytes now, while we still have them */
+	span->p = start;
+	span->len = (const unsigned char *) buf->p - start;
+	span->body_off = body - start;
+	span->body_len = body_end - body;
+
+	bitc_tx_span_txid(&tx->sha256, span);
+	tx->sha256_valid = true;
+
+	if (bitc_tx_span_witness(span))
+		bitc_tx_span_wtxid(&tx->wtxid, span);
+	else
+		bu256_copy(&tx->wtxid, &tx->sha256);
+	tx->wtxid_valid = true;
+
 	return true;
 
 err_out:
@@ -276,11 +358,18 @@ err_out:
 	return false;
 }
 
-void ser_bitc_tx(cstring *s, const struct bitc_tx *tx)
+bool deser_bitc_tx(struct bitc_tx *tx, struct const_buffer *buf)
 {
-	ser_u32(s, tx->nVersion);
+	struct bitc_tx_span span;
 
-	ser_varlen(s, tx->vin ? tx->vin->len : 0);
+	return deser_bitc_tx_span(tx, buf, &span);
+}
+
+void ser_sink_bitc_tx(struct bitc_sink *sink, const struct bitc_tx *tx)
+{
+	ser_sink_u32(sink, tx->nVersion);
+
+	ser_sink_varlen(sink, tx->vin ? tx->vin->len : 0);
 
 	unsigned int i;
 	if (tx->vin) {
@@ -288,22 +377,29 @@ void ser_bitc_tx(cstring *s, const struct bitc_tx *tx)
 			struct bitc_txin *txin;
 
 			txin = parr_idx(tx->vin, i);
-			ser_bitc_txin(s, txin);
+			ser_sink_bitc_txin(sink, txin);
 		}
 	}
 
-	ser_varlen(s, tx->vout ? tx->vout->len : 0);
+	ser_sink_varlen(sink, tx->vout ? tx->vout->len : 0);
 
 	if (tx->vout) {
 		for (i = 0; i < tx->vout->len; i++) {
 			struct bitc_txout *txout;
 
 			txout = parr_idx(tx->vout, i);
-			ser_bitc_txout(s, txout);
+			ser_sink_bitc_txout(sink, txout);
 		}
 	}
 
-	ser_u32(s, tx->nLockTime);
+	ser_sink_u32(sink, tx->nLockTime);
+}
+
+void ser_bitc_tx(cstring *s, const struct bitc_tx *tx)
+{
+	struct bitc_sink sink;
+	bitc_sink_cstr_init(&sink, s);
+	ser_sink_bitc_tx(&sink, tx);
 }
 
 void bitc_tx_free_vout(struct bitc_tx *tx)
@@ -328,6 +424,7 @@ void bitc_tx_free(struct bitc_tx *tx)
 	bitc_tx_free_vout(tx);
 
 	tx->sha256_valid = false;
+	tx->wtxid_valid = false;
 }
 
 void bitc_tx_freep(void *p)
@@ -347,31 +444,97 @@ void bitc_tx_calc_sha256(struct bitc_tx *tx)
 	if (tx->sha256_valid)
 		return;
 
-	/* TODO: introduce hashing-only serialization mode */
+	SHA256_CTX ctx;
+	struct bitc_sink sink;
+	bitc_sink_sha256_init(&sink, &ctx);
 
-	cstring *s = cstr_new_sz(512);
-	ser_bitc_tx(s, tx);
+	ser_sink_bitc_tx(&sink, tx);
 
-	bu_Hash((unsigned char *) &tx->sha256, s->str, s->len);
+	bitc_sink_sha256d(&sink, (unsigned char *) &tx->sha256);
 	tx->sha256_valid = true;
+}
+
+static bool bitc_tx_has_witness(const struct bitc_tx *tx)
+{
+	if (!tx->vin)
+		return false;
+
+	unsigned int i;
+	for (i = 0; i < tx->vin->len; i++) {
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+
+		if (txin->scriptWitness && txin->scriptWitness->len)
+			return true;
+	}
 
-	cstr_free(s, true);
+	return false;
 }
 
-unsigned int bitc_tx_ser_size(const struct bitc_tx *tx)
+/* BIP144 serialization, for transactions carrying witness data */
+static void ser_sink_bitc_tx_witness(struct bitc_sink *sink,
+				     const struct bitc_tx *tx)
 {
-	unsigned int tx_ser_size;
+	unsigned char marker_flag[2] = { 0, 1 };
+	unsigned int i, j;
+
+	ser_sink_u32(sink, tx->nVersion);
+	ser_sink_bytes(sink, marker_flag, sizeof(marker_flag));
 
-	/* TODO: introduce a counting-only serialization mode */
+	ser_sink_varlen(sink, tx->vin->len);
+	for (i = 0; i < tx->vin->len; i++)
+		ser_sink_bitc_txin(sink, parr_idx(tx->vin, i));
 
-	cstring *s = cstr_new_sz(512);
-	ser_bitc_tx(s, tx);
+	ser_sink_varlen(sink, tx->vout ? tx->vout->len : 0);
+	if (tx->vout)
+		for (i = 0; i < tx->vout->len; i++)
+			ser_sink_bitc_txout(sink, parr_idx(tx->vout, i));
 
-	tx_ser_size = s->len;
+	for (i = 0; i < tx->vin->len; i++) {
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+		parr *wit = txin->scriptWitness;
+
+		ser_sink_varlen(sink, wit ? wit->len : 0);
+		for (j = 0; wit && j < wit->len; j++) {
+			struct buffer *item = parr_idx(wit, j);
+			struct const_buffer cbuf = { item->p, item->len };
 
-	cstr_free(s, true);
+			ser_sink_varslice(sink, &cbuf);
+		}
+	}
 
-	return tx_ser_size;
+	ser_sink_u32(sink, tx->nLockTime);
+}
+
+void bitc_tx_calc_wtxid(struct bitc_tx *tx)
+{
+	if (tx->wtxid_valid)
+		return;
+
+	if (!bitc_tx_has_witness(tx)) {
+		bitc_tx_calc_sha256(tx);
+		bu256_copy(&tx->wtxid, &tx->sha256);
+		tx->wtxid_valid = true;
+		return;
+	}
+
+	SHA256_CTX ctx;
+	struct bitc_sink sink;
+	bitc_sink_sha256_init(&sink, &ctx);
+
+	ser_sink_bitc_tx_witness(&sink, tx);
+
+	bitc_sink_sha256d(&sink, (unsigned char *) &tx->wtxid);
+	tx->wtxid_valid = true;
+}
+
+unsigned int bitc_tx_ser_size(const struct bitc_tx *tx)
+{
+	struct bitc_sink sink;
+	bitc_sink_count_init(&sink);
+
+	ser_sink_bitc_tx(&sink, tx);
+
+	return sink.len;
 }
 
 void bitc_tx_copy(struct bitc_tx *dest, const struct bitc_tx *src)
@@ -380,6 +543,8 @@ void bitc_tx_copy(struct bitc_tx *dest, const struct bitc_tx *src)
 	dest->nLockTime = src->nLockTime;
 	dest->sha256_valid = src->sha256_valid;
 	bu256_copy(&dest->sha256, &src->sha256);
+	dest->wtxid_valid = src->wtxid_valid;
+	bu256_copy(&dest->wtxid, &src->wtxid);
 
 	if (!src->vin)
 		dest->vin = NULL;
@@ -416,19 +581,285 @@ void bitc_tx_copy(struct bitc_tx *dest, const struct bitc_tx *src)
 	}
 }
 
-static bool bitc_has_dup_inputs(const struct bitc_tx *tx)
+static bool deser_bitc_txin_view(struct bitc_txin_view *txin,
+				 struct const_buffer *buf)
+{
+	if (!deser_bitc_outpt(&txin->prevout, buf)) return false;
+	if (!deser_varslice(&txin->scriptSig, buf)) return false;
+	if (!deser_u32(&txin->nSequence, buf)) return false;
+	return true;
+}
+
+static bool deser_txin_view_array(struct bitc_tx_view *tx,
+				  struct const_buffer *buf,
+				  struct bitc_arena *arena)
+{
+	uint32_t vlen;
+	if (!deser_varlen(&vlen, buf)) return false;
+	if (vlen > buf->len / MIN_TXIN_SZ)
+		return false;
+
+	tx->n_vin = vlen;
+	tx->vin = NULL;
+	if (!vlen)
+		return true;
+
+	tx->vin = bitc_arena_calloc(arena, vlen, sizeof(struct bitc_txin_view));
+	if (!tx->vin)
+		return false;
+
+	unsigned int i;
+	for (i = 0; i < vlen; i++)
+		if (!deser_bitc_txin_view(&tx->vin[i], buf))
+			return false;
+
+	return true;
+}
+
+static bool deser_txout_view_array(struct bitc_tx_view *tx,
+				   struct const_buffer *buf,
+				   struct bitc_arena *arena)
+{
+	uint32_t vlen;
+	if (!deser_varlen(&vlen, buf)) return false;
+	if (vlen > buf->len / MIN_TXOUT_SZ)
+		return false;
+
+	tx->n_vout = vlen;
+	tx->vout = NULL;
+	if (!vlen)
+		return true;
+
+	tx->vout = bitc_arena_calloc(arena, vlen, sizeof(struct bitc_txout_view));
+	if (!tx->vout)
+		return false;
+
+	unsigned int i;
+	for (i = 0; i < vlen; i++) {
+		struct bitc_txout_view *txout = &tx->vout[i];
+
+		if (!deser_s64(&txout->nValue, buf)) return false;
+		if (!deser_varslice(&txout->scriptPubKey, buf)) return false;
+	}
+
+	return true;
+}
+
+static bool deser_witness_view(struct bitc_txin_view *txin,
+			       struct const_buffer *buf,
+			       struct bitc_arena *arena)
 {
-	if (!tx->vin || !tx->vin->len || tx->vin->len == 1)
+	uint32_t vlen;
+	if (!deser_varlen(&vlen, buf)) return false;
+	if (vlen > buf->len)
 		return false;
 
-	struct bitc_txin *txin, *txin_tmp;
+	txin->n_witness = vlen;
+	txin->scriptWitness = NULL;
+	if (!vlen)
+		return true;
+
+	txin->scriptWitness = bitc_arena_calloc(arena, vlen,
+						sizeof(struct const_buffer));
+	if (!txin->scriptWitness)
+		return false;
+
+	unsigned int i;
+	for (i = 0; i < vlen; i++)
+		if (!deser_varslice(&txin->scriptWitness[i], buf))
+			return false;
+
+	return true;
+}
+
+bool deser_bitc_tx_view(struct bitc_tx_view *tx, struct const_buffer *buf,
+			struct bitc_arena *arena)
+{
+	memset(tx, 0, sizeof(*tx));
+
+	const unsigned char *start = buf->p;
+
+	if (!deser_u32(&tx->nVersion, buf)) return false;
+
+	const unsigned char *body = buf->p;
+
+	/* same dummy-vin / flags logic as deser_bitc_tx() */
+	unsigned char flags = 0;
+	if (!deser_txin_view_array(tx, buf, arena)) return false;
+
+	if (tx->n_vin == 0) {
+		deser_bytes(&flags, buf, 1);
+		if (flags != 0) {
+			body = buf->p;
+			if (!deser_txin_view_array(tx, buf, arena)) return false;
+			if (!deser_txout_view_array(tx, buf, arena)) return false;
+		}
+	} else {
+		if (!deser_txout_view_array(tx, buf, arena)) return false;
+	}
+
+	const unsigned char *body_end = buf->p;
+
+	if (flags & 1) {
+		flags ^= 1;
+
+		unsigned int i;
+		for (i = 0; i < tx->n_vin; i++)
+			if (!deser_witness_view(&tx->vin[i], buf, arena))
+				return false;
+	}
+	if (flags)
+		return false;
+
+	if (!deser_u32(&tx->nLockTime, buf)) return false;
+
+	tx->span.p = start;
+	tx->span.len = (const unsigned char *) buf->p - start;
+	tx->span.body_off = body - start;
+	tx->span.body_len = body_end - body;
+
+	return true;
+}
+
+void ser_sink_bitc_tx_view(struct bitc_sink *sink,
+			   const struct bitc_tx_view *tx)
+{
+	ser_sink_u32(sink, tx->nVersion);
+
+	unsigned int i;
+	ser_sink_varlen(sink, tx->n_vin);
+	for (i = 0; i < tx->n_vin; i++) {
+		const struct bitc_txin_view *txin = &tx->vin[i];
+
+		ser_sink_bitc_outpt(sink, &txin->prevout);
+		ser_sink_varslice(sink, &txin->scriptSig);
+		ser_sink_u32(sink, txin->nSequence);
+	}
+
+	ser_sink_varlen(sink, tx->n_vout);
+	for (i = 0; i < tx->n_vout; i++) {
+		const struct bitc_txout_view *txout = &tx->vout[i];
+
+		ser_sink_s64(sink, txout->nValue);
+		ser_sink_varslice(sink, &txout->scriptPubKey);
+	}
+
+	ser_sink_u32(sink, tx->nLockTime);
+}
+
+void ser_bitc_tx_view(cstring *s, const struct bitc_tx_view *tx)
+{
+	struct bitc_sink sink;
+	bitc_sink_cstr_init(&sink, s);
+	ser_sink_bitc_tx_view(&sink, tx);
+}
+
+void bitc_tx_view_calc_sha256(struct bitc_tx_view *tx)
+{
+	if (tx->sha256_valid)
+		return;
+
+	if (tx->span.p) {
+		bitc_tx_span_txid(&tx->sha256, &tx->span);
+	} else {
+		SHA256_CTX ctx;
+		struct bitc_sink sink;
+		bitc_sink_sha256_init(&sink, &ctx);
+
+		ser_sink_bitc_tx_view(&sink, tx);
+
+		bitc_sink_sha256d(&sink, (unsigned char *) &tx->sha256);
+	}
+
+	tx->sha256_valid = true;
+}
+
+void bitc_tx_view_calc_wtxid(struct bitc_tx_view *tx)
+{
+	if (tx->wtxid_valid)
+		return;
+
+	if (tx->span.p && bitc_tx_span_witness(&tx->span)) {
+		bitc_tx_span_wtxid(&tx->wtxid, &tx->span);
+	} else {
+		bitc_tx_view_calc_sha256(tx);
+		bu256_copy(&tx->wtxid, &tx->sha256);
+	}
+
+	tx->wtxid_valid = true;
+}
+
+/* deep-copy a view into an owning, mutable transaction */
+void bitc_tx_from_view(struct bitc_tx *dest, const struct bitc_tx_view *src)
+{
+	dest->nVersion = src->nVersion;
+	dest->nLockTime = src->nLockTime;
+	dest->sha256_valid = src->sha256_valid;
+	bu256_copy(&dest->sha256, &src->sha256);
+	dest->wtxid_valid = src->wtxid_valid;
+	bu256_copy(&dest->wtxid, &src->wtxid);
+
+	unsigned int i, j;
+
+	dest->vin = parr_new(src->n_vin, bitc_txin_freep);
+	for (i = 0; i < src->n_vin; i++) {
+		const struct bitc_txin_view *txin_view = &src->vin[i];
+		struct bitc_txin *txin;
+
+		txin = calloc(1, sizeof(*txin));
+		bitc_txin_init(txin);
+
+		bitc_outpt_copy(&txin->prevout, &txin_view->prevout);
+		txin->scriptSig = cstr_new_buf(txin_view->scriptSig.p,
+					       txin_view->scriptSig.len);
+		txin->nSequence = txin_view->nSequence;
+
+		if (txin_view->n_witness) {
+			txin->scriptWitness = parr_new(txin_view->n_witness,
+						       buffer_freep);
+			for (j = 0; j < txin_view->n_witness; j++) {
+				const struct const_buffer *item;
+
+				item = &txin_view->scriptWitness[j];
+				parr_add(txin->scriptWitness,
+					 buffer_copy(item->p, item->len));
+			}
+		}
+
+		parr_add(dest->vin, txin);
+	}
+
+	dest->vout = parr_new(src->n_vout, bitc_txout_freep);
+	for (i = 0; i < src->n_vout; i++) {
+		const struct bitc_txout_view *txout_view = &src->vout[i];
+		struct bitc_txout *txout;
+
+		txout = calloc(1, sizeof(*txout));
+		bitc_txout_init(txout);
+
+		txout->nValue = txout_view->nValue;
+		txout->scriptPubKey = cstr_new_buf(txout_view->scriptPubKey.p,
+						   txout_view->scriptPubKey.len);
+
+		parr_add(dest->vout, txout);
+	}
+}
+
+/* a few inputs are compared pairwise, more are sorted */
+enum {
+	DUP_INPUTS_PAIRWISE	= 8,
+	DUP_INPUTS_STACK	= 128,
+};
+
+static bool dup_inputs_pairwise(const struct bitc_tx *tx)
+{
 	unsigned int i, j;
+
 	for (i = 0; i < tx->vin->len; i++) {
-		txin = parr_idx(tx->vin, i);
-		for (j = 0; j < tx->vin->len; j++) {
-			if (i == j)
-				continue;
-			txin_tmp = parr_idx(tx->vin, j);
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+
+		for (j = i + 1; j < tx->vin->len; j++) {
+			struct bitc_txin *txin_tmp = parr_idx(tx->vin, j);
 
 			if (bitc_outpt_equal(&txin->prevout,
 					   &txin_tmp->prevout))
@@ -439,6 +870,52 @@ static bool bitc_has_dup_inputs(const struct bitc_tx *tx)
 	return false;
 }
 
+static int outpt_ptr_cmp(const void *a_, const void *b_)
+{
+	const struct bitc_outpt *a = *(const struct bitc_outpt * const *) a_;
+	const struct bitc_outpt *b = *(const struct bitc_outpt * const *) b_;
+	int cmp = memcmp(&a->hash, &b->hash, sizeof(a->hash));
+
+	if (cmp)
+		return cmp;
+	return (a->n > b->n) - (a->n < b->n);
+}
+
+/* O(n log n): sort the prevouts, then look for equal neighbours */
+static bool bitc_has_dup_inputs(const struct bitc_tx *tx)
+{
+	if (!tx->vin || tx->vin->len < 2)
+		return false;
+	if (tx->vin->len <= DUP_INPUTS_PAIRWISE)
+		return dup_inputs_pairwise(tx);
+
+	const struct bitc_outpt *stack_outpts[DUP_INPUTS_STACK];
+	const struct bitc_outpt **outpts = stack_outpts;
+	size_t n = tx->vin->len, i;
+	bool dup = false;
+
+	if (n > DUP_INPUTS_STACK) {
+		outpts = malloc(n * sizeof(*outpts));
+		if (!outpts)
+			return dup_inputs_pairwise(tx);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct bitc_txin *txin = parr_idx(tx->vin, i);
+
+		outpts[i] = &txin->prevout;
+	}
+
+	qsort(outpts, n, sizeof(*outpts), outpt_ptr_cmp);
+
+	for (i = 1; i < n && !dup; i++)
+		dup = bitc_outpt_equal(outpts[i - 1], outpts[i]);
+
+	if (outpts != stack_outpts)
+		free(outpts);
+	return dup;
+}
+
 bool bitc_tx_valid(const struct bitc_tx *tx)
 {
 	unsigned int i;
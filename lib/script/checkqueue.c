@@ -0,0 +1,367 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/script/checkqueue.h>     // for bitc_checkq, etc
+#include <bitc/parr.h>                  // for parr_idx
+
+#include <assert.h>                     // for assert
+#include <stdlib.h>                     // for calloc, free, malloc
+#include <string.h>                     // for memcpy, memset
+#include <unistd.h>                     // for sysconf
+
+enum {
+	CHECKQ_DEQUE_MIN	= 256,
+	CHECKQ_ARENA_CHUNK	= 1024 * 1024,
+};
+
+static bool deque_init(struct bitc_checkq_deque *d)
+{
+	memset(d, 0, sizeof(*d));
+
+	d->ring = malloc(CHECKQ_DEQUE_MIN * sizeof(*d->ring));
+	if (!d->ring)
+		return false;
+	d->cap = CHECKQ_DEQUE_MIN;
+
+	pthread_mutex_init(&d->lock, NULL);
+	return true;
+}
+
+static void deque_free(struct bitc_checkq_deque *d)
+{
+	pthread_mutex_destroy(&d->lock);
+	free(d->ring);
+	memset(d, 0, sizeof(*d));
+}
+
+static bool deque_push(struct bitc_checkq_deque *d, struct bitc_check *chk)
+{
+	bool rc = true;
+
+	pthread_mutex_lock(&d->lock);
+
+	if (d->tail - d->head == d->cap) {
+		struct bitc_check **ring = malloc(2 * d->cap * sizeof(*ring));
+		size_t i, n = d->tail - d->head;
+
+		if (!ring) {
+			rc = false;
+			goto out;
+		}
+
+		for (i = 0; i < n; i++)
+			ring[i] = d->ring[(d->head + i) & (d->cap - 1)];
+
+		free(d->ring);
+		d->ring = ring;
+		d->cap *= 2;
+		d->head = 0;
+		d->tail = n;
+	}
+
+	d->ring[d->tail++ & (d->cap - 1)] = chk;
+
+out:
+	pthread_mutex_unlock(&d->lock);
+	return rc;
+}
+
+/* the owner takes its newest check, a thief the oldest */
+static struct bitc_check *deque_pop(struct bitc_checkq_deque *d, bool steal)
+{
+	struct bitc_check *chk = NULL;
+
+	pthread_mutex_lock(&d->lock);
+
+	if (d->head != d->tail) {
+		if (steal)
+			chk = d->ring[d->head++ & (d->cap - 1)];
+		else
+			chk = d->ring[--d->tail & (d->cap - 1)];
+	}
+
+	pthread_mutex_unlock(&d->lock);
+	return chk;
+}
+
+static struct bitc_check *checkq_take(struct bitc_checkq *q, unsigned int id)
+{
+	unsigned int n_deques = q->n_workers + 1;
+	struct bitc_check *chk = deque_pop(&q->deques[id], false);
+	unsigned int i;
+
+	for (i = 1; !chk && i < n_deques; i++)
+		chk = deque_pop(&q->deques[(id + i) % n_deques], true);
+
+	if (chk)
+		__atomic_sub_fetch(&q->queued, 1, __ATOMIC_RELAXED);
+	return chk;
+}
+
+static void checkq_run(struct bitc_checkq *q, struct bitc_check *chk)
+{
+	/* once the batch has failed, the rest are only drained */
+	if (!__atomic_load_n(&q->failed, __ATOMIC_RELAXED)) {
+		struct bitc_txin *txin = parr_idx(chk->tx->vin, chk->nIn);
+
+		if (!bitc_script_verify_deferred(txin->scriptSig,
+						 &chk->scriptPubKey,
+						 &txin->scriptWitness, chk->tx,
+						 chk->nIn, chk->flags,
+						 chk->amount, chk->txdata,
+						 &q->batch))
+			__atomic_store_n(&q->failed, true, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_sub_fetch(&q->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_broadcast(&q->done_cv);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+/* with q->lock held */
+static bool checkq_sigs_unclaimed(const struct bitc_checkq *q)
+{
+	return q->sig_phase &&
+	       __atomic_load_n(&q->batch.next, __ATOMIC_RELAXED) < q->batch.len;
+}
+
+static void *checkq_worker(void *arg)
+{
+	struct bitc_checkq_worker *w = arg;
+	struct bitc_checkq *q = w->q;
+
+	for (;;) {
+		struct bitc_check *chk;
+
+		pthread_mutex_lock(&q->lock);
+		while (!q->quit &&
+		       __atomic_load_n(&q->queued, __ATOMIC_ACQUIRE) == 0 &&
+		       !checkq_sigs_unclaimed(q))
+			pthread_cond_wait(&q->work_cv, &q->lock);
+		bool quit = q->quit;
+		bool sigs = checkq_sigs_unclaimed(q);
+		if (sigs)
+			q->sig_workers++;
+		pthread_mutex_unlock(&q->lock);
+
+		if (quit)
+			break;
+
+		while ((chk = checkq_take(q, w->id)) != NULL)
+			checkq_run(q, chk);
+
+		/* counted, so the batch is not reset under us */
+		if (sigs) {
+			bitc_sigbatch_run(&q->batch);
+
+			pthread_mutex_lock(&q->lock);
+			if (--q->sig_workers == 0 &&
+			    bitc_sigbatch_done(&q->batch))
+				pthread_cond_broadcast(&q->done_cv);
+			pthread_mutex_unlock(&q->lock);
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned int checkq_auto_workers(void)
+{
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n_cpus > 1) ? (unsigned int) n_cpus - 1 : 0;
+}
+
+bool bitc_checkq_init(struct bitc_checkq *q, unsigned int n_workers)
+{
+	unsigned int i;
+
+	memset(q, 0, sizeof(*q));
+
+	if (n_workers == BITC_CHECKQ_AUTO)
+		n_workers = checkq_auto_workers();
+
+	q->deques = calloc(n_workers + 1, sizeof(*q->deques));
+	q->workers = calloc(n_workers + 1, sizeof(*q->workers));
+	if (!q->deques || !q->workers)
+		goto err_out;
+
+	for (i = 0; i < n_workers + 1; i++)
+		if (!deque_init(&q->deques[i]))
+			goto err_out;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->work_cv, NULL);
+	pthread_cond_init(&q->done_cv, NULL);
+	bitc_arena_init(&q->arena, CHECKQ_ARENA_CHUNK);
+	bitc_sigbatch_init(&q->batch);
+
+	for (i = 0; i < n_workers; i++) {
+		struct bitc_checkq_worker *w = &q->workers[i];
+
+		w->q = q;
+		w->id = i;
+		if (pthread_create(&w->thread, NULL, checkq_worker, w))
+			break;
+		q->n_workers++;
+	}
+
+	/* run with the threads we got; the caller's deque moves down */
+	for (i = q->n_workers + 1; i < n_workers + 1; i++)
+		deque_free(&q->deques[i]);
+
+	return true;
+
+err_out:
+	if (q->deques)
+		for (i = 0; i < n_workers + 1; i++)
+			if (q->deques[i].ring)
+				deque_free(&q->deques[i]);
+	free(q->deques);
+	free(q->workers);
+	memset(q, 0, sizeof(*q));
+	return false;
+}
+
+void bitc_checkq_free(struct bitc_checkq *q)
+{
+	unsigned int i;
+
+	if (!q->deques)
+		return;
+
+	assert(q->pending == 0);
+
+	pthread_mutex_lock(&q->lock);
+	q->quit = true;
+	pthread_cond_broadcast(&q->work_cv);
+	pthread_mutex_unlock(&q->lock);
+
+	for (i = 0; i < q->n_workers; i++)
+		pthread_join(q->workers[i].thread, NULL);
+
+	for (i = 0; i < q->n_workers + 1; i++)
+		deque_free(&q->deques[i]);
+
+	pthread_cond_destroy(&q->done_cv);
+	pthread_cond_destroy(&q->work_cv);
+	pthread_mutex_destroy(&q->lock);
+	bitc_arena_free(&q->arena);
+	bitc_sigbatch_free(&q->batch);
+
+	free(q->deques);
+	free(q->workers);
+	memset(q, 0, sizeof(*q));
+}
+
+void bitc_checkq_begin(struct bitc_checkq *q)
+{
+	assert(q->pending == 0);
+
+	bitc_arena_reset(&q->arena);
+	q->failed = false;
+	q->next = 0;
+
+	pthread_mutex_lock(&q->lock);
+	q->sig_phase = false;
+	bitc_sigbatch_reset(&q->batch);
+	pthread_mutex_unlock(&q->lock);
+}
+
+struct bitc_txdata *bitc_checkq_txdata(struct bitc_checkq *q,
+				       const struct bitc_tx *tx)
+{
+	struct bitc_txdata *txdata = bitc_arena_alloc(&q->arena,
+						      sizeof(*txdata));
+	if (!txdata)
+		return NULL;
+
+	bitc_txdata_init(txdata, tx);
+	bitc_txdata_fill(txdata);
+	return txdata;
+}
+
+bool bitc_checkq_add(struct bitc_checkq *q, const struct bitc_tx *tx,
+		     struct bitc_txdata *txdata, unsigned int nIn,
+		     const cstring *scriptPubKey, unsigned int flags,
+		     int64_t amount)
+{
+	if (__atomic_load_n(&q->failed, __ATOMIC_RELAXED))
+		return false;
+
+	struct bitc_check *chk = bitc_arena_alloc(&q->arena, sizeof(*chk));
+	char *script = bitc_arena_alloc(&q->arena, scriptPubKey->len + 1);
+	if (nIn >= tx->vin->len || !chk || !script)
+		return false;
+
+	memcpy(script, scriptPubKey->str, scriptPubKey->len);
+	script[scriptPubKey->len] = 0;
+
+	chk->tx = tx;
+	chk->txdata = txdata;
+	chk->scriptPubKey.str = script;
+	chk->scriptPubKey.len = scriptPubKey->len;
+	chk->scriptPubKey.alloc = scriptPubKey->len + 1;
+	chk->nIn = nIn;
+	chk->flags = flags;
+	chk->amount = amount;
+
+	__atomic_add_fetch(&q->pending, 1, __ATOMIC_RELAXED);
+
+	if (q->n_workers == 0) {
+		checkq_run(q, chk);
+		return !q->failed;
+	}
+
+	/* count it before it becomes visible, so no worker sleeps on it */
+	__atomic_add_fetch(&q->queued, 1, __ATOMIC_RELEASE);
+
+	unsigned int id = q->next++ % q->n_workers;
+	if (!deque_push(&q->deques[id], chk)) {
+		__atomic_sub_fetch(&q->queued, 1, __ATOMIC_RELAXED);
+		checkq_run(q, chk);
+		return !__atomic_load_n(&q->failed, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_signal(&q->work_cv);
+	pthread_mutex_unlock(&q->lock);
+
+	return true;
+}
+
+bool bitc_checkq_wait(struct bitc_checkq *q)
+{
+	struct bitc_check *chk;
+
+	while ((chk = checkq_take(q, q->n_workers)) != NULL)
+		checkq_run(q, chk);
+
+	pthread_mutex_lock(&q->lock);
+	while (__atomic_load_n(&q->pending, __ATOMIC_ACQUIRE) != 0)
+		pthread_cond_wait(&q->done_cv, &q->lock);
+
+	if (__atomic_load_n(&q->failed, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+
+	/* every script has run, so nothing more is added to the batch */
+	q->sig_phase = true;
+	pthread_cond_broadcast(&q->work_cv);
+	pthread_mutex_unlock(&q->lock);
+
+	bitc_sigbatch_run(&q->batch);
+
+	pthread_mutex_lock(&q->lock);
+	while (!bitc_sigbatch_done(&q->batch) || q->sig_workers != 0)
+		pthread_cond_wait(&q->done_cv, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+
+	return !__atomic_load_n(&q->batch.failed, __ATOMIC_ACQUIRE);
+}
@@ -7,6 +7,7 @@
 
 #define _GNU_SOURCE                     // for memmem
 
+#include <bitc/arena.h>                 // for bitc_arena_alloc, etc
 #include <bitc/compat.h>                // for parr_new
 #include <bitc/crypto/ripemd160.h>      // for RIPEMD160_DIGEST_LENGTH, etc
 #include <bitc/crypto/sha1.h>           // for sha1_Raw, etc
@@ -14,8 +15,10 @@
 #include <bitc/key.h>                   // for bitc_key_free, etc
 #include <bitc/script/interpreter.h>    // for ::SIGHASH_SINGLE, etc
 #include <bitc/script/script.h>         // for bscript_op, bsp_getop, etc
+#include <bitc/script/sigbatch.h>       // for bitc_sigbatch_add
+#include <bitc/script/sigcache.h>       // for bitc_sigcache_get, etc
 #include <bitc/serialize.h>             // for ser_u32, ser_varlen, etc
-#include <bitc/util.h>                  // for bn_getvch, bu_Hash, etc
+#include <bitc/util.h>                  // for bu_Hash, etc
 
 #include <assert.h>                     // for assert
 #include <stdint.h>                     // for int64_t, uint8_t, uint32_t, etc
@@ -24,30 +27,90 @@
 
 static const size_t nDefaultMaxNumSize = 4;
 
-static void string_find_del(cstring *s, const struct buffer *buf)
+// OP_IF nesting; each one counts against MAX_OPS_PER_SCRIPT
+enum { MAX_EXEC_DEPTH = 201 };
+
+/*
+ * FindAndDelete: remove every push of buf that starts on an opcode
+ * boundary of s.  A signature almost never occurs in the script it
+ * signs, so a plain byte search rules out the common case before the
+ * push is built or the script parsed.
+ */
+static bool find_del_candidate(const cstring *s, const struct buffer *buf)
+{
+	return buf->len ? memmem(s->str, s->len, buf->p, buf->len) != NULL
+			: memchr(s->str, OP_0, s->len) != NULL;
+}
+
+unsigned int bitc_script_find_del(cstring *s, const struct buffer *buf)
 {
+	unsigned int found = 0;
+
+	if (!find_del_candidate(s, buf))
+		return 0;
+
 	/* wrap buffer in a script */
 	cstring *script = cstr_new_sz(buf->len + 8);
 	bsp_push_data(script, buf->p, buf->len);
 
-	/* search for script, as a substring of 's' */
-	void *p;
-	unsigned int sublen = script->len;
-	while ((p = memmem(s->str, s->len, script->str, sublen)) != NULL) {
-		void *begin = s->str;
-		void *end = begin + s->len;
-		void *tail = p + sublen;
-		unsigned int tail_len = end - tail;
-		unsigned int new_len = s->len - sublen;
-
-		memmove(p, tail, tail_len);
-		cstr_resize(s, new_len);
-	}
+	/* compact s in place, one opcode at a time */
+	struct const_buffer it = { s->str, s->len };
+	struct bscript_parser bp;
+	struct bscript_op op;
+	const char *end = s->str + s->len;
+	const char *keep = s->str;
+	char *out = s->str;
+
+	bsp_start(&bp, &it);
+	do {
+		const char *pc = it.p;
+
+		memmove(out, keep, pc - keep);
+		out += pc - keep;
+
+		while ((size_t) (end - pc) >= script->len &&
+		       !memcmp(pc, script->str, script->len)) {
+			pc += script->len;
+			found++;
+		}
+
+		it.p = keep = pc;
+		it.len = end - pc;
+	} while (bsp_getop(&op, &bp));
+
+	memmove(out, keep, end - keep);
+	out += end - keep;
+	cstr_resize(s, out - s->str);
 
 	cstr_free(script, true);
+	return found;
+}
+
+/*
+ * scriptCode starts out as a view of the executing script and is
+ * copied only when a signature push has to be removed from it;
+ * release the result with script_code_free.
+ */
+static cstring *script_code_del(cstring *scriptCode, const cstring *view,
+				const struct buffer *sig)
+{
+	if (!find_del_candidate(scriptCode, sig))
+		return scriptCode;
+
+	if (scriptCode == view)
+		scriptCode = cstr_new_buf(view->str, view->len);
+	bitc_script_find_del(scriptCode, sig);
+	return scriptCode;
 }
 
-void bitc_tx_sigserializer(cstring *s, const cstring *scriptCode,
+static void script_code_free(cstring *scriptCode, const cstring *view)
+{
+	if (scriptCode != view)
+		cstr_free(scriptCode, true);
+}
+
+static void bitc_tx_sigserializer(struct bitc_sink *s,
+			const cstring *scriptCode,
 			const struct bitc_tx *txTo, unsigned int nIn,
 			int nHashType)
 {
@@ -57,11 +120,11 @@ void bitc_tx_sigserializer(cstring *s, const cstring *scriptCode,
 
     /** Serialize txTo */
     // Serialize nVersion
-    ser_u32(s, txTo->nVersion);
+    ser_sink_u32(s, txTo->nVersion);
 
     // Serialize vin
     unsigned int nInputs = fAnyoneCanPay ? 1 : txTo->vin->len;
-    ser_varlen(s, nInputs);
+    ser_sink_varlen(s, nInputs);
 
 	unsigned int nInput;
 	for (nInput = 0; nInput < nInputs; nInput++) {
@@ -73,14 +136,14 @@ void bitc_tx_sigserializer(cstring *s, const cstring *scriptCode,
 		struct bitc_txin *txin = parr_idx(txTo->vin, nInput);
 
 		// Serialize the prevout
-		ser_bitc_outpt(s, &txin->prevout);
+		ser_sink_bitc_outpt(s, &txin->prevout);
 
 		// Serialize the script
 		if (nInput != nIn)
 			// Blank out other inputs' signatures
-			ser_varlen(s, (int)0);
+			ser_sink_varlen(s, (int)0);
 		else if (scriptCode == NULL)
-		    cstr_append_c(s, 0);
+		    ser_sink_varlen(s, 0);
 		else {
 			/** Serialize the passed scriptCode, skipping OP_CODESEPARATORs */
 			struct const_buffer it = { scriptCode->str, scriptCode->len };
@@ -95,151 +158,219 @@ void bitc_tx_sigserializer(cstring *s, const cstring *scriptCode,
 				if (op.op == OP_CODESEPARATOR)
 				    nCodeSeparators++;
 			}
-			ser_varlen(s, scriptCode->len - nCodeSeparators);
+			ser_sink_varlen(s, scriptCode->len - nCodeSeparators);
 
 			it = itBegin;
 			bsp_start(&bp, &it);
 
 			while (bsp_getop(&op, &bp)) {
 			    if (op.op == OP_CODESEPARATOR) {
-					ser_bytes(s, itBegin.p, it.p - itBegin.p - 1);
+					ser_sink_bytes(s, itBegin.p, it.p - itBegin.p - 1);
 					itBegin  = it;
 			    }
 			}
 
 			if (itBegin.p != scriptCode->str + scriptCode->len)
-			    ser_bytes(s, itBegin.p, it.p - itBegin.p);
+			    ser_sink_bytes(s, itBegin.p, it.p - itBegin.p);
 		}
 
 		// Serialize the nSequence
 		if ((nInput != nIn) && (fHashSingle || fHashNone))
 			// let the others update at will
-			ser_u32(s, (int)0);
+			ser_sink_u32(s, (int)0);
 		else
-			ser_u32(s, txin->nSequence);
+			ser_sink_u32(s, txin->nSequence);
 	}
 
         // Serialize vout
         unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? (nIn + 1) : txTo->vout->len);
-        ser_varlen(s, nOutputs);
+        ser_sink_varlen(s, nOutputs);
 
 	unsigned int nOutput;
         for (nOutput = 0; nOutput < nOutputs; nOutput++) {
 		struct bitc_txout *txout = parr_idx(txTo->vout, nOutput);
 		if (fHashSingle && (nOutput != nIn)) {
 			// Do not lock-in the txout payee at other indices as txin;
-			ser_s64(s, (int)-1);
-			ser_varlen(s, 0);
+			ser_sink_s64(s, (int)-1);
+			ser_sink_varlen(s, 0);
 		} else {
-		    ser_bitc_txout(s, txout);
+		    ser_sink_bitc_txout(s, txout);
 		}
         }
         // Serialize nLockTime
-        ser_u32(s, txTo->nLockTime);
+        ser_sink_u32(s, txTo->nLockTime);
 }
 
-void bitc_tx_sighash(bu256_t* hash, const cstring* scriptCode, const struct bitc_tx* txTo,
-        unsigned int nIn,  int nHashType, int64_t amount, enum SigVersion sigversion)
+static void txdata_hash_prevouts(struct bitc_txdata *txdata)
+{
+    SHA256_CTX ctx;
+    struct bitc_sink sink;
+    unsigned int i;
+
+    bitc_sink_sha256_init(&sink, &ctx);
+    for (i = 0; i < txdata->tx->vin->len; i++) {
+        struct bitc_txin* txin = parr_idx(txdata->tx->vin, i);
+        ser_sink_bitc_outpt(&sink, &txin->prevout);
+    }
+    bitc_sink_sha256d(&sink, (unsigned char*)&txdata->hashPrevouts);
+    txdata->have_prevouts = true;
+}
+
+static void txdata_hash_sequence(struct bitc_txdata *txdata)
+{
+    SHA256_CTX ctx;
+    struct bitc_sink sink;
+    unsigned int i;
+
+    bitc_sink_sha256_init(&sink, &ctx);
+    for (i = 0; i < txdata->tx->vin->len; i++) {
+        struct bitc_txin* txin = parr_idx(txdata->tx->vin, i);
+        ser_sink_u32(&sink, txin->nSequence);
+    }
+    bitc_sink_sha256d(&sink, (unsigned char*)&txdata->hashSequence);
+    txdata->have_sequence = true;
+}
+
+static void txdata_hash_outputs(struct bitc_txdata *txdata)
+{
+    SHA256_CTX ctx;
+    struct bitc_sink sink;
+    unsigned int i;
+
+    bitc_sink_sha256_init(&sink, &ctx);
+    for (i = 0; i < txdata->tx->vout->len; i++)
+        ser_sink_bitc_txout(&sink, parr_idx(txdata->tx->vout, i));
+    bitc_sink_sha256d(&sink, (unsigned char*)&txdata->hashOutputs);
+    txdata->have_outputs = true;
+}
+
+void bitc_txdata_fill(struct bitc_txdata *txdata)
 {
-    cstring* s = cstr_new_sz(512);
+    unsigned int i;
+
+    // only v0 witness programs use these, and those need a witness
+    for (i = 0; i < txdata->tx->vin->len; i++) {
+        struct bitc_txin* txin = parr_idx(txdata->tx->vin, i);
+        if (txin->scriptWitness && txin->scriptWitness->len)
+            break;
+    }
+    if (i == txdata->tx->vin->len)
+        return;
+
+    if (!txdata->have_prevouts)
+        txdata_hash_prevouts(txdata);
+    if (!txdata->have_sequence)
+        txdata_hash_sequence(txdata);
+    if (!txdata->have_outputs)
+        txdata_hash_outputs(txdata);
+}
 
+static void bitc_tx_sighash_v0(bu256_t* hash, const cstring* scriptCode,
+        const struct bitc_tx* txTo, unsigned int nIn, int nHashType,
+        int64_t amount, struct bitc_txdata *txdata)
+{
+    const bool fAnyoneCanPay = (!!(nHashType & SIGHASH_ANYONECANPAY));
+    const bool fHashSingle = ((nHashType & 0x1f) == SIGHASH_SINGLE);
+    const bool fHashNone = ((nHashType & 0x1f) == SIGHASH_NONE);
+    bu256_t zero, hashOutputs;
+    const bu256_t *hashPrevouts = &zero, *hashSequence = &zero;
+    const bu256_t *pOutputs = &zero;
+    SHA256_CTX ctx;
+    struct bitc_sink sink;
+
+    memset(&zero, 0, sizeof(zero));
+
+    if (!fAnyoneCanPay) {
+        if (!txdata->have_prevouts)
+            txdata_hash_prevouts(txdata);
+        hashPrevouts = &txdata->hashPrevouts;
+    }
+
+    if (!fAnyoneCanPay && !fHashSingle && !fHashNone) {
+        if (!txdata->have_sequence)
+            txdata_hash_sequence(txdata);
+        hashSequence = &txdata->hashSequence;
+    }
+
+    if (!fHashSingle && !fHashNone) {
+        if (!txdata->have_outputs)
+            txdata_hash_outputs(txdata);
+        pOutputs = &txdata->hashOutputs;
+    } else if (fHashSingle && nIn < txTo->vout->len) {
+        // SIGHASH_SINGLE commits to the output paired with this input only
+        bitc_sink_sha256_init(&sink, &ctx);
+        ser_sink_bitc_txout(&sink, parr_idx(txTo->vout, nIn));
+        bitc_sink_sha256d(&sink, (unsigned char*)&hashOutputs);
+        pOutputs = &hashOutputs;
+    }
+
+    bitc_sink_sha256_init(&sink, &ctx);
+    // Version
+    ser_sink_u32(&sink, txTo->nVersion);
+    // Input prevouts/nSequence (none/all, depending on flags)
+    ser_sink_u256(&sink, hashPrevouts);
+    ser_sink_u256(&sink, hashSequence);
+    // The input being signed (replacing the scriptSig with scriptCode + amount)
+    // The prevout may already be contained in hashPrevout, and the nSequence
+    // may already be contain in hashSequence.
+    struct bitc_txin* txin = parr_idx(txTo->vin, nIn);
+    ser_sink_bitc_outpt(&sink, &txin->prevout);
+    ser_sink_varstr(&sink, scriptCode);
+    ser_sink_s64(&sink, amount);
+    ser_sink_u32(&sink, txin->nSequence);
+    // Outputs (none/one/all, depending on flags)
+    ser_sink_u256(&sink, pOutputs);
+    // Locktime
+    ser_sink_u32(&sink, txTo->nLockTime);
+    // Sighash type
+    ser_sink_s32(&sink, nHashType);
+
+    bitc_sink_sha256d(&sink, (unsigned char*)hash);
+}
+
+void bitc_tx_sighash(bu256_t* hash, const cstring* scriptCode, const struct bitc_tx* txTo,
+        unsigned int nIn,  int nHashType, int64_t amount, enum SigVersion sigversion,
+        struct bitc_txdata *txdata)
+{
     if (sigversion == SIGVERSION_WITNESS_V0) {
-        bu256_t* hashPrevouts = bu256_new(NULL);
-        bu256_t* hashSequence = bu256_new(NULL);
-        bu256_t* hashOutputs = bu256_new(NULL);
-
-        if (!(nHashType & SIGHASH_ANYONECANPAY)) {
-            cstring* s_prevout = cstr_new_sz(512);
-            struct bitc_txin* txin;
-            unsigned int i;
-            for (i = 0; i < txTo->vin->len; i++) {
-                txin = parr_idx(txTo->vin, i);
-                // Serialize the prevout
-                ser_bitc_outpt(s_prevout, &txin->prevout);
-            }
-            bu_Hash((unsigned char*)hashPrevouts, s_prevout->str, s_prevout->len);
-            cstr_free(s_prevout, true);
-        }
+        struct bitc_txdata local;
 
-        if (!(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE &&
-            (nHashType & 0x1f) != SIGHASH_NONE) {
-            cstring* s_seq = cstr_new_sz(512);
-            struct bitc_txin* txin;
-            unsigned int i;
-            for (i = 0; i < txTo->vin->len; i++) {
-                txin = parr_idx(txTo->vin, i);
-                // Serialize the nSequence
-                ser_u32(s_seq, txin->nSequence);
-            }
-            bu_Hash((unsigned char*)hashSequence, s_seq->str, s_seq->len);
-            cstr_free(s_seq, true);
+        if (!txdata) {
+            bitc_txdata_init(&local, txTo);
+            txdata = &local;
         }
+        assert(txdata->tx == txTo);
 
-        if ((nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            cstring* s_out = cstr_new_sz(512);
-            struct bitc_txout* txout;
-            unsigned int i;
-            for (i = 0; i < txTo->vout->len; i++) {
-                txout = parr_idx(txTo->vout, i);
-                ser_bitc_txout(s_out, txout);
-            }
-            bu_Hash((unsigned char*)hashOutputs, s_out->str, s_out->len);
-            cstr_free(s_out, true);
-        } else if ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn < txTo->vout->len) {
-            cstring* s_out = cstr_new_sz(512);
-            struct bitc_txout* txout = parr_idx(txTo->vout, nIn);
-            ser_bitc_txout(s_out, txout);
-            bu_Hash((unsigned char*)hashOutputs, s_out->str, s_out->len);
-            cstr_free(s_out, true);
-        }
+        bitc_tx_sighash_v0(hash, scriptCode, txTo, nIn, nHashType, amount, txdata);
+        return;
+    }
 
-        // Version
-        ser_u32(s, txTo->nVersion);
-        // Input prevouts/nSequence (none/all, depending on flags)
-        ser_u256(s, hashPrevouts);
-        ser_u256(s, hashSequence);
-        // The input being signed (replacing the scriptSig with scriptCode + amount)
-        // The prevout may already be contained in hashPrevout, and the nSequence
-        // may already be contain in hashSequence.
-        struct bitc_txin* txin = parr_idx(txTo->vin, nIn);
-        ser_bitc_outpt(s, &txin->prevout);
-        ser_varstr(s, (struct cstring*)scriptCode);
-        ser_s64(s, amount);
-        ser_u32(s, txin->nSequence);
-        // Outputs (none/one/all, depending on flags)
-        ser_u256(s, hashOutputs);
-        // Locktime
-        ser_u32(s, txTo->nLockTime);
-
-        bu256_freep(hashPrevouts);
-        bu256_freep(hashSequence);
-        bu256_freep(hashOutputs);
-    } else {
-        if (nIn >= txTo->vin->len) {
-            //  nIn out of range
-            bu256_set_u64(hash, 1);
-            goto out;
-        }
+    if (nIn >= txTo->vin->len) {
+        //  nIn out of range
+        bu256_set_u64(hash, 1);
+        return;
+    }
 
-        // Check for invalid use of SIGHASH_SINGLE
-        if ((nHashType & 0x1f) == SIGHASH_SINGLE) {
-            if (nIn >= txTo->vout->len) {
-                //  nOut out of range
-                bu256_set_u64(hash, 1);
-                goto out;
-            }
+    // Check for invalid use of SIGHASH_SINGLE
+    if ((nHashType & 0x1f) == SIGHASH_SINGLE) {
+        if (nIn >= txTo->vout->len) {
+            //  nOut out of range
+            bu256_set_u64(hash, 1);
+            return;
         }
-        // Serialize only the necessary parts of the transaction being signed
-        bitc_tx_sigserializer(s, scriptCode, txTo, nIn, nHashType);
     }
 
-    // Sighash type
-    ser_s32(s, nHashType);
+    SHA256_CTX ctx;
+    struct bitc_sink sink;
+    bitc_sink_sha256_init(&sink, &ctx);
 
-    bu_Hash((unsigned char*)hash, s->str, s->len);
+    // Serialize only the necessary parts of the transaction being signed
+    bitc_tx_sigserializer(&sink, scriptCode, txTo, nIn, nHashType);
 
-out:
-    cstr_free(s, true);
+    // Sighash type
+    ser_sink_s32(&sink, nHashType);
+
+    bitc_sink_sha256d(&sink, (unsigned char*)hash);
 }
 
 static const unsigned char disabled_op[256] = {
@@ -260,36 +391,6 @@ static const unsigned char disabled_op[256] = {
 	[OP_RSHIFT] = 1,
 };
 
-static bool CastToBigNum(mpz_t vo, const struct buffer *buf, bool fRequireMinimal, const size_t nMaxNumSize)
-{
-	if (buf->len > nMaxNumSize)
-		return false;
-
-	const unsigned char *vch = buf->p;
-
-	if (fRequireMinimal && buf->len > 0) {
-		// Check that the number is encoded with the minimum possible
-		// number of bytes.
-		//
-		// If the most-significant-byte - excluding the sign bit - is zero
-		// then we're not minimal. Note how this test also rejects the
-		// negative-zero encoding, 0x80.
-		if ((vch[buf->len - 1] & 0x7f) == 0) {
-			// One exception: if there's more than one byte and the most
-			// significant bit of the second-most-significant-byte is set
-			// it would conflict with the sign bit. An example of this case
-			// is +-255, which encode to 0xff00 and 0xff80 respectively.
-			// (big-endian).
-			if (buf->len <= 1 || (vch[buf->len - 2] & 0x80) == 0) {
-				return false;
-			}
-		}
-	}
-	bn_setvch(vo, buf->p, buf->len);
-
-	return true;
-}
-
 static bool CastToBool(const struct buffer *buf)
 {
 	unsigned int i;
@@ -305,101 +406,341 @@ static bool CastToBool(const struct buffer *buf)
 	return false;
 }
 
-static void stack_insert(parr *stack, const struct buffer *buf, int index_)
+/*
+ * Script stack.  Elements of up to STACK_INLINE_SIZE bytes (every
+ * signature, public key, hash and number) are stored in the element
+ * itself; larger ones are copied into an arena that lives as long as
+ * the verification.  Elements are never modified in place, so copying
+ * an arena-backed element between stacks sharing the arena only
+ * copies the pointer.  The first STACK_LOCAL_ELEMS slots are part of
+ * the stack object, so standard scripts never touch the heap.
+ */
+enum {
+	STACK_INLINE_SIZE	= 75,
+	STACK_LOCAL_ELEMS	= 16,
+};
+
+struct stack_elem {
+	struct buffer		buf;		// p is data when inline
+	unsigned char		data[STACK_INLINE_SIZE];
+};
+
+struct script_stack {
+	struct stack_elem	*elems;
+	unsigned int		len;
+	unsigned int		alloc;
+	bool			oom;		// an element was lost
+	struct bitc_arena	*arena;
+	struct stack_elem	local[STACK_LOCAL_ELEMS];
+};
+
+static void stack_init(struct script_stack *stack, struct bitc_arena *arena)
+{
+	stack->elems = stack->local;
+	stack->len = 0;
+	stack->alloc = STACK_LOCAL_ELEMS;
+	stack->oom = false;
+	stack->arena = arena;
+}
+
+static void elem_move(struct stack_elem *dst, const struct stack_elem *src)
+{
+	if (src->buf.p == src->data) {
+		memcpy(dst->data, src->data, src->buf.len);
+		dst->buf.p = dst->data;
+	} else
+		dst->buf.p = src->buf.p;
+	dst->buf.len = src->buf.len;
+}
+
+static void elem_set(struct script_stack *stack, struct stack_elem *e,
+		     const void *p, size_t len)
 {
-	int index = stack->len + index_;
-	parr_add(stack, NULL);
-	memmove(&stack->data[index + 1], &stack->data[index],
-		sizeof(void *) * (stack->len - index - 1));
-	stack->data[index] = buffer_copy(buf->p, buf->len);
+	void *data = e->data;
+
+	if (len > STACK_INLINE_SIZE) {
+		data = bitc_arena_alloc(stack->arena, len);
+		if (!data) {
+			stack->oom = true;
+			data = e->data;
+			len = 0;
+		}
+	}
+
+	if (len)
+		memcpy(data, p, len);
+	e->buf.p = data;
+	e->buf.len = len;
 }
 
-static void stack_push(parr *stack, const struct buffer *buf)
+static struct stack_elem *stack_grow(struct script_stack *stack)
 {
-    parr_add(stack, buffer_copy(buf->p, buf->len));
+	if (stack->len == stack->alloc) {
+		unsigned int alloc = stack->alloc * 2, i;
+		struct stack_elem *elems = bitc_arena_alloc(stack->arena,
+						alloc * sizeof(*elems));
+		if (!elems) {
+			stack->oom = true;
+			return NULL;
+		}
+
+		for (i = 0; i < stack->len; i++)
+			elem_move(&elems[i], &stack->elems[i]);
+
+		stack->elems = elems;
+		stack->alloc = alloc;
+	}
+
+	return &stack->elems[stack->len++];
 }
 
-static void stack_push_nocopy(parr *stack, struct buffer *buf)
+/* push a copy of data from outside the stack */
+static void stack_push(struct script_stack *stack, const struct buffer *buf)
 {
-	parr_add(stack, buf);
+	struct stack_elem *e = stack_grow(stack);
+
+	if (e)
+		elem_set(stack, e, buf->p, buf->len);
 }
 
-static void stack_push_char(parr *stack, unsigned char ch)
+static void stack_push_num(struct script_stack *stack, scriptnum v)
 {
-	parr_add(stack, buffer_copy(&ch, 1));
+	unsigned char vch[SCRIPTNUM_MAX_SIZE];
+	struct buffer buf = { vch, scriptnum_encode(vch, v) };
+
+	stack_push(stack, &buf);
+}
+
+static struct stack_elem *stack_elem(struct script_stack *stack, int index)
+{
+	return &stack->elems[(int) stack->len + index];
+}
+
+static struct buffer *stacktop(struct script_stack *stack, int index)
+{
+	return &stack_elem(stack, index)->buf;
 }
 
-static void stack_push_str(parr *stack, cstring *s)
+/* push a copy of an element of this or another stack on the same arena */
+static void stack_push_elem(struct script_stack *stack,
+			    struct script_stack *src, int index)
 {
-	parr_add(stack, buffer_copy(s->str, s->len));
-	cstr_free(s, true);
+	/* the source may be in the slots stack_grow replaces; those
+	 * remain readable until the arena goes
+	 */
+	struct stack_elem *from = stack_elem(src, index);
+	struct stack_elem *e = stack_grow(stack);
+
+	if (e)
+		elem_move(e, from);
 }
 
-static void stack_copy(parr *dest, const parr *src)
+static void stack_copy(struct script_stack *dest, struct script_stack *src)
 {
 	unsigned int i;
+
 	for (i = 0; i < src->len; i++)
-		stack_push(dest, parr_idx(src, i));
+		stack_push_elem(dest, src, (int) i - (int) src->len);
+}
+
+static int stackint(struct script_stack *stack, int index, bool fRequireMinimal)
+{
+	scriptnum bn;
+
+	if (!scriptnum_decode(&bn, stacktop(stack, index), fRequireMinimal,
+			      nDefaultMaxNumSize))
+		return -1;
+
+	return bn;
 }
 
-static struct buffer *stacktop(parr *stack, int index)
+static void popstack(struct script_stack *stack)
 {
-	return stack->data[stack->len + index];
+	assert(stack->len > 0);
+	stack->len--;
 }
 
-static int stackint(parr *stack, int index, bool fRequireMinimal)
+static void stack_swap(struct script_stack *stack, int idx1, int idx2)
 {
-	struct buffer *buf = stacktop(stack, index);
-	mpz_t bn;
-	mpz_init(bn);
+	struct stack_elem tmp;
 
-	int ret = -1;
+	elem_move(&tmp, stack_elem(stack, idx1));
+	elem_move(stack_elem(stack, idx1), stack_elem(stack, idx2));
+	elem_move(stack_elem(stack, idx2), &tmp);
+}
 
-	if (!CastToBigNum(bn, buf, fRequireMinimal, nDefaultMaxNumSize))
-		goto out;
+/* move the element at index to the top, the ones above it down one */
+static void stack_roll(struct script_stack *stack, int index)
+{
+	struct stack_elem tmp;
+	int i;
 
-	ret = mpz_get_si(bn);
+	elem_move(&tmp, stack_elem(stack, index));
+	for (i = index; i < -1; i++)
+		elem_move(stack_elem(stack, i), stack_elem(stack, i + 1));
+	elem_move(stack_elem(stack, -1), &tmp);
+}
 
-out:
-	mpz_clear(bn);
-	return ret;
+static void stack_remove(struct script_stack *stack, int index)
+{
+	stack_roll(stack, index);
+	popstack(stack);
 }
 
-static struct buffer *stack_take(parr *stack, int index)
+/* insert a copy of the top element below index */
+static void stack_insert_top(struct script_stack *stack, int index)
 {
-	struct buffer *ret = stack->data[stack->len + index];
-	stack->data[stack->len + index] = NULL;
-	return ret;
+	stack_push_elem(stack, stack, -1);
+	if (stack->oom)
+		return;
+
+	/* ... a b c c  ->  ... c a b c */
+	struct stack_elem tmp;
+	int i;
+
+	elem_move(&tmp, stack_elem(stack, -1));
+	for (i = -1; i > index - 1; i--)
+		elem_move(stack_elem(stack, i), stack_elem(stack, i - 1));
+	elem_move(stack_elem(stack, index - 1), &tmp);
 }
 
-static void popstack(parr *stack)
+/*
+ * Scripts are decoded into an array of ops before they run.  Anything
+ * that fails a script wherever it appears, executed or not, fails the
+ * decode: a truncated push, an element over MAX_SCRIPT_ELEMENT_SIZE, a
+ * disabled opcode, OP_VERIF/OP_VERNOTIF or too many non-push ops.  Each
+ * OP_IF, OP_NOTIF and OP_ELSE records its matching OP_ELSE or OP_ENDIF,
+ * so a branch not taken is jumped over and every op the interpreter
+ * visits executes.
+ */
+enum {
+	SCRIPT_LOCAL_OPS	= 32,
+	SCRIPT_NO_JUMP		= 0xffff,	// IF/ELSE never closed
+};
+
+struct script_op {
+	const unsigned char	*data;		// push data
+	uint16_t		len;
+	uint8_t			op;
+	uint16_t		jump;		// IF/NOTIF/ELSE: next ELSE/ENDIF
+	uint16_t		end;		// script offset past this op
+};
+
+struct script_code {
+	struct script_op	*ops;
+	unsigned int		len;
+	unsigned int		alloc;
+	unsigned int		nOpCount;	// non-push ops in the script
+	struct script_op	local[SCRIPT_LOCAL_OPS];
+};
+
+static struct script_op *script_code_grow(struct script_code *code,
+					  struct bitc_arena *arena)
 {
-	assert(stack->len > 0);
-	parr_remove_idx(stack, stack->len - 1);
+	if (code->len == code->alloc) {
+		unsigned int alloc = code->alloc * 2;
+		struct script_op *ops = bitc_arena_alloc(arena,
+						alloc * sizeof(*ops));
+		if (!ops)
+			return NULL;
+
+		memcpy(ops, code->ops, code->len * sizeof(*ops));
+		code->ops = ops;
+		code->alloc = alloc;
+	}
+
+	return &code->ops[code->len++];
 }
 
-static void stack_swap(parr *stack, int idx1, int idx2)
+static bool script_decode(struct script_code *code, const cstring *script,
+			  struct bitc_arena *arena)
 {
-	int len = stack->len;
-	struct buffer *tmp = stack->data[len + idx1];
-	stack->data[len + idx1] = stack->data[len + idx2];
-	stack->data[len + idx2] = tmp;
+	struct const_buffer pc = { script->str, script->len };
+	struct bscript_parser bp;
+	struct bscript_op op;
+	uint16_t open[MAX_EXEC_DEPTH];		// unclosed IF/ELSE
+	unsigned int nOpen = 0, nOpCount = 0;
+
+	code->ops = code->local;
+	code->len = 0;
+	code->alloc = SCRIPT_LOCAL_OPS;
+
+	if (script->len > MAX_SCRIPT_SIZE)
+		return false;
+
+	bsp_start(&bp, &pc);
+	while (bsp_getop(&op, &bp)) {
+		enum opcodetype opcode = op.op;
+
+		if (op.data.len > MAX_SCRIPT_ELEMENT_SIZE)
+			return false;
+		if (opcode > OP_16 && ++nOpCount > MAX_OPS_PER_SCRIPT)
+			return false;
+		if (disabled_op[opcode] ||
+		    opcode == OP_VERIF || opcode == OP_VERNOTIF)
+			return false;
+
+		unsigned int idx = code->len;
+		struct script_op *sop = script_code_grow(code, arena);
+		if (!sop)
+			return false;
+
+		sop->data = op.data.p;
+		sop->len = op.data.len;
+		sop->op = opcode;
+		sop->jump = SCRIPT_NO_JUMP;
+		sop->end = (const char *) pc.p - script->str;
+
+		switch (opcode) {
+		case OP_IF:
+		case OP_NOTIF:
+			open[nOpen++] = idx;
+			break;
+		case OP_ELSE:
+			if (nOpen) {
+				code->ops[open[nOpen - 1]].jump = idx;
+				open[nOpen - 1] = idx;
+			}
+			break;
+		case OP_ENDIF:
+			if (nOpen)
+				code->ops[open[--nOpen]].jump = idx;
+			break;
+		default:
+			break;
+		}
+	}
+
+	code->nOpCount = nOpCount;
+	return !bp.error;
 }
 
-static unsigned int count_false(cstring *vfExec)
+/*
+ * Jump over the branch that starts after the OP_IF, OP_NOTIF or OP_ELSE
+ * at *pc.  An OP_ELSE landed on starts the next branch, an OP_ENDIF
+ * closes the OP_IF; an OP_IF that is never closed can't succeed.
+ */
+static bool skip_branch(const struct script_code *code, unsigned int *pc,
+			unsigned int *nExec)
 {
-	unsigned int i, count = 0;
+	unsigned int jump = code->ops[*pc].jump;
 
-	for (i = 0; i < vfExec->len; i++)
-		if (vfExec->str[i] == 0)
-			count++;
+	if (jump == SCRIPT_NO_JUMP)
+		return false;
 
-	return count;
+	if (code->ops[jump].op == OP_ENDIF)
+		(*nExec)--;
+	*pc = jump;
+	return true;
 }
 
+/* with a batch, a signature that is not in the cache is queued there
+ * and passes for now; only for callers that fail on any bad signature
+ */
 static bool bitc_checksig(const struct buffer* vchSigIn, const struct buffer* vchPubKey,
         const cstring* scriptCode, const struct bitc_tx* txTo, unsigned int nIn,
-        int64_t amount, enum SigVersion sigversion)
+        int64_t amount, enum SigVersion sigversion, struct bitc_txdata *txdata,
+        struct bitc_sigbatch *batch)
 {
     if (!vchSigIn || !vchPubKey || !scriptCode || !txTo || !vchSigIn->len || !vchPubKey->len ||
         !scriptCode->len)
@@ -412,7 +753,15 @@ static bool bitc_checksig(const struct buffer* vchSigIn, const struct buffer* vc
 
     /* calculate signature hash of transaction */
     bu256_t sighash;
-    bitc_tx_sighash(&sighash, scriptCode, txTo, nIn, nHashType, amount, sigversion);
+    bitc_tx_sighash(&sighash, scriptCode, txTo, nIn, nHashType, amount, sigversion,
+                    txdata);
+
+    /* seen and verified before? */
+    if (bitc_sigcache_get(&sighash, vchPubKey, &vchSig))
+        return true;
+
+    if (batch && bitc_sigbatch_add(batch, &sighash, vchPubKey, &vchSig))
+        return true;
 
     /* verify signature hash */
     struct bitc_key pubkey;
@@ -423,6 +772,7 @@ static bool bitc_checksig(const struct buffer* vchSigIn, const struct buffer* vc
     if (!bitc_verify(&pubkey, &sighash, sizeof(sighash), vchSig.p, vchSig.len))
         goto out;
 
+    bitc_sigcache_add(&sighash, vchPubKey, &vchSig);
     rc = true;
 
 out:
@@ -710,49 +1060,38 @@ bool CheckSequence(const unsigned int nSequence, const struct bitc_tx *txTo, uns
 	return true;
 }
 
-static bool bitc_script_eval(parr* stack, const cstring* script, const struct bitc_tx* txTo,
-        unsigned int nIn, unsigned int flags, int64_t amount, enum SigVersion sigversion)
+static bool bitc_script_eval(struct script_stack* stack, const cstring* script, const struct bitc_tx* txTo,
+        unsigned int nIn, unsigned int flags, int64_t amount, enum SigVersion sigversion,
+        struct bitc_txdata *txdata)
 {
-	struct const_buffer pc = { script->str, script->len };
-	struct const_buffer pend = { script->str + script->len, 0 };
 	struct const_buffer pbegincodehash = { script->str, script->len };
-	struct bscript_op op;
+	struct script_code code;
 	bool rc = false;
-	cstring *vfExec = cstr_new(NULL);
-	parr *altstack = parr_new(0, buffer_freep);
-	mpz_t bn, bn_Zero, bn_One;
-	mpz_init(bn);
-	mpz_init_set_ui(bn_Zero, 0);
-	mpz_init_set_ui(bn_One,1);
-
-	if (script->len > MAX_SCRIPT_SIZE)
-		goto out;
+	struct script_stack altstack;
+	scriptnum bn;
 
-	unsigned int nOpCount = 0;
-	bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+	// open OP_IFs; any op visited runs, so no per-branch state is kept
+	unsigned int nExec = 0;
+	unsigned int nKeyOps = 0;		// CHECKMULTISIG keys, counted as ops
 
-	struct bscript_parser bp;
-	bsp_start(&bp, &pc);
+	stack_init(&altstack, stack->arena);
 
-	while (pc.p < pend.p) {
-		bool fExec = !count_false(vfExec);
+	if (!script_decode(&code, script, stack->arena))
+		goto out;
 
-		if (!bsp_getop(&op, &bp))
-			goto out;
-		enum opcodetype opcode = op.op;
+	bool fRequireMinimal = (flags & SCRIPT_VERIFY_MINIMALDATA) != 0;
+	unsigned int pc;
 
-		if (op.data.len > MAX_SCRIPT_ELEMENT_SIZE)
-			goto out;
-		if (opcode > OP_16 && ++nOpCount > MAX_OPS_PER_SCRIPT)
-			goto out;
-		if (disabled_op[opcode])
-			goto out;
+	for (pc = 0; pc < code.len; pc++) {
+		const struct script_op *sop = &code.ops[pc];
+		enum opcodetype opcode = sop->op;
 
-		if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4) {
-			if (fRequireMinimal && !CheckMinimalPush(&op.data, opcode))
+		if (opcode <= OP_PUSHDATA4) {
+			struct const_buffer data = { sop->data, sop->len };
+			if (fRequireMinimal && !CheckMinimalPush(&data, opcode))
 				goto out;
-			stack_push(stack, (struct buffer *) &op.data);
-		} else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
+			stack_push(stack, (struct buffer *) &data);
+		} else
 		switch (opcode) {
 
 		//
@@ -775,8 +1114,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 		case OP_14:
 		case OP_15:
 		case OP_16:
-			mpz_set_si(bn, (int)opcode - (int)(OP_1 - 1));
-			stack_push_str(stack, bn_getvch(bn));
+			stack_push_num(stack, (int)opcode - (int)(OP_1 - 1));
 			break;
 
 		//
@@ -799,7 +1137,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// Note that elsewhere numeric opcodes are limited to
 			// operands in the range -2**31+1 to 2**31-1, however it is
 			// legal for opcodes to produce results exceeding that
-			// range. This limitation is implemented by CastToBigNum's
+			// range. This limitation is implemented by scriptnum_decode's
 			// default 4-byte limit.
 			//
 			// If we kept to that limit we'd have a year 2038 problem,
@@ -807,20 +1145,20 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// themselves is uint32 which only becomes meaningless
 			// after the year 2106.
 			//
-			// Thus as a special case we tell CastToBigNum to accept up
-			// to 5-byte bignums, which are good until 2**39-1, well
+			// Thus as a special case we tell scriptnum_decode to accept up
+			// to 5-byte numbers, which are good until 2**39-1, well
 			// beyond the 2**32-1 limit of the nLockTime field itself.
 
-			if (!CastToBigNum(bn, stacktop(stack, -1), fRequireMinimal, 5))
+			if (!scriptnum_decode(&bn, stacktop(stack, -1), fRequireMinimal, 5))
 				goto out;
 
 			// In the rare event that the argument may be < 0 due to
 			// some arithmetic being done first, you can always use
 			// 0 MAX CHECKLOCKTIMEVERIFY.
-			if (mpz_sgn(bn) < 0)
+			if (bn < 0)
 				goto out;
 
-			uint64_t nLockTime = mpz_get_ui(bn);
+			uint64_t nLockTime = bn;
 
 			// Actually compare the specified lock time with the transaction.
 			if (!CheckLockTime(nLockTime, txTo, nIn))
@@ -844,16 +1182,16 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// nSequence, like nLockTime, is a 32-bit unsigned integer
 			// field. See the comment in CHECKLOCKTIMEVERIFY regarding
 			// 5-byte numeric operands.
-			if (!CastToBigNum(bn, stacktop(stack, -1), fRequireMinimal, 5))
+			if (!scriptnum_decode(&bn, stacktop(stack, -1), fRequireMinimal, 5))
 				goto out;
 
 			// In the rare event that the argument may be < 0 due to
 			// some arithmetic being done first, you can always use
 			// 0 MAX CHECKSEQUENCEVERIFY.
-			if (mpz_sgn(bn) < 0)
+			if (bn < 0)
 				goto out;
 
-			uint32_t nSequence = mpz_get_ui(bn);
+			uint32_t nSequence = bn;
 
 			// To provide for future soft-fork extensibility, if the
 			// operand has the disabled lock-time flag set,
@@ -877,41 +1215,37 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 		case OP_IF:
 		case OP_NOTIF: {
 			// <expression> if [statements] [else [statements]] endif
-			bool fValue = false;
-			if (fExec) {
-				if (stack->len < 1)
-					goto out;
-				struct buffer *vch = stacktop(stack, -1);
-                if ((sigversion == SIGVERSION_WITNESS_V0) &&
-                    (flags & SCRIPT_VERIFY_MINIMALIF)) {
-                    if (vch->len > 1)
-                        goto out;
-                    const unsigned char* _vch = vch->p;
-                    if (vch->len == 1 && _vch[0] != 1)
-                        goto out;
-                }
-                fValue = CastToBool(vch);
-                if (opcode == OP_NOTIF)
-					fValue = !fValue;
-				popstack(stack);
-			}
-			uint8_t vc = (uint8_t) fValue;
-			cstr_append_c(vfExec, vc);
+			if (stack->len < 1)
+				goto out;
+			struct buffer *vch = stacktop(stack, -1);
+            if ((sigversion == SIGVERSION_WITNESS_V0) &&
+                (flags & SCRIPT_VERIFY_MINIMALIF)) {
+                if (vch->len > 1)
+                    goto out;
+                const unsigned char* _vch = vch->p;
+                if (vch->len == 1 && _vch[0] != 1)
+                    goto out;
+            }
+            bool fValue = CastToBool(vch);
+            if (opcode == OP_NOTIF)
+				fValue = !fValue;
+			popstack(stack);
+			nExec++;
+			if (!fValue && !skip_branch(&code, &pc, &nExec))
+				goto out;
 			break;
 		}
 
-		case OP_ELSE: {
-			if (vfExec->len == 0)
+		case OP_ELSE:
+			// the branch just run ends here
+			if (nExec == 0 || !skip_branch(&code, &pc, &nExec))
 				goto out;
-			uint8_t *v = (uint8_t *) &vfExec->str[vfExec->len - 1];
-			*v = !(*v);
 			break;
-		}
 
 		case OP_ENDIF:
-			if (vfExec->len == 0)
+			if (nExec == 0)
 				goto out;
-			cstr_erase(vfExec, vfExec->len - 1, 1);
+			nExec--;
 			break;
 
 		case OP_VERIFY: {
@@ -934,15 +1268,15 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 		case OP_TOALTSTACK:
 			if (stack->len < 1)
 				goto out;
-			stack_push(altstack, stacktop(stack, -1));
+			stack_push_elem(&altstack, stack, -1);
 			popstack(stack);
 			break;
 
 		case OP_FROMALTSTACK:
-			if (altstack->len < 1)
+			if (altstack.len < 1)
 				goto out;
-			stack_push(stack, stacktop(altstack, -1));
-			popstack(altstack);
+			stack_push_elem(stack, &altstack, -1);
+			popstack(&altstack);
 			break;
 
 		case OP_2DROP:
@@ -957,10 +1291,8 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x1 x2 -- x1 x2 x1 x2)
 			if (stack->len < 2)
 				goto out;
-			struct buffer *vch1 = stacktop(stack, -2);
-			struct buffer *vch2 = stacktop(stack, -1);
-			stack_push(stack, vch1);
-			stack_push(stack, vch2);
+			stack_push_elem(stack, stack, -2);
+			stack_push_elem(stack, stack, -2);
 			break;
 		}
 
@@ -968,12 +1300,9 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
 			if (stack->len < 3)
 				goto out;
-			struct buffer *vch1 = stacktop(stack, -3);
-			struct buffer *vch2 = stacktop(stack, -2);
-			struct buffer *vch3 = stacktop(stack, -1);
-			stack_push(stack, vch1);
-			stack_push(stack, vch2);
-			stack_push(stack, vch3);
+			stack_push_elem(stack, stack, -3);
+			stack_push_elem(stack, stack, -3);
+			stack_push_elem(stack, stack, -3);
 			break;
 		}
 
@@ -981,10 +1310,8 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
 			if (stack->len < 4)
 				goto out;
-			struct buffer *vch1 = stacktop(stack, -4);
-			struct buffer *vch2 = stacktop(stack, -3);
-			stack_push(stack, vch1);
-			stack_push(stack, vch2);
+			stack_push_elem(stack, stack, -4);
+			stack_push_elem(stack, stack, -4);
 			break;
 		}
 
@@ -992,11 +1319,8 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
 			if (stack->len < 6)
 				goto out;
-			struct buffer *vch1 = stack_take(stack, -6);
-			struct buffer *vch2 = stack_take(stack, -5);
-			parr_remove_range(stack, stack->len - 6, 2);
-			stack_push_nocopy(stack, vch1);
-			stack_push_nocopy(stack, vch2);
+			stack_roll(stack, -6);
+			stack_roll(stack, -6);
 			break;
 		}
 
@@ -1012,16 +1336,14 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x - 0 | x x)
 			if (stack->len < 1)
 				goto out;
-			struct buffer *vch = stacktop(stack, -1);
-			if (CastToBool(vch))
-				stack_push(stack, vch);
+			if (CastToBool(stacktop(stack, -1)))
+				stack_push_elem(stack, stack, -1);
 			break;
 		}
 
 		case OP_DEPTH:
 			// -- stacksize
-			mpz_set_ui(bn, stack->len);
-			stack_push_str(stack, bn_getvch(bn));
+			stack_push_num(stack, stack->len);
 			break;
 
 		case OP_DROP:
@@ -1035,8 +1357,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x -- x x)
 			if (stack->len < 1)
 				goto out;
-			struct buffer *vch = stacktop(stack, -1);
-			stack_push(stack, vch);
+			stack_push_elem(stack, stack, -1);
 			break;
 		}
 
@@ -1044,15 +1365,14 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x1 x2 -- x2)
 			if (stack->len < 2)
 				goto out;
-			parr_remove_idx(stack, stack->len - 2);
+			stack_remove(stack, -2);
 			break;
 
 		case OP_OVER: {
 			// (x1 x2 -- x1 x2 x1)
 			if (stack->len < 2)
 				goto out;
-			struct buffer *vch = stacktop(stack, -2);
-			stack_push(stack, vch);
+			stack_push_elem(stack, stack, -2);
 			break;
 		}
 
@@ -1067,14 +1387,10 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			popstack(stack);
 			if (n < 0 || n >= (int)stack->len)
 				goto out;
-			struct buffer *vch = stacktop(stack, -n-1);
-			if (opcode == OP_ROLL) {
-				vch = buffer_copy(vch->p, vch->len);
-				parr_remove_idx(stack,
-							 stack->len - n - 1);
-				stack_push_nocopy(stack, vch);
-			} else
-				stack_push(stack, vch);
+			if (opcode == OP_ROLL)
+				stack_roll(stack, -n-1);
+			else
+				stack_push_elem(stack, stack, -n-1);
 			break;
 		}
 
@@ -1101,8 +1417,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x1 x2 -- x2 x1 x2)
 			if (stack->len < 2)
 				goto out;
-			struct buffer *vch = stacktop(stack, -1);
-			stack_insert(stack, vch, -2);
+			stack_insert_top(stack, -2);
 			break;
 		}
 
@@ -1111,8 +1426,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			if (stack->len < 1)
 				goto out;
 			struct buffer *vch = stacktop(stack, -1);
-			mpz_set_ui(bn, vch->len);
-			stack_push_str(stack, bn_getvch(bn));
+			stack_push_num(stack, vch->len);
 			break;
 		}
 
@@ -1132,7 +1446,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			//	fEqual = !fEqual;
 			popstack(stack);
 			popstack(stack);
-			stack_push_str(stack, fEqual ? bn_getvch(bn_One) : bn_getvch(bn_Zero));
+			stack_push_num(stack, fEqual ? 1 : 0);
 			if (opcode == OP_EQUALVERIFY) {
 				if (fEqual)
 					popstack(stack);
@@ -1154,34 +1468,35 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (in -- out)
 			if (stack->len < 1)
 				goto out;
-			if (!CastToBigNum(bn, stacktop(stack, -1), fRequireMinimal, nDefaultMaxNumSize))
+			if (!scriptnum_decode(&bn, stacktop(stack, -1), fRequireMinimal, nDefaultMaxNumSize))
 				goto out;
 			switch (opcode)
 			{
 			case OP_1ADD:
-				mpz_add_ui(bn, bn, 1);
+				bn += 1;
 				break;
 			case OP_1SUB:
-				mpz_sub_ui(bn, bn, 1);
+				bn -= 1;
 				break;
 			case OP_NEGATE:
-				mpz_neg(bn, bn);
+				bn = -bn;
 				break;
 			case OP_ABS:
-				mpz_abs(bn, bn);
+				if (bn < 0)
+					bn = -bn;
 				break;
 			case OP_NOT:
-				mpz_set_ui(bn, mpz_sgn(bn) == 0 ? 1 : 0);
+				bn = (bn == 0) ? 1 : 0;
 				break;
 			case OP_0NOTEQUAL:
-				mpz_set_ui(bn, mpz_sgn(bn) == 0 ? 0 : 1);
+				bn = (bn == 0) ? 0 : 1;
 				break;
 			default:
 				// impossible
 				goto out;
 			}
 			popstack(stack);
-			stack_push_str(stack, bn_getvch(bn));
+			stack_push_num(stack, bn);
 			break;
 		}
 
@@ -1202,80 +1517,57 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			if (stack->len < 2)
 				goto out;
 
-			mpz_t bn1, bn2;
-			mpz_init(bn1);
-			mpz_init(bn2);
-			if (!CastToBigNum(bn1, stacktop(stack, -2), fRequireMinimal, nDefaultMaxNumSize) ||
-			    !CastToBigNum(bn2, stacktop(stack, -1), fRequireMinimal, nDefaultMaxNumSize)) {
-				mpz_clear(bn1);
-				mpz_clear(bn2);
+			scriptnum bn1, bn2;
+			if (!scriptnum_decode(&bn1, stacktop(stack, -2), fRequireMinimal, nDefaultMaxNumSize) ||
+			    !scriptnum_decode(&bn2, stacktop(stack, -1), fRequireMinimal, nDefaultMaxNumSize))
 				goto out;
-			}
 
 			switch (opcode)
 			{
 			case OP_ADD:
-				mpz_add(bn, bn1, bn2);
+				bn = bn1 + bn2;
 				break;
 			case OP_SUB:
-				mpz_sub(bn, bn1, bn2);
+				bn = bn1 - bn2;
 				break;
 			case OP_BOOLAND:
-				mpz_set_ui(bn,
-				    !(mpz_sgn(bn1) == 0) && !(mpz_sgn(bn2) == 0) ?
-				    1 : 0);
+				bn = (bn1 != 0 && bn2 != 0) ? 1 : 0;
 				break;
 			case OP_BOOLOR:
-				mpz_set_ui(bn,
-				    !(mpz_sgn(bn1) == 0) || !(mpz_sgn(bn2) == 0) ?
-				    1 : 0);
+				bn = (bn1 != 0 || bn2 != 0) ? 1 : 0;
 				break;
 			case OP_NUMEQUAL:
 			case OP_NUMEQUALVERIFY:
-				mpz_set_ui(bn,
-				    mpz_cmp(bn1, bn2) == 0 ?  1 : 0);
+				bn = (bn1 == bn2) ? 1 : 0;
 				break;
 			case OP_NUMNOTEQUAL:
-				mpz_set_ui(bn,
-				    mpz_cmp(bn1, bn2) != 0 ?  1 : 0);
+				bn = (bn1 != bn2) ? 1 : 0;
 				break;
 			case OP_LESSTHAN:
-				mpz_set_ui(bn,
-				    mpz_cmp(bn1, bn2) < 0 ?  1 : 0);
+				bn = (bn1 < bn2) ? 1 : 0;
 				break;
 			case OP_GREATERTHAN:
-				mpz_set_ui(bn,
-				    mpz_cmp(bn1, bn2) > 0 ?  1 : 0);
+				bn = (bn1 > bn2) ? 1 : 0;
 				break;
 			case OP_LESSTHANOREQUAL:
-				mpz_set_ui(bn,
-				    mpz_cmp(bn1, bn2) <= 0 ?  1 : 0);
+				bn = (bn1 <= bn2) ? 1 : 0;
 				break;
 			case OP_GREATERTHANOREQUAL:
-				mpz_set_ui(bn,
-				    mpz_cmp(bn1, bn2) >= 0 ?  1 : 0);
+				bn = (bn1 >= bn2) ? 1 : 0;
 				break;
 			case OP_MIN:
-				if (mpz_cmp(bn1, bn2) < 0)
-					mpz_set(bn, bn1);
-				else
-					mpz_set(bn, bn2);
+				bn = (bn1 < bn2) ? bn1 : bn2;
 				break;
 			case OP_MAX:
-				if (mpz_cmp(bn1, bn2) > 0)
-					mpz_set(bn, bn1);
-				else
-					mpz_set(bn, bn2);
+				bn = (bn1 > bn2) ? bn1 : bn2;
 				break;
 			default:
 				// impossible
-				break;
+				goto out;
 			}
 			popstack(stack);
 			popstack(stack);
-			stack_push_str(stack, bn_getvch(bn));
-			mpz_clear(bn1);
-			mpz_clear(bn2);
+			stack_push_num(stack, bn);
 
 			if (opcode == OP_NUMEQUALVERIFY)
 			{
@@ -1291,24 +1583,16 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			// (x min max -- out)
 			if (stack->len < 3)
 				goto out;
-			mpz_t bn1, bn2, bn3;
-			mpz_init(bn1);
-			mpz_init(bn2);
-			mpz_init(bn3);
-			bool rc1 = CastToBigNum(bn1, stacktop(stack, -3), fRequireMinimal, nDefaultMaxNumSize);
-			bool rc2 = CastToBigNum(bn2, stacktop(stack, -2), fRequireMinimal, nDefaultMaxNumSize);
-			bool rc3 = CastToBigNum(bn3, stacktop(stack, -1), fRequireMinimal, nDefaultMaxNumSize);
-			bool fValue = (mpz_cmp(bn2, bn1) <= 0 &&
-				       mpz_cmp(bn1, bn3) < 0);
+			scriptnum bn1, bn2, bn3;
+			if (!scriptnum_decode(&bn1, stacktop(stack, -3), fRequireMinimal, nDefaultMaxNumSize) ||
+			    !scriptnum_decode(&bn2, stacktop(stack, -2), fRequireMinimal, nDefaultMaxNumSize) ||
+			    !scriptnum_decode(&bn3, stacktop(stack, -1), fRequireMinimal, nDefaultMaxNumSize))
+				goto out;
+			bool fValue = (bn2 <= bn1 && bn1 < bn3);
 			popstack(stack);
 			popstack(stack);
 			popstack(stack);
-			stack_push_str(stack, fValue ? bn_getvch(bn_One) : bn_getvch(bn_Zero));
-			mpz_clear(bn1);
-			mpz_clear(bn2);
-			mpz_clear(bn3);
-			if (!rc1 || !rc2 || !rc3)
-				goto out;
+			stack_push_num(stack, fValue ? 1 : 0);
 			break;
 		}
 
@@ -1361,7 +1645,8 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 
 		case OP_CODESEPARATOR:
 			// Hash starts after the code separator
-			memcpy(&pbegincodehash, &pc, sizeof(pc));
+			pbegincodehash.p = script->str + sop->end;
+			pbegincodehash.len = script->len - sop->end;
 			break;
 
 		case OP_CHECKSIG:
@@ -1374,31 +1659,33 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			struct buffer *vchPubKey = stacktop(stack, -1);
 
 			// Subset of script starting at the most recent codeseparator
-			cstring *scriptCode = cstr_new_buf(pbegincodehash.p,
-                                                pbegincodehash.len);
+			cstring codeView = { (char *) pbegincodehash.p,
+					     pbegincodehash.len, 0 };
+			cstring *scriptCode = &codeView;
 
             // Drop the signature in pre-segwit scripts but not segwit scripts
             if (sigversion == SIGVERSION_BASE) {
-                string_find_del(scriptCode, vchSig);
+                scriptCode = script_code_del(scriptCode, &codeView, vchSig);
             }
 
             if (!CheckSignatureEncoding(vchSig, flags) ||
                 !CheckPubKeyEncoding(vchPubKey, flags, sigversion)) {
-                cstr_free(scriptCode, true);
+                script_code_free(scriptCode, &codeView);
                 goto out;
             }
 
             bool fSuccess = bitc_checksig(
-                vchSig, vchPubKey, scriptCode, txTo, nIn, amount, sigversion);
+                vchSig, vchPubKey, scriptCode, txTo, nIn, amount, sigversion, txdata,
+                NULL);
 
-            cstr_free(scriptCode, true);
+            script_code_free(scriptCode, &codeView);
 
             if (!fSuccess && (flags & SCRIPT_VERIFY_NULLFAIL) && vchSig->len)
                 goto out;
 
             popstack(stack);
 			popstack(stack);
-			stack_push_str(stack, fSuccess ? bn_getvch(bn_One) : bn_getvch(bn_Zero));
+			stack_push_num(stack, fSuccess ? 1 : 0);
 			if (opcode == OP_CHECKSIGVERIFY)
 			{
 				if (fSuccess)
@@ -1420,8 +1707,11 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			int nKeysCount = stackint(stack, -i, fRequireMinimal);
 			if (nKeysCount < 0 || nKeysCount > MAX_PUBKEYS_PER_MULTISIG)
 				goto out;
-			nOpCount += nKeysCount;
-			if (nOpCount > MAX_OPS_PER_SCRIPT)
+			// every non-push op, run or skipped, counts against
+			// the keys: past the last of them the count is that
+			// of the whole script, so check that once here
+			nKeyOps += nKeysCount;
+			if (code.nOpCount + nKeyOps > MAX_OPS_PER_SCRIPT)
 				goto out;
 			int ikey = ++i;
             // ikey2 is the position of last non-signature item in the stack. Top stack
@@ -1441,8 +1731,9 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 				goto out;
 
 			// Subset of script starting at the most recent codeseparator
-			cstring *scriptCode = cstr_new_buf(pbegincodehash.p,
-                                            pbegincodehash.len);
+			cstring codeView = { (char *) pbegincodehash.p,
+					     pbegincodehash.len, 0 };
+			cstring *scriptCode = &codeView;
 
             // Drop the signature in pre-segwit scripts but not segwit scripts
             int k;
@@ -1450,7 +1741,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 			{
                 struct buffer* vchSig = stacktop(stack, -isig - k);
                 if (sigversion == SIGVERSION_BASE) {
-                    string_find_del(scriptCode, vchSig);
+                    scriptCode = script_code_del(scriptCode, &codeView, vchSig);
                 }
             }
 
@@ -1465,13 +1756,14 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 				// See the script_(in)valid tests for details.
                 if (!CheckSignatureEncoding(vchSig, flags) ||
                     !CheckPubKeyEncoding(vchPubKey, flags, sigversion)) {
-                    cstr_free(scriptCode, true);
+                    script_code_free(scriptCode, &codeView);
                         goto out;
                 }
 
 				// Check signature
                 bool fOk = bitc_checksig(
-                    vchSig, vchPubKey, scriptCode, txTo, nIn, amount, sigversion);
+                    vchSig, vchPubKey, scriptCode, txTo, nIn, amount, sigversion, txdata,
+                    NULL);
 
                 if (fOk) {
                     isig++;
@@ -1486,7 +1778,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 					fSuccess = false;
 			}
 
-			cstr_free(scriptCode, true);
+			script_code_free(scriptCode, &codeView);
 
 			// Clean up stack of actual arguments
             while (i-- > 1) {
@@ -1512,7 +1804,7 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 				goto out;
 			popstack(stack);
 
-			stack_push_str(stack, fSuccess ? bn_getvch(bn_One) : bn_getvch(bn_Zero));
+			stack_push_num(stack, fSuccess ? 1 : 0);
 
 			if (opcode == OP_CHECKMULTISIGVERIFY)
 			{
@@ -1529,52 +1821,70 @@ static bool bitc_script_eval(parr* stack, const cstring* script, const struct bi
 		}
 
 		// Size limits
-                if (stack->len + altstack->len > MAX_STACK_SIZE)
+                if (stack->len + altstack.len > MAX_STACK_SIZE)
+                    goto out;
+                if (stack->oom || altstack.oom)
                     goto out;
         }
 
-        rc = (vfExec->len == 0 && bp.error == false);
+        rc = (nExec == 0);
 
 out:
-	mpz_clears(bn, bn_Zero, bn_One, NULL);
-	parr_free(altstack, true);
-	cstr_free(vfExec, true);
 	return rc;
 }
 
-static bool bitc_witnessprogram_verify(parr* witness, int witversion, cstring* program,
-        const struct bitc_tx* txTo, unsigned int nIn, unsigned int flags, int64_t amount)
+/* DUP HASH160 <program> EQUALVERIFY CHECKSIG, the P2WPKH scriptCode */
+static void p2wpkh_script(unsigned char *script, const void *program)
+{
+    script[0] = OP_DUP;
+    script[1] = OP_HASH160;
+    script[2] = RIPEMD160_DIGEST_LENGTH;
+    memcpy(&script[3], program, RIPEMD160_DIGEST_LENGTH);
+    script[23] = OP_EQUALVERIFY;
+    script[24] = OP_CHECKSIG;
+}
+
+static bool bitc_witnessprogram_verify(const parr* witness, int witversion,
+        const struct const_buffer* program, const struct bitc_tx* txTo, unsigned int nIn,
+        unsigned int flags, int64_t amount, struct bitc_arena* arena,
+        struct bitc_txdata *txdata)
 {
-    parr* stack = parr_new(0, buffer_freep);
+    struct script_stack stack;
+    unsigned int nWitness = witness ? witness->len : 0;
+    unsigned int nItems = nWitness;
     cstring* scriptPubKey = NULL;
+    unsigned char p2wpkh[25];
+    cstring p2wpkhScript = { (char*) p2wpkh, sizeof(p2wpkh), 0 };
     bool rc = false;
 
+    stack_init(&stack, arena);
+
     if (witversion == 0) {
         if (program->len == SHA256_DIGEST_LENGTH) {
             // Version 0 segregated witness program: SHA256(Script) inside the program, Script +
             // inputs in witness
-            if (witness->len == 0) {
+            if (nWitness == 0) {
                 goto out;
             }
 
-            struct buffer* buf = stacktop(witness, -1);
+            struct buffer* buf = parr_idx(witness, nWitness - 1);
             scriptPubKey = cstr_new_buf(buf->p, buf->len);
-            stack_copy(stack, witness);
-            popstack(stack);
+            nItems--;
 
             unsigned char hashScriptPubKey[SHA256_DIGEST_LENGTH];
             sha256_Raw(scriptPubKey->str, scriptPubKey->len, hashScriptPubKey);
 
-            if (memcmp(hashScriptPubKey, program->str, SHA256_DIGEST_LENGTH)) {
+            if (memcmp(hashScriptPubKey, program->p, SHA256_DIGEST_LENGTH)) {
                 goto out;
             }
         } else if (program->len == RIPEMD160_DIGEST_LENGTH) {
             // Special case for pay-to-pubkeyhash; signature + pubkey in witness
-            if (witness->len != 2) {
+            if (nWitness != 2) {
                 goto out; // 2 items in witness
             }
-            scriptPubKey = bsp_make_pubkeyhash(program);
-            stack_copy(stack, witness);
+
+            p2wpkh_script(p2wpkh, program->p);
+            scriptPubKey = &p2wpkhScript;
         } else {
             goto out;
         }
@@ -1588,86 +1898,343 @@ static bool bitc_witnessprogram_verify(parr* witness, int witversion, cstring* p
 
     // Disallow stack item size > MAX_SCRIPT_ELEMENT_SIZE in witness stack
     unsigned int i;
-    for (i = 0; i < stack->len; i++) {
-        struct buffer* buf = stack->data[i];
-        if (buf && (buf->len > MAX_SCRIPT_ELEMENT_SIZE))
+    for (i = 0; i < nItems; i++) {
+        struct buffer* buf = parr_idx(witness, i);
+        if (buf->len > MAX_SCRIPT_ELEMENT_SIZE)
             goto out;
+        stack_push(&stack, buf);
     }
+    if (stack.oom)
+        goto out;
 
     if (!bitc_script_eval(
-            stack, scriptPubKey, txTo, nIn, flags, amount, SIGVERSION_WITNESS_V0)) {
+            &stack, scriptPubKey, txTo, nIn, flags, amount, SIGVERSION_WITNESS_V0,
+            txdata)) {
         goto out;
     }
 
     // Scripts inside witness implicitly require cleanstack behaviour
-    if (stack->len != 1)
+    if (stack.len != 1)
         goto out;
 
-    if (!CastToBool(stacktop(stack, -1)))
+    if (!CastToBool(stacktop(&stack, -1)))
         goto out;
 
     rc = true;
 
 out:
-    parr_free(stack, true);
-    cstr_free(scriptPubKey, true);
+    if (scriptPubKey != &p2wpkhScript)
+        cstr_free(scriptPubKey, true);
     return rc;
 }
 
-bool bitc_script_verify(const cstring* scriptSig, const cstring* scriptPubKey,
-        parr** witness, const struct bitc_tx* txTo, unsigned int nIn,
-        unsigned int flags, int64_t amount)
+/*
+ * Standard spends are checked without the interpreter: P2PK, P2PKH,
+ * P2WPKH and m-of-n CHECKMULTISIG behind P2SH.  A template only takes a
+ * spend when it reaches the interpreter's verdict the same way the
+ * interpreter would, doing the same encoding and signature checks in
+ * the same order.  Anything else -- extra stack items, non-minimal
+ * pushes under MINIMALDATA, witness data where none belongs,
+ * CLEANSTACK -- is left to the interpreter.
+ */
+enum {
+	TEMPLATE_MAX_ITEMS	= 18,		// dummy, 16 signatures, redeemScript
+};
+
+/* a push-only scriptSig, as the stack it leaves */
+static bool template_pushes(const cstring *scriptSig, unsigned int flags,
+			    struct buffer *items, unsigned int *nItems)
+{
+	struct const_buffer pc = { scriptSig->str, scriptSig->len };
+	struct bscript_parser bp;
+	struct bscript_op op;
+	unsigned int n = 0;
+
+	bsp_start(&bp, &pc);
+	while (bsp_getop(&op, &bp)) {
+		if (op.op > OP_PUSHDATA4 || n == TEMPLATE_MAX_ITEMS ||
+		    op.data.len > MAX_SCRIPT_ELEMENT_SIZE)
+			return false;
+		if ((flags & SCRIPT_VERIFY_MINIMALDATA) &&
+		    !CheckMinimalPush(&op.data, op.op))
+			return false;
+
+		items[n].p = (void *) op.data.p;
+		items[n].len = op.data.len;
+		n++;
+	}
+
+	*nItems = n;
+	return !bp.error;
+}
+
+/* m <pubkey>... n CHECKMULTISIG, with 1 <= m <= n <= 16 */
+static bool template_multisig(const struct buffer *script, unsigned int *m,
+			      struct buffer *pubkeys, unsigned int *n)
+{
+	const unsigned char *vch = script->p;
+	size_t len = script->len, i = 1;
+	unsigned int nKeys = 0;
+
+	if (len < 3 || vch[0] < OP_1 || vch[0] > OP_16)
+		return false;
+
+	while (i < len && (vch[i] == 33 || vch[i] == 65)) {
+		if (nKeys == 16 || len - i - 1 < vch[i])
+			return false;
+		pubkeys[nKeys].p = (void *) &vch[i + 1];
+		pubkeys[nKeys].len = vch[i];
+		nKeys++;
+		i += 1 + vch[i];
+	}
+
+	if (len - i != 2 || vch[i] != OP_1 + nKeys - 1 ||
+	    vch[i + 1] != OP_CHECKMULTISIG)
+		return false;
+
+	*m = vch[0] - (OP_1 - 1);
+	*n = nKeys;
+	return *m <= *n;
+}
+
+/* CHECKSIG of one signature against script as the executing script */
+static bool template_checksig(const struct buffer *sig,
+        const struct buffer *pubkey, const cstring *script,
+        const struct bitc_tx *txTo, unsigned int nIn, unsigned int flags,
+        int64_t amount, enum SigVersion sigversion, struct bitc_txdata *txdata,
+        struct bitc_sigbatch *batch)
+{
+	cstring codeView = { script->str, script->len, 0 };
+	cstring *scriptCode = &codeView;
+	bool rc;
+
+	if (sigversion == SIGVERSION_BASE)
+		scriptCode = script_code_del(scriptCode, &codeView, sig);
+
+	rc = CheckSignatureEncoding(sig, flags) &&
+	     CheckPubKeyEncoding(pubkey, flags, sigversion) &&
+	     bitc_checksig(sig, pubkey, scriptCode, txTo, nIn, amount,
+			   sigversion, txdata, batch);
+
+	script_code_free(scriptCode, &codeView);
+	return rc;
+}
+
+static bool hash160_equal(const struct buffer *data, const void *hash)
+{
+	unsigned char md[RIPEMD160_DIGEST_LENGTH];
+
+	bu_Hash160(md, data->p, data->len);
+	return !memcmp(md, hash, sizeof(md));
+}
+
+/* <dummy> <sig>... <redeemScript>; false if not a multisig redeemScript */
+static bool template_p2sh_multisig(const struct buffer *items,
+        unsigned int nItems, const unsigned char *scriptHash,
+        const struct bitc_tx *txTo, unsigned int nIn, unsigned int flags,
+        int64_t amount, struct bitc_txdata *txdata,
+        struct bitc_sigbatch *batch, bool *rc)
+{
+	struct buffer pubkeys[16];
+	const struct buffer *redeem = &items[nItems - 1];
+	const struct buffer *sigs = &items[1];
+	unsigned int m, n;
+
+	if (!template_multisig(redeem, &m, pubkeys, &n) || nItems != m + 2)
+		return false;
+
+	*rc = false;
+	if (!hash160_equal(redeem, scriptHash))
+		return true;
+
+	// as CHECKMULTISIG: drop the signatures, then match them against
+	// the keys from the last of each
+	cstring codeView = { redeem->p, redeem->len, 0 };
+	cstring *scriptCode = &codeView;
+	unsigned int nSigs = m, nKeys = n, i;
+	bool fSuccess = true;
+
+	for (i = 0; i < m; i++)
+		scriptCode = script_code_del(scriptCode, &codeView, &sigs[i]);
+
+	// a signature may only be deferred if it must match its own key
+	if (m != n)
+		batch = NULL;
+
+	while (fSuccess && nSigs > 0) {
+		const struct buffer *vchSig = &sigs[nSigs - 1];
+		const struct buffer *vchPubKey = &pubkeys[nKeys - 1];
+
+		if (!CheckSignatureEncoding(vchSig, flags) ||
+		    !CheckPubKeyEncoding(vchPubKey, flags, SIGVERSION_BASE)) {
+			script_code_free(scriptCode, &codeView);
+			return true;
+		}
+
+		if (bitc_checksig(vchSig, vchPubKey, scriptCode, txTo, nIn,
+				  amount, SIGVERSION_BASE, txdata, batch))
+			nSigs--;
+		nKeys--;
+
+		if (nSigs > nKeys)
+			fSuccess = false;
+	}
+
+	script_code_free(scriptCode, &codeView);
+
+	*rc = fSuccess &&
+	      (!(flags & SCRIPT_VERIFY_NULLDUMMY) || items[0].len == 0);
+	return true;
+}
+
+/* true when a template took the spend, with its verdict in *rc */
+static bool verify_template(const cstring *scriptSig,
+        const cstring *scriptPubKey, const parr *witness,
+        const struct bitc_tx *txTo, unsigned int nIn, unsigned int flags,
+        int64_t amount, struct bitc_txdata *txdata,
+        struct bitc_sigbatch *batch, bool *rc)
+{
+	struct const_buffer spk = { scriptPubKey->str, scriptPubKey->len };
+	const unsigned char *vch = spk.p;
+	unsigned int nWitness = witness ? witness->len : 0;
+	struct buffer items[TEMPLATE_MAX_ITEMS];
+	unsigned int nItems;
+
+	if ((flags & SCRIPT_VERIFY_CLEANSTACK) ||
+	    ((flags & SCRIPT_VERIFY_WITNESS) && !(flags & SCRIPT_VERIFY_P2SH)))
+		return false;
+
+	if (is_bsp_p2wpkh(&spk)) {
+		if (!(flags & SCRIPT_VERIFY_WITNESS) || scriptSig->len)
+			return false;
+
+		struct buffer program = { (void *) &vch[2], RIPEMD160_DIGEST_LENGTH };
+		struct buffer *sig, *pubkey;
+		unsigned char p2wpkh[25];
+		cstring scriptCode = { (char *) p2wpkh, sizeof(p2wpkh), 0 };
+
+		*rc = false;
+		if (!CastToBool(&program) || nWitness != 2)
+			return true;
+		sig = parr_idx(witness, 0);
+		pubkey = parr_idx(witness, 1);
+		if (sig->len > MAX_SCRIPT_ELEMENT_SIZE ||
+		    pubkey->len > MAX_SCRIPT_ELEMENT_SIZE ||
+		    !hash160_equal(pubkey, program.p))
+			return true;
+
+		p2wpkh_script(p2wpkh, program.p);
+		*rc = template_checksig(sig, pubkey, &scriptCode, txTo, nIn,
+					flags, amount, SIGVERSION_WITNESS_V0,
+					txdata, batch);
+		return true;
+	}
+
+	if (!is_bsp_p2pkh(&spk) && !is_bsp_p2pk(&spk) &&
+	    !((flags & SCRIPT_VERIFY_P2SH) && is_bsp_p2sh(&spk)))
+		return false;
+	if (((flags & SCRIPT_VERIFY_WITNESS) && nWitness) ||
+	    !template_pushes(scriptSig, flags, items, &nItems))
+		return false;
+
+	if (is_bsp_p2pkh(&spk) && nItems == 2) {
+		*rc = hash160_equal(&items[1], &vch[3]) &&
+		      template_checksig(&items[0], &items[1], scriptPubKey,
+					txTo, nIn, flags, amount,
+					SIGVERSION_BASE, txdata, batch);
+		return true;
+	}
+
+	if (is_bsp_p2pk(&spk) && nItems == 1) {
+		struct buffer pubkey = { (void *) &vch[1], spk.len - 2 };
+
+		*rc = template_checksig(&items[0], &pubkey, scriptPubKey,
+					txTo, nIn, flags, amount,
+					SIGVERSION_BASE, txdata, batch);
+		return true;
+	}
+
+	if (is_bsp_p2sh(&spk) && nItems >= 3)
+		return template_p2sh_multisig(items, nItems, &vch[2], txTo, nIn,
+					      flags, amount, txdata, batch, rc);
+
+	return false;
+}
+
+bool bitc_script_verify_deferred(const cstring* scriptSig,
+        const cstring* scriptPubKey, parr** witness,
+        const struct bitc_tx* txTo, unsigned int nIn, unsigned int flags,
+        int64_t amount, struct bitc_txdata *txdata,
+        struct bitc_sigbatch *batch)
 {
-    cstring* witnessprogram = NULL;
-    if (*witness == NULL) {
-        *witness = parr_new(0, buffer_freep);
+    struct const_buffer witnessprogram;
+    struct bitc_txdata local;
+    struct bitc_arena arena;
+    struct script_stack stack, stackCopy;
+
+    // a missing witness is an empty one
+    const parr* witnessStack = *witness;
+    unsigned int nWitness = witnessStack ? witnessStack->len : 0;
+
+    if (!txdata) {
+        bitc_txdata_init(&local, txTo);
+        txdata = &local;
     }
 
+    bool rc = false;
+    if (verify_template(scriptSig, scriptPubKey, witnessStack, txTo, nIn, flags,
+                        amount, txdata, batch, &rc))
+        return rc;
+
+    // large stack elements; nothing is allocated for standard scripts
+    bitc_arena_init(&arena, BITC_ARENA_MIN_CHUNK);
+    stack_init(&stack, &arena);
+    stack_init(&stackCopy, &arena);
+
     bool hadWitness = false;
 
+    // the stack the spend leaves; a P2SH spend goes on in stackCopy
+    struct script_stack* stackResult = &stack;
+
     cstring* pubkey2 = NULL;
-    struct buffer* pubKeySerialized = NULL;
 
-    bool rc = false;
-    parr* stack = parr_new(0, buffer_freep);
-    parr* stackCopy = NULL;
     struct const_buffer sigbuf = {scriptSig->str, scriptSig->len};
 
     if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !is_bsp_pushonly(&sigbuf))
         goto out;
 
-    if (!bitc_script_eval(stack, scriptSig, txTo, nIn, flags, amount, SIGVERSION_BASE))
+    if (!bitc_script_eval(
+            &stack, scriptSig, txTo, nIn, flags, amount, SIGVERSION_BASE, txdata))
         goto out;
     if (flags & SCRIPT_VERIFY_P2SH) {
-        stackCopy = parr_new(stack->len, buffer_freep);
-        stack_copy(stackCopy, stack);
+        stack_copy(&stackCopy, &stack);
     }
-    if (!bitc_script_eval(stack, scriptPubKey, txTo, nIn, flags, amount, SIGVERSION_BASE))
+    if (!bitc_script_eval(
+            &stack, scriptPubKey, txTo, nIn, flags, amount, SIGVERSION_BASE, txdata))
         goto out;
-    if (stack->len == 0)
+    if (stack.len == 0)
         goto out;
 
-    if (CastToBool(stacktop(stack, -1)) == false)
+    if (CastToBool(stacktop(&stack, -1)) == false)
         goto out;
 
     // Bare witness programs
     int witnessversion;
     if (flags & SCRIPT_VERIFY_WITNESS) {
-        witnessprogram = cstr_new_sz(0);
-
-        if (is_bsp_witnessprogram(scriptPubKey, &witnessversion, witnessprogram)) {
+        if (is_bsp_witnessprogram(scriptPubKey, &witnessversion, &witnessprogram)) {
             hadWitness = true;
             if (scriptSig->len != 0) {
                 // The scriptSig must be _exactly_ 0, otherwise we reintroduce malleability.
                 goto out;
             }
             if (!bitc_witnessprogram_verify(
-                    *witness, witnessversion, witnessprogram, txTo, nIn, flags, amount)) {
+                    witnessStack, witnessversion, &witnessprogram, txTo, nIn, flags,
+                    amount, &arena, txdata)) {
                 goto out;
             }
             // Bypass the cleanstack check at the end. The actual stack is obviously not clean
             // for witness programs.
-            parr_resize(stack, 1);
+            stack.len = 1;
         }
     }
 
@@ -1680,41 +2247,46 @@ bool bitc_script_verify(const cstring* scriptSig, const cstring* scriptPubKey,
         // stack cannot be empty here, because if it was the
         // P2SH  HASH <> EQUAL  scriptPubKey would be evaluated with
         // an empty stack and the script_eval above would return false.
-        if (stack->len < 1)
+        if (stackCopy.len < 1)
             goto out;
 
-        pubKeySerialized = stack_take(stackCopy, -1);
+        stackResult = &stackCopy;
+
+        struct buffer* pubKeySerialized = stacktop(&stackCopy, -1);
         pubkey2 = cstr_new_buf(pubKeySerialized->p, pubKeySerialized->len);
-        popstack(stackCopy);
+        popstack(&stackCopy);
 
         if (!bitc_script_eval(
-                stackCopy, pubkey2, txTo, nIn, flags, amount, SIGVERSION_BASE))
+                &stackCopy, pubkey2, txTo, nIn, flags, amount, SIGVERSION_BASE, txdata))
             goto out;
-        if (stackCopy->len == 0)
+        if (stackCopy.len == 0)
             goto out;
-        if (CastToBool(stacktop(stackCopy, -1)) == false)
+        if (CastToBool(stacktop(&stackCopy, -1)) == false)
             goto out;
 
         // P2SH witness program
         if (flags & SCRIPT_VERIFY_WITNESS) {
-            if (is_bsp_witnessprogram(pubkey2, &witnessversion, witnessprogram)) {
+            if (is_bsp_witnessprogram(pubkey2, &witnessversion, &witnessprogram)) {
                 hadWitness = true;
-                cstr_resize(pubkey2, 0);
-                bsp_push_data(pubkey2, pubKeySerialized->p, pubKeySerialized->len);
-                if (!cstr_equal(scriptSig, pubkey2)) {
+                cstring* push = cstr_new_sz(pubkey2->len + 1);
+                bsp_push_data(push, pubkey2->str, pubkey2->len);
+                bool fExactPush = cstr_equal(scriptSig, push);
+                cstr_free(push, true);
+                if (!fExactPush) {
                     // The scriptSig must be _exactly_ a single push of the redeemScript. Otherwise
                     // we
                     // reintroduce malleability.
                     goto out;
                 }
                 if (!bitc_witnessprogram_verify(
-                        *witness, witnessversion, witnessprogram, txTo, nIn, flags, amount)) {
+                        witnessStack, witnessversion, &witnessprogram, txTo, nIn, flags,
+                        amount, &arena, txdata)) {
                     goto out;
                 }
                 // Bypass the cleanstack check at the end. The actual stack is obviously not
                 // clean
                 // for witness programs.
-                parr_resize(stackCopy, 1);
+                stackCopy.len = 1;
             }
         }
     }
@@ -1729,7 +2301,7 @@ bool bitc_script_verify(const cstring* scriptSig, const cstring* scriptPubKey,
             goto out;
         //		if ((flags & SCRIPT_VERIFY_WITNESS) == 0)
         //		    goto out;
-        if (stackCopy->len != 1)
+        if (stackResult->len != 1)
             goto out;
     }
 
@@ -1739,26 +2311,30 @@ bool bitc_script_verify(const cstring* scriptSig, const cstring* scriptPubKey,
         // possible, which is not a softfork.
         if ((flags & SCRIPT_VERIFY_P2SH) == 0)
             goto out;
-        if (!hadWitness && ((*witness)->len != 0))
+        if (!hadWitness && nWitness != 0)
             goto out;
     }
-    rc = true;
+    rc = !stack.oom && !stackCopy.oom;
 
 out:
-	parr_free(stack, true);
-        if (stackCopy)
-            parr_free(stackCopy, true);
         if (pubkey2)
             cstr_free(pubkey2, true);
-        if (pubKeySerialized)
-            buffer_freep(pubKeySerialized);
-        if (witnessprogram)
-            cstr_free(witnessprogram, true);
+        bitc_arena_free(&arena);
         return rc;
 }
 
+bool bitc_script_verify(const cstring* scriptSig, const cstring* scriptPubKey,
+        parr** witness, const struct bitc_tx* txTo, unsigned int nIn,
+        unsigned int flags, int64_t amount, struct bitc_txdata *txdata)
+{
+	return bitc_script_verify_deferred(scriptSig, scriptPubKey, witness,
+					   txTo, nIn, flags, amount, txdata,
+					   NULL);
+}
+
 bool bitc_verify_sig(const struct bitc_utxo* txFrom, const struct bitc_tx* txTo,
-        unsigned int nIn, unsigned int flags, int64_t amount)
+        unsigned int nIn, unsigned int flags, int64_t amount,
+        struct bitc_txdata *txdata)
 {
 	if (!txFrom || !txFrom->vout || !txFrom->vout->len ||
 	    !txTo || !txTo->vin || !txTo->vin->len ||
@@ -1775,5 +2351,5 @@ bool bitc_verify_sig(const struct bitc_utxo* txFrom, const struct bitc_tx* txTo,
 		return false;
 
         return bitc_script_verify(txin->scriptSig, txout->scriptPubKey, &txin->scriptWitness,
-            txTo, nIn, flags, amount);
+            txTo, nIn, flags, amount, txdata);
 }
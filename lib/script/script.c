@@ -8,7 +8,7 @@
 #include <bitc/endian.h>                // for htole16, htole32
 #include <bitc/script/script.h>         // for bscript_op, bscript_parser, etc
 #include <bitc/serialize.h>             // for deser_bytes, deser_skip, etc
-#include <bitc/util.h>                  // for bn_getvch, memdup
+#include <bitc/util.h>                  // for memdup
 
 #include <assert.h>                     // for assert
 
@@ -126,9 +126,81 @@ unsigned int bsp_get_sigopcount(struct const_buffer* buf, bool fAccurate)
     return n;
 }
 
+/* the last push of a push-only scriptSig, as a P2SH redeemScript */
+static bool bsp_last_push(struct const_buffer *data,
+			  struct const_buffer *scriptSig)
+{
+	struct const_buffer script = *scriptSig;
+	struct bscript_parser bp;
+	struct bscript_op op;
+	bool found = false;
+
+	bsp_start(&bp, &script);
+	while (bsp_getop(&op, &bp)) {
+		if (op.op > OP_16)
+			return false;
+		*data = op.data;
+		found = true;
+	}
+
+	return found && !bp.error;
+}
+
+unsigned int bsp_get_p2sh_sigopcount(struct const_buffer *scriptPubKey,
+				     struct const_buffer *scriptSig)
+{
+	struct const_buffer redeem;
+
+	if (!is_bsp_p2sh(scriptPubKey) || !bsp_last_push(&redeem, scriptSig))
+		return 0;
+
+	return bsp_get_sigopcount(&redeem, true);
+}
+
+static unsigned int witness_sigopcount(int version,
+				       const struct const_buffer *program,
+				       const parr *witness)
+{
+	if (version != 0)
+		return 0;
+	if (program->len == 20)
+		return 1;
+	if (program->len == 32 && witness && witness->len) {
+		struct buffer *item = parr_idx(witness, witness->len - 1);
+		struct const_buffer witnessScript = { item->p, item->len };
+
+		return bsp_get_sigopcount(&witnessScript, true);
+	}
+
+	return 0;
+}
+
+unsigned int bsp_get_witness_sigopcount(struct const_buffer *scriptPubKey,
+					struct const_buffer *scriptSig,
+					const parr *witness)
+{
+	cstring spk = { (char *) scriptPubKey->p, scriptPubKey->len, 0 };
+	struct const_buffer program, redeem;
+	int version;
+
+	if (is_bsp_witnessprogram(&spk, &version, &program))
+		return witness_sigopcount(version, &program, witness);
+
+	// P2SH-wrapped witness program
+	if (is_bsp_p2sh(scriptPubKey) && bsp_last_push(&redeem, scriptSig)) {
+		cstring rs = { (char *) redeem.p, redeem.len, 0 };
+
+		if (is_bsp_witnessprogram(&rs, &version, &program))
+			return witness_sigopcount(version, &program, witness);
+	}
+
+	return 0;
+}
+
 // A witness program is any valid script that consists of a 1-byte push opcode
 // followed by a data push between 2 and 40 bytes.
-bool is_bsp_witnessprogram(const cstring* s, int* version, cstring* program)
+bool is_bsp_witnessprogram(const cstring* s, int* version,
+                           struct const_buffer* program)
 {
     if (s->len < 4 || s->len > 42) {
         return false;
@@ -138,7 +210,8 @@ bool is_bsp_witnessprogram(const cstring* s, int* version, cstring* program)
     }
     if ((size_t)(s->str[1] + 2) == s->len) {
         *version = DecodeOP_N((enum opcodetype)s->str[0]);
-        cstr_append_buf(program, s->str + 2, s->len - 2);
+        program->p = s->str + 2;
+        program->len = s->len - 2;
         return true;
     }
     return false;
@@ -339,6 +412,87 @@ void bsp_push_data(cstring *s, const void *data, size_t data_len)
 	cstr_append_buf(s, data, data_len);
 }
 
+/*
+ * script numbers
+ */
+
+bool scriptnum_decode(scriptnum *vo, const struct buffer *buf,
+		      bool fRequireMinimal, size_t nMaxNumSize)
+{
+	const unsigned char *vch = buf->p;
+	size_t len = buf->len;
+
+	assert(nMaxNumSize <= sizeof(uint64_t));
+
+	if (len > nMaxNumSize)
+		return false;
+
+	if (fRequireMinimal && len > 0) {
+		// Check that the number is encoded with the minimum possible
+		// number of bytes.
+		//
+		// If the most-significant-byte - excluding the sign bit - is zero
+		// then we're not minimal. Note how this test also rejects the
+		// negative-zero encoding, 0x80.
+		if ((vch[len - 1] & 0x7f) == 0) {
+			// One exception: if there's more than one byte and the most
+			// significant bit of the second-most-significant-byte is set
+			// it would conflict with the sign bit. An example of this case
+			// is +-255, which encode to 0xff00 and 0xff80 respectively.
+			// (big-endian).
+			if (len <= 1 || (vch[len - 2] & 0x80) == 0)
+				return false;
+		}
+	}
+
+	if (len == 0) {
+		*vo = 0;
+		return true;
+	}
+
+	uint64_t mag = 0;
+	size_t i;
+	for (i = 0; i < len; i++)
+		mag |= (uint64_t) vch[i] << (8 * i);
+
+	// strip the sign bit; 8 bytes leave at most 63 bits of magnitude
+	uint64_t sign = (uint64_t) 0x80 << (8 * (len - 1));
+	if (mag & sign)
+		*vo = -(int64_t) (mag & ~sign);
+	else
+		*vo = mag;
+
+	return true;
+}
+
+static size_t scriptnum_encode_mag(unsigned char *out, uint64_t mag, bool neg)
+{
+	size_t len = 0;
+
+	while (mag) {
+		out[len++] = mag & 0xff;
+		mag >>= 8;
+	}
+
+	// the top bit is the sign: when the magnitude already uses it,
+	// an extra byte carries the sign instead
+	if (len > 0) {
+		if (out[len - 1] & 0x80)
+			out[len++] = neg ? 0x80 : 0;
+		else if (neg)
+			out[len - 1] |= 0x80;
+	}
+
+	return len;
+}
+
+size_t scriptnum_encode(unsigned char *out, scriptnum v)
+{
+	if (v < 0)
+		return scriptnum_encode_mag(out, -(uint64_t) v, true);
+	return scriptnum_encode_mag(out, v, false);
+}
+
 void bsp_push_int64(cstring *s, int64_t n)
 {
 	if (n == -1 || (n >= 1 && n <= 16)) {
@@ -349,30 +503,10 @@ void bsp_push_int64(cstring *s, int64_t n)
 		return;
 	}
 
-	bool neg = false;
-	if (n < 0) {
-		neg = true;
-		n = -n;
-	}
+	unsigned char vch[SCRIPTNUM_MAX_SIZE];
+	size_t len = scriptnum_encode(vch, n);
 
-	mpz_t bn, bn_lo, bn_hi;
-	mpz_init(bn);
-
-	mpz_init_set_ui(bn_hi, (n >> 32));
-	mpz_mul_2exp(bn_hi, bn_hi, 32);
-	mpz_init_set_ui(bn_lo, (n & 0xffffffffU));
-	mpz_add(bn, bn_hi, bn_lo);
-	if (neg && mpz_sgn(bn) >= 0)
-		mpz_neg(bn, bn);
-
-	cstring *vch = bn_getvch(bn);
-
-	bsp_push_data(s, vch->str, vch->len);
-
-	cstr_free(vch, true);
-	mpz_clear(bn);
-	mpz_clear(bn_hi);
-	mpz_clear(bn_lo);
+	bsp_push_data(s, vch, len);
 }
 
 void bsp_push_uint64(cstring *s, uint64_t n)
@@ -385,22 +519,10 @@ void bsp_push_uint64(cstring *s, uint64_t n)
 		return;
 	}
 
-	mpz_t bn, bn_lo, bn_hi;
-	mpz_init(bn);
-
-	mpz_init_set_ui(bn_hi, (n >> 32));
-	mpz_mul_2exp(bn_hi, bn_hi, 32);
-	mpz_init_set_ui(bn_lo, (n & 0xffffffffU));
-	mpz_add(bn, bn_hi, bn_lo);
-
-	cstring *vch = bn_getvch(bn);
-
-	bsp_push_data(s, vch->str, vch->len);
+	unsigned char vch[SCRIPTNUM_MAX_SIZE];
+	size_t len = scriptnum_encode_mag(vch, n, false);
 
-	cstr_free(vch, true);
-	mpz_clear(bn);
-	mpz_clear(bn_hi);
-	mpz_clear(bn_lo);
+	bsp_push_data(s, vch, len);
 }
 
 cstring *bsp_make_scripthash(cstring *hash)
@@ -3,6 +3,7 @@
 
 #include <bitc/buint.h>                 // for bu256_t, bu160_t
 #include <bitc/key.h>                   // for bitc_key_free, etc
+#include <bitc/script/interpreter.h>    // for bitc_tx_sighash
 #include <bitc/script/script.h>         // for bscript_addr, etc
 #include <bitc/util.h>                  // for bu_Hash160
 #include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_txin, etc
@@ -56,7 +57,7 @@ bool bitc_script_sign(struct bitc_keystore *ks, const cstring *fromPubKey,
 
 	/* get signature hash */
 	bu256_t hash;
-        bitc_tx_sighash(&hash, fromPubKey, txTo, nIn, nHashType, 0, 0);
+        bitc_tx_sighash(&hash, fromPubKey, txTo, nIn, nHashType, 0, 0, NULL);
 
         /* match fromPubKey against templates, to find what pubkey[hashes]
 	 * are required for signing
@@ -0,0 +1,137 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/script/sigbatch.h>       // for bitc_sigbatch, etc
+#include <bitc/key.h>                   // for bitc_pubkey_set, etc
+#include <bitc/script/sigcache.h>       // for bitc_sigcache_add
+
+#include <stdlib.h>                     // for realloc, free
+#include <string.h>                     // for memcpy, memset
+
+enum {
+	SIGBATCH_MIN_ALLOC	= 256,
+};
+
+void bitc_sigbatch_init(struct bitc_sigbatch *b)
+{
+	memset(b, 0, sizeof(*b));
+	pthread_mutex_init(&b->lock, NULL);
+}
+
+void bitc_sigbatch_free(struct bitc_sigbatch *b)
+{
+	pthread_mutex_destroy(&b->lock);
+	free(b->entries);
+	memset(b, 0, sizeof(*b));
+}
+
+void bitc_sigbatch_reset(struct bitc_sigbatch *b)
+{
+	b->len = 0;
+	b->next = 0;
+	b->done = 0;
+	b->failed = false;
+}
+
+bool bitc_sigbatch_add(struct bitc_sigbatch *b, const bu256_t *sighash,
+		       const struct buffer *pubkey, const struct buffer *sig)
+{
+	bool rc = false;
+
+	if (pubkey->len > BITC_SIGBATCH_MAX_PUBKEY ||
+	    sig->len > BITC_SIGBATCH_MAX_SIG)
+		return false;
+
+	pthread_mutex_lock(&b->lock);
+
+	if (b->len == b->alloc) {
+		size_t alloc = b->alloc ? b->alloc * 2 : SIGBATCH_MIN_ALLOC;
+		struct bitc_sigbatch_entry *entries;
+
+		entries = realloc(b->entries, alloc * sizeof(*entries));
+		if (!entries)
+			goto out;
+
+		b->entries = entries;
+		b->alloc = alloc;
+	}
+
+	struct bitc_sigbatch_entry *e = &b->entries[b->len++];
+
+	e->sighash = *sighash;
+	e->pubkey_len = pubkey->len;
+	e->sig_len = sig->len;
+	e->valid = false;
+	memcpy(e->pubkey, pubkey->p, pubkey->len);
+	memcpy(e->sig, sig->p, sig->len);
+	rc = true;
+
+out:
+	pthread_mutex_unlock(&b->lock);
+	return rc;
+}
+
+static void sigbatch_run_chunk(struct bitc_sigbatch *b,
+			       struct bitc_sigbatch_entry *entries, size_t n)
+{
+	struct bitc_key keys[BITC_SIGBATCH_CHUNK];
+	secp256k1_ecdsa_signature sigs[BITC_SIGBATCH_CHUNK];
+	bool parsed[BITC_SIGBATCH_CHUNK];
+	bool failed = false;
+	size_t i;
+
+	/* parse every key and signature first, then verify */
+	for (i = 0; i < n; i++) {
+		struct bitc_sigbatch_entry *e = &entries[i];
+
+		bitc_key_init(&keys[i]);
+		parsed[i] = bitc_pubkey_set(&keys[i], e->pubkey, e->pubkey_len) &&
+			    bitc_sig_parse(&sigs[i], e->sig, e->sig_len);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct bitc_sigbatch_entry *e = &entries[i];
+
+		e->valid = parsed[i] &&
+			   bitc_verify_parsed(&keys[i], &e->sighash, &sigs[i]);
+		bitc_key_free(&keys[i]);
+
+		if (e->valid) {
+			struct buffer pubkey = { e->pubkey, e->pubkey_len };
+			struct buffer sig = { e->sig, e->sig_len };
+
+			bitc_sigcache_add(&e->sighash, &pubkey, &sig);
+		} else
+			failed = true;
+	}
+
+	if (failed)
+		__atomic_store_n(&b->failed, true, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&b->done, n, __ATOMIC_RELEASE);
+}
+
+void bitc_sigbatch_run(struct bitc_sigbatch *b)
+{
+	for (;;) {
+		size_t first = __atomic_fetch_add(&b->next, BITC_SIGBATCH_CHUNK,
+						  __ATOMIC_RELAXED);
+		if (first >= b->len)
+			break;
+
+		size_t n = b->len - first;
+		if (n > BITC_SIGBATCH_CHUNK)
+			n = BITC_SIGBATCH_CHUNK;
+
+		sigbatch_run_chunk(b, &b->entries[first], n);
+	}
+}
+
+bool bitc_sigbatch_verify(struct bitc_sigbatch *b)
+{
+	bitc_sigbatch_run(b);
+	return bitc_sigbatch_done(b) &&
+	       !__atomic_load_n(&b->failed, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,219 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/script/sigcache.h>       // for bitc_sigcache_stats, etc
+#include <bitc/crypto/prng.h>           // for prng_get_random_bytes
+#include <bitc/crypto/sha2.h>           // for SHA256_CTX, sha256_Update, etc
+
+#include <stdlib.h>                     // for calloc, free
+#include <string.h>                     // for memcmp, memset
+
+#define SC_KEY_WORDS	4
+
+struct sc_slot {
+	uint64_t	seq;			// odd while being written
+	uint64_t	key[SC_KEY_WORDS];	// all zero when empty
+};
+
+static struct {
+	struct sc_slot	*slots;
+	size_t		mask;
+	SHA256_CTX	salted;			// state after one salt block
+
+	/* counters apart from the read-mostly fields above */
+	uint64_t	hits __attribute__((aligned(64)));
+	uint64_t	misses;
+	uint64_t	inserts;
+	uint64_t	evictions;
+} sc;
+
+static void sc_key(uint64_t *key, const bu256_t *sighash,
+		   const struct buffer *pubkey, const struct buffer *sig)
+{
+	SHA256_CTX ctx = sc.salted;
+	uint32_t pklen = pubkey->len;
+
+	sha256_Update(&ctx, sighash, sizeof(*sighash));
+	sha256_Update(&ctx, &pklen, sizeof(pklen));
+	sha256_Update(&ctx, pubkey->p, pubkey->len);
+	sha256_Update(&ctx, sig->p, sig->len);
+	sha256_Final((uint8_t *) key, &ctx);
+}
+
+static inline size_t sc_index(const uint64_t *key, unsigned int way)
+{
+	return key[way] & sc.mask;
+}
+
+static inline bool sc_empty(const uint64_t *key)
+{
+	return !(key[0] | key[1] | key[2] | key[3]);
+}
+
+/* consistent copy of slot's key; false if a writer got in the way */
+static bool sc_read(const struct sc_slot *slot, uint64_t *key)
+{
+	uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	unsigned int i;
+
+	if (seq & 1)
+		return false;
+
+	for (i = 0; i < SC_KEY_WORDS; i++)
+		key[i] = __atomic_load_n(&slot->key[i], __ATOMIC_RELAXED);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static bool sc_lock(struct sc_slot *slot, uint64_t *seq)
+{
+	*seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+
+	return !(*seq & 1) &&
+	       __atomic_compare_exchange_n(&slot->seq, seq, *seq + 1, false,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* store key in a locked slot, handing back what it held */
+static void sc_swap(struct sc_slot *slot, uint64_t seq, uint64_t *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < SC_KEY_WORDS; i++) {
+		uint64_t old = slot->key[i];
+		__atomic_store_n(&slot->key[i], key[i], __ATOMIC_RELAXED);
+		key[i] = old;
+	}
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool bitc_sigcache_init(size_t max_bytes)
+{
+	uint8_t salt[64];
+	size_t n_slots = 1;
+
+	bitc_sigcache_free();
+
+	if (max_bytes < BITC_SIGCACHE_WAYS * sizeof(struct sc_slot))
+		return true;
+
+	while (n_slots * 2 * sizeof(struct sc_slot) <= max_bytes)
+		n_slots *= 2;
+
+	if (prng_get_random_bytes(salt, sizeof(salt)) < 0)
+		return false;
+
+	struct sc_slot *slots = calloc(n_slots, sizeof(*slots));
+	if (!slots)
+		return false;
+
+	sha256_Init(&sc.salted);
+	sha256_Update(&sc.salted, salt, sizeof(salt));
+
+	sc.mask = n_slots - 1;
+	sc.slots = slots;
+	return true;
+}
+
+void bitc_sigcache_free(void)
+{
+	free(sc.slots);
+	memset(&sc, 0, sizeof(sc));
+}
+
+bool bitc_sigcache_enabled(void)
+{
+	return sc.slots != NULL;
+}
+
+bool bitc_sigcache_get(const bu256_t *sighash, const struct buffer *pubkey,
+		       const struct buffer *sig)
+{
+	uint64_t key[SC_KEY_WORDS], cur[SC_KEY_WORDS];
+	unsigned int way;
+
+	if (!sc.slots)
+		return false;
+
+	sc_key(key, sighash, pubkey, sig);
+
+	for (way = 0; way < BITC_SIGCACHE_WAYS; way++) {
+		const struct sc_slot *slot = &sc.slots[sc_index(key, way)];
+
+		if (sc_read(slot, cur) && !memcmp(cur, key, sizeof(key))) {
+			__atomic_add_fetch(&sc.hits, 1, __ATOMIC_RELAXED);
+			return true;
+		}
+	}
+
+	__atomic_add_fetch(&sc.misses, 1, __ATOMIC_RELAXED);
+	return false;
+}
+
+void bitc_sigcache_add(const bu256_t *sighash, const struct buffer *pubkey,
+		       const struct buffer *sig)
+{
+	uint64_t key[SC_KEY_WORDS], cur[SC_KEY_WORDS], seq;
+	size_t prev = SIZE_MAX;
+	unsigned int way, kick;
+
+	if (!sc.slots)
+		return;
+
+	sc_key(key, sighash, pubkey, sig);
+	__atomic_add_fetch(&sc.inserts, 1, __ATOMIC_RELAXED);
+
+	for (kick = 0; kick <= BITC_SIGCACHE_KICKS; kick++) {
+		/* a free candidate ends the walk */
+		for (way = 0; way < BITC_SIGCACHE_WAYS; way++) {
+			struct sc_slot *slot = &sc.slots[sc_index(key, way)];
+
+			if (!sc_read(slot, cur) || !sc_empty(cur) ||
+			    !sc_lock(slot, &seq))
+				continue;
+
+			if (sc_empty(slot->key)) {
+				sc_swap(slot, seq, key);
+				return;
+			}
+			__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+		}
+
+		/* otherwise displace an occupant, which moves on in turn;
+		 * never back into the slot it was just pushed out of
+		 */
+		unsigned int i;
+		for (i = 0; i < BITC_SIGCACHE_WAYS; i++) {
+			way = (kick + i) % BITC_SIGCACHE_WAYS;
+			if (sc_index(key, way) != prev)
+				break;
+		}
+		if (i == BITC_SIGCACHE_WAYS)
+			break;
+
+		prev = sc_index(key, way);
+		struct sc_slot *slot = &sc.slots[prev];
+		if (!sc_lock(slot, &seq))
+			break;
+		sc_swap(slot, seq, key);
+		if (sc_empty(key))
+			return;
+	}
+
+	__atomic_add_fetch(&sc.evictions, 1, __ATOMIC_RELAXED);
+}
+
+void bitc_sigcache_stats(struct bitc_sigcache_stats *st)
+{
+	st->hits = __atomic_load_n(&sc.hits, __ATOMIC_RELAXED);
+	st->misses = __atomic_load_n(&sc.misses, __ATOMIC_RELAXED);
+	st->inserts = __atomic_load_n(&sc.inserts, __ATOMIC_RELAXED);
+	st->evictions = __atomic_load_n(&sc.evictions, __ATOMIC_RELAXED);
+	st->slots = sc.slots ? sc.mask + 1 : 0;
+	st->memory = st->slots * sizeof(struct sc_slot);
+}
@@ -4,6 +4,7 @@
  */
 
 #include <bitc/buint.h>                 // for bu256_t
+#include <bitc/crypto/sha2.h>           // for sha256_Init, etc
 #include <bitc/cstr.h>                  // for cstring, cstr_append_buf, etc
 #include <bitc/endian.h>                // for htole16, htole32, htole64, etc
 #include <bitc/parr.h>                  // for parr, parr_idx
@@ -14,7 +15,7 @@
 #include <stdbool.h>                    // for false, true, bool
 #include <stddef.h>                     // for size_t
 #include <stdint.h>                     // for uint32_t, uint16_t, etc
-#include <string.h>                     // for NULL, strnlen
+#include <string.h>                     // for NULL, memcpy, strnlen
 
 
 void ser_bytes(cstring *s, const void *p, size_t len)
@@ -45,30 +46,37 @@ void ser_bool(cstring *s, bool v_)
 	cstr_append_c(s, v_?1:0);
 }
 
-void ser_varlen(cstring *s, uint32_t vlen)
+static size_t varlen_encode(unsigned char *p, uint32_t vlen)
 {
-	unsigned char c;
-
 	if (vlen < 253) {
-		c = vlen;
-		ser_bytes(s, &c, 1);
+		p[0] = vlen;
+		return 1;
 	}
 
 	else if (vlen < 0x10000) {
-		c = 253;
-		ser_bytes(s, &c, 1);
-		ser_u16(s, (uint16_t) vlen);
+		uint16_t v = htole16((uint16_t) vlen);
+		p[0] = 253;
+		memcpy(p + 1, &v, sizeof(v));
+		return 1 + sizeof(v);
 	}
 
 	else {
-		c = 254;
-		ser_bytes(s, &c, 1);
-		ser_u32(s, vlen);
+		uint32_t v = htole32(vlen);
+		p[0] = 254;
+		memcpy(p + 1, &v, sizeof(v));
+		return 1 + sizeof(v);
 	}
 
 	/* u64 case intentionally not implemented */
 }
 
+void ser_varlen(cstring *s, uint32_t vlen)
+{
+	unsigned char buf[1 + sizeof(uint32_t)];
+
+	ser_bytes(s, buf, varlen_encode(buf, vlen));
+}
+
 void ser_str(cstring *s, const char *s_in, size_t maxlen)
 {
 	size_t slen = strnlen(s_in, maxlen);
@@ -88,6 +96,13 @@ void ser_varstr(cstring *s, cstring *s_in)
 	ser_bytes(s, s_in->str, s_in->len);
 }
 
+void ser_varslice(cstring *s, const struct const_buffer *buf)
+{
+	ser_varlen(s, buf->len);
+	if (buf->len)
+		ser_bytes(s, buf->p, buf->len);
+}
+
 void ser_u256_array(cstring *s, parr *arr)
 {
 	unsigned int arr_len = arr ? arr->len : 0;
@@ -119,6 +134,92 @@ void ser_varlen_array(cstring* s, parr* arr)
     }
 }
 
+static void sink_cstr_write(struct bitc_sink *sink, const void *p, size_t len)
+{
+	cstr_append_buf(sink->ctx, p, len);
+}
+
+static void sink_sha256_write(struct bitc_sink *sink, const void *p,
+			      size_t len)
+{
+	sha256_Update(sink->ctx, p, len);
+}
+
+void bitc_sink_cstr_init(struct bitc_sink *sink, cstring *s)
+{
+	sink->write = sink_cstr_write;
+	sink->ctx = s;
+	sink->len = 0;
+}
+
+void bitc_sink_sha256_init(struct bitc_sink *sink, SHA256_CTX *ctx)
+{
+	sha256_Init(ctx);
+
+	sink->write = sink_sha256_write;
+	sink->ctx = ctx;
+	sink->len = 0;
+}
+
+void bitc_sink_count_init(struct bitc_sink *sink)
+{
+	sink->write = NULL;
+	sink->ctx = NULL;
+	sink->len = 0;
+}
+
+/* finish a SHA-256 sink, yielding the double-SHA256 of all data written */
+void bitc_sink_sha256d(struct bitc_sink *sink, unsigned char *md256)
+{
+	unsigned char md1[SHA256_DIGEST_LENGTH];
+
+	sha256_Final(md1, sink->ctx);
+	sha256_Raw(md1, SHA256_DIGEST_LENGTH, md256);
+}
+
+void ser_sink_u16(struct bitc_sink *sink, uint16_t v_)
+{
+	uint16_t v = htole16(v_);
+	ser_sink_bytes(sink, &v, sizeof(v));
+}
+
+void ser_sink_u32(struct bitc_sink *sink, uint32_t v_)
+{
+	uint32_t v = htole32(v_);
+	ser_sink_bytes(sink, &v, sizeof(v));
+}
+
+void ser_sink_u64(struct bitc_sink *sink, uint64_t v_)
+{
+	uint64_t v = htole64(v_);
+	ser_sink_bytes(sink, &v, sizeof(v));
+}
+
+void ser_sink_varlen(struct bitc_sink *sink, uint32_t vlen)
+{
+	unsigned char buf[1 + sizeof(uint32_t)];
+
+	ser_sink_bytes(sink, buf, varlen_encode(buf, vlen));
+}
+
+void ser_sink_varstr(struct bitc_sink *sink, const cstring *s_in)
+{
+	if (!s_in || !s_in->len) {
+		ser_sink_varlen(sink, 0);
+		return;
+	}
+
+	ser_sink_varlen(sink, s_in->len);
+	ser_sink_bytes(sink, s_in->str, s_in->len);
+}
+
+void ser_sink_varslice(struct bitc_sink *sink, const struct const_buffer *buf)
+{
+	ser_sink_varlen(sink, buf->len);
+	if (buf->len)
+		ser_sink_bytes(sink, buf->p, buf->len);
+}
+
 bool deser_skip(struct const_buffer *buf, size_t len)
 {
 	if (buf->len < len)
@@ -263,6 +364,29 @@ bool deser_varstr(cstring **so, struct const_buffer *buf)
 	return true;
 }
 
+/* zero-copy: point *so at the next len bytes of buf */
+bool deser_slice(struct const_buffer *so, struct const_buffer *buf, size_t len)
+{
+	if (buf->len < len)
+		return false;
+
+	so->p = buf->p;
+	so->len = len;
+
+	buf->p += len;
+	buf->len -= len;
+
+	return true;
+}
+
+bool deser_varslice(struct const_buffer *so, struct const_buffer *buf)
+{
+	uint32_t len;
+	if (!deser_varlen(&len, buf)) return false;
+
+	return deser_slice(so, buf, len);
+}
+
 bool deser_u256_array(parr **ao, struct const_buffer *buf)
 {
 	parr *arr = *ao;
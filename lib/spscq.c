@@ -0,0 +1,33 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+#include "libbitc-config.h"
+
+#include <bitc/spscq.h>                 // for bitc_spscq
+
+#include <stdlib.h>                     // for calloc, free
+#include <string.h>                     // for memset
+
+bool bitc_spscq_init(struct bitc_spscq *q, size_t size)
+{
+	size_t n = 1;
+
+	memset(q, 0, sizeof(*q));
+
+	while (n < size)
+		n <<= 1;
+
+	q->slots = calloc(n, sizeof(*q->slots));
+	if (!q->slots)
+		return false;
+
+	q->mask = n - 1;
+	return true;
+}
+
+void bitc_spscq_free(struct bitc_spscq *q)
+{
+	free(q->slots);
+	memset(q, 0, sizeof(*q));
+}
@@ -9,8 +9,8 @@
 #include <bitc/mbr.h>                   // for fread_block
 #include <bitc/message.h>               // for p2p_message, etc
 #include <bitc/parr.h>                  // for parr, parr_idx, parr_free
-#include <bitc/primitives/block.h>      // for bitc_block, bitc_block_free, etc
-#include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_txout
+#include <bitc/primitives/block.h>      // for bitc_block_view, etc
+#include <bitc/primitives/transaction.h>  // for bitc_tx_view, etc
 #include <bitc/script/script.h>         // for bsp_classify, bsp_parse_all, etc
 #include <bitc/util.h>                  // for file_seq_open, ARRAY_SIZE
 
@@ -52,8 +52,12 @@ enum stat_type {
 	STA_PUBKEYHASH,
 	STA_SCRIPTHASH,
 	STA_UNKNOWN,
+	STA_BASE_BYTES,
+	STA_TOTAL_BYTES,
+	STA_WEIGHT,
+	STA_SIGOPS,
 
-	STA_LAST = STA_UNKNOWN
+	STA_LAST = STA_SIGOPS
 };
 
 static const char *stat_names[STA_LAST + 1] = {
@@ -67,6 +71,10 @@ static const char *stat_names[STA_LAST + 1] = {
 	"pubkeyhash",
 	"scripthash",
 	"unknown",
+	"base_bytes",
+	"total_bytes",
+	"weight",
+	"legacy_sigops",
 };
 
 static unsigned long gbl_stats[STA_LAST + 1];
@@ -76,6 +84,11 @@ static inline void incstat(enum stat_type stype)
 	gbl_stats[stype]++;
 }
 
+static inline void addstat(enum stat_type stype, unsigned long n)
+{
+	gbl_stats[stype] += n;
+}
+
 static inline unsigned long getstat(enum stat_type stype)
 {
 	return gbl_stats[stype];
@@ -115,12 +128,12 @@ static bool match_op_pos(parr *script, enum opcodetype opcode,
 	return (op->op == opcode);
 }
 
-static void scan_txout(struct bitc_txout *txout)
+static void scan_txout(const struct bitc_txout_view *txout)
 {
 	incstat(STA_TXOUT);
 
-	parr *script = bsp_parse_all(txout->scriptPubKey->str,
-					  txout->scriptPubKey->len);
+	parr *script = bsp_parse_all(txout->scriptPubKey.p,
+					  txout->scriptPubKey.len);
 	if (!script) {
 		fprintf(stderr, "error at txout %lu\n", getstat(STA_TXOUT)-1);
 		return;
@@ -155,54 +168,50 @@ static void scan_txout(struct bitc_txout *txout)
 	parr_free(script, true);
 }
 
-static void scan_tx(struct bitc_tx *tx)
+static void scan_tx(const struct bitc_tx_view *tx)
 {
 	unsigned int i;
-	for (i = 0; i < tx->vout->len; i++) {
-		struct bitc_txout *txout;
-
-		txout = parr_idx(tx->vout, i);
-
-		scan_txout(txout);
-	}
+	for (i = 0; i < tx->n_vout; i++)
+		scan_txout(&tx->vout[i]);
 
 	incstat(STA_TX);
 }
 
-static void scan_block(struct bitc_block *block)
+static void scan_block(const struct bitc_block_view *block,
+		       const struct bitc_block_stats *stats)
 {
 	unsigned int n;
-	for (n = 0; n < block->vtx->len; n++) {
-		struct bitc_tx *tx;
-
-		tx = parr_idx(block->vtx, n);
-
-		scan_tx(tx);
-	}
+	for (n = 0; n < block->n_tx; n++)
+		scan_tx(&block->vtx[n]);
 
+	addstat(STA_BASE_BYTES, stats->base_size);
+	addstat(STA_TOTAL_BYTES, stats->total_size);
+	addstat(STA_WEIGHT, stats->weight);
+	addstat(STA_SIGOPS, stats->sigops_legacy);
 	incstat(STA_BLOCK);
 }
 
 static void scan_decode_block(struct p2p_message *msg, uint64_t *fpos)
 {
-	struct bitc_block block;
-	bitc_block_init(&block);
+	struct bitc_block_view block;
+	struct bitc_block_stats stats;
+	bitc_block_view_init(&block);
 
 	struct const_buffer buf = { msg->data, msg->hdr.data_len };
 
-	bool rc = deser_bitc_block(&block, &buf);
+	bool rc = deser_bitc_block_view_stats(&block, &buf, &stats);
 	if (!rc) {
 		fprintf(stderr, "block deser failed at block %lu\n",
 			getstat(STA_BLOCK));
 		exit(1);
 	}
 
-	scan_block(&block);
+	scan_block(&block, &stats);
 
 	uint64_t pos_tmp = msg->hdr.data_len;
 	*fpos += (pos_tmp + 8);
 
-	bitc_block_free(&block);
+	bitc_block_view_free(&block);
 }
 
 static void scan_blocks(void)
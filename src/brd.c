@@ -6,11 +6,12 @@
 
 #include "brd.h"
 #include <bitc/db/chaindb.h>           // for blkinfo, blkdb, etc
-#include <bitc/db/db.h>                // for blockdb_init, db_close, etc
+#include <bitc/db/db.h>                // for blockdb_init, utxodb, etc
 #include <bitc/buffer.h>               // for const_buffer, buffer_copy, etc
 #include <bitc/clist.h>                // for clist_length
-#include <bitc/core.h>                 // for bitc_block, bitc_utxo, bitc_tx, etc
-#include <bitc/coredefs.h>             // for chain_info, chain_find, etc
+#include <bitc/coins.h>                // for bitc_coin, bitc_coin_free, etc
+#include <bitc/core.h>                 // for bitc_block, bitc_tx, etc
+#include <bitc/coredefs.h>             // for chain_info, MAX_BLOCK_SIGOPS_COST, etc
 #include <bitc/crypto/prng.h>          // for prng_get_random_bytes
 #include <bitc/cstr.h>                 // for cstring, cstr_free
 #include <bitc/hexcode.h>              // for decode_hex
@@ -20,7 +21,9 @@
 #include <bitc/net/net.h>              // for net_child_info, nc_conns_gc, etc
 #include <bitc/net/peerman.h>          // for peer_manager, peerman_write, etc
 #include <bitc/parr.h>                 // for parr, parr_idx, parr_free, etc
-#include <bitc/script/interpreter.h>   // for bitc_verify_sig
+#include <bitc/script/checkqueue.h>    // for bitc_checkq, etc
+#include <bitc/script/interpreter.h>   // for bitc_txdata, SCRIPT_VERIFY_P2SH, etc
+#include <bitc/script/sigcache.h>      // for bitc_sigcache_init, etc
 #include <bitc/util.h>                 // for ARRAY_SIZE, czstr_equal, etc
 
 #include <event.h>                     // for event_base_dispatch, etc
@@ -33,7 +36,7 @@
 #include <signal.h>                     // for signal, SIG_IGN, SIGHUP, etc
 #include <stddef.h>                     // for NULL, size_t
 #include <stdio.h>                      // for fclose, fopen, ferror, etc
-#include <stdlib.h>                     // for exit, free, calloc
+#include <stdlib.h>                     // for exit, free, calloc, strtoul
 #include <string.h>                     // for strcmp, strlen, strdup, etc
 #include <sys/uio.h>                    // for iovec, writev
 #include <unistd.h>                     // for for access, F_OK
@@ -60,8 +63,11 @@ bool debugging = false;
 
 static char *peer_filename = NULL;
 static struct chaindb db;
+static struct chaindb hdr_db;
+static struct event *db_timer;
 static struct bitc_hashtab *orphans;
-static struct bitc_utxo_set uset;
+static struct utxodb udb;
+static struct bitc_checkq checkq;
 static bool script_verf = false;
 static unsigned int net_conn_timeout = 11;
 struct net_child_info global_nci;
@@ -72,7 +78,8 @@ static const char *const_settings[] = {
 	"log=-", /* "log=brd.log", */
 };
 
-static bool block_process(const struct bitc_block *block);
+static bool block_process(const struct bitc_block *block,
+			  struct bitc_block_stats *stats);
 static bool have_orphan(const bu256_t *v);
 static bool add_orphan(const bu256_t *hash_in, struct const_buffer *buf_in);
 
@@ -221,17 +228,64 @@ static void init_chaindb(void)
     log_debug("%s: Initialised chaindb", prog_name);
 }
 
+static unsigned long setting_ul(const char *key, unsigned long def)
+{
+	char *value = setting(key);
+
+	return value ? strtoul(value, NULL, 10) : def;
+}
+
 static void init_db(void)
 {
+	unsigned int flush_blocks = setting_ul("utxo.flush.blocks", 0);
+	size_t cache_mb = setting_ul("utxo.cache.mb", 0);
+	struct db_batch_policy policy = {
+		.max_writes	= setting_ul("db.batch.writes", DB_BATCH_WRITES),
+		.max_bytes	= setting_ul("db.batch.mb",
+					     DB_BATCH_BYTES >> 20) << 20,
+		.max_secs	= setting_ul("db.batch.secs", DB_BATCH_SECS),
+		.nosync		= setting("db.nosync") != NULL,
+		.writemap	= setting("db.writemap") != NULL,
+	};
+
+	db_set_policy(&policy);
+
 	if (!metadb_init(chain->netmagic, &chain_genesis) ||
 		!blockdb_init() ||
-		!blockheightdb_init())
+		!blockheightdb_init() ||
+		!blockidxdb_init() ||
+		!utxodb_init(&udb, flush_blocks, cache_mb * 1024 * 1024))
 		{
 		log_error("%s: db initialisation failed", prog_name);
 		exit(1);
 	}
 
+	/* block, height and UTXO writes from here on share transactions */
+	db_batch_begin();
 }
+static void init_verify(void)
+{
+	script_verf = setting("script.verify") != NULL;
+	if (!script_verf)
+		return;
+
+	unsigned long n_threads = setting_ul("script.threads", BITC_CHECKQ_AUTO);
+	if (!bitc_checkq_init(&checkq, n_threads)) {
+		log_error("%s: script verification pool init failed", prog_name);
+		exit(1);
+	}
+
+	size_t sigcache_mb = setting_ul("sigcache.mb",
+					BITC_SIGCACHE_DEFAULT_MB);
+	if (!bitc_sigcache_init(sigcache_mb << 20)) {
+		log_error("%s: signature cache init failed", prog_name);
+		exit(1);
+	}
+
+	log_info("%s: verifying scripts, %u worker threads, %zuMB signature cache",
+		 prog_name, checkq.n_workers, sigcache_mb);
+}
+
 static const char *genesis_bitcoin =
 "0100000000000000000000000000000000000000000000000000000000000000000000003ba3edfd7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa4b1e5e4a29ab5f49ffff001d1dac2b7c0101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff4d04ffff001d0104455468652054696d65732030332f4a616e2f32303039204368616e63656c6c6f72206f6e206272696e6b206f66207365636f6e64206261696c6f757420666f722062616e6b73ffffffff0100f2052a01000000434104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac00000000";
 static const char *genesis_testnet =
@@ -271,45 +325,54 @@ static void init_block0(void)
 	}
 }
 
-static bool spend_tx(struct bitc_utxo_set *uset, const struct bitc_tx *tx,
-		     unsigned int tx_idx, unsigned int height)
+static bool spend_tx(struct utxodb *udb, const struct bitc_tx *tx,
+		     unsigned int tx_idx, unsigned int height,
+		     struct bitc_block_stats *stats)
 {
 	bool is_coinbase = (tx_idx == 0);
 
-	struct bitc_utxo *coin;
+	struct bitc_coin coin;
+	struct bitc_txdata *txdata = NULL;
 
 	int64_t total_in = 0, total_out = 0;
 
+	bool rc = false;
 	unsigned int i;
 
+	bitc_coin_init(&coin);
+	if (script_verf && !is_coinbase &&
+	    !(txdata = bitc_checkq_txdata(&checkq, tx)))
+		goto out;
+
 	/* verify and spend this transaction's inputs */
 	if (!is_coinbase) {
 		for (i = 0; i < tx->vin->len; i++) {
 			struct bitc_txin *txin;
-			struct bitc_txout *txout;
 
 			txin = parr_idx(tx->vin, i);
 
-			coin = bitc_utxo_lookup(uset, &txin->prevout.hash);
-			if (!coin || !coin->vout)
-				return false;
+			if (!utxodb_spend(udb, &txin->prevout, &coin))
+				goto out;
 
-			if (coin->is_coinbase &&
-			    ((coin->height + COINBASE_MATURITY) > height))
-				return false;
+			if (coin.is_coinbase &&
+			    ((coin.height + COINBASE_MATURITY) > height))
+				goto out;
 
-			txout = NULL;
-			if (txin->prevout.n >= coin->vout->len)
-				return false;
-			txout = parr_idx(coin->vout, txin->prevout.n);
-			total_in += txout->nValue;
+			total_in += coin.nValue;
 
-            if (script_verf &&
-                 !bitc_verify_sig(coin, tx, i, SCRIPT_VERIFY_NONE, 0))
-                return false;
+			/* no block before P2SH or segwit comes near the
+			 * limit, so their sigops are counted throughout
+			 */
+			bitc_block_stats_spend(stats, txin, coin.scriptPubKey,
+					       SCRIPT_VERIFY_P2SH |
+					       SCRIPT_VERIFY_WITNESS);
 
-			if (!bitc_utxo_spend(uset, &txin->prevout))
-				return false;
+			/* queued for the pool; the coin is copied */
+			if (script_verf &&
+			    !bitc_checkq_add(&checkq, tx, txdata, i,
+					     coin.scriptPubKey,
+					     SCRIPT_VERIFY_NONE, coin.nValue))
+				goto out;
 		}
 	}
 
@@ -322,45 +385,66 @@ static bool spend_tx(struct bitc_utxo_set *uset, const struct bitc_tx *tx,
 
 	if (!is_coinbase) {
 		if (total_out > total_in)
-			return false;
-	}
-
-	/* copy-and-convert a tx into a UTXO */
-	coin = calloc(1, sizeof(*coin));
-	bitc_utxo_init(coin);
-
-	if (!bitc_utxo_from_tx(coin, tx, is_coinbase, height)) {
-		bitc_utxo_freep(coin);
-		return false;
+			goto out;
 	}
 
 	/* add unspent outputs to set */
-	bitc_utxo_set_add(uset, coin);
+	rc = utxodb_add_tx(udb, tx, is_coinbase, height);
 
-	return true;
+out:
+	bitc_coin_free(&coin);
+	return rc;
 }
 
-static bool spend_block(struct bitc_utxo_set *uset, const struct bitc_block *block,
-			unsigned int height)
+static bool spend_block(struct utxodb *udb, const struct bitc_block *block,
+			struct bitc_block_stats *stats, unsigned int height)
 {
 	unsigned int i;
+	bool rc = true;
+
+	if (script_verf)
+		bitc_checkq_begin(&checkq);
 
 	for (i = 0; i < block->vtx->len; i++) {
 		struct bitc_tx *tx;
 
 		tx = parr_idx(block->vtx, i);
-		if (!spend_tx(uset, tx, i, height)) {
+		if (!spend_tx(udb, tx, i, height, stats)) {
 			char hexstr[BU256_STRSZ];
 			bu256_hex(hexstr, &tx->sha256);
 			log_error("%s: spent_block tx fail %s", prog_name, hexstr);
-			return false;
+			rc = false;
+			break;
+		}
+		if (bitc_block_stats_sigop_cost(stats) > MAX_BLOCK_SIGOPS_COST) {
+			log_error("%s: spent_block too many sigops, height %u",
+				  prog_name, height);
+			rc = false;
+			break;
 		}
 	}
 
-	return true;
+	/* queued checks refer to block; always let them finish */
+	if (script_verf && !bitc_checkq_wait(&checkq) && rc) {
+		log_error("%s: spent_block script fail, height %u",
+			  prog_name, height);
+		rc = false;
+	}
+
+	/* what the block did so far must not reach the next flush */
+	if (!rc) {
+		if (!utxodb_block_abort(udb)) {
+			log_error("%s: UTXO cache undo fail, height %u",
+				  prog_name, height);
+		}
+		return false;
+	}
+
+	return utxodb_block_done(udb, &block->sha256, height);
 }
 
-static bool block_process(const struct bitc_block *block)
+static bool block_process(const struct bitc_block *block,
+			  struct bitc_block_stats *stats)
 {
 	struct blkinfo *bi = bi_new();
 	bu256_copy(&bi->hash, &block->sha256);
@@ -369,6 +453,14 @@ static bool block_process(const struct bitc_block *block)
 	bu256_hex(hexstr, &bi->hash);
 
 	struct chaindb_reorg reorg;
+	struct blkinfo *prev = chaindb_lookup(&db, &block->hashPrevBlock);
+	int height = prev ? prev->height + 1 : 0;
+
+	if (height == udb.best_height &&
+	    !bu256_equal(&bi->hash, &udb.best_hash)) {
+		log_error("%s: UTXO db best block not on chain", prog_name);
+		goto err_out;
+	}
 
 	if (!chaindb_add(&db, bi, &reorg)) {
 		log_debug("%s: Adding block %s to chaindb failed", prog_name, hexstr);
@@ -379,15 +471,20 @@ static bool block_process(const struct bitc_block *block)
 	assert(reorg.conn == 1);
 	assert(reorg.disconn == 0);
 
-	/* if best chain, mark TX's as spent */
-	if (bu256_equal(&db.best_chain->hash, &bi->hdr.sha256)) {
-		if (!spend_block(&uset, block, bi->height)) {
+	/* if best chain and not yet in the UTXO db, mark TX's as spent */
+	if (bu256_equal(&db.best_chain->hash, &bi->hdr.sha256) &&
+	    bi->height > udb.best_height) {
+		if (!spend_block(&udb, block, stats, bi->height)) {
 			bu256_hex(hexstr, &bi->hdr.sha256);
 			log_info("%s: block spend fail %u %s",
 				prog_name,
 				bi->height, hexstr);
-			/* FIXME: bad record is now in chaindb */
-			goto err_out;
+			/* bi is in chaindb now; take it out again */
+			if (!chaindb_remove(&db, bi, &reorg)) {
+				log_error("%s: block index undo fail %d %s",
+					  prog_name, height, hexstr);
+			}
+			return false;
 		}
 	}
 
@@ -403,15 +500,16 @@ static bool read_block(void *p, size_t len)
 	bool rc = false;
 
 	struct bitc_block block;
+	struct bitc_block_stats stats;
 	bitc_block_init(&block);
 	struct const_buffer buf = { p, len };
-	if (!deser_bitc_block(&block, &buf)) {
+	if (!deser_bitc_block_stats(&block, &buf, &stats)) {
 		log_error("%s: block deser fail", prog_name);
 		goto out;
 	}
 	bitc_block_calc_sha256(&block);
 
-	if (!bitc_block_valid(&block)) {
+	if (!bitc_block_valid_stats(&block, &stats)) {
 		log_info("%s: block not valid", prog_name);
 		goto out;
 	}
@@ -419,13 +517,87 @@ static bool read_block(void *p, size_t len)
 	/* used at runtime */
 	bool		sha256_valid;
 	bu256_t		sha256;
-	rc = block_process(&block);
+	rc = block_process(&block, &stats);
 
 out:
 	bitc_block_free(&block);
 	return rc;
 }
 
+static bool spend_stored_block(void *p, size_t len)
+{
+	bool rc = false;
+
+	struct bitc_block block;
+	struct bitc_block_stats stats;
+	bitc_block_init(&block);
+	struct const_buffer buf = { p, len };
+	if (!deser_bitc_block_stats(&block, &buf, &stats)) {
+		log_error("%s: block deser fail", prog_name);
+		goto out;
+	}
+	bitc_block_calc_sha256(&block);
+
+	struct blkinfo *bi = chaindb_lookup(&db, &block.sha256);
+	if (!bi)
+		goto out;
+
+	rc = spend_block(&udb, &block, &stats, bi->height);
+
+out:
+	bitc_block_free(&block);
+	return rc;
+}
+
+/* apply best-chain blocks stored after the last UTXO db flush */
+static bool utxo_catch_up(void)
+{
+	struct blkinfo *bi = db.best_chain;
+	unsigned int n = 0, i;
+	bool rc = true;
+
+	while (bi && bi->height > udb.best_height) {
+		bi = bi->prev;
+		n++;
+	}
+
+	if (udb.best_height >= 0 &&
+	    (!bi || !bu256_equal(&bi->hash, &udb.best_hash))) {
+		log_error("%s: UTXO db best block not on chain", prog_name);
+		return false;
+	}
+	if (n == 0)
+		return true;
+
+	struct blkinfo **todo = calloc(n, sizeof(*todo));
+	if (!todo)
+		return false;
+
+	for (bi = db.best_chain, i = n; i > 0; bi = bi->prev)
+		todo[--i] = bi;
+
+	log_info("%s: Applying %u blocks to UTXO db", prog_name, n);
+	for (i = 0; i < n && rc; i++)
+		rc = blockdb_get(&todo[i]->hash, spend_stored_block);
+
+	free(todo);
+	return rc;
+}
+
+static void init_blocks(void)
+{
+	/* headers-only restart, unless asked to re-validate every block */
+	if (!setting("reverify") && chaindb_load(&db)) {
+		if (!utxo_catch_up()) {
+			log_error("%s: UTXO db catch-up failed", prog_name);
+			exit(1);
+		}
+		return;
+	}
+
+	blockheightdb_getall(read_block);
+}
+
 static void init_orphans(void)
 {
 	orphans = bitc_hashtab_new_ext(bu256_hash, bu256_equal_,
@@ -506,22 +678,40 @@ static bool add_block(struct bitc_block *block, struct const_buffer *buf)
         return true;
 
 	blockdb_add(&block->sha256, buf);
+	struct bitc_block_stats stats;
+	bitc_block_stats_calc(&stats, block);
     /* process block */
-    if (!block_process(block))
+    if (!block_process(block, &stats))
         return false;
 
     return true;
 
 }
 
+/* commit the db batch when blocks stop coming */
+static void db_timer_evt(int fd, short events, void *priv)
+{
+	struct timeval tv = { DB_BATCH_IDLE, };
+
+	if (!db_batch_idle()) {
+		log_error("%s: db batch commit failed", prog_name);
+	}
+	if (event_add(db_timer, &tv) != 0) {
+		log_error("%s: db timer lost", prog_name);
+	}
+}
+
 static void init_nci(struct net_child_info *nci)
 {
+	struct timeval tv = { DB_BATCH_IDLE, };
+
 	memset(nci, 0, sizeof(*nci));
 	nci->read_fd = -1;
 	nci->write_fd = -1;
 	init_peers(nci);
         nci->db = &db;
-        nci->conns = parr_new(NC_MAX_CONN, NULL);
+	nci->max_conns = setting_ul("net.connections", NC_MAX_CONN);
+        nci->conns = parr_new(nci->max_conns, NULL);
 	nci->eb = event_base_new();
         nci->inv_block_process = inv_block_process;
 	nci->block_process = add_block;
@@ -529,15 +719,39 @@ static void init_nci(struct net_child_info *nci)
         nci->chain = chain;
         nci->instance_nonce = &instance_nonce;
 	nci->running = true;
+
+	/* optionally move socket I/O off the main loop */
+	if (!nc_loops_start(nci, setting_ul("net.threads", 0))) {
+		log_error("%s: network thread init failed", prog_name);
+		exit(1);
+	}
+
+	/* optionally sync headers first, then blocks from all peers */
+	if (setting("net.headers")) {
+		chaindb_init(&hdr_db, chain->netmagic, &chain_genesis);
+		hdr_db.hdrs_only = true;
+		nci->dl_window = setting_ul("net.blocks.window",
+					    NC_DL_WINDOW);
+		nci->dl_per_peer = setting_ul("net.blocks.per_peer",
+					      NC_DL_PER_PEER);
+		if (!nc_hdrs_start(nci, &hdr_db))
+			exit(1);
+	}
+
+	db_timer = event_new(nci->eb, -1, 0, db_timer_evt, NULL);
+	if (!db_timer || event_add(db_timer, &tv) != 0) {
+		log_error("%s: db timer init failed", prog_name);
+		exit(1);
+	}
 }
 
 static void init_daemon(struct net_child_info *nci)
 {
+	init_verify();
 	init_chaindb();
-	bitc_utxo_set_init(&uset);
 	init_block0();
 	init_orphans();
-	blockheightdb_getall(read_block);
+	init_blocks();
 	init_nci(nci);
 }
 
@@ -552,10 +766,17 @@ static void run_daemon(struct net_child_info *nci)
 
 static void shutdown_nci(struct net_child_info *nci)
 {
+	nc_loops_stop(nci);
 	peerman_free(nci->peers);
 	nc_conns_gc(nci, true);
+	if (nci->hdr_db) {
+		nc_hdrs_stop(nci);
+		chaindb_free(&hdr_db);
+	}
 	assert(nci->conns->len == 0);
 	parr_free(nci->conns, true);
+	event_del(db_timer);
+	event_free(db_timer);
 	event_base_free(nci->eb);
 }
 
@@ -566,6 +787,20 @@ static void shutdown_daemon(struct net_child_info *nci)
 		rc ? "wrote" : "failed to write",
 		bitc_hashtab_size(nci->peers->map_addr),
 		clist_length(nci->peers->addrlist));
+	if (!utxodb_close(&udb)) {
+		log_error("%s: UTXO db flush failed", prog_name);
+	}
+
+	if (bitc_sigcache_enabled()) {
+		struct bitc_sigcache_stats st;
+
+		bitc_sigcache_stats(&st);
+		log_info("%s: signature cache %llu hits, %llu misses, "
+			 "%llu evictions", prog_name,
+			 (unsigned long long) st.hits,
+			 (unsigned long long) st.misses,
+			 (unsigned long long) st.evictions);
+	}
 
 	db_close();
 
@@ -580,7 +815,9 @@ static void shutdown_daemon(struct net_child_info *nci)
 		bitc_hashtab_unref(orphans);
 		bitc_hashtab_unref(settings);
 		chaindb_free(&db);
-		bitc_utxo_set_free(&uset);
+		utxodb_free(&udb);
+		bitc_checkq_free(&checkq);
+		bitc_sigcache_free();
 	}
 }
 
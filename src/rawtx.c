@@ -356,6 +356,10 @@ static void apply_mutations(void)
 		mutate_inputs();
 	if (opt_txout || opt_del_txout)
 		mutate_outputs();
+
+	/* hashes cached by deser_bitc_tx are of the tx as read */
+	tx.sha256_valid = false;
+	tx.wtxid_valid = false;
 }
 
 static void read_data(void)
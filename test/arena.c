@@ -0,0 +1,84 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/arena.h>                 // for bitc_arena, etc
+
+#include <assert.h>                     // for assert
+#include <stdint.h>                     // for uintptr_t, SIZE_MAX
+#include <string.h>                     // for memset, NULL
+
+static void test_basic(void)
+{
+	struct bitc_arena arena;
+	bitc_arena_init(&arena, 0);
+	assert(arena.head == NULL);
+	assert(arena.chunk_sz == BITC_ARENA_MIN_CHUNK);
+	assert(bitc_arena_used(&arena) == 0);
+
+	unsigned char *p1 = bitc_arena_alloc(&arena, 3);
+	unsigned char *p2 = bitc_arena_alloc(&arena, 5);
+	assert(p1 != NULL && p2 != NULL);
+	assert(((uintptr_t) p1 % BITC_ARENA_ALIGN) == 0);
+	assert(((uintptr_t) p2 % BITC_ARENA_ALIGN) == 0);
+	assert(p2 == p1 + BITC_ARENA_ALIGN);
+	assert(bitc_arena_used(&arena) == 2 * BITC_ARENA_ALIGN);
+
+	memset(p1, 0xff, 3);
+	memset(p2, 0xff, 5);
+
+	unsigned int *zp = bitc_arena_calloc(&arena, 16, sizeof(unsigned int));
+	assert(zp != NULL);
+	unsigned int i;
+	for (i = 0; i < 16; i++)
+		assert(zp[i] == 0);
+
+	/* larger than a chunk: gets a dedicated chunk */
+	unsigned char *big = bitc_arena_alloc(&arena, BITC_ARENA_MIN_CHUNK * 3);
+	assert(big != NULL);
+	memset(big, 0xaa, BITC_ARENA_MIN_CHUNK * 3);
+	assert(arena.head->next != NULL);
+
+	/* overflow checks */
+	assert(bitc_arena_alloc(&arena, SIZE_MAX) == NULL);
+	assert(bitc_arena_calloc(&arena, SIZE_MAX / 2, 4) == NULL);
+
+	bitc_arena_reset(&arena);
+	assert(bitc_arena_used(&arena) == 0);
+	assert(arena.head != NULL);
+	assert(arena.head->next == NULL);
+
+	unsigned char *p3 = bitc_arena_alloc(&arena, 1);
+	assert(p3 == arena.head->data);
+
+	bitc_arena_free(&arena);
+	assert(arena.head == NULL);
+
+	/* free(NULL) should succeed, as a no-op */
+	bitc_arena_free(NULL);
+}
+
+static void test_many(void)
+{
+	struct bitc_arena arena;
+	bitc_arena_init(&arena, 100);
+
+	unsigned int i;
+	for (i = 0; i < 100000; i++) {
+		unsigned int *p = bitc_arena_alloc(&arena, sizeof(*p));
+		assert(p != NULL);
+		*p = i;
+	}
+
+	assert(bitc_arena_used(&arena) == 100000 * BITC_ARENA_ALIGN);
+
+	bitc_arena_free(&arena);
+}
+
+int main (int argc, char *argv[])
+{
+	test_basic();
+	test_many();
+	return 0;
+}
@@ -0,0 +1,111 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+/*
+ * Hashing microbenchmark; not run by "make check".  Build and run with
+ *
+ *   make -C test bench-crypto && ./test/bench-crypto
+ *
+ * Every block transform the CPU supports is timed on short messages
+ * (checksums, sighash), 64-byte node pairs and long buffers.
+ */
+
+#include <bitc/crypto/sha2.h>           // for sha256_Raw, sha256_select, etc
+#include <bitc/crypto/sha256d64.h>      // for sha256d64, etc
+
+#include <stdbool.h>                    // for bool
+#include <stdio.h>                      // for printf
+#include <string.h>                     // for memset
+#include <time.h>                       // for clock_gettime, timespec
+
+enum {
+	BENCH_BUFSZ	= 1024 * 1024,
+	BENCH_MIN_NS	= 200 * 1000 * 1000,
+};
+
+static unsigned char bench_buf[BENCH_BUFSZ];
+static unsigned char bench_out[BENCH_BUFSZ / 2];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef void (*bench_fn)(size_t len);
+
+static void run_sha256(size_t len)
+{
+	sha256_Raw(bench_buf, len, bench_out);
+}
+
+static void run_sha512(size_t len)
+{
+	sha512_Raw(bench_buf, len, bench_out);
+}
+
+static void run_sha256d64(size_t len)
+{
+	sha256d64(bench_out, bench_buf, len / 64);
+}
+
+/* repeat until BENCH_MIN_NS has passed, print ns/op and MB/s */
+static void bench(const char *name, const char *impl, bench_fn fn, size_t len)
+{
+	unsigned long iters = 0, batch = 1;
+	double start = now_ns(), elapsed;
+	unsigned long i;
+
+	do {
+		for (i = 0; i < batch; i++)
+			fn(len);
+		iters += batch;
+		batch *= 2;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	printf("%-10s %-9s %8zu bytes %12.1f ns/op %9.1f MB/s\n",
+	       name, impl, len, elapsed / iters,
+	       (double) len * iters / elapsed * 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *sha2_kernels[] = { "sha-ni", "armv8", "portable" };
+	static const char *d64_kernels[] = { "sha-ni", "armv8", "avx2", "sse4.1",
+					      "scalar" };
+	static const size_t lens[] = { 24, 64, 256, 4096, BENCH_BUFSZ };
+	const char *impl256 = sha256_impl();
+	unsigned int i, k;
+
+	memset(bench_buf, 0xa5, sizeof(bench_buf));
+
+	for (k = 0; k < sizeof(sha2_kernels) / sizeof(sha2_kernels[0]); k++) {
+		if (!sha256_select(sha2_kernels[k]))
+			continue;
+		for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+			bench("sha256", sha2_kernels[k], run_sha256, lens[i]);
+	}
+
+	sha256_select(impl256);
+
+	for (k = 0; k < sizeof(sha2_kernels) / sizeof(sha2_kernels[0]); k++) {
+		if (!sha512_select(sha2_kernels[k]))
+			continue;
+		for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+			bench("sha512", sha2_kernels[k], run_sha512, lens[i]);
+	}
+
+	for (k = 0; k < sizeof(d64_kernels) / sizeof(d64_kernels[0]); k++) {
+		if (!sha256d64_select(d64_kernels[k]))
+			continue;
+		bench("sha256d64", d64_kernels[k], run_sha256d64, 64);
+		bench("sha256d64", d64_kernels[k], run_sha256d64, 64 * 1024);
+	}
+
+	return 0;
+}
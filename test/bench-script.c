@@ -0,0 +1,199 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+/*
+ * Script interpreter microbenchmark; not run by "make check".  Build
+ * and run with
+ *
+ *   make -C test bench-script && ./test/bench-script
+ *
+ * Every script_tests.json vector is verified once per round, as in
+ * test/script.c, and the mean time per vector is printed.
+ */
+
+#include "libtest.h"                    // for parse_script_str, etc
+#include <bitc/core.h>                  // for bitc_tx, bitc_txin, etc
+#include <bitc/hexcode.h>               // for hex2str
+#include <bitc/script/interpreter.h>    // for bitc_script_verify, etc
+
+#include <cJSON.h>                      // for cJSON_GetArrayItem, cJSON, etc
+
+#include <assert.h>                     // for assert
+#include <stdio.h>                      // for printf
+#include <stdlib.h>                     // for calloc, free
+#include <string.h>                     // for strcmp, strtok
+#include <time.h>                       // for clock_gettime, timespec
+
+enum {
+	BENCH_MIN_NS	= 1000 * 1000 * 1000,
+};
+
+struct bench_vec {
+	cstring		*scriptSig;
+	cstring		*scriptPubKey;
+	parr		*scriptWitness;
+	unsigned int	flags;
+	int64_t		nValue;
+	struct bitc_tx	tx;
+};
+
+static const struct {
+	const char	*name;
+	unsigned int	flag;
+} bench_flags[] = {
+	{ "P2SH", SCRIPT_VERIFY_P2SH },
+	{ "STRICTENC", SCRIPT_VERIFY_STRICTENC },
+	{ "DERSIG", SCRIPT_VERIFY_DERSIG },
+	{ "LOW_S", SCRIPT_VERIFY_LOW_S },
+	{ "NULLDUMMY", SCRIPT_VERIFY_NULLDUMMY },
+	{ "SIGPUSHONLY", SCRIPT_VERIFY_SIGPUSHONLY },
+	{ "MINIMALDATA", SCRIPT_VERIFY_MINIMALDATA },
+	{ "DISCOURAGE_UPGRADABLE_NOPS",
+	  SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS },
+	{ "CLEANSTACK", SCRIPT_VERIFY_CLEANSTACK },
+	{ "CHECKLOCKTIMEVERIFY", SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY },
+	{ "CHECKSEQUENCEVERIFY", SCRIPT_VERIFY_CHECKSEQUENCEVERIFY },
+	{ "WITNESS", SCRIPT_VERIFY_WITNESS },
+	{ "DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM",
+	  SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM },
+	{ "MINIMALIF", SCRIPT_VERIFY_MINIMALIF },
+	{ "NULLFAIL", SCRIPT_VERIFY_NULLFAIL },
+	{ "WITNESS_PUBKEYTYPE", SCRIPT_VERIFY_WITNESS_PUBKEYTYPE },
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned int parse_flags(char *s)
+{
+	unsigned int flags = SCRIPT_VERIFY_NONE, i;
+	const char *name;
+
+	for (name = strtok(s, ","); name; name = strtok(NULL, ","))
+		for (i = 0; i < sizeof(bench_flags) / sizeof(bench_flags[0]); i++)
+			if (!strcmp(name, bench_flags[i].name))
+				flags |= bench_flags[i].flag;
+
+	return flags;
+}
+
+/* a one-input spend; only signature checks look inside it */
+static void build_tx(struct bench_vec *v)
+{
+	struct bitc_tx *tx = &v->tx;
+	struct bitc_txin *txin = calloc(1, sizeof(*txin));
+	struct bitc_txout *txout = calloc(1, sizeof(*txout));
+
+	bitc_tx_init(tx);
+	tx->nVersion = 1;
+	tx->vin = parr_new(1, bitc_txin_freep);
+	tx->vout = parr_new(1, bitc_txout_freep);
+
+	bitc_txin_init(txin);
+	txin->scriptSig = cstr_new_buf(v->scriptSig->str, v->scriptSig->len);
+	txin->scriptWitness = v->scriptWitness;
+	txin->nSequence = SEQUENCE_FINAL;
+	parr_add(tx->vin, txin);
+
+	bitc_txout_init(txout);
+	txout->scriptPubKey = cstr_new(NULL);
+	txout->nValue = v->nValue;
+	parr_add(tx->vout, txout);
+}
+
+static unsigned int load_vecs(struct bench_vec **vecs_out)
+{
+	char *json_fn = test_filename("data/script_tests.json");
+	cJSON *tests = read_json(json_fn);
+	assert(tests != NULL);
+
+	unsigned int n_tests = cJSON_GetArraySize(tests), n_vecs = 0, idx;
+	struct bench_vec *vecs = calloc(n_tests, sizeof(*vecs));
+	assert(vecs != NULL);
+
+	for (idx = 0; idx < n_tests; idx++) {
+		cJSON *test = cJSON_GetArrayItem(tests, idx);
+		struct bench_vec *v = &vecs[n_vecs];
+		unsigned int pos = 0, i;
+
+		v->scriptWitness = parr_new(0, buffer_freep);
+		if (cJSON_GetArraySize(test) > 0 &&
+		    (cJSON_GetArrayItem(test, 0)->type & 0xFF) == cJSON_Array) {
+			cJSON *wit = cJSON_GetArrayItem(test, pos++);
+			unsigned int n_wit = cJSON_GetArraySize(wit) - 1;
+
+			for (i = 0; i < n_wit; i++) {
+				cstring *s = hex2str(
+					cJSON_GetArrayItem(wit, i)->valuestring);
+				if (!s)
+					s = cstr_new_sz(0);
+				parr_add(v->scriptWitness,
+					 buffer_copy(s->str, s->len));
+				cstr_free(s, true);
+			}
+			v->nValue = cJSON_GetArrayItem(wit, n_wit)->valuedouble
+				    * COIN;
+		}
+
+		// comments
+		if (cJSON_GetArraySize(test) < 4 + pos) {
+			parr_free(v->scriptWitness, true);
+			continue;
+		}
+
+		v->scriptSig = parse_script_str(
+			cJSON_GetArrayItem(test, pos++)->valuestring);
+		v->scriptPubKey = parse_script_str(
+			cJSON_GetArrayItem(test, pos++)->valuestring);
+		assert(v->scriptSig && v->scriptPubKey);
+		v->flags = parse_flags(
+			cJSON_GetArrayItem(test, pos++)->valuestring);
+
+		build_tx(v);
+		n_vecs++;
+	}
+
+	cJSON_Delete(tests);
+	free(json_fn);
+
+	*vecs_out = vecs;
+	return n_vecs;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_vec *vecs;
+	unsigned int n_vecs = load_vecs(&vecs), i;
+	unsigned long rounds = 0;
+	double start = now_ns(), elapsed;
+
+	do {
+		for (i = 0; i < n_vecs; i++) {
+			struct bench_vec *v = &vecs[i];
+
+			bitc_script_verify(v->scriptSig, v->scriptPubKey,
+					   &v->scriptWitness, &v->tx, 0,
+					   v->flags, v->nValue, NULL);
+		}
+		rounds++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	printf("script_tests %u vectors %lu rounds %9.1f ns/vector\n",
+	       n_vecs, rounds, elapsed / rounds / n_vecs);
+
+	for (i = 0; i < n_vecs; i++) {
+		cstr_free(vecs[i].scriptSig, true);
+		cstr_free(vecs[i].scriptPubKey, true);
+		bitc_tx_free(&vecs[i].tx);
+	}
+	free(vecs);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+/*
+ * Transaction check microbenchmark; not run by "make check".  Build
+ * and run with
+ *
+ *   make -C test bench-tx && ./test/bench-tx
+ *
+ * bitc_tx_valid is timed on spends of a growing number of distinct
+ * outputs, up to about the most a block can hold.  No input is a
+ * duplicate, so every prevout has to be compared.
+ */
+
+#include "libtest.h"                    // for make_spend_tx
+#include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_tx_valid, etc
+
+#include <assert.h>                     // for assert
+#include <stdio.h>                      // for printf
+#include <time.h>                       // for clock_gettime, timespec
+
+enum {
+	BENCH_MIN_NS	= 200 * 1000 * 1000,
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(unsigned int n_in)
+{
+	unsigned long iters = 0;
+	double start = now_ns(), elapsed;
+	struct bitc_tx tx;
+
+	make_spend_tx(&tx, n_in);
+
+	do {
+		assert(bitc_tx_valid(&tx));
+		iters++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	printf("tx_valid %6u inputs %14.1f ns/tx %9.1f ns/input\n",
+	       n_in, elapsed / iters, elapsed / iters / n_in);
+
+	bitc_tx_free(&tx);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int n_ins[] = { 1, 2, 8, 64, 512, 4096, 24000 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(n_ins) / sizeof(n_ins[0]); i++)
+		bench(n_ins[i]);
+
+	return 0;
+}
@@ -9,8 +9,12 @@
 #include <bitc/cstr.h>                  // for cstring, cstr_free, etc
 #include <bitc/key.h>                   // for bitc_key_static_shutdown
 #include <bitc/mbr.h>                   // for fread_message
+#include <bitc/parr.h>                  // for parr_idx
+#include <bitc/script/interpreter.h>    // for ::SCRIPT_VERIFY_P2SH, etc
+#include <bitc/script/script.h>         // for bsp_push_data, etc
+#include <bitc/serialize.h>             // for bitc_sink, etc
 #include <bitc/message.h>               // for p2p_message, etc
-#include <bitc/util.h>                  // for file_seq_open
+#include <bitc/util.h>                  // for file_seq_open, bu_Hash
 #include "libtest.h"                    // for test_filename, read_json
 
 #include <cJSON.h>                      // for cJSON, cJSON_GetObjectItem, etc
@@ -22,6 +26,71 @@
 #include <string.h>                     // for strcmp, memcmp, strncmp
 #include <unistd.h>                     // for close
 
+static void runtest_view(const struct bitc_block *block,
+			 const struct p2p_message *msg)
+{
+	struct bitc_block_view view;
+	struct bitc_block_stats stats, calc;
+	bitc_block_view_init(&view);
+
+	struct const_buffer buf = { msg->data, msg->hdr.data_len };
+	bool rc = deser_bitc_block_view_stats(&view, &buf, &stats);
+	assert(rc);
+	assert(buf.len == 0);
+
+	bitc_block_stats_calc(&calc, block);
+	assert(memcmp(&stats, &calc, sizeof(stats)) == 0);
+
+	bitc_block_view_calc_sha256(&view);
+	assert(bu256_equal(&view.sha256, &block->sha256));
+
+	assert(block->vtx != NULL);
+	assert(view.n_tx == block->vtx->len);
+
+	unsigned int i;
+	for (i = 0; i < view.n_tx; i++) {
+		struct bitc_tx_view *txv = &view.vtx[i];
+		struct bitc_tx *tx = parr_idx(block->vtx, i);
+
+		assert(txv->n_vin == tx->vin->len);
+		assert(txv->n_vout == tx->vout->len);
+
+		unsigned int j;
+		for (j = 0; j < txv->n_vout; j++) {
+			struct bitc_txout *txout = parr_idx(tx->vout, j);
+			assert(txv->vout[j].nValue == txout->nValue);
+			assert(txv->vout[j].scriptPubKey.len ==
+			       txout->scriptPubKey->len);
+			assert(memcmp(txv->vout[j].scriptPubKey.p,
+				      txout->scriptPubKey->str,
+				      txout->scriptPubKey->len) == 0);
+		}
+
+		bitc_tx_calc_sha256(tx);
+		bitc_tx_view_calc_sha256(txv);
+		assert(bu256_equal(&txv->sha256, &tx->sha256));
+
+		cstring *s1 = cstr_new_sz(1024);
+		cstring *s2 = cstr_new_sz(1024);
+		ser_bitc_tx(s1, tx);
+		ser_bitc_tx_view(s2, txv);
+		assert(cstr_equal(s1, s2));
+
+		struct bitc_tx tmp;
+		bitc_tx_init(&tmp);
+		bitc_tx_from_view(&tmp, txv);
+		cstr_resize(s2, 0);
+		ser_bitc_tx(s2, &tmp);
+		assert(cstr_equal(s1, s2));
+		bitc_tx_free(&tmp);
+
+		cstr_free(s1, true);
+		cstr_free(s2, true);
+	}
+
+	bitc_block_view_free(&view);
+}
+
 static void runtest(const char *json_base_fn, const char *ser_fn_base)
 {
 	char *json_fn = test_filename(json_base_fn);
@@ -51,13 +120,23 @@ static void runtest(const char *json_base_fn, const char *ser_fn_base)
 	assert((24 + msg.hdr.data_len) == size);
 
 	struct bitc_block block;
+	struct bitc_block_stats stats, calc;
 	bitc_block_init(&block);
 
 	struct const_buffer buf = { msg.data, msg.hdr.data_len };
 
-	rc = deser_bitc_block(&block, &buf);
+	rc = deser_bitc_block_stats(&block, &buf, &stats);
 	assert(rc);
 
+	/* no witness data in these; parsed and computed stats agree */
+	assert(stats.total_size == msg.hdr.data_len);
+	assert(stats.base_size == stats.total_size);
+	assert(stats.weight == stats.total_size * WITNESS_SCALE_FACTOR);
+	assert(stats.sigops_legacy > 0);
+	bitc_block_stats_calc(&calc, &block);
+	assert(memcmp(&stats, &calc, sizeof(stats)) == 0);
+	assert(bitc_block_valid_stats(&block, &stats));
+
 	cstring *gs = cstr_new_sz(100000);
 	ser_bitc_block(gs, &block);
 
@@ -68,6 +147,21 @@ static void runtest(const char *json_base_fn, const char *ser_fn_base)
 	}
 	assert(memcmp(gs->str, msg.data, msg.hdr.data_len) == 0);
 
+	/* counting and hashing sinks must agree with the cstring sink */
+	assert(bitc_block_ser_size(&block) == msg.hdr.data_len);
+
+	SHA256_CTX ctx;
+	struct bitc_sink sink;
+	unsigned char md_sink[SHA256_DIGEST_LENGTH];
+	unsigned char md_buf[SHA256_DIGEST_LENGTH];
+
+	bitc_sink_sha256_init(&sink, &ctx);
+	ser_sink_bitc_block(&sink, &block);
+	assert(sink.len == msg.hdr.data_len);
+	bitc_sink_sha256d(&sink, md_sink);
+	bu_Hash(md_buf, gs->str, gs->len);
+	assert(memcmp(md_sink, md_buf, sizeof(md_buf)) == 0);
+
 	bitc_block_calc_sha256(&block);
 
 	char hexstr[BU256_STRSZ];
@@ -82,6 +176,27 @@ static void runtest(const char *json_base_fn, const char *ser_fn_base)
 	rc = bitc_block_valid(&block);
 	assert(rc);
 
+	/* every tx must prove its way up to the merkle root */
+	parr *mrktree = bitc_block_merkle_tree(&block);
+	assert(mrktree != NULL);
+
+	unsigned int txidx;
+	for (txidx = 0; txidx < block.vtx->len; txidx++) {
+		struct bitc_tx *tx = parr_idx(block.vtx, txidx);
+		parr *branch = bitc_block_merkle_branch(&block, mrktree, txidx);
+		bu256_t root;
+
+		assert(branch != NULL);
+		bitc_check_merkle_branch(&root, &tx->sha256, branch, txidx);
+		assert(bu256_equal(&root, &block.hashMerkleRoot));
+
+		parr_free(branch, true);
+	}
+
+	parr_free(mrktree, true);
+
+	runtest_view(&block, &msg);
+
 	bitc_block_free(&block);
 	cstr_free(gs, true);
 	free(msg.data);
@@ -90,10 +205,172 @@ static void runtest(const char *json_base_fn, const char *ser_fn_base)
 	cJSON_Delete(meta);
 }
 
+static struct bitc_txin *add_txin(struct bitc_tx *tx, const cstring *scriptSig)
+{
+	struct bitc_txin *txin = calloc(1, sizeof(*txin));
+
+	bitc_txin_init(txin);
+	txin->prevout.n = tx->vin->len;
+	txin->scriptSig = cstr_new_buf(scriptSig->str, scriptSig->len);
+	txin->scriptWitness = parr_new(0, buffer_freep);
+	parr_add(tx->vin, txin);
+
+	return txin;
+}
+
+/* item of len bytes on the witness stack; returns its serialized size */
+static size_t add_witness(struct bitc_txin *txin, const void *p, size_t len)
+{
+	parr_add(txin->scriptWitness, buffer_copy(p, len));
+	return 1 + len;
+}
+
+static cstring *make_multisig(const unsigned char *pubkey, unsigned int m,
+			      unsigned int n)
+{
+	cstring *s = cstr_new(NULL);
+	unsigned int i;
+
+	bsp_push_op(s, OP_1 + m - 1);
+	for (i = 0; i < n; i++)
+		bsp_push_data(s, pubkey, 33);
+	bsp_push_op(s, OP_1 + n - 1);
+	bsp_push_op(s, OP_CHECKMULTISIG);
+
+	return s;
+}
+
+static void test_witness_stats(void)
+{
+	unsigned char sig[72] = { 0x30 }, pubkey[33] = { 0x02 };
+	unsigned char hash20[20] = {}, hash32[32] = {};
+	cstring *multisig = make_multisig(pubkey, 2, 3);
+	cstring *empty = cstr_new(NULL);
+	cstring *p2sh_sig = cstr_new(NULL);
+	cstring *spk_wpkh = cstr_new(NULL);
+	cstring *spk_wsh = cstr_new(NULL);
+	cstring *spk_sh = cstr_new(NULL);
+	struct bitc_txin *txin[3];
+	struct bitc_tx tx;
+	size_t witness_size = 2;		// marker and flag
+	unsigned int i;
+
+	bsp_push_op(spk_wpkh, OP_0);
+	bsp_push_data(spk_wpkh, hash20, sizeof(hash20));
+	bsp_push_op(spk_wsh, OP_0);
+	bsp_push_data(spk_wsh, hash32, sizeof(hash32));
+	bsp_push_op(spk_sh, OP_HASH160);
+	bsp_push_data(spk_sh, hash20, sizeof(hash20));
+	bsp_push_op(spk_sh, OP_EQUAL);
+
+	bsp_push_op(p2sh_sig, OP_0);
+	bsp_push_data(p2sh_sig, sig, sizeof(sig));
+	bsp_push_data(p2sh_sig, sig, sizeof(sig));
+	bsp_push_data(p2sh_sig, multisig->str, multisig->len);
+
+	/* spends of P2WPKH, 2-of-3 P2SH and 2-of-3 P2WSH */
+	bitc_tx_init(&tx);
+	tx.nVersion = 1;
+	tx.vin = parr_new(3, bitc_txin_freep);
+	tx.vout = parr_new(1, bitc_txout_freep);
+
+	txin[0] = add_txin(&tx, empty);
+	witness_size += 1 + add_witness(txin[0], sig, sizeof(sig)) +
+			add_witness(txin[0], pubkey, sizeof(pubkey));
+	txin[1] = add_txin(&tx, p2sh_sig);
+	witness_size += 1;
+	txin[2] = add_txin(&tx, empty);
+	witness_size += 1 + add_witness(txin[2], NULL, 0) +
+			add_witness(txin[2], sig, sizeof(sig)) +
+			add_witness(txin[2], sig, sizeof(sig)) +
+			add_witness(txin[2], multisig->str, multisig->len);
+
+	struct bitc_txout *txout = calloc(1, sizeof(*txout));
+	bitc_txout_init(txout);
+	cstring *hash = cstr_new_buf(hash20, sizeof(hash20));
+	txout->scriptPubKey = bsp_make_pubkeyhash(hash);
+	parr_add(tx.vout, txout);
+	cstr_free(hash, true);
+
+	/* header-only block, then the tx in BIP144 form */
+	struct bitc_block block;
+	bitc_block_init(&block);
+	cstring *s = cstr_new(NULL);
+	unsigned char marker_flag[2] = { 0, 1 };
+
+	ser_bitc_block(s, &block);
+	ser_varlen(s, 1);
+	ser_u32(s, tx.nVersion);
+	ser_bytes(s, marker_flag, sizeof(marker_flag));
+	ser_varlen(s, tx.vin->len);
+	for (i = 0; i < tx.vin->len; i++)
+		ser_bitc_txin(s, parr_idx(tx.vin, i));
+	ser_varlen(s, tx.vout->len);
+	ser_bitc_txout(s, txout);
+	for (i = 0; i < tx.vin->len; i++)
+		ser_varlen_array(s, txin[i]->scriptWitness);
+	ser_u32(s, tx.nLockTime);
+
+	struct bitc_block_stats stats, calc;
+	struct const_buffer buf = { s->str, s->len };
+
+	assert(deser_bitc_block_stats(&block, &buf, &stats));
+	assert(buf.len == 0);
+	assert(stats.total_size == s->len);
+	assert(stats.base_size == s->len - witness_size);
+	assert(stats.weight == stats.base_size * (WITNESS_SCALE_FACTOR - 1) +
+			       stats.total_size);
+	assert(stats.sigops_legacy == 1);
+
+	bitc_block_stats_calc(&calc, &block);
+	assert(memcmp(&stats, &calc, sizeof(stats)) == 0);
+
+	struct bitc_block_view view;
+	bitc_block_view_init(&view);
+	buf.p = s->str;
+	buf.len = s->len;
+	assert(deser_bitc_block_view_stats(&view, &buf, &calc));
+	assert(memcmp(&stats, &calc, sizeof(stats)) == 0);
+	bitc_block_view_free(&view);
+
+	/* inputs count nothing more without the flags enabling them */
+	struct bitc_txin *btxin[3];
+	for (i = 0; i < 3; i++)
+		btxin[i] = parr_idx(((struct bitc_tx *)
+				     parr_idx(block.vtx, 0))->vin, i);
+
+	bitc_block_stats_spend(&stats, btxin[1], spk_sh, SCRIPT_VERIFY_NONE);
+	assert(stats.sigops_p2sh == 0);
+
+	bitc_block_stats_spend(&stats, btxin[0], spk_wpkh,
+			       SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS);
+	assert(stats.sigops_p2sh == 0 && stats.sigops_witness == 1);
+	bitc_block_stats_spend(&stats, btxin[1], spk_sh,
+			       SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS);
+	assert(stats.sigops_p2sh == 3 && stats.sigops_witness == 1);
+	bitc_block_stats_spend(&stats, btxin[2], spk_wsh,
+			       SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS);
+	assert(stats.sigops_p2sh == 3 && stats.sigops_witness == 4);
+
+	assert(bitc_block_stats_sigop_cost(&stats) ==
+	       (1 + 3) * WITNESS_SCALE_FACTOR + 4);
+
+	bitc_block_free(&block);
+	bitc_tx_free(&tx);
+	cstr_free(s, true);
+	cstr_free(spk_sh, true);
+	cstr_free(spk_wsh, true);
+	cstr_free(spk_wpkh, true);
+	cstr_free(p2sh_sig, true);
+	cstr_free(empty, true);
+	cstr_free(multisig, true);
+}
+
 int main (int argc, char *argv[])
 {
 	runtest("data/blk0.json", "data/blk0.ser");
 	runtest("data/blk120383.json", "data/blk120383.ser");
+	test_witness_stats();
 
 	bitc_key_static_shutdown();
 	return 0;
@@ -13,12 +13,14 @@
 #include <bitc/key.h>                   // for bitc_key_static_shutdown
 #include <bitc/parr.h>                  // for parr, parr_idx
 #include <bitc/checkpoints.h>           // for bitc_ckpt_last
-#include <bitc/coredefs.h>              // for chain_info, etc
+#include <bitc/coredefs.h>              // for chain_info, MAX_BLOCK_SIGOPS_COST, etc
 #include <bitc/log.h>                   // for logging
 #include <bitc/mbr.h>                   // for fread_block
 #include <bitc/message.h>               // for p2p_message, etc
-#include <bitc/script/interpreter.h>    // for bitc_verify_sig, etc
-#include <bitc/util.h>                  // for file_seq_open
+#include <bitc/script/checkqueue.h>     // for bitc_checkq, etc
+#include <bitc/script/interpreter.h>    // for SCRIPT_VERIFY_P2SH, etc
+#include <bitc/script/script.h>         // for bsp_push_data, etc
+#include <bitc/util.h>                  // for file_seq_open, bu_Hash160
 
 #include <assert.h>                     // for assert
 #include <stdbool.h>                    // for true, false, bool
@@ -31,17 +33,19 @@
 
 static bool no_script_verf = false;
 static bool force_script_verf = false;
+static struct bitc_checkq checkq;
 struct logging *log_state;
 
 static bool spend_tx(struct bitc_utxo_set *uset, const struct bitc_tx *tx,
 		     unsigned int tx_idx, unsigned int height,
-		     unsigned int ckpt_height)
+		     unsigned int ckpt_height, struct bitc_block_stats *stats)
 {
 	assert(tx->sha256_valid == true);
 
 	bool is_coinbase = (tx_idx == 0);
 
 	struct bitc_utxo *coin;
+	struct bitc_txdata *txdata = NULL;
 
 	int64_t total_in = 0, total_out = 0;
 
@@ -69,6 +73,10 @@ static bool spend_tx(struct bitc_utxo_set *uset, const struct bitc_tx *tx,
 			txout = parr_idx(coin->vout, txin->prevout.n);
 			total_in += txout->nValue;
 
+			bitc_block_stats_spend(stats, txin, txout->scriptPubKey,
+					       SCRIPT_VERIFY_P2SH |
+					       SCRIPT_VERIFY_WITNESS);
+
 			bool check_script;
 			if (force_script_verf)
 				check_script = true;
@@ -79,8 +87,13 @@ static bool spend_tx(struct bitc_utxo_set *uset, const struct bitc_tx *tx,
 			else
 				check_script = true;
 
+			if (check_script && !txdata)
+				txdata = bitc_checkq_txdata(&checkq, tx);
+
 			if (check_script &&
-			    !bitc_verify_sig(coin, tx, i, SCRIPT_VERIFY_NONE, 0))
+			    !bitc_checkq_add(&checkq, tx, txdata, i,
+					     txout->scriptPubKey,
+					     SCRIPT_VERIFY_NONE, txout->nValue))
 				return false;
 
 			if (!bitc_utxo_spend(uset, &txin->prevout))
@@ -113,27 +126,41 @@ static bool spend_tx(struct bitc_utxo_set *uset, const struct bitc_tx *tx,
 }
 
 static bool spend_block(struct bitc_utxo_set *uset, const struct bitc_block *block,
+			struct bitc_block_stats *stats,
 			unsigned int height, unsigned int ckpt_height)
 {
 	unsigned int i;
+	bool rc = true;
 
 	if (height % 5000 == 0)
 		fprintf(stderr, "chain-verf: spend block @ %u\n", height);
 
+	bitc_checkq_begin(&checkq);
+
 	for (i = 0; i < block->vtx->len; i++) {
 		struct bitc_tx *tx;
 
 		tx = parr_idx(block->vtx, i);
-		if (!spend_tx(uset, tx, i, height, ckpt_height)) {
+		if (!spend_tx(uset, tx, i, height, ckpt_height, stats)) {
 			char hexstr[BU256_STRSZ];
 			bu256_hex(hexstr, &tx->sha256);
 			fprintf(stderr,
 				"chain-verf: tx fail %s\n", hexstr);
-			return false;
+			rc = false;
+			break;
+		}
+		if (bitc_block_stats_sigop_cost(stats) > MAX_BLOCK_SIGOPS_COST) {
+			fprintf(stderr,
+				"chain-verf: too many sigops @ %u\n", height);
+			rc = false;
+			break;
 		}
 	}
 
-	return true;
+	if (!bitc_checkq_wait(&checkq))
+		rc = false;
+
+	return rc;
 }
 
 static void read_test_msg(struct chaindb *db, struct bitc_utxo_set *uset,
@@ -144,13 +171,14 @@ static void read_test_msg(struct chaindb *db, struct bitc_utxo_set *uset,
 		       sizeof(msg->hdr.command)) == 0);
 
 	struct bitc_block block;
+	struct bitc_block_stats stats;
 	bitc_block_init(&block);
 
 	struct const_buffer buf = { msg->data, msg->hdr.data_len };
-	assert(deser_bitc_block(&block, &buf) == true);
+	assert(deser_bitc_block_stats(&block, &buf, &stats) == true);
 	bitc_block_calc_sha256(&block);
 
-	assert(bitc_block_valid(&block) == true);
+	assert(bitc_block_valid_stats(&block, &stats) == true);
 
 	struct blkinfo *bi = bi_new();
 	bu256_copy(&bi->hash, &block.sha256);
@@ -165,7 +193,8 @@ static void read_test_msg(struct chaindb *db, struct bitc_utxo_set *uset,
 
 	/* if best chain, mark TX's as spent */
 	if (bu256_equal(&db->best_chain->hash, &bi->hdr.sha256)) {
-		if (!spend_block(uset, &block, bi->height, ckpt_height)) {
+		if (!spend_block(uset, &block, &stats, bi->height,
+				 ckpt_height)) {
 			char hexstr[BU256_STRSZ];
 			bu256_hex(hexstr, &bi->hdr.sha256);
 			fprintf(stderr,
@@ -198,6 +227,8 @@ static void runtest(bool use_testnet, const char *blocks_fn)
 	struct bitc_utxo_set uset;
 	bitc_utxo_set_init(&uset);
 
+	assert(bitc_checkq_init(&checkq, BITC_CHECKQ_AUTO) == true);
+
 	fprintf(stderr, "chain-verf: validating %s chainfile %s (%cscript)\n",
 		use_testnet ? "testnet3" : "mainnet",
 		blocks_fn,
@@ -231,16 +262,134 @@ static void runtest(bool use_testnet, const char *blocks_fn)
 
 	chaindb_free(&chaindb);
 	bitc_utxo_set_free(&uset);
+	bitc_checkq_free(&checkq);
 
 	fprintf(stderr, "chain-verf: %u records validated\n", records);
 }
 
+static const bu256_t null_hash;
+
+/* a tx with 1 input and 1 output, each with an empty script */
+static struct bitc_tx *sigop_tx(const bu256_t *prev_hash, unsigned int n)
+{
+	struct bitc_tx *tx = calloc(1, sizeof(*tx));
+	struct bitc_txin *txin = calloc(1, sizeof(*txin));
+	struct bitc_txout *txout = calloc(1, sizeof(*txout));
+
+	bitc_tx_init(tx);
+	tx->vin = parr_new(1, bitc_txin_freep);
+	tx->vout = parr_new(1, bitc_txout_freep);
+
+	bitc_txin_init(txin);
+	bu256_copy(&txin->prevout.hash, prev_hash);
+	txin->prevout.n = n;
+	txin->scriptSig = cstr_new(NULL);
+	parr_add(tx->vin, txin);
+
+	bitc_txout_init(txout);
+	txout->scriptPubKey = cstr_new(NULL);
+	parr_add(tx->vout, txout);
+
+	return tx;
+}
+
+/*
+ * A block spending n_in P2SH outputs, each redeemed by a script of 500
+ * CHECKMULTISIGs: 10000 sigops, or a quarter of the block's cost limit.
+ * The outputs are spent without a script check, so only the sigop
+ * count can fail the block.
+ */
+static bool spend_p2sh_sigops(unsigned int n_in)
+{
+	enum { REDEEM_OPS = 500 };
+	unsigned char redeem[REDEEM_OPS];
+	unsigned char redeem_hash[20];
+	unsigned int i;
+
+	memset(redeem, OP_CHECKMULTISIG, sizeof(redeem));
+	bu_Hash160(redeem_hash, redeem, sizeof(redeem));
+
+	/* funding tx, with one P2SH output per input */
+	struct bitc_tx *fund = sigop_tx(&null_hash, 0);
+	struct bitc_txout *txout = parr_idx(fund->vout, 0);
+	cstr_free(txout->scriptPubKey, true);
+	txout->scriptPubKey = cstr_new(NULL);
+	bsp_push_op(txout->scriptPubKey, OP_HASH160);
+	bsp_push_data(txout->scriptPubKey, redeem_hash, sizeof(redeem_hash));
+	bsp_push_op(txout->scriptPubKey, OP_EQUAL);
+	for (i = 1; i < n_in; i++) {
+		struct bitc_txout *copy = calloc(1, sizeof(*copy));
+		bitc_txout_init(copy);
+		bitc_txout_copy(copy, txout);
+		parr_add(fund->vout, copy);
+	}
+	bitc_tx_calc_sha256(fund);
+
+	struct bitc_utxo_set uset;
+	struct bitc_utxo *coin = calloc(1, sizeof(*coin));
+	bitc_utxo_set_init(&uset);
+	bitc_utxo_init(coin);
+	assert(bitc_utxo_from_tx(coin, fund, false, 1) == true);
+	bitc_utxo_set_add(&uset, coin);
+
+	/* coinbase, then the spend */
+	struct bitc_block block;
+	bitc_block_init(&block);
+	block.vtx = parr_new(2, bitc_tx_freep);
+	parr_add(block.vtx, sigop_tx(&null_hash, 0xffffffff));
+
+	struct bitc_tx *spend = sigop_tx(&fund->sha256, 0);
+	for (i = 1; i < n_in; i++) {
+		struct bitc_txin *txin = calloc(1, sizeof(*txin));
+		bitc_txin_init(txin);
+		bitc_txin_copy(txin, parr_idx(spend->vin, 0));
+		txin->prevout.n = i;
+		parr_add(spend->vin, txin);
+	}
+	for (i = 0; i < n_in; i++) {
+		struct bitc_txin *txin = parr_idx(spend->vin, i);
+		bsp_push_data(txin->scriptSig, redeem, sizeof(redeem));
+	}
+	parr_add(block.vtx, spend);
+
+	for (i = 0; i < block.vtx->len; i++)
+		bitc_tx_calc_sha256(parr_idx(block.vtx, i));
+
+	struct bitc_block_stats stats;
+	bitc_block_stats_calc(&stats, &block);
+	assert(stats.sigops_legacy == 0);
+
+	bool rc = spend_block(&uset, &block, &stats, 2, 3);
+
+	bitc_block_free(&block);
+	bitc_utxo_set_free(&uset);
+	bitc_tx_freep(fund);
+	return rc;
+}
+
+static void test_sigop_cost(void)
+{
+	bool saved_no = no_script_verf, saved_force = force_script_verf;
+
+	assert(bitc_checkq_init(&checkq, BITC_CHECKQ_AUTO) == true);
+	no_script_verf = true;
+	force_script_verf = false;
+
+	assert(spend_p2sh_sigops(1) == true);
+	assert(spend_p2sh_sigops(2) == true);	// exactly at the limit
+	assert(spend_p2sh_sigops(3) == false);
+
+	no_script_verf = saved_no;
+	force_script_verf = saved_force;
+	bitc_checkq_free(&checkq);
+}
+
 int main (int argc, char *argv[])
 {
 	char *fn;
 	unsigned int verfd = 0;
 
-	log_state = calloc(0, sizeof(struct logging));
+	log_state = calloc(1, sizeof(struct logging));
 
 	log_state->stream = stderr;
 	log_state->logtofile = false;
@@ -253,6 +402,8 @@ int main (int argc, char *argv[])
 		force_script_verf = true;
 	}
 
+	test_sigop_cost();
+
 	fn = getenv("TEST_TESTNET3_VERF");
 	if (fn) {
 		verfd++;
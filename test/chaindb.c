@@ -12,13 +12,66 @@
 #include <bitc/coredefs.h>              // for chain_info, chain_metadata, etc
 #include <bitc/key.h>                   // for bitc_key_static_shutdown
 #include <bitc/log.h>                   // for logging
+#include <bitc/parr.h>                  // for parr_new, parr_add, etc
 #include <bitc/util.h>                  // for file_seq_open
 #include "libtest.h"                    // for test_filename
 
 #include <assert.h>                     // for assert
 #include <stdbool.h>                    // for true, bool
-#include <stdlib.h>                     // for free, NULL
-#include <unistd.h>                     // for close, read
+#include <stdio.h>                      // for snprintf
+#include <stdlib.h>                     // for free, mkdtemp, realpath, etc
+#include <string.h>                     // for strcpy
+#include <unistd.h>                     // for close, read, chdir, etc
+
+/* A fresh database for one test, in its own directory under /tmp: the
+ * db files are named for the chain and opened in the current directory.
+ */
+struct db_tmp {
+	char	dir[sizeof("/tmp/chaindb-XXXXXX")];
+	char	*cwd;
+	char	fn[64];
+};
+
+static void db_tmp_open(struct db_tmp *tmp, const struct chain_info *chain)
+{
+	strcpy(tmp->dir, "/tmp/chaindb-XXXXXX");
+	assert(mkdtemp(tmp->dir) != NULL);
+	tmp->cwd = getcwd(NULL, 0);
+	assert(tmp->cwd != NULL);
+	assert(chdir(tmp->dir) == 0);
+	snprintf(tmp->fn, sizeof(tmp->fn), "%s.mdb", chain->name);
+
+	assert(metadb_init(chain->netmagic, (const bu256_t *)chain->genesis_hash));
+	assert(blockdb_init());
+	assert(blockheightdb_init());
+	assert(blockidxdb_init());
+}
+
+static void db_tmp_close(struct db_tmp *tmp)
+{
+	char lockfn[sizeof(tmp->fn) + 5];
+
+	db_close();
+
+	snprintf(lockfn, sizeof(lockfn), "%s-lock", tmp->fn);
+	unlink(tmp->fn);
+	unlink(lockfn);
+
+	assert(chdir(tmp->cwd) == 0);
+	assert(rmdir(tmp->dir) == 0);
+	free(tmp->cwd);
+}
+
+/* a test data file by absolute path, for use from inside a db_tmp */
+static char *data_path(const char *basename)
+{
+	char *filename = test_filename(basename);
+	char *path = realpath(filename, NULL);
+
+	assert(path != NULL);
+	free(filename);
+	return path;
+}
 
 static void add_header(struct chaindb *db, char *raw)
 {
@@ -29,7 +82,11 @@ static void add_header(struct chaindb *db, char *raw)
 
 	assert(deser_bitc_block(&bi->hdr, &buf) == true);
 
-	bitc_block_calc_sha256(&bi->hdr);
+	/* proof of work holds, and not for any other nonce */
+	struct bitc_block bad = bi->hdr;
+	bad.nNonce++;
+	assert(bitc_block_valid_hdr(&bi->hdr) == true);
+	assert(bitc_block_valid_hdr(&bad) == false);
 
 	bu256_copy(&bi->hash, &bi->hdr.sha256);
 
@@ -41,9 +98,8 @@ static void add_header(struct chaindb *db, char *raw)
 	assert(reorg.disconn == 0);
 }
 
-static void read_headers(const char *ser_base_fn, struct chaindb *db)
+static void read_headers(const char *filename, struct chaindb *db)
 {
-	char *filename = test_filename(ser_base_fn);
 	int fd = file_seq_open(filename);
 	assert(fd >= 0);
 
@@ -54,7 +110,6 @@ static void read_headers(const char *ser_base_fn, struct chaindb *db)
 	}
 
 	close(fd);
-	free(filename);
 }
 
 static void test_blkinfo_prev(struct chaindb *db)
@@ -72,7 +127,42 @@ static void test_blkinfo_prev(struct chaindb *db)
 	assert(height == -1);
 }
 
-static void runtest(const char *ser_base_fn, const struct chain_info *chain,
+/* a header index started from a block further up builds on it alike */
+static void test_add_root(struct chaindb *db, const unsigned char *netmagic)
+{
+	struct blkinfo *from = db->best_chain, *above[3];
+	struct chaindb_reorg reorg;
+	struct chaindb part;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		above[2 - i] = from;
+		from = from->prev;
+	}
+
+	assert(chaindb_init(&part, netmagic, &db->block0) == true);
+	assert(chaindb_add_root(&part, from) == false);
+	part.hdrs_only = true;
+	assert(chaindb_add_root(&part, from) == true);
+	assert(chaindb_add_root(&part, from) == false);
+
+	for (i = 0; i < 3; i++) {
+		struct blkinfo *bi = bi_new();
+		bitc_block_copy_hdr(&bi->hdr, &above[i]->hdr);
+		bu256_copy(&bi->hash, &above[i]->hash);
+		assert(chaindb_add(&part, bi, &reorg) == true);
+	}
+
+	assert(part.best_chain->height == db->best_chain->height);
+	assert(bu256_equal(&part.best_chain->hash, &db->best_chain->hash));
+	assert(mpz_cmp(part.best_chain->work, db->best_chain->work) == 0);
+	assert(part.best_chain->prev->prev->prev->height == from->height);
+	assert(part.best_chain->prev->prev->prev->prev == NULL);
+
+	chaindb_free(&part);
+}
+
+static void runtest(const char *ser_fn, const struct chain_info *chain,
 		    unsigned int check_height, const char *check_hash)
 {
 	struct chaindb db;
@@ -84,7 +174,7 @@ static void runtest(const char *ser_base_fn, const struct chain_info *chain,
 	rc = chaindb_init(&db, chain->netmagic, &block0);
 	assert(rc);
 
-	read_headers(ser_base_fn, &db);
+	read_headers(ser_fn, &db);
 
 	assert(db.best_chain->height == check_height);
 
@@ -96,28 +186,280 @@ static void runtest(const char *ser_base_fn, const struct chain_info *chain,
 	test_blkinfo_prev(&db);
 
 	chaindb_free(&db);
+
+	/* the block index written by chaindb_add rebuilds the same chain */
+	rc = chaindb_init(&db, chain->netmagic, &block0);
+	assert(rc);
+	assert(chaindb_load(&db) == true);
+
+	assert(db.best_chain->height == check_height);
+	assert(bu256_equal(&db.best_chain->hash, &best_block));
+
+	test_blkinfo_prev(&db);
+
+	/* taking the tip out again leaves its parent best, in the index too */
+	struct chaindb_reorg reorg = { db.best_chain->prev, 1, 0 };
+	bu256_t height_hash;
+	assert(blockheightdb_get(check_height, &height_hash) == true);
+	assert(bu256_equal(&height_hash, &best_block));
+	assert(chaindb_remove(&db, db.best_chain, &reorg) == true);
+	assert(db.best_chain->height == check_height - 1);
+	assert(chaindb_lookup(&db, &best_block) == NULL);
+	assert(blockheightdb_get(check_height, &height_hash) == false);
+	assert(blockheightdb_get(check_height - 1, &height_hash) == true);
+	assert(bu256_equal(&height_hash, &db.best_chain->hash));
+
+	chaindb_free(&db);
+
+	rc = chaindb_init(&db, chain->netmagic, &block0);
+	assert(rc);
+	assert(chaindb_load(&db) == true);
+	assert(db.best_chain->height == check_height - 1);
+	assert(chaindb_lookup(&db, &best_block) == NULL);
+
+	chaindb_free(&db);
+
+	/* a header-only index builds the same chain */
+	rc = chaindb_init(&db, chain->netmagic, &block0);
+	assert(rc);
+	db.hdrs_only = true;
+
+	read_headers(ser_fn, &db);
+
+	assert(db.best_chain->height == check_height);
+	assert(bu256_equal(&db.best_chain->hash, &best_block));
+
+	test_blkinfo_prev(&db);
+	test_add_root(&db, chain->netmagic);
+
+	chaindb_free(&db);
+}
+
+static void test_db_batch(void)
+{
+	struct db_batch_policy policy = { .max_writes = 2 };
+	char raw[80] = { 0 };
+	struct const_buffer buf = { raw, sizeof(raw) };
+	bu256_t hash;
+	unsigned int i;
+
+	db_set_policy(&policy);
+	db_batch_begin();
+
+	/* the second write reaches the limit and commits */
+	for (i = 0; i < 3; i++) {
+		raw[0] = i;
+		bu256_set_u64(&hash, 0x7e57ba7c400 + i);
+		assert(blockdb_add(&hash, &buf) == true);
+		assert((dbinfo.batch_txn != NULL) == (i != 1));
+	}
+
+	/* a batch is left open while writes keep coming, not once idle */
+	assert(db_batch_idle() == true);
+	assert(dbinfo.batch_txn != NULL);
+	dbinfo.batch_last -= DB_BATCH_IDLE;
+	assert(db_batch_idle() == true);
+	assert(dbinfo.batch_txn == NULL);
+
+	assert(db_batch_commit() == true);
+	assert(dbinfo.batch_txn == NULL);
+}
+
+static void test_utxodb(void)
+{
+	struct utxodb udb;
+	struct bitc_coin coin;
+	struct bitc_outpt outpt;
+	struct bitc_tx tx;
+	unsigned int i;
+
+	/* flush every second block */
+	assert(utxodb_init(&udb, 2, 0) == true);
+	int height = udb.best_height + 1;
+
+	bitc_tx_init(&tx);
+	tx.vin = parr_new(0, bitc_txin_freep);
+	tx.vout = parr_new(2, bitc_txout_freep);
+	for (i = 0; i < 2; i++) {
+		struct bitc_txout *txout = calloc(1, sizeof(*txout));
+		bitc_txout_init(txout);
+		txout->nValue = 1000 + i;
+		txout->scriptPubKey = cstr_new_buf("\x51", 1);
+		parr_add(tx.vout, txout);
+	}
+	bitc_tx_calc_sha256(&tx);
+
+	bitc_coin_init(&coin);
+	bu256_copy(&outpt.hash, &tx.sha256);
+
+	/* first block adds both outputs, only to the cache */
+	assert(utxodb_add_tx(&udb, &tx, true, height) == true);
+	assert(utxodb_block_done(&udb, &tx.sha256, height) == true);
+	assert(udb.n_blocks == 1);
+	outpt.n = 1;
+	assert(utxodb_lookup(&udb, &outpt, &coin) == true);
+	assert(coin.nValue == 1001 && coin.height == height);
+	assert(coin.is_coinbase == true);
+
+	/* second block triggers a flush */
+	assert(utxodb_block_done(&udb, &tx.sha256, height + 1) == true);
+	assert(udb.n_blocks == 0);
+	assert(bitc_coins_size(&udb.cache) == 0);
+
+	/* spend a flushed output; it stays gone across the next flush */
+	outpt.n = 0;
+	assert(utxodb_spend(&udb, &outpt, &coin) == true);
+	assert(coin.nValue == 1000);
+	assert(utxodb_spend(&udb, &outpt, NULL) == false);
+	assert(utxodb_block_done(&udb, &tx.sha256, height + 2) == true);
+	assert(utxodb_close(&udb) == true);
+	utxodb_free(&udb);
+
+	/* reopen: best block and remaining output come from disk */
+	assert(utxodb_init(&udb, 2, 0) == true);
+	assert(udb.best_height == height + 2);
+	assert(bu256_equal(&udb.best_hash, &tx.sha256));
+	assert(utxodb_lookup(&udb, &outpt, NULL) == false);
+	outpt.n = 1;
+	assert(utxodb_lookup(&udb, &outpt, &coin) == true);
+	assert(coin.nValue == 1001 && coin.height == height);
+	assert(cstr_equal(coin.scriptPubKey, ((struct bitc_txout *)
+			  parr_idx(tx.vout, 1))->scriptPubKey));
+	assert(utxodb_close(&udb) == true);
+	utxodb_free(&udb);
+
+	bitc_coin_free(&coin);
+	bitc_tx_free(&tx);
+}
+
+/* a tx spending in, if non-NULL, into n_out outputs of value */
+static void utxo_tx(struct bitc_tx *tx, const struct bitc_outpt *in,
+		    int64_t value, unsigned int n_out)
+{
+	unsigned int i;
+
+	bitc_tx_init(tx);
+	tx->vin = parr_new(1, bitc_txin_freep);
+	tx->vout = parr_new(n_out, bitc_txout_freep);
+	if (in) {
+		struct bitc_txin *txin = calloc(1, sizeof(*txin));
+		bitc_txin_init(txin);
+		bitc_outpt_copy(&txin->prevout, in);
+		parr_add(tx->vin, txin);
+	}
+	for (i = 0; i < n_out; i++) {
+		struct bitc_txout *txout = calloc(1, sizeof(*txout));
+		bitc_txout_init(txout);
+		txout->nValue = value + i;
+		txout->scriptPubKey = cstr_new_buf("\x51", 1);
+		parr_add(tx->vout, txout);
+	}
+	bitc_tx_calc_sha256(tx);
+}
+
+/* a block that fails partway leaves nothing behind for the flush */
+static void test_utxodb_abort(void)
+{
+	struct utxodb udb;
+	struct bitc_outpt a0, a1, c0, b0, missing;
+	struct bitc_tx a, b, c;
+
+	assert(utxodb_init(&udb, 100, 0) == true);
+	int height = udb.best_height + 1;
+
+	/* a's outputs reach the disk; c's stay in the cache */
+	utxo_tx(&a, NULL, 7000, 2);
+	assert(utxodb_add_tx(&udb, &a, false, height) == true);
+	assert(utxodb_block_done(&udb, &a.sha256, height) == true);
+	assert(utxodb_flush(&udb) == true);
+
+	utxo_tx(&c, NULL, 8000, 1);
+	assert(utxodb_add_tx(&udb, &c, false, height + 1) == true);
+	assert(utxodb_block_done(&udb, &c.sha256, height + 1) == true);
+
+	bu256_copy(&a0.hash, &a.sha256);
+	a0.n = 0;
+	bu256_copy(&a1.hash, &a.sha256);
+	a1.n = 1;
+	bu256_copy(&c0.hash, &c.sha256);
+	c0.n = 0;
+
+	/* spends from disk and cache, an add, a spend of the add, then
+	 * a tx whose input is missing
+	 */
+	utxo_tx(&b, &a0, 9000, 2);
+	bu256_copy(&b0.hash, &b.sha256);
+	b0.n = 0;
+	missing = b0;
+	missing.n = 5;
+	assert(utxodb_spend(&udb, &a0, NULL) == true);
+	assert(utxodb_spend(&udb, &c0, NULL) == true);
+	assert(utxodb_add_tx(&udb, &b, false, height + 2) == true);
+	assert(utxodb_spend(&udb, &b0, NULL) == true);
+	assert(utxodb_spend(&udb, &missing, NULL) == false);
+	assert(utxodb_block_abort(&udb) == true);
+	assert(udb.n_undo == 0);
+
+	/* after a flush, as before the block */
+	assert(utxodb_flush(&udb) == true);
+	assert(udb.best_height == height + 1);
+	assert(utxodb_lookup(&udb, &a0, NULL) == true);
+	assert(utxodb_lookup(&udb, &a1, NULL) == true);
+	assert(utxodb_lookup(&udb, &c0, NULL) == true);
+	b0.n = 1;
+	assert(utxodb_lookup(&udb, &b0, NULL) == false);
+
+	/* a later block may spend them after all */
+	assert(utxodb_spend(&udb, &a0, NULL) == true);
+	assert(utxodb_spend(&udb, &c0, NULL) == true);
+	assert(utxodb_block_done(&udb, &b.sha256, height + 2) == true);
+	assert(utxodb_close(&udb) == true);
+	utxodb_free(&udb);
+
+	bitc_tx_free(&a);
+	bitc_tx_free(&b);
+	bitc_tx_free(&c);
 }
 
 int main (int argc, char *argv[])
 {
-	log_state = calloc(0, sizeof(struct logging));
+	const struct chain_info *bitcoin = &chain_metadata[CHAIN_BITCOIN];
+	const struct chain_info *testnet = &chain_metadata[CHAIN_TESTNET3];
+	char *hdrs = data_path("data/hdr50000.ser");
+	char *tn_hdrs = data_path("data/tn_hdr25000.ser");
+	struct db_tmp tmp;
+
+	log_state = calloc(1, sizeof(struct logging));
 
 	log_state->stream = stderr;
 	log_state->logtofile = false;
 	log_state->debug = true;
 
-	assert(metadb_init(chain_metadata[CHAIN_BITCOIN].netmagic, (const bu256_t *)chain_metadata[CHAIN_BITCOIN].genesis_hash));
-	assert(blockdb_init());
-	assert(blockheightdb_init());
-	runtest("data/hdr50000.ser", &chain_metadata[CHAIN_BITCOIN], 50000,
+	db_tmp_open(&tmp, bitcoin);
+	test_db_batch();
+	assert(db_batch_end() == true);
+	db_tmp_close(&tmp);
+
+	db_tmp_open(&tmp, bitcoin);
+	test_utxodb();
+	db_tmp_close(&tmp);
+
+	db_tmp_open(&tmp, bitcoin);
+	test_utxodb_abort();
+	db_tmp_close(&tmp);
+
+	db_tmp_open(&tmp, bitcoin);
+	runtest(hdrs, bitcoin, 50000,
 	    "000000001aeae195809d120b5d66a39c83eb48792e068f8ea1fea19d84a4278a");
+	db_tmp_close(&tmp);
 
-	assert(metadb_init(chain_metadata[CHAIN_TESTNET3].netmagic, (const bu256_t *)chain_metadata[CHAIN_TESTNET3].genesis_hash));
-	assert(blockdb_init());
-	assert(blockheightdb_init());
-	runtest("data/tn_hdr25000.ser", &chain_metadata[CHAIN_TESTNET3], 25000,
+	db_tmp_open(&tmp, testnet);
+	runtest(tn_hdrs, testnet, 25000,
 	    "0000000022b23de294af24d922fb3f1ed21521a8b3bd7716861dcb5310b1b525");
+	db_tmp_close(&tmp);
 
+	free(hdrs);
+	free(tn_hdrs);
 	bitc_key_static_shutdown();
 	free(log_state);
 	return 0;
@@ -0,0 +1,103 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/script/checkqueue.h>     // for bitc_checkq, etc
+#include <bitc/core.h>                  // for bitc_tx, bitc_txin, etc
+#include <bitc/cstr.h>                  // for cstring, cstr_new_sz
+#include <bitc/parr.h>                  // for parr_new, parr_add
+#include <bitc/script/script.h>         // for bsp_push_int64, etc
+
+#include <assert.h>                     // for assert
+#include <stdlib.h>                     // for calloc
+
+enum { N_INPUTS = 3000 };
+
+/* input i pushes i; the matching scriptPubKey is "<i> OP_EQUAL" */
+static void make_tx(struct bitc_tx *tx)
+{
+	unsigned int i;
+
+	bitc_tx_init(tx);
+	tx->vin = parr_new(N_INPUTS, bitc_txin_freep);
+	tx->vout = parr_new(0, bitc_txout_freep);
+
+	for (i = 0; i < N_INPUTS; i++) {
+		struct bitc_txin *txin = calloc(1, sizeof(*txin));
+
+		bitc_txin_init(txin);
+		txin->scriptSig = cstr_new_sz(8);
+		bsp_push_int64(txin->scriptSig, i);
+		parr_add(tx->vin, txin);
+	}
+}
+
+static cstring *make_script(unsigned int n)
+{
+	cstring *s = cstr_new_sz(8);
+
+	bsp_push_int64(s, n);
+	bsp_push_op(s, OP_EQUAL);
+	return s;
+}
+
+/* queue every input, with input bad_idx (if in range) failing */
+static bool run_batch(struct bitc_checkq *q, const struct bitc_tx *tx,
+		      unsigned int bad_idx)
+{
+	struct bitc_txdata *txdata;
+	unsigned int i;
+
+	bitc_checkq_begin(q);
+	txdata = bitc_checkq_txdata(q, tx);
+	assert(txdata != NULL);
+
+	for (i = 0; i < N_INPUTS; i++) {
+		cstring *s = make_script(i == bad_idx ? i + 1 : i);
+		bool added = bitc_checkq_add(q, tx, txdata,
+					     i, s, SCRIPT_VERIFY_NONE, 0);
+		cstr_free(s, true);
+
+		/* failure may be seen early, but never for good checks */
+		if (!added) {
+			assert(bad_idx < N_INPUTS && i >= bad_idx);
+			break;
+		}
+	}
+
+	return bitc_checkq_wait(q);
+}
+
+static void test_checkq(unsigned int n_workers)
+{
+	struct bitc_checkq q;
+	struct bitc_tx tx;
+
+	make_tx(&tx);
+	assert(bitc_checkq_init(&q, n_workers) == true);
+	assert(q.n_workers == n_workers);
+
+	assert(run_batch(&q, &tx, N_INPUTS) == true);
+	assert(run_batch(&q, &tx, 0) == false);
+	assert(run_batch(&q, &tx, N_INPUTS / 2) == false);
+	assert(run_batch(&q, &tx, N_INPUTS - 1) == false);
+
+	// a failed batch does not taint the next
+	assert(run_batch(&q, &tx, N_INPUTS) == true);
+
+	// nothing queued
+	bitc_checkq_begin(&q);
+	assert(bitc_checkq_wait(&q) == true);
+
+	bitc_checkq_free(&q);
+	bitc_tx_free(&tx);
+}
+
+int main(int argc, char *argv[])
+{
+	test_checkq(0);
+	test_checkq(1);
+	test_checkq(4);
+	return 0;
+}
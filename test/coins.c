@@ -0,0 +1,203 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/coins.h>                 // for bitc_coins, etc
+#include <bitc/crypto/sha2.h>           // for sha256_Raw
+#include <bitc/hexcode.h>               // for hex2str
+#include <bitc/util.h>                  // for ARRAY_SIZE
+
+#include <assert.h>                     // for assert
+#include <stdint.h>                     // for uint32_t, etc
+#include <string.h>                     // for memcmp, memset
+
+static const char *script_hex[] = {
+	// P2PKH
+	"76a91462e907b15cbf27d5425399ebf6f0fb50ebb88f1888ac",
+	// P2SH
+	"a914748284390f9e263a4b766a75d0633c50426eb87587",
+	// P2PK, both compressed key parities
+	"2102a1633cafcc01ebfb6d78e39f687a1f0995c62fc95f51ead10a02ee0be551b5dcac",
+	"2103a1633cafcc01ebfb6d78e39f687a1f0995c62fc95f51ead10a02ee0be551b5dcac",
+	// P2WPKH
+	"0014751e76e8199196d454941c45d1b3a323f1433bd6",
+	// P2WSH
+	"00201863143c14c5166804bd19203356da136c985678cd4d27a1b8c6329604903262",
+	// P2TR
+	"5120a60869f0dbcf1dc659c9cecbaf8050135ea9e8cdc487053f1dc6880949dc684c",
+	// uncompressed P2PK, stored raw
+	"4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb6"
+	"49f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac",
+	// bare multisig, stored raw
+	"512102a1633cafcc01ebfb6d78e39f687a1f0995c62fc95f51ead10a02ee0be551b5dc51ae",
+	// almost P2PKH: wrong push length
+	"76a91362e907b15cbf27d5425399ebf6f0fb50ebb88f88ac",
+	// empty script
+	"",
+};
+
+static cstring *script_from_hex(const char *hex)
+{
+	cstring *s = *hex ? hex2str(hex) : cstr_new(NULL);
+	assert(s != NULL);
+	return s;
+}
+
+static void test_compress(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(script_hex); i++) {
+		cstring *s = script_from_hex(script_hex[i]);
+		unsigned char comp[256];
+
+		size_t len = bitc_script_compress(NULL,
+				(const unsigned char *) s->str, s->len);
+		assert(len <= s->len + 1);
+		assert(bitc_script_compress(comp,
+				(const unsigned char *) s->str, s->len) == len);
+
+		// recognized templates drop all opcodes
+		if (i < 7)
+			assert(len == 21 || len == 33);
+		else
+			assert(len == s->len + 1);
+
+		cstring *out = cstr_new(NULL);
+		assert(bitc_script_decompress(out, comp, len) == true);
+		assert(out->len == s->len);
+		assert(memcmp(out->str, s->str, s->len) == 0);
+
+		cstr_free(out, true);
+		cstr_free(s, true);
+	}
+
+	cstring *out = cstr_new(NULL);
+	unsigned char bad[2] = { 0, 0 };
+	assert(bitc_script_decompress(out, bad, 0) == false);
+	assert(bitc_script_decompress(out, bad, sizeof(bad)) == false);
+	bad[0] = 0xff;
+	assert(bitc_script_decompress(out, bad, sizeof(bad)) == false);
+	cstr_free(out, true);
+}
+
+static void make_outpt(struct bitc_outpt *outpt, uint32_t seed, uint32_t n)
+{
+	sha256_Raw(&seed, sizeof(seed), (uint8_t *) &outpt->hash);
+	outpt->n = n;
+}
+
+static void make_txout(struct bitc_txout *txout, int64_t value,
+		       const char *hex)
+{
+	txout->nValue = value;
+	txout->scriptPubKey = script_from_hex(hex);
+}
+
+static void test_add_spend(void)
+{
+	struct bitc_coins coins;
+	struct bitc_coin coin;
+	struct bitc_outpt op1, op2;
+	struct bitc_txout txout;
+
+	assert(bitc_coins_init(&coins) == true);
+	bitc_coin_init(&coin);
+
+	make_outpt(&op1, 1, 0);
+	make_outpt(&op2, 1, 1);
+	make_txout(&txout, 5000000000LL, script_hex[0]);
+
+	assert(bitc_coins_have(&coins, &op1) == false);
+	assert(bitc_coins_add(&coins, &op1, &txout, true, 170) == true);
+	assert(bitc_coins_size(&coins) == 1);
+	assert(bitc_coins_have(&coins, &op1) == true);
+	assert(bitc_coins_have(&coins, &op2) == false);
+
+	assert(bitc_coins_lookup(&coins, &op1, &coin) == true);
+	assert(coin.nValue == 5000000000LL);
+	assert(coin.height == 170);
+	assert(coin.is_coinbase == true);
+	assert(cstr_equal(coin.scriptPubKey, txout.scriptPubKey));
+
+	// duplicate outpoint replaces the older coin
+	txout.nValue = 1;
+	assert(bitc_coins_add(&coins, &op1, &txout, false, 200) == true);
+	assert(bitc_coins_size(&coins) == 1);
+	assert(bitc_coins_lookup(&coins, &op1, &coin) == true);
+	assert(coin.nValue == 1 && coin.height == 200);
+	assert(coin.is_coinbase == false);
+
+	assert(bitc_coins_spend(&coins, &op2, &coin) == false);
+	assert(bitc_coins_spend(&coins, &op1, &coin) == true);
+	assert(coin.nValue == 1);
+	assert(bitc_coins_size(&coins) == 0);
+	assert(bitc_coins_spend(&coins, &op1, NULL) == false);
+	cstr_free(txout.scriptPubKey, true);
+
+	// provably unspendable outputs are never stored
+	make_txout(&txout, 0, "6a0b68656c6c6f20776f726c64");
+	assert(bitc_coins_add(&coins, &op2, &txout, false, 1) == true);
+	assert(bitc_coins_size(&coins) == 0);
+	assert(bitc_coins_have(&coins, &op2) == false);
+	cstr_free(txout.scriptPubKey, true);
+
+	bitc_coin_free(&coin);
+	bitc_coins_free(&coins);
+}
+
+/* spending and re-adding outputs recycles record memory */
+static void test_churn(void)
+{
+	enum { N_COINS = 5000 };
+	struct bitc_coins coins;
+	struct bitc_coin coin;
+	struct bitc_outpt outpt;
+	struct bitc_txout txout;
+	unsigned int i, round;
+	size_t mem = 0;
+
+	assert(bitc_coins_init(&coins) == true);
+	bitc_coin_init(&coin);
+
+	for (round = 0; round < 4; round++) {
+		for (i = 0; i < N_COINS; i++) {
+			make_outpt(&outpt, round * N_COINS + i, i % 3);
+			make_txout(&txout, i,
+				   script_hex[i % ARRAY_SIZE(script_hex)]);
+			assert(bitc_coins_add(&coins, &outpt, &txout,
+					      false, i) == true);
+			cstr_free(txout.scriptPubKey, true);
+		}
+		assert(bitc_coins_size(&coins) == N_COINS);
+
+		if (round == 0)
+			mem = bitc_coins_memory(&coins);
+		else
+			assert(bitc_coins_memory(&coins) == mem);
+
+		for (i = 0; i < N_COINS; i++) {
+			const char *hex = script_hex[i % ARRAY_SIZE(script_hex)];
+			cstring *s = script_from_hex(hex);
+
+			make_outpt(&outpt, round * N_COINS + i, i % 3);
+			assert(bitc_coins_spend(&coins, &outpt, &coin) == true);
+			assert(coin.nValue == i && coin.height == i);
+			assert(cstr_equal(coin.scriptPubKey, s));
+			cstr_free(s, true);
+		}
+		assert(bitc_coins_size(&coins) == 0);
+	}
+
+	bitc_coin_free(&coin);
+	bitc_coins_free(&coins);
+}
+
+int main(int argc, char *argv[])
+{
+	test_compress();
+	test_add_spend();
+	test_churn();
+	return 0;
+}
@@ -7,6 +7,7 @@
 #include <bitc/crypto/ripemd160.h>      // for RIPEMD160_DIGEST_LENGTH, etc
 #include <bitc/crypto/sha1.h>           // for SHA1_DIGEST_LENGTH, etc
 #include <bitc/crypto/sha2.h>           // for SHA256_DIGEST_LENGTH, etc
+#include <bitc/crypto/sha256d64.h>      // for sha256d64, etc
 #include <bitc/cstr.h>                  // for cstr_free, cstring
 #include <bitc/hexcode.h>               // for str2hex
 
@@ -63,6 +64,181 @@ static void test_sha256(void)
 	cstr_free(s2, true);
 }
 
+/* FIPS 180-2 vectors, hashed once per available block transform and
+ * fed in odd-sized pieces so both the buffered and the multi-block
+ * paths of *_Update() are exercised.
+ */
+static const struct {
+	const char	*msg;
+	unsigned int	repeat;
+	const char	*sha256;
+	const char	*sha512;
+} sha2_kat[] = {
+	{ "", 1,
+	  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+	  "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e" },
+	{ "abc", 1,
+	  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+	  "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+	  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+	  "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c33596fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445" },
+	{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+	  "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1",
+	  "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909" },
+	{ "a", 1000000,
+	  "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+	  "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973ebde0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b" },
+};
+
+static void test_sha2_kernels(void)
+{
+	static const char *kernels[] = { "sha-ni", "armv8", "portable" };
+	static const size_t chunks[] = { 1, 63, 64, 65, 127, 128, 129, 1000 };
+	enum { N_LEN = 300 };
+	static unsigned char lenbuf[N_LEN];
+	static unsigned char ref256[N_LEN][SHA256_DIGEST_LENGTH];
+	static unsigned char ref512[N_LEN][SHA512_DIGEST_LENGTH];
+	unsigned char md256[SHA256_DIGEST_LENGTH];
+	unsigned char md512[SHA512_DIGEST_LENGTH];
+	char buf[4096];
+	unsigned int i, k, c;
+
+	const char *impl256 = sha256_impl();
+	const char *impl512 = sha512_impl();
+	assert(impl256 != NULL && impl512 != NULL);
+
+	assert(sha256_select("no-such-kernel") == false);
+	assert(sha512_select("no-such-kernel") == false);
+
+	for (c = 0; c < N_LEN; c++)
+		lenbuf[c] = (unsigned char)(c * 7 + 1);
+
+	assert(sha256_select("portable") && sha512_select("portable"));
+	for (c = 0; c < N_LEN; c++) {
+		sha256_Raw(lenbuf, c, ref256[c]);
+		sha512_Raw(lenbuf, c, ref512[c]);
+	}
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		bool have256 = sha256_select(kernels[k]);
+		bool have512 = sha512_select(kernels[k]);
+
+		if (strcmp(kernels[k], "portable") == 0)
+			assert(have256 && have512);
+
+		for (i = 0; i < sizeof(sha2_kat) / sizeof(sha2_kat[0]); i++) {
+			size_t msglen = strlen(sha2_kat[i].msg);
+			size_t total = msglen * sha2_kat[i].repeat;
+			size_t pos, n, j;
+			SHA256_CTX ctx256;
+			SHA512_CTX ctx512;
+
+			/* single-character messages are repeated into buf */
+			assert(msglen == 1 || sha2_kat[i].repeat == 1);
+			if (msglen == 1)
+				memset(buf, sha2_kat[i].msg[0], sizeof(buf));
+			else
+				memcpy(buf, sha2_kat[i].msg, msglen);
+
+			sha256_Init(&ctx256);
+			sha512_Init(&ctx512);
+			for (pos = 0, j = 0; pos < total; pos += n, j++) {
+				n = chunks[j % (sizeof(chunks) / sizeof(chunks[0]))];
+				if (msglen == 1 && j % 5 == 4)
+					n = sizeof(buf);
+				if (n > total - pos)
+					n = total - pos;
+				sha256_Update(&ctx256, msglen == 1 ? buf : buf + pos, n);
+				sha512_Update(&ctx512, msglen == 1 ? buf : buf + pos, n);
+			}
+			sha256_Final(md256, &ctx256);
+			sha512_Final(md512, &ctx512);
+
+			cstring *s256 = str2hex(md256, sizeof(md256));
+			cstring *s512 = str2hex(md512, sizeof(md512));
+
+			if (have256)
+				assert(strcmp(sha2_kat[i].sha256, s256->str) == 0);
+			if (have512)
+				assert(strcmp(sha2_kat[i].sha512, s512->str) == 0);
+
+			cstr_free(s256, true);
+			cstr_free(s512, true);
+		}
+
+		/* one-shot over lengths spanning several block boundaries,
+		 * against the portable transform */
+		for (c = 0; c < N_LEN && (have256 || have512); c++) {
+			if (have256) {
+				sha256_Raw(lenbuf, c, md256);
+				assert(memcmp(md256, ref256[c], sizeof(md256)) == 0);
+			}
+			if (have512) {
+				sha512_Raw(lenbuf, c, md512);
+				assert(memcmp(md512, ref512[c], sizeof(md512)) == 0);
+			}
+		}
+	}
+
+	assert(sha256_select(impl256) == true);
+	assert(sha512_select(impl512) == true);
+}
+
+static void test_sha256d64(void)
+{
+	static const char *kernels[] = {
+		"sha-ni", "armv8", "avx2", "sse4.1", "scalar",
+	};
+	static const char *sha2_kernels[] = { "sha-ni", "armv8", "portable" };
+	enum { N_MSG = 37 };
+	unsigned char in[N_MSG * 64];
+	unsigned char out[N_MSG * SHA256_DIGEST_LENGTH];
+	unsigned char ref[N_MSG * SHA256_DIGEST_LENGTH];
+	unsigned int i, j, k, n;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = (i * 131) ^ (i >> 5);
+
+	const char *impl = sha256d64_impl();
+	const char *impl256 = sha256_impl();
+	assert(impl != NULL);
+
+	assert(sha256d64_select("no-such-kernel") == false);
+
+	/* generic result: two portable sha256 passes per message */
+	assert(sha256_select("portable") == true);
+	for (i = 0; i < N_MSG; i++) {
+		unsigned char *md = ref + i * SHA256_DIGEST_LENGTH;
+		sha256_Raw(in + i * 64, 64, md);
+		sha256_Raw(md, SHA256_DIGEST_LENGTH, md);
+	}
+
+	/* each kernel must not depend on the sha256 transform in use */
+	for (j = 0; j < sizeof(sha2_kernels) / sizeof(sha2_kernels[0]); j++) {
+		if (!sha256_select(sha2_kernels[j]))
+			continue;
+
+		for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+			if (!sha256d64_select(kernels[k])) {
+				assert(strcmp(kernels[k], "scalar") != 0);
+				continue;
+			}
+
+			/* batch sizes around the 8-way boundaries */
+			for (n = 0; n <= N_MSG; n += (n < 17 ? 1 : 10)) {
+				memset(out, 0, sizeof(out));
+				sha256d64(out, in, n);
+				assert(memcmp(out, ref,
+					      n * SHA256_DIGEST_LENGTH) == 0);
+			}
+		}
+	}
+
+	assert(sha256_select(impl256) == true);
+	assert(sha256d64_select(impl) == true);
+}
+
 static void test_sha512(void)
 {
 	SHA512_CTX ctx;
@@ -135,6 +311,8 @@ int main (int argc, char *argv[])
 {
 	test_sha1();
 	test_sha256();
+	test_sha2_kernels();
+	test_sha256d64();
 	test_sha512();
 	test_ripemd160();
 	test_hmac();
@@ -0,0 +1,206 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/flatmap.h>               // for bitc_flatmap, etc
+#include <bitc/crypto/sha2.h>           // for sha256_Raw
+
+#include <assert.h>                     // for assert
+#include <stdint.h>                     // for uint32_t, uint64_t, etc
+#include <stdlib.h>                     // for calloc, free
+#include <string.h>                     // for memset, memcmp, NULL
+
+static void make_key(bu256_t *key, uint32_t n)
+{
+	sha256_Raw(&n, sizeof(n), (uint8_t *) key);
+}
+
+static void test_basics(void)
+{
+	struct bitc_flatmap *fm = bitc_flatmap_new_bu256(sizeof(uint64_t));
+	assert(fm != NULL);
+	assert(bitc_flatmap_size(fm) == 0);
+
+	bu256_t k1, k2;
+	make_key(&k1, 1);
+	make_key(&k2, 2);
+
+	assert(bitc_flatmap_get(fm, &k1) == NULL);
+	assert(bitc_flatmap_del(fm, &k1, NULL) == false);
+
+	uint64_t v = 100;
+	assert(bitc_flatmap_put(fm, &k1, &v) == true);
+	assert(bitc_flatmap_size(fm) == 1);
+
+	uint64_t *vp = bitc_flatmap_get(fm, &k1);
+	assert(vp != NULL);
+	assert(((uintptr_t) vp % 8) == 0);
+	assert(*vp == 100);
+	assert(bitc_flatmap_has(fm, &k2) == false);
+
+	// overwrite existing entry
+	v = 200;
+	assert(bitc_flatmap_put(fm, &k1, &v) == true);
+	assert(bitc_flatmap_size(fm) == 1);
+	assert(*(uint64_t *) bitc_flatmap_get(fm, &k1) == 200);
+
+	// insert hands back a zeroed slot, then the same slot
+	bool inserted = false;
+	vp = bitc_flatmap_insert(fm, &k2, &inserted);
+	assert(vp != NULL && inserted == true && *vp == 0);
+	*vp = 300;
+	vp = bitc_flatmap_insert(fm, &k2, &inserted);
+	assert(vp != NULL && inserted == false && *vp == 300);
+	assert(bitc_flatmap_size(fm) == 2);
+
+	uint64_t out = 0;
+	assert(bitc_flatmap_del(fm, &k1, &out) == true);
+	assert(out == 200);
+	assert(bitc_flatmap_size(fm) == 1);
+	assert(bitc_flatmap_get(fm, &k1) == NULL);
+	assert(*(uint64_t *) bitc_flatmap_get(fm, &k2) == 300);
+
+	bitc_flatmap_clear(fm);
+	assert(bitc_flatmap_size(fm) == 0);
+	assert(bitc_flatmap_get(fm, &k2) == NULL);
+
+	bitc_flatmap_free(fm);
+}
+
+static void test_set_bu160(void)
+{
+	struct bitc_flatmap *fm = bitc_flatmap_new_bu160(0);
+	assert(fm != NULL);
+	assert(fm->slot_len == 24);
+
+	bu160_t k;
+	memset(&k, 0x11, sizeof(k));
+
+	assert(bitc_flatmap_put(fm, &k, NULL) == true);
+	assert(bitc_flatmap_has(fm, &k) == true);
+
+	k.dword[BU160_WORDS - 1] ^= 1;
+	assert(bitc_flatmap_has(fm, &k) == false);
+
+	bitc_flatmap_free(fm);
+}
+
+struct iter_state {
+	unsigned int	count;
+	uint64_t	sum;
+};
+
+static void iter_cb(void *key, void *value, void *priv)
+{
+	struct iter_state *st = priv;
+	uint32_t n;
+
+	memcpy(&n, value, sizeof(n));
+	st->count++;
+	st->sum += n;
+}
+
+/* random insert/delete mix, checked against a plain array */
+static void test_churn(void)
+{
+	enum { N_KEYS = 20000, N_OPS = 200000 };
+	struct bitc_flatmap *fm = bitc_flatmap_new_bu256(sizeof(uint32_t));
+	bool *present = calloc(N_KEYS, sizeof(bool));
+	bu256_t *keys = calloc(N_KEYS, sizeof(bu256_t));
+	unsigned int live = 0, i;
+	uint64_t rnd = 0x12345678;
+
+	assert(fm != NULL && present != NULL && keys != NULL);
+
+	for (i = 0; i < N_KEYS; i++)
+		make_key(&keys[i], i);
+
+	for (i = 0; i < N_OPS; i++) {
+		rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+		uint32_t n = (rnd >> 33) % N_KEYS;
+		bool del = (rnd >> 20) & 1;
+
+		if (del) {
+			uint32_t out = 0;
+			assert(bitc_flatmap_del(fm, &keys[n], &out) == present[n]);
+			if (present[n]) {
+				assert(out == n);
+				present[n] = false;
+				live--;
+			}
+		} else {
+			assert(bitc_flatmap_put(fm, &keys[n], &n) == true);
+			if (!present[n]) {
+				present[n] = true;
+				live++;
+			}
+		}
+
+		assert(bitc_flatmap_size(fm) == live);
+	}
+
+	struct iter_state st = {};
+	uint64_t sum = 0;
+	for (i = 0; i < N_KEYS; i++) {
+		uint32_t *vp = bitc_flatmap_get(fm, &keys[i]);
+		assert((vp != NULL) == present[i]);
+		if (vp) {
+			assert(*vp == i);
+			sum += i;
+		}
+	}
+
+	bitc_flatmap_iter(fm, iter_cb, &st);
+	assert(st.count == live);
+	assert(st.sum == sum);
+
+	// drain completely; every remaining entry must stay reachable
+	for (i = 0; i < N_KEYS; i++) {
+		if (!present[i])
+			continue;
+		assert(bitc_flatmap_del(fm, &keys[i], NULL) == true);
+		live--;
+		assert(bitc_flatmap_size(fm) == live);
+	}
+	assert(bitc_flatmap_size(fm) == 0);
+	for (i = 0; i < N_KEYS; i++)
+		assert(bitc_flatmap_get(fm, &keys[i]) == NULL);
+
+	bitc_flatmap_free(fm);
+	free(keys);
+	free(present);
+}
+
+static void test_reserve(void)
+{
+	enum { N_KEYS = 1000 };
+	struct bitc_flatmap *fm = bitc_flatmap_new_bu256(sizeof(uint32_t));
+	unsigned int i;
+
+	assert(bitc_flatmap_reserve(fm, N_KEYS) == true);
+	size_t cap = fm->cap;
+	size_t mem = bitc_flatmap_memory(fm);
+	assert(cap >= N_KEYS);
+
+	for (i = 0; i < N_KEYS; i++) {
+		bu256_t k;
+		make_key(&k, i);
+		assert(bitc_flatmap_put(fm, &k, &i) == true);
+	}
+
+	// no resize once reserved
+	assert(fm->cap == cap);
+	assert(bitc_flatmap_memory(fm) == mem);
+
+	bitc_flatmap_free(fm);
+}
+
+int main(int argc, char *argv[])
+{
+	test_basics();
+	test_set_bu160();
+	test_churn();
+	test_reserve();
+	return 0;
+}
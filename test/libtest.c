@@ -6,6 +6,7 @@
 #include <bitc/cstr.h>                  // for cstr_free, cstring, etc
 #include <bitc/hexcode.h>               // for hex2str, is_hexstr
 #include <bitc/parr.h>                  // for parr_add, parr_free, parr, etc
+#include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_txin, etc
 #include <bitc/script/script.h>         // for GetOpType, bsp_push_data, etc
 #include <bitc/util.h>                  // for bu_read_file
 #include "libtest.h"
@@ -17,7 +18,7 @@
 #include <stdbool.h>                    // for true, false, bool
 #include <stdint.h>                     // for int64_t
 #include <stdio.h>                      // for fprintf, stderr
-#include <stdlib.h>                     // for free, malloc, strtoll
+#include <stdlib.h>                     // for free, malloc, calloc, etc
 #include <string.h>                     // for strlen, memset, strcmp
 
 cJSON *read_json(const char *json_fn)
@@ -182,3 +183,31 @@ cstring *parse_script_str(const char *enc)
 	return script;
 }
 
+/* a spend of n_in distinct outputs, in no particular order; 24000
+ * inputs nearly fill a block
+ */
+void make_spend_tx(struct bitc_tx *tx, unsigned int n_in)
+{
+	struct bitc_txout *txout = calloc(1, sizeof(*txout));
+	unsigned int i;
+
+	bitc_tx_init(tx);
+	tx->nVersion = 1;
+	tx->vin = parr_new(n_in, bitc_txin_freep);
+	tx->vout = parr_new(1, bitc_txout_freep);
+
+	for (i = 0; i < n_in; i++) {
+		struct bitc_txin *txin = calloc(1, sizeof(*txin));
+
+		bitc_txin_init(txin);
+		txin->prevout.hash.dword[0] = i * 2654435761U;
+		txin->prevout.hash.dword[1] = i;
+		txin->prevout.n = i % 3;
+		txin->scriptSig = cstr_new(NULL);
+		parr_add(tx->vin, txin);
+	}
+
+	bitc_txout_init(txout);
+	txout->scriptPubKey = cstr_new(NULL);
+	parr_add(tx->vout, txout);
+}
@@ -6,6 +6,7 @@
  */
 
 #include <bitc/cstr.h>                  // for cstring
+#include <bitc/primitives/transaction.h>  // for bitc_tx
 #include <stddef.h>                     // for size_t
 
 #include <cJSON.h>                      // for cJSON
@@ -14,5 +15,6 @@ extern cJSON *read_json(const char *filename);
 extern char *test_filename(const char *basename);
 extern void dumphex(const char *prefix, const void *p_, size_t len);
 extern cstring *parse_script_str(const char *enc);
+extern void make_spend_tx(struct bitc_tx *tx, unsigned int n_in);
 
 #endif /* __LIBTEST_H__ */
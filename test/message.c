@@ -355,10 +355,46 @@ static void test_addr(void)
 	cstr_free(addr_ser, true);
 }
 
+static void test_msgbuf(void)
+{
+	static const unsigned char netmagic[4] = { 0xf9, 0xbe, 0xb4, 0xd9 };
+	static const unsigned char payload[] = { 1, 2, 3, 4, 5 };
+
+	struct p2p_msgbuf *mb = p2p_msgbuf_new(netmagic, "inv",
+					       payload, sizeof(payload));
+	cstring *s = message_str(netmagic, "inv", payload, sizeof(payload));
+
+	assert(mb != NULL);
+	assert(mb->refs == 1);
+	check_buffer(s, mb->data, mb->len);
+	cstr_free(s, true);
+
+	/* the header parses back and the checksum holds */
+	struct p2p_message msg;
+	parse_message_hdr(&msg.hdr, mb->data);
+	msg.data = mb->data + P2P_HDR_SZ;
+	assert(msg.hdr.data_len == sizeof(payload));
+	assert(message_valid(&msg));
+
+	/* shared by two queues, freed by the last */
+	assert(p2p_msgbuf_ref(mb) == mb);
+	assert(mb->refs == 2);
+	p2p_msgbuf_unref(mb);
+	assert(mb->refs == 1);
+	p2p_msgbuf_unref(mb);
+
+	mb = p2p_msgbuf_new(netmagic, "verack", NULL, 0);
+	s = message_str(netmagic, "verack", NULL, 0);
+	check_buffer(s, mb->data, mb->len);
+	cstr_free(s, true);
+	p2p_msgbuf_unref(mb);
+}
+
 int main(int argc, char **argv)
 {
     test_version();
     test_addr();
+    test_msgbuf();
 
     return 0;
 }
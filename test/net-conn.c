@@ -0,0 +1,625 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+/* net.c's connection internals, driven directly over socketpairs */
+#include "../lib/net/net.c"             // for nc_conn_read_evt, etc
+
+#include <bitc/coredefs.h>              // for chain_metadata, etc
+#include <bitc/log.h>                   // for logging
+#include <bitc/message.h>               // for message_str, msg_vinv, etc
+#include <bitc/net/peerman.h>           // for peer_init
+#include "libtest.h"
+
+#include <assert.h>                     // for assert
+#include <errno.h>                      // for errno, EAGAIN
+#include <fcntl.h>                      // for fcntl, O_NONBLOCK
+#include <poll.h>                       // for poll, POLLIN
+#include <stdlib.h>                     // for calloc, free, malloc
+#include <string.h>                     // for memcpy, memset
+#include <sys/socket.h>                 // for socketpair
+#include <unistd.h>                     // for read, write, close
+
+static const struct chain_info *chain = &chain_metadata[CHAIN_BITCOIN];
+
+/* block invs are numbered by their first four hash bytes; each must
+ * arrive once and in order
+ */
+static unsigned int n_inv;
+static struct nc_conn *drop_conn;	/* dropped once n_inv hits drop_at */
+static unsigned int drop_at;
+
+static bool count_inv_block(bu256_t *hash)
+{
+	uint32_t idx;
+
+	memcpy(&idx, hash, sizeof(idx));
+	assert(idx == n_inv);
+	n_inv++;
+
+	if (drop_conn && n_inv == drop_at)
+		nc_conn_close(drop_conn);
+	return false;
+}
+
+/* an "inv" of n block hashes numbered from first */
+static cstring *inv_msg(uint32_t first, unsigned int n)
+{
+	struct msg_vinv mv;
+	bu256_t hash;
+	unsigned int i;
+
+	msg_vinv_init(&mv);
+	for (i = 0; i < n; i++) {
+		uint32_t idx = first + i;
+
+		memset(&hash, 0, sizeof(hash));
+		memcpy(&hash, &idx, sizeof(idx));
+		msg_vinv_push(&mv, MSG_BLOCK, &hash);
+	}
+
+	cstring *body = ser_msg_vinv(&mv);
+	cstring *s = message_str(chain->netmagic, "inv", body->str, body->len);
+
+	cstr_free(body, true);
+	msg_vinv_free(&mv);
+	return s;
+}
+
+/* a conn past its handshake reading one end of a socketpair; the
+ * test writes the other
+ */
+static struct nc_conn *rx_conn_new(struct net_child_info *nci, int *peer_fd)
+{
+	struct peer peer;
+	int sv[2];
+
+	peer_init(&peer);
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+	assert(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+
+	struct nc_conn *conn = nc_conn_new(&peer);
+	assert(conn != NULL);
+	conn->fd = sv[0];
+	conn->nci = nci;
+	conn->seen_version = true;
+	conn->seen_verack = true;
+
+	*peer_fd = sv[1];
+	peer_free(&peer);
+	return conn;
+}
+
+/* one read event, with data known to be waiting */
+static void rx_read(struct nc_conn *conn)
+{
+	struct pollfd pfd = { conn->fd, POLLIN, 0 };
+
+	assert(poll(&pfd, 1, 0) == 1);
+	nc_conn_read_evt(conn->fd, EV_READ, conn);
+}
+
+static void rx_write(int fd, const void *p, size_t len)
+{
+	assert(write(fd, p, len) == (ssize_t) len);
+}
+
+/* write len bytes however the socket takes them, reading as they land */
+static void rx_stream(struct nc_conn *conn, int fd, const void *data,
+		      size_t len)
+{
+	const unsigned char *p = data;
+	struct pollfd pfd = { conn->fd, POLLIN, 0 };
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0)
+			assert(errno == EAGAIN || errno == EWOULDBLOCK);
+		else {
+			p += n;
+			len -= n;
+		}
+
+		while (!conn->dead && poll(&pfd, 1, 0) > 0)
+			nc_conn_read_evt(conn->fd, EV_READ, conn);
+	}
+}
+
+static void test_rx_frame(struct net_child_info *nci)
+{
+	int fd;
+	struct nc_conn *conn = rx_conn_new(nci, &fd);
+	cstring *all = cstr_new(NULL);
+	cstring *m[3];
+	unsigned int i;
+
+	n_inv = 0;
+
+	/* several messages in one read */
+	for (i = 0; i < 3; i++) {
+		m[i] = inv_msg(i * 10, 10);
+		cstr_append_buf(all, m[i]->str, m[i]->len);
+		cstr_free(m[i], true);
+	}
+	rx_write(fd, all->str, all->len);
+	rx_read(conn);
+	assert(n_inv == 30);
+	assert(conn->rx_end == 0);
+
+	/* a header split across reads */
+	m[0] = inv_msg(30, 5);
+	rx_write(fd, m[0]->str, 10);
+	rx_read(conn);
+	assert(n_inv == 30);
+	assert(conn->rx_end == 10);
+	rx_write(fd, m[0]->str + 10, m[0]->len - 10);
+	rx_read(conn);
+	assert(n_inv == 35);
+	assert(conn->rx_end == 0);
+	cstr_free(m[0], true);
+
+	/* a body split across reads, the next message behind it */
+	m[0] = inv_msg(35, 5);
+	m[1] = inv_msg(40, 1);
+	rx_write(fd, m[0]->str, P2P_HDR_SZ + 7);
+	rx_read(conn);
+	assert(n_inv == 35);
+	cstr_resize(all, 0);
+	cstr_append_buf(all, m[0]->str + P2P_HDR_SZ + 7,
+			m[0]->len - P2P_HDR_SZ - 7);
+	cstr_append_buf(all, m[1]->str, m[1]->len);
+	rx_write(fd, all->str, all->len);
+	rx_read(conn);
+	assert(n_inv == 41);
+	assert(conn->rx_end == 0);
+	cstr_free(m[0], true);
+	cstr_free(m[1], true);
+
+	/* a body too big for rx_buf reads into its own buffer, then
+	 * whatever follows it lands back in rx_buf
+	 */
+	unsigned int n_big = NC_RX_BUF_SZ / 36 + 100;
+	m[0] = inv_msg(41, n_big);
+	m[1] = inv_msg(41 + n_big, 3);
+	assert(m[0]->len - P2P_HDR_SZ > NC_RX_BUF_SZ - P2P_HDR_SZ);
+
+	rx_write(fd, m[0]->str, P2P_HDR_SZ + 100);
+	rx_read(conn);
+	assert(n_inv == 41);
+	assert(conn->expected == m[0]->len - P2P_HDR_SZ - 100);
+	assert(conn->rx_end == 0);
+
+	cstr_resize(all, 0);
+	cstr_append_buf(all, m[0]->str + P2P_HDR_SZ + 100,
+			m[0]->len - P2P_HDR_SZ - 100);
+	cstr_append_buf(all, m[1]->str, m[1]->len);
+	rx_stream(conn, fd, all->str, all->len);
+	assert(n_inv == 41 + n_big + 3);
+	assert(conn->expected == 0);
+	assert(conn->rx_end == 0);
+	assert(conn->dead == false);
+	cstr_free(m[0], true);
+	cstr_free(m[1], true);
+
+	cstr_free(all, true);
+	close(fd);
+	nc_conn_free(conn);
+}
+
+/* a message that gets conn dropped is the last one handled */
+static void test_rx_frame_drop(struct net_child_info *nci)
+{
+	int fd;
+	struct nc_conn *conn = rx_conn_new(nci, &fd);
+	cstring *all = cstr_new(NULL);
+	unsigned int i;
+
+	n_inv = 0;
+	drop_conn = conn;
+	drop_at = 2;
+
+	for (i = 0; i < 3; i++) {
+		cstring *m = inv_msg(i, 1);
+		cstr_append_buf(all, m->str, m->len);
+		cstr_free(m, true);
+	}
+	rx_write(fd, all->str, all->len);
+	rx_read(conn);
+	assert(conn->dead == true);
+	assert(n_inv == 2);
+
+	drop_conn = NULL;
+	cstr_free(all, true);
+	close(fd);
+	nc_conn_free(conn);
+}
+
+/* one msgbuf to every conn past its handshake; each conn lets go of it
+ * once fully written, however little the socket took at a time
+ */
+static void test_send_all(struct net_child_info *nci)
+{
+	enum { N_CONNS = 4 };
+	struct nc_conn *conn[N_CONNS];
+	int fd[N_CONNS];
+	size_t got[N_CONNS] = {};
+	unsigned char *rx[N_CONNS];
+	unsigned int i, busy;
+
+	nci->conns = parr_new(N_CONNS, NULL);
+	for (i = 0; i < N_CONNS; i++) {
+		conn[i] = rx_conn_new(nci, &fd[i]);
+		parr_add(nci->conns, conn[i]);
+	}
+	conn[2]->dead = true;
+	conn[3]->seen_verack = false;
+
+	/* bigger than a socket buffer, so every first write is partial */
+	size_t data_len = 1024 * 1024;
+	unsigned char *data = calloc(1, data_len);
+	assert(data != NULL);
+	memset(data, 0x5a, data_len);
+	struct p2p_msgbuf *mb = p2p_msgbuf_new(chain->netmagic, "foo",
+					       data, data_len);
+	assert(mb != NULL);
+	free(data);
+
+	nc_conns_send_all(nci, mb);
+	assert(mb->refs == 3);
+	assert(conn[0]->write_q != NULL && conn[1]->write_q != NULL);
+	assert(conn[2]->write_q == NULL && conn[3]->write_q == NULL);
+
+	for (i = 0; i < 2; i++) {
+		rx[i] = malloc(mb->len);
+		assert(rx[i] != NULL);
+	}
+
+	do {
+		busy = 0;
+		for (i = 0; i < 2; i++) {
+			ssize_t n = read(fd[i], rx[i] + got[i],
+					 mb->len - got[i]);
+			if (n > 0)
+				got[i] += n;
+			if (conn[i]->write_q) {
+				nc_conn_write_evt(conn[i]->fd, EV_WRITE,
+						  conn[i]);
+				busy++;
+			}
+		}
+	} while (busy || got[0] < mb->len || got[1] < mb->len);
+
+	for (i = 0; i < 2; i++) {
+		assert(memcmp(rx[i], mb->data, mb->len) == 0);
+		assert(conn[i]->dead == false);
+		free(rx[i]);
+	}
+
+	/* only our own reference is left */
+	assert(mb->refs == 1);
+	p2p_msgbuf_unref(mb);
+
+	for (i = 0; i < N_CONNS; i++) {
+		close(fd[i]);
+		nc_conn_free(conn[i]);
+	}
+	parr_free(nci->conns, true);
+	nci->conns = NULL;
+}
+
+/*
+ * headers-first download over a made-up chain, whose headers link but
+ * carry no proof of work; chaindb does not check that
+ */
+
+enum { DL_BLOCKS = 64, DL_CONNS = 3 };
+
+static struct bitc_block dl_hdr[DL_BLOCKS];
+static struct chaindb *dl_db;		/* the chain block_process builds */
+static int dl_fed[DL_BLOCKS];		/* heights, in block_process order */
+static unsigned int n_fed;
+
+struct dl_test {
+	struct net_child_info	nci;
+	struct chaindb		db;
+	struct chaindb		hdr_db;
+	struct nc_conn		*conn[DL_CONNS];
+	int			fd[DL_CONNS];
+};
+
+static void dl_chain_init(void)
+{
+	int h;
+
+	for (h = 0; h < DL_BLOCKS; h++) {
+		struct bitc_block *hdr = &dl_hdr[h];
+
+		bitc_block_init(hdr);
+		hdr->nVersion = 1;
+		hdr->nTime = 1500000000 + h * 600;
+		hdr->nBits = 0x207fffff;
+		hdr->nNonce = h;
+		if (h > 0)
+			bu256_copy(&hdr->hashPrevBlock, &dl_hdr[h - 1].sha256);
+		bitc_block_calc_sha256(hdr);
+	}
+}
+
+static void dl_db_add(struct chaindb *db, const struct bitc_block *hdr)
+{
+	struct blkinfo *bi = bi_new();
+	struct chaindb_reorg reorg;
+
+	bitc_block_copy_hdr(&bi->hdr, hdr);
+	bu256_copy(&bi->hash, &hdr->sha256);
+	assert(chaindb_add(db, bi, &reorg) == true);
+}
+
+/* the node: each block must extend its chain */
+static bool dl_block_process(struct bitc_block *block,
+			     struct const_buffer *buf)
+{
+	assert(bu256_equal(&block->hashPrevBlock, &dl_db->best_chain->hash));
+	dl_db_add(dl_db, block);
+	dl_fed[n_fed++] = dl_db->best_chain->height;
+	return true;
+}
+
+/* our chain up to tip, headers up to hdr_tip, and peers that have
+ * them all
+ */
+static void dl_setup(struct dl_test *t, int tip, int hdr_tip)
+{
+	unsigned int i;
+	int h;
+
+	memset(t, 0, sizeof(*t));
+	t->nci.chain = chain;
+	t->nci.eb = event_base_new();
+	t->nci.db = &t->db;
+	t->nci.conns = parr_new(DL_CONNS, NULL);
+	t->nci.block_process = dl_block_process;
+
+	assert(chaindb_init(&t->db, chain->netmagic, &dl_hdr[0].sha256));
+	t->db.hdrs_only = true;
+	for (h = 0; h <= tip; h++)
+		dl_db_add(&t->db, &dl_hdr[h]);
+	dl_db = &t->db;
+	n_fed = 0;
+
+	assert(chaindb_init(&t->hdr_db, chain->netmagic, &dl_hdr[0].sha256));
+	t->hdr_db.hdrs_only = true;
+	assert(nc_hdrs_start(&t->nci, &t->hdr_db) == true);
+	for (h = tip + 1; h <= hdr_tip; h++)
+		assert(nc_hdr_add(&t->hdr_db, &dl_hdr[h]) != NULL);
+	assert(nc_hdr_chain_update(&t->nci) == true);
+
+	for (i = 0; i < DL_CONNS; i++) {
+		t->conn[i] = rx_conn_new(&t->nci, &t->fd[i]);
+		t->conn[i]->best_height = hdr_tip;
+		parr_add(t->nci.conns, t->conn[i]);
+	}
+}
+
+static void dl_teardown(struct dl_test *t)
+{
+	unsigned int i;
+
+	nc_hdrs_stop(&t->nci);
+	for (i = 0; i < DL_CONNS; i++) {
+		close(t->fd[i]);
+		nc_conn_free(t->conn[i]);
+	}
+	parr_free(t->nci.conns, true);
+	chaindb_free(&t->hdr_db);
+	chaindb_free(&t->db);
+	event_base_free(t->nci.eb);
+}
+
+static struct nc_dlblock *dl_get(struct dl_test *t, int h)
+{
+	return bitc_hashtab_get(t->nci.dl_blocks, &dl_hdr[h].sha256);
+}
+
+/* whom block h is asked of, if anyone */
+static struct nc_conn *dl_conn(struct dl_test *t, int h)
+{
+	struct nc_dlblock *dl = dl_get(t, h);
+
+	return dl ? dl->conn : NULL;
+}
+
+/* block h arrives from conn, header only */
+static void dl_arrive(struct nc_conn *conn, int h)
+{
+	struct bitc_block block = dl_hdr[h];
+	cstring *s = cstr_new_sz(80);
+
+	ser_bitc_block(s, &block);
+	struct const_buffer buf = { s->str, s->len };
+	assert(nc_dl_block(conn, &block, &buf) == true);
+	cstr_free(s, true);
+}
+
+/* each peer is asked for its share, lowest heights first, and no more
+ * than the window holds
+ */
+static void test_dl_window(void)
+{
+	struct dl_test t;
+	unsigned int i;
+	int h;
+
+	dl_setup(&t, 10, 40);
+	t.nci.dl_window = 16;
+	t.nci.dl_per_peer = 4;
+	nc_dl_schedule(&t.nci);
+	for (i = 0; i < DL_CONNS; i++)
+		assert(t.conn[i]->blocks_in_flight == 4);
+	for (h = 11; h <= 22; h++)
+		assert(dl_conn(&t, h) != NULL);
+	assert(dl_get(&t, 23) == NULL);
+	dl_teardown(&t);
+
+	/* a peer half as fast as the best gets half the share; one not
+	 * yet measured is taken to be as fast as the best
+	 */
+	dl_setup(&t, 10, 40);
+	t.nci.dl_window = 16;
+	t.nci.dl_per_peer = 4;
+	t.nci.dl_best_rate = 1000;
+	t.conn[0]->dl_rated = true;
+	t.conn[0]->dl_rate = 1000;
+	t.conn[1]->dl_rated = true;
+	t.conn[1]->dl_rate = 500;
+	nc_dl_schedule(&t.nci);
+	assert(t.conn[0]->blocks_in_flight == 4);
+	assert(t.conn[1]->blocks_in_flight == 2);
+	assert(t.conn[2]->blocks_in_flight == 4);
+	assert(dl_conn(&t, 20) != NULL);
+	assert(dl_get(&t, 21) == NULL);
+	dl_teardown(&t);
+
+	/* the window bounds peers with room to spare */
+	dl_setup(&t, 10, 40);
+	t.nci.dl_window = 5;
+	t.nci.dl_per_peer = 100;
+	nc_dl_schedule(&t.nci);
+	assert(dl_conn(&t, 15) != NULL);
+	assert(dl_get(&t, 16) == NULL);
+	dl_teardown(&t);
+}
+
+/* a late next block with the window full moves all its peer was asked
+ * for to others, until that peer sends a block
+ */
+static void test_dl_stall(void)
+{
+	struct dl_test t;
+	struct nc_conn *slow, *other;
+	int h;
+
+	dl_setup(&t, 10, 40);
+	t.conn[2]->dead = true;
+	t.nci.dl_window = 8;
+	t.nci.dl_per_peer = 8;
+	nc_dl_schedule(&t.nci);
+	slow = dl_conn(&t, 11);
+	other = (slow == t.conn[0]) ? t.conn[1] : t.conn[0];
+	assert(slow->blocks_in_flight == 4);
+	assert(other->blocks_in_flight == 4);
+
+	/* not late yet */
+	nc_dl_tick(-1, EV_TIMEOUT, &t.nci);
+	assert(slow->dl_stalled == false);
+
+	dl_get(&t, 11)->requested -= NC_DL_STALL + 1;
+	nc_dl_tick(-1, EV_TIMEOUT, &t.nci);
+	assert(slow->dl_stalled == true);
+	assert(slow->blocks_in_flight == 0);
+	assert(other->blocks_in_flight == 8);
+	for (h = 11; h <= 18; h++)
+		assert(dl_conn(&t, h) == other);
+
+	/* the block it was too slow with still counts, and it is asked
+	 * for the next one again
+	 */
+	dl_arrive(slow, 11);
+	assert(slow->dl_stalled == false);
+	assert(n_fed == 1 && dl_fed[0] == 11);
+	assert(other->blocks_in_flight == 7);
+	assert(dl_conn(&t, 19) == slow);
+	dl_teardown(&t);
+}
+
+/* blocks ahead of their parent wait, then go to block_process in order */
+static void test_dl_order(void)
+{
+	struct dl_test t;
+
+	dl_setup(&t, 10, 40);
+	t.nci.dl_window = 8;
+	t.nci.dl_per_peer = 8;
+	nc_dl_schedule(&t.nci);
+
+	dl_arrive(dl_conn(&t, 13), 13);
+	dl_arrive(dl_conn(&t, 12), 12);
+	assert(n_fed == 0);
+	assert(dl_get(&t, 12)->data != NULL);
+	assert(dl_get(&t, 13)->data != NULL);
+
+	dl_arrive(dl_conn(&t, 11), 11);
+	assert(n_fed == 3);
+	assert(dl_fed[0] == 11 && dl_fed[1] == 12 && dl_fed[2] == 13);
+	assert(t.db.best_chain->height == 13);
+	assert(dl_get(&t, 12) == NULL && dl_get(&t, 13) == NULL);
+
+	/* and the window moves along */
+	assert(dl_conn(&t, 21) != NULL);
+	assert(dl_get(&t, 22) == NULL);
+
+	/* a block we already have, or no header for, is ignored */
+	dl_arrive(t.conn[0], 12);
+	dl_arrive(t.conn[0], 50);
+	assert(n_fed == 3);
+	dl_teardown(&t);
+}
+
+/* what a departing peer was asked for goes to the others */
+static void test_dl_conn_gone(void)
+{
+	struct dl_test t;
+	struct nc_conn *gone, *left;
+	int h;
+
+	dl_setup(&t, 10, 40);
+	t.conn[2]->dead = true;
+	t.nci.dl_window = 8;
+	t.nci.dl_per_peer = 8;
+	nc_dl_schedule(&t.nci);
+
+	gone = t.conn[0];
+	left = t.conn[1];
+	t.nci.hdr_conn = gone;
+	assert(gone->blocks_in_flight == 4);
+
+	nc_hdrs_conn_gone(&t.nci, gone);
+	gone->dead = true;
+	assert(t.nci.hdr_conn == NULL);
+	for (h = 11; h <= 18; h++)
+		assert(dl_conn(&t, h) != gone);
+
+	nc_dl_schedule(&t.nci);
+	for (h = 11; h <= 18; h++)
+		assert(dl_conn(&t, h) == left);
+	assert(left->blocks_in_flight == 8);
+	dl_teardown(&t);
+}
+
+int main (int argc, char *argv[])
+{
+	static struct logging log;
+	struct net_child_info nci = {};
+
+	log.stream = stderr;
+	log_state = &log;
+
+	nci.chain = chain;
+	nci.eb = event_base_new();
+	nci.inv_block_process = count_inv_block;
+
+	test_rx_frame(&nci);
+	test_rx_frame_drop(&nci);
+	test_send_all(&nci);
+
+	dl_chain_init();
+	test_dl_window();
+	test_dl_stall();
+	test_dl_order();
+	test_dl_conn_gone();
+
+	event_base_free(nci.eb);
+	return 0;
+}
@@ -5,9 +5,21 @@
 #include "libbitc-config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <event.h>
+#include <bitc/coredefs.h>
+#include <bitc/db/chaindb.h>
+#include <bitc/log.h>
+#include <bitc/net/net.h>
 #include <bitc/net/netbase.h>
+#include <bitc/net/peerman.h>
 #include "libtest.h"
 
 static void test_addr_str(void)
@@ -23,8 +35,118 @@ static void test_addr_str(void)
 	assert(strcmp(host, "1.2.3.4") == 0);
 }
 
+enum { N_PEERS = 4 };
+
+struct listener {
+	int		fd;
+	int		held[N_PEERS];
+	unsigned int	n_held;
+};
+
+/* accept N_PEERS connections; hang up on half, hold the rest */
+static void *listener_main(void *priv)
+{
+	struct listener *l = priv;
+	unsigned int i;
+
+	for (i = 0; i < N_PEERS; i++) {
+		int fd = accept(l->fd, NULL, NULL);
+		assert(fd >= 0);
+		if (i < N_PEERS / 2)
+			close(fd);
+		else
+			l->held[l->n_held++] = fd;
+	}
+	return NULL;
+}
+
+static bool no_inv_block(bu256_t *hash)
+{
+	return false;
+}
+
+/* I/O loops survive peers hanging up, and stop with conns still open */
+static void test_loops_kill(void)
+{
+	static struct logging log;
+	static struct chaindb db;
+	static uint64_t nonce = 1;
+	struct net_child_info nci = {};
+	struct listener l = {};
+	struct sockaddr_in sin = {};
+	socklen_t sin_len = sizeof(sin);
+	pthread_t thread;
+	unsigned int i, dead = 0;
+
+	log.stream = stderr;
+	log_state = &log;
+	signal(SIGPIPE, SIG_IGN);
+	alarm(60);
+
+	l.fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(l.fd >= 0);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	assert(bind(l.fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	assert(listen(l.fd, N_PEERS) == 0);
+	assert(getsockname(l.fd, (struct sockaddr *) &sin, &sin_len) == 0);
+	assert(pthread_create(&thread, NULL, listener_main, &l) == 0);
+
+	nci.chain = &chain_metadata[CHAIN_BITCOIN];
+	nci.db = &db;
+	nci.conns = parr_new(N_PEERS, NULL);
+	nci.eb = event_base_new();
+	nci.peers = peerman_seed(false);
+	nci.instance_nonce = &nonce;
+	nci.net_conn_timeout = 10;
+	nci.max_conns = N_PEERS;
+	nci.inv_block_process = no_inv_block;
+	nci.running = true;
+
+	/* one IP per conn: 127.0.0.1 and up */
+	for (i = 0; i < N_PEERS; i++) {
+		struct bitc_address addr;
+		bitc_addr_init(&addr);
+		memcpy(addr.ip, "\0\0\0\0\0\0\0\0\0\0\xff\xff\x7f\0\0", 15);
+		addr.ip[15] = i + 1;
+		addr.port = ntohs(sin.sin_port);
+		peerman_add_addr(nci.peers, &addr, true);
+	}
+
+	assert(nc_loops_start(&nci, 2));
+	nc_conns_process(&nci);
+	assert(nci.conns->len == N_PEERS);
+
+	/* conns die on the loops as their peers hang up */
+	while (dead < N_PEERS / 2) {
+		event_base_dispatch(nci.eb);
+		dead = 0;
+		for (i = 0; i < nci.conns->len; i++) {
+			struct nc_conn *conn = parr_idx(nci.conns, i);
+			if (conn->dead && conn->detached)
+				dead++;
+		}
+	}
+	nc_conns_gc(&nci, false);
+	assert(nci.conns->len <= N_PEERS - N_PEERS / 2);
+
+	nc_loops_stop(&nci);
+	assert(nci.conns->len == 0);
+
+	pthread_join(thread, NULL);
+	for (i = 0; i < l.n_held; i++)
+		close(l.held[i]);
+	close(l.fd);
+	alarm(0);
+
+	peerman_free(nci.peers);
+	parr_free(nci.conns, true);
+	event_base_free(nci.eb);
+}
+
 int main (int argc, char *argv[])
 {
 	test_addr_str();
+	test_loops_kill();
 	return 0;
 }
@@ -4,10 +4,15 @@
  */
 
 #include "libtest.h"                    // for parse_script_str, etc
+#include <bitc/buffer.h>                // for buffer
 #include <bitc/core.h>                  // for bitc_tx, bitc_txin, etc
+#include <bitc/crypto/ripemd160.h>      // for RIPEMD160_DIGEST_LENGTH
 #include <bitc/cstr.h>                  // for cstr_free, cstring
 #include <bitc/hexcode.h>               // for hex2str
+#include <bitc/key.h>                   // for bitc_key, bitc_sign, etc
 #include <bitc/script/interpreter.h>    // for bitc_script_verify, etc
+#include <bitc/script/script.h>         // for scriptnum_decode, etc
+#include <bitc/util.h>                  // for bn_getvch, bu_Hash160, etc
 
 #include <cJSON.h>                      // for cJSON_GetArrayItem, cJSON, etc
 
@@ -86,7 +91,7 @@ static void test_script(bool is_valid, cstring* scriptSig, cstring* scriptPubKey
 
     bool rc;
     rc = bitc_script_verify(scriptSig, scriptPubKey, &scriptWitness, &tx, 0,
-                        test_flags, nValue);
+                        test_flags, nValue, NULL);
 
     if (rc != is_valid) {
         fprintf(stderr, "script: %sis_valid test %u failed\n"
@@ -203,8 +208,529 @@ static void runtest(const char* json_base_fn)
     free(json_fn);
 }
 
+/* the int64 codec must agree with the GMP one it replaced */
+static void check_scriptnum(int64_t v)
+{
+    unsigned char vch[SCRIPTNUM_MAX_SIZE];
+    size_t len = scriptnum_encode(vch, v);
+
+    mpz_t bn;
+    mpz_init(bn);
+    mpz_set_si(bn, v);
+    cstring *ref = bn_getvch(bn);
+    assert(ref->len == len && memcmp(ref->str, vch, len) == 0);
+    cstr_free(ref, true);
+
+    if (len <= 8) {
+        struct buffer buf = { vch, len };
+        scriptnum out;
+        assert(scriptnum_decode(&out, &buf, true, len) == true);
+        assert(out == v);
+        if (len > 0)
+            assert(scriptnum_decode(&out, &buf, true, len - 1) == false);
+    }
+
+    mpz_clear(bn);
+}
+
+static void check_scriptnum_raw(const char *hex, bool minimal, int64_t v)
+{
+    cstring *s = hex2str(hex);
+    if (!s)
+        s = cstr_new_sz(0);
+    struct buffer buf = { s->str, s->len };
+    scriptnum out;
+
+    assert(scriptnum_decode(&out, &buf, false, 8) == true);
+    assert(out == v);
+    assert(scriptnum_decode(&out, &buf, true, 8) == minimal);
+
+    mpz_t bn;
+    mpz_init(bn);
+    bn_setvch(bn, s->str, s->len);
+    assert(mpz_cmp_si(bn, v) == 0);
+    mpz_clear(bn);
+
+    cstr_free(s, true);
+}
+
+static void test_scriptnum(void)
+{
+    static const int64_t edges[] = {
+        0, 1, 127, 128, 255, 256, 32767, 32768, 65535, 65536,
+        0x7fffffLL, 0x800000LL, 0x7fffffffLL, 0x80000000LL,
+        0xffffffffLL, 0x7fffffffffLL, 0x8000000000LL,
+        0x7fffffffffffffffLL,
+    };
+    unsigned int i;
+    int64_t v;
+
+    for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        check_scriptnum(edges[i]);
+        check_scriptnum(-edges[i]);
+        if (edges[i] > 1) {
+            check_scriptnum(edges[i] - 1);
+            check_scriptnum(1 - edges[i]);
+        }
+    }
+    check_scriptnum(INT64_MIN);
+
+    for (v = -70000; v <= 70000; v++)
+        check_scriptnum(v);
+
+    check_scriptnum_raw("", true, 0);
+    check_scriptnum_raw("00", false, 0);
+    check_scriptnum_raw("80", false, 0);            // negative zero
+    check_scriptnum_raw("0100", false, 1);
+    check_scriptnum_raw("0180", false, -1);
+    check_scriptnum_raw("ff00", true, 255);
+    check_scriptnum_raw("ff80", true, -255);
+    check_scriptnum_raw("ffffff7f", true, 0x7fffffff);
+    check_scriptnum_raw("ffffffff", true, -0x7fffffff);
+    check_scriptnum_raw("0000008000", true, 0x80000000LL);
+    check_scriptnum_raw("ffffffffffffff7f", true, INT64_MAX);
+    check_scriptnum_raw("ffffffffffffffff", true, -INT64_MAX);
+}
+
+static cstring *hex2str_empty(const char *hex)
+{
+    cstring *s = hex2str(hex);
+    return s ? s : cstr_new_sz(0);
+}
+
+static void check_find_del(const char *script_hex, const char *data_hex,
+                           const char *expect_hex, unsigned int expect_n)
+{
+    cstring *s = hex2str_empty(script_hex);
+    cstring *data = hex2str_empty(data_hex);
+    cstring *expect = hex2str_empty(expect_hex);
+    struct buffer buf = { data->str, data->len };
+
+    assert(bitc_script_find_del(s, &buf) == expect_n);
+    assert(s->len == expect->len &&
+           memcmp(s->str, expect->str, s->len) == 0);
+
+    cstr_free(s, true);
+    cstr_free(data, true);
+    cstr_free(expect, true);
+}
+
+static void test_find_del(void)
+{
+    check_find_del("0302ff03", "02ff03", "", 1);
+    check_find_del("0302ff030302ff03", "02ff03", "", 2);   // back to back
+    check_find_del("510302ff03520302ff03", "02ff03", "5152", 2);
+    check_find_del("0302ff030302ff03", "ff", "0302ff030302ff03", 0);
+
+    // push of the signature embedded inside a larger push
+    check_find_del("050302ff0300", "02ff03", "050302ff0300", 0);
+    check_find_del("050302ff03000302ff03", "02ff03", "050302ff0300", 1);
+
+    // 01aa first lines up inside the push 0201aa, then on a boundary
+    check_find_del("0201aa01aa", "aa", "0201aa", 1);
+    check_find_del("020201aa", "aa", "020201aa", 0);
+
+    // an empty signature removes OP_0s; the truncated push is kept
+    check_find_del("000051", "", "51", 2);
+    check_find_del("0003feed", "", "03feed", 1);
+    check_find_del("0003feed", "feed", "0003feed", 0);
+}
+
+/* 0 0 <nKeys empty keys> nKeys CHECKMULTISIG, nBefore NOPs ahead and
+ * nAfter NOPs behind, the latter in a branch not taken if fSkipped
+ */
+static void check_op_count(unsigned int nKeys, unsigned int nBefore,
+                           unsigned int nAfter, bool fSkipped, bool is_valid)
+{
+    cstring *scriptSig = cstr_new(NULL);
+    cstring *scriptPubKey = cstr_new(NULL);
+    unsigned int i;
+
+    for (i = 0; i < nBefore; i++)
+        bsp_push_op(scriptPubKey, OP_NOP);
+    bsp_push_op(scriptPubKey, OP_0);
+    bsp_push_op(scriptPubKey, OP_0);
+    for (i = 0; i < nKeys; i++)
+        bsp_push_op(scriptPubKey, OP_0);
+    bsp_push_int64(scriptPubKey, nKeys);
+    bsp_push_op(scriptPubKey, OP_CHECKMULTISIG);
+    if (fSkipped) {
+        bsp_push_op(scriptPubKey, OP_0);
+        bsp_push_op(scriptPubKey, OP_IF);
+    }
+    for (i = 0; i < nAfter; i++)
+        bsp_push_op(scriptPubKey, OP_NOP);
+    if (fSkipped)
+        bsp_push_op(scriptPubKey, OP_ENDIF);
+
+    test_script(is_valid, scriptSig, scriptPubKey, parr_new(0, buffer_freep),
+                nAfter, "", "CHECKMULTISIG op count", SCRIPT_VERIFY_P2SH, 0);
+
+    cstr_free(scriptSig, true);
+    cstr_free(scriptPubKey, true);
+}
+
+/* CHECKMULTISIG keys count as ops against every op that follows */
+static void test_op_count(void)
+{
+    unsigned int n = MAX_OPS_PER_SCRIPT - 21;
+
+    check_op_count(20, 0, n, false, true);
+    check_op_count(20, 0, n + 1, false, false);
+    check_op_count(20, n, 0, false, true);
+    check_op_count(20, n + 1, 0, false, false);
+    check_op_count(20, 0, n - 2, true, true);       // IF, ENDIF
+    check_op_count(20, 0, n - 1, true, false);
+    check_op_count(1, 0, n + 19, false, true);
+    check_op_count(1, 0, n + 20, false, false);
+}
+
+static const struct {
+    const char *scriptSig;
+    const char *scriptPubKey;
+    bool is_valid;
+} branch_tests[] = {
+    { "1", "IF 2 ELSE 3 ENDIF 2 EQUAL", true },
+    { "0", "IF 2 ELSE 3 ENDIF 3 EQUAL", true },
+    { "0", "NOTIF 2 ELSE 3 ENDIF 2 EQUAL", true },
+    { "0", "IF 2 ENDIF DEPTH 0 EQUAL", true },
+    { "1", "IF 2 ELSE 3 ELSE 4 ENDIF 4 EQUALVERIFY 2 EQUAL", true },
+    { "0", "IF 2 ELSE 3 ELSE 4 ENDIF 3 EQUAL", true },
+    { "0 1", "IF IF 2 ELSE 3 ENDIF ELSE 4 ENDIF 3 EQUAL", true },
+    { "1 0", "IF IF 2 ELSE 3 ENDIF ELSE 4 ENDIF 4 EQUAL", true },
+    { "0", "IF 1 IF RETURN ELSE RETURN ENDIF RETURN ENDIF 1", true },
+    { "1", "IF 1 ELSE IF RETURN ENDIF RETURN ENDIF", true },
+    { "0", "IF 1 ELSE 0 IF RETURN ENDIF ENDIF 1", true },
+    { "0", "IF CAT ENDIF 1", false },
+    { "0", "IF VERIF ENDIF 1", false },
+    { "1", "IF 1", false },
+    { "0", "IF ELSE 1", false },
+    { "1", "IF 1 ELSE RETURN", false },
+    { "1", "ELSE 1 ENDIF", false },
+    { "1", "1 ENDIF", false },
+    { "1", "IF ENDIF ENDIF 1", false },
+    { "0", "IF ELSE ENDIF ELSE 1", false },
+};
+
+static void test_branches(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(branch_tests) / sizeof(branch_tests[0]); i++) {
+        cstring *scriptSig = parse_script_str(branch_tests[i].scriptSig);
+        cstring *scriptPubKey = parse_script_str(branch_tests[i].scriptPubKey);
+        assert(scriptSig != NULL && scriptPubKey != NULL);
+
+        test_script(branch_tests[i].is_valid, scriptSig, scriptPubKey,
+                    parr_new(0, buffer_freep), i, branch_tests[i].scriptSig,
+                    branch_tests[i].scriptPubKey, SCRIPT_VERIFY_P2SH, 0);
+
+        cstr_free(scriptSig, true);
+        cstr_free(scriptPubKey, true);
+    }
+}
+
+/*
+ * Standard spends are verified by templates; with CLEANSTACK they go
+ * through the interpreter, which must reach the same verdict.
+ */
+enum {
+    TMPL_KEYS = 3,
+    TMPL_FLAGS = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS,
+};
+
+static struct bitc_key tmpl_key[TMPL_KEYS];
+static cstring *tmpl_pub[TMPL_KEYS];
+
+static cstring *tmpl_sign(unsigned int k, const cstring *scriptCode,
+                          const struct bitc_tx *tx, int64_t amount,
+                          enum SigVersion sigversion)
+{
+    bu256_t hash;
+    void *sig;
+    size_t siglen;
+
+    bitc_tx_sighash(&hash, scriptCode, tx, 0, SIGHASH_ALL, amount,
+                    sigversion, NULL);
+    assert(bitc_sign(&tmpl_key[k], &hash, sizeof(hash), &sig, &siglen));
+
+    cstring *s = cstr_new_buf(sig, siglen);
+    cstr_append_c(s, SIGHASH_ALL);
+    free(sig);
+    return s;
+}
+
+static cstring *tmpl_hash160(const cstring *s)
+{
+    cstring *hash = cstr_new_sz(RIPEMD160_DIGEST_LENGTH);
+
+    cstr_resize(hash, RIPEMD160_DIGEST_LENGTH);
+    bu_Hash160((unsigned char *) hash->str, s->str, s->len);
+    return hash;
+}
+
+/* a spend of scriptPubKey to sign; only the input's prevout matters */
+static struct bitc_tx tmpl_tx(const cstring *scriptPubKey, int64_t amount)
+{
+    cstring *empty = cstr_new(NULL);
+    struct bitc_tx tx = BuildCreditingTransaction((cstring *) scriptPubKey,
+                                                  amount);
+
+    tx = BuildSpendingTransaction(empty, NULL, &tx);
+    cstr_free(empty, true);
+    return tx;
+}
+
+/* fClean: a good spend leaves a clean stack, so CLEANSTACK can't
+ * change the verdict
+ */
+static void check_tmpl(const cstring *scriptSig, const cstring *scriptPubKey,
+                       parr *witness, const struct bitc_tx *tx,
+                       int64_t amount, unsigned int flags, bool fClean,
+                       bool is_valid)
+{
+    assert(bitc_script_verify(scriptSig, scriptPubKey, &witness, tx, 0,
+                              flags, amount, NULL) == is_valid);
+    if (fClean)
+        assert(bitc_script_verify(scriptSig, scriptPubKey, &witness, tx, 0,
+                                  flags | SCRIPT_VERIFY_CLEANSTACK, amount,
+                                  NULL) == is_valid);
+}
+
+static void test_tmpl_p2pk(void)
+{
+    cstring *scriptPubKey = cstr_new(NULL);
+    bsp_push_data(scriptPubKey, tmpl_pub[0]->str, tmpl_pub[0]->len);
+    bsp_push_op(scriptPubKey, OP_CHECKSIG);
+
+    struct bitc_tx tx = tmpl_tx(scriptPubKey, 0);
+    cstring *sig0 = tmpl_sign(0, scriptPubKey, &tx, 0, SIGVERSION_BASE);
+    cstring *sig1 = tmpl_sign(1, scriptPubKey, &tx, 0, SIGVERSION_BASE);
+    cstring *scriptSig = cstr_new(NULL);
+
+    bsp_push_data(scriptSig, sig0->str, sig0->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, true);
+
+    cstr_resize(scriptSig, 0);
+    bsp_push_data(scriptSig, sig1->str, sig1->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+
+    cstr_resize(scriptSig, 0);
+    sig0->str[8] ^= 1;
+    bsp_push_data(scriptSig, sig0->str, sig0->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+
+    cstr_free(scriptSig, true);
+    cstr_free(sig0, true);
+    cstr_free(sig1, true);
+    cstr_free(scriptPubKey, true);
+    bitc_tx_free(&tx);
+}
+
+static void test_tmpl_p2pkh(void)
+{
+    cstring *hash = tmpl_hash160(tmpl_pub[0]);
+    cstring *scriptPubKey = bsp_make_pubkeyhash(hash);
+    struct bitc_tx tx = tmpl_tx(scriptPubKey, 0);
+    cstring *sig0 = tmpl_sign(0, scriptPubKey, &tx, 0, SIGVERSION_BASE);
+    cstring *sig1 = tmpl_sign(1, scriptPubKey, &tx, 0, SIGVERSION_BASE);
+    cstring *scriptSig = cstr_new(NULL);
+
+    bsp_push_data(scriptSig, sig0->str, sig0->len);
+    bsp_push_data(scriptSig, tmpl_pub[0]->str, tmpl_pub[0]->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, true);
+
+    cstr_resize(scriptSig, 0);
+    bsp_push_data(scriptSig, sig1->str, sig1->len);
+    bsp_push_data(scriptSig, tmpl_pub[0]->str, tmpl_pub[0]->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+
+    cstr_resize(scriptSig, 0);
+    bsp_push_data(scriptSig, sig1->str, sig1->len);
+    bsp_push_data(scriptSig, tmpl_pub[1]->str, tmpl_pub[1]->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+
+    // an extra item only fails under CLEANSTACK
+    cstr_resize(scriptSig, 0);
+    bsp_push_op(scriptSig, OP_0);
+    bsp_push_data(scriptSig, sig0->str, sig0->len);
+    bsp_push_data(scriptSig, tmpl_pub[0]->str, tmpl_pub[0]->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, false, true);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0,
+               TMPL_FLAGS | SCRIPT_VERIFY_CLEANSTACK, false, false);
+
+    // a non-minimal push only fails under MINIMALDATA
+    cstr_resize(scriptSig, 0);
+    bsp_push_data(scriptSig, sig0->str, sig0->len);
+    cstr_append_c(scriptSig, OP_PUSHDATA1);
+    cstr_append_c(scriptSig, tmpl_pub[0]->len);
+    cstr_append_buf(scriptSig, tmpl_pub[0]->str, tmpl_pub[0]->len);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, true);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0,
+               TMPL_FLAGS | SCRIPT_VERIFY_MINIMALDATA, true, false);
+
+    cstr_free(scriptSig, true);
+    cstr_free(sig0, true);
+    cstr_free(sig1, true);
+    cstr_free(scriptPubKey, true);
+    cstr_free(hash, true);
+    bitc_tx_free(&tx);
+}
+
+static parr *tmpl_witness(const cstring *sig, const cstring *pubkey)
+{
+    parr *witness = parr_new(2, buffer_freep);
+
+    parr_add(witness, buffer_copy(sig->str, sig->len));
+    parr_add(witness, buffer_copy(pubkey->str, pubkey->len));
+    return witness;
+}
+
+static void test_tmpl_p2wpkh(void)
+{
+    const int64_t amount = 12345;
+    cstring *hash = tmpl_hash160(tmpl_pub[0]);
+    cstring *scriptCode = bsp_make_pubkeyhash(hash);
+    cstring *scriptPubKey = cstr_new(NULL);
+    bsp_push_op(scriptPubKey, OP_0);
+    bsp_push_data(scriptPubKey, hash->str, hash->len);
+
+    struct bitc_tx tx = tmpl_tx(scriptPubKey, amount);
+    cstring *sig0 = tmpl_sign(0, scriptCode, &tx, amount,
+                              SIGVERSION_WITNESS_V0);
+    cstring *sig0_amount = tmpl_sign(0, scriptCode, &tx, amount + 1,
+                                     SIGVERSION_WITNESS_V0);
+    cstring *empty = cstr_new(NULL);
+    cstring *scriptSig = cstr_new(NULL);
+    parr *witness;
+
+    witness = tmpl_witness(sig0, tmpl_pub[0]);
+    check_tmpl(empty, scriptPubKey, witness, &tx, amount, TMPL_FLAGS,
+               true, true);
+    parr_free(witness, true);
+
+    witness = tmpl_witness(sig0_amount, tmpl_pub[0]);
+    check_tmpl(empty, scriptPubKey, witness, &tx, amount, TMPL_FLAGS,
+               true, false);
+    parr_free(witness, true);
+
+    witness = tmpl_witness(sig0, tmpl_pub[1]);
+    check_tmpl(empty, scriptPubKey, witness, &tx, amount, TMPL_FLAGS,
+               true, false);
+    parr_free(witness, true);
+
+    bsp_push_op(scriptSig, OP_0);
+    witness = tmpl_witness(sig0, tmpl_pub[0]);
+    check_tmpl(scriptSig, scriptPubKey, witness, &tx, amount, TMPL_FLAGS,
+               true, false);
+    parr_free(witness, true);
+
+    cstr_free(scriptSig, true);
+    cstr_free(empty, true);
+    cstr_free(sig0, true);
+    cstr_free(sig0_amount, true);
+    cstr_free(scriptPubKey, true);
+    cstr_free(scriptCode, true);
+    cstr_free(hash, true);
+    bitc_tx_free(&tx);
+}
+
+/* <dummy> <sigs...> <2-of-3 redeemScript> */
+static cstring *tmpl_multisig_sig(enum opcodetype dummy, const cstring *sig_a,
+                                  const cstring *sig_b, const cstring *redeem)
+{
+    cstring *scriptSig = cstr_new(NULL);
+
+    bsp_push_op(scriptSig, dummy);
+    bsp_push_data(scriptSig, sig_a->str, sig_a->len);
+    bsp_push_data(scriptSig, sig_b->str, sig_b->len);
+    bsp_push_data(scriptSig, redeem->str, redeem->len);
+    return scriptSig;
+}
+
+static void test_tmpl_p2sh_multisig(void)
+{
+    cstring *redeem = cstr_new(NULL);
+    unsigned int i;
+
+    bsp_push_op(redeem, OP_2);
+    for (i = 0; i < TMPL_KEYS; i++)
+        bsp_push_data(redeem, tmpl_pub[i]->str, tmpl_pub[i]->len);
+    bsp_push_op(redeem, OP_3);
+    bsp_push_op(redeem, OP_CHECKMULTISIG);
+
+    cstring *hash = tmpl_hash160(redeem);
+    cstring *scriptPubKey = bsp_make_scripthash(hash);
+    struct bitc_tx tx = tmpl_tx(scriptPubKey, 0);
+    cstring *sig0 = tmpl_sign(0, redeem, &tx, 0, SIGVERSION_BASE);
+    cstring *sig2 = tmpl_sign(2, redeem, &tx, 0, SIGVERSION_BASE);
+    cstring *scriptSig;
+
+    scriptSig = tmpl_multisig_sig(OP_0, sig0, sig2, redeem);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, true);
+    cstr_free(scriptSig, true);
+
+    scriptSig = tmpl_multisig_sig(OP_0, sig2, sig0, redeem);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+    cstr_free(scriptSig, true);
+
+    scriptSig = tmpl_multisig_sig(OP_0, sig0, sig0, redeem);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+    cstr_free(scriptSig, true);
+
+    scriptSig = tmpl_multisig_sig(OP_1, sig0, sig2, redeem);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, true);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0,
+               TMPL_FLAGS | SCRIPT_VERIFY_NULLDUMMY, true, false);
+    cstr_free(scriptSig, true);
+
+    // the redeemScript must hash to the scriptPubKey's
+    redeem->str[2] ^= 1;
+    scriptSig = tmpl_multisig_sig(OP_0, sig0, sig2, redeem);
+    check_tmpl(scriptSig, scriptPubKey, NULL, &tx, 0, TMPL_FLAGS, true, false);
+    cstr_free(scriptSig, true);
+
+    cstr_free(sig0, true);
+    cstr_free(sig2, true);
+    cstr_free(scriptPubKey, true);
+    cstr_free(hash, true);
+    cstr_free(redeem, true);
+    bitc_tx_free(&tx);
+}
+
+static void test_templates(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < TMPL_KEYS; i++) {
+        void *pubkey;
+        size_t pubkey_len;
+
+        bitc_key_init(&tmpl_key[i]);
+        assert(bitc_key_generate(&tmpl_key[i]));
+        assert(bitc_pubkey_get(&tmpl_key[i], &pubkey, &pubkey_len));
+        tmpl_pub[i] = cstr_new_buf(pubkey, pubkey_len);
+        free(pubkey);
+    }
+
+    test_tmpl_p2pk();
+    test_tmpl_p2pkh();
+    test_tmpl_p2wpkh();
+    test_tmpl_p2sh_multisig();
+
+    for (i = 0; i < TMPL_KEYS; i++) {
+        cstr_free(tmpl_pub[i], true);
+        bitc_key_free(&tmpl_key[i]);
+    }
+}
+
 int main(int argc, char* argv[])
 {
+    test_scriptnum();
+    test_find_del();
+    test_op_count();
+    test_branches();
+    test_templates();
     runtest("data/script_tests.json");
     return 0;
 }
@@ -0,0 +1,177 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/script/sigbatch.h>       // for bitc_sigbatch_add, etc
+#include <bitc/crypto/sha2.h>           // for sha256_Raw
+#include <bitc/key.h>                   // for bitc_key, bitc_sign, etc
+#include <bitc/script/sigcache.h>       // for bitc_sigcache_get, etc
+
+#include <assert.h>                     // for assert
+#include <pthread.h>                    // for pthread_create, etc
+#include <stdint.h>                     // for uint32_t
+#include <stdlib.h>                     // for free
+
+enum {
+	N_KEYS		= 4,
+	N_SIGS		= 200,
+	N_THREADS	= 4,
+};
+
+struct signed_hash {
+	bu256_t		sighash;
+	void		*pubkey;
+	size_t		pubkey_len;
+	void		*sig;
+	size_t		sig_len;
+	bool		good;
+};
+
+static struct bitc_key keys[N_KEYS];
+static struct signed_hash sigs[N_SIGS];
+
+/* every fifth one fails, by hash, key or signature */
+static void make_sigs(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < N_KEYS; i++) {
+		bitc_key_init(&keys[i]);
+		assert(bitc_key_generate(&keys[i]));
+	}
+
+	for (i = 0; i < N_SIGS; i++) {
+		struct signed_hash *s = &sigs[i];
+		struct bitc_key *key = &keys[i % N_KEYS];
+
+		sha256_Raw((const uint8_t *) &i, sizeof(i),
+			   (uint8_t *) &s->sighash);
+		assert(bitc_sign(key, &s->sighash, sizeof(s->sighash),
+				 &s->sig, &s->sig_len));
+		assert(bitc_pubkey_get(&keys[(i + (i % 15 == 5)) % N_KEYS],
+				       &s->pubkey, &s->pubkey_len));
+
+		s->good = (i % 5 != 0);
+		if (i % 15 == 0)
+			s->sighash.dword[0] ^= 1;
+		else if (i % 15 == 10)
+			((unsigned char *) s->sig)[s->sig_len - 1] ^= 1;
+	}
+}
+
+static void free_sigs(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_SIGS; i++) {
+		free(sigs[i].pubkey);
+		free(sigs[i].sig);
+	}
+	for (i = 0; i < N_KEYS; i++)
+		bitc_key_free(&keys[i]);
+}
+
+static void add_sigs(struct bitc_sigbatch *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_SIGS; i++) {
+		struct buffer pubkey = { sigs[i].pubkey, sigs[i].pubkey_len };
+		struct buffer sig = { sigs[i].sig, sigs[i].sig_len };
+
+		assert(bitc_sigbatch_add(b, &sigs[i].sighash, &pubkey, &sig));
+	}
+	assert(b->len == N_SIGS);
+}
+
+static void check_verdicts(const struct bitc_sigbatch *b)
+{
+	unsigned int i;
+
+	assert(bitc_sigbatch_done(b));
+	for (i = 0; i < N_SIGS; i++)
+		assert(b->entries[i].valid == sigs[i].good);
+}
+
+static void test_basics(void)
+{
+	struct bitc_sigbatch b;
+	unsigned char big[BITC_SIGBATCH_MAX_SIG + 1] = {};
+	struct buffer pubkey = { sigs[1].pubkey, sigs[1].pubkey_len };
+	struct buffer sig = { big, sizeof(big) };
+
+	bitc_sigbatch_init(&b);
+
+	// an empty batch is valid
+	assert(bitc_sigbatch_verify(&b) == true);
+
+	// too big to queue: left to the caller
+	assert(bitc_sigbatch_add(&b, &sigs[1].sighash, &pubkey, &sig) == false);
+	assert(b.len == 0);
+
+	// a good one alone
+	bitc_sigbatch_reset(&b);
+	sig.p = sigs[1].sig;
+	sig.len = sigs[1].sig_len;
+	assert(bitc_sigbatch_add(&b, &sigs[1].sighash, &pubkey, &sig));
+	assert(bitc_sigbatch_done(&b) == false);
+	assert(bitc_sigbatch_verify(&b) == true);
+
+	// one bad one fails the batch
+	bitc_sigbatch_reset(&b);
+	add_sigs(&b);
+	assert(bitc_sigbatch_verify(&b) == false);
+	check_verdicts(&b);
+
+	bitc_sigbatch_free(&b);
+}
+
+static void *thread_main(void *arg)
+{
+	bitc_sigbatch_run(arg);
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	pthread_t threads[N_THREADS];
+	struct bitc_sigbatch b;
+	unsigned int i;
+
+	assert(bitc_sigcache_init(64 * 1024) == true);
+	bitc_sigbatch_init(&b);
+	add_sigs(&b);
+
+	for (i = 0; i < N_THREADS; i++)
+		assert(pthread_create(&threads[i], NULL, thread_main, &b) == 0);
+	bitc_sigbatch_run(&b);
+	for (i = 0; i < N_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	check_verdicts(&b);
+	assert(b.failed == true);
+
+	// the good ones, and only those, are cached
+	for (i = 0; i < N_SIGS; i++) {
+		struct buffer pubkey = { sigs[i].pubkey, sigs[i].pubkey_len };
+		struct buffer sig = { sigs[i].sig, sigs[i].sig_len };
+
+		assert(bitc_sigcache_get(&sigs[i].sighash, &pubkey, &sig) ==
+		       sigs[i].good);
+	}
+
+	bitc_sigbatch_free(&b);
+	bitc_sigcache_free();
+}
+
+int main(int argc, char *argv[])
+{
+	make_sigs();
+	test_basics();
+	test_threads();
+	free_sigs();
+
+	bitc_key_static_shutdown();
+	return 0;
+}
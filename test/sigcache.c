@@ -0,0 +1,177 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/script/sigcache.h>       // for bitc_sigcache_get, etc
+#include <bitc/crypto/sha2.h>           // for sha256_Raw
+
+#include <assert.h>                     // for assert
+#include <pthread.h>                    // for pthread_create, etc
+#include <stdint.h>                     // for uint32_t
+#include <string.h>                     // for memset
+
+struct entry {
+	bu256_t		sighash;
+	unsigned char	pubkey[33];
+	unsigned char	sig[72];
+	struct buffer	pk_buf;
+	struct buffer	sig_buf;
+};
+
+static void make_entry(struct entry *e, uint32_t n)
+{
+	sha256_Raw(&n, sizeof(n), (uint8_t *) &e->sighash);
+	memset(e->pubkey, 0x02, sizeof(e->pubkey));
+	memcpy(e->pubkey + 1, &n, sizeof(n));
+	memset(e->sig, 0x30, sizeof(e->sig));
+	memcpy(e->sig + 4, &n, sizeof(n));
+
+	e->pk_buf.p = e->pubkey;
+	e->pk_buf.len = sizeof(e->pubkey);
+	e->sig_buf.p = e->sig;
+	e->sig_buf.len = 71 + (n & 1);
+}
+
+static bool entry_get(const struct entry *e)
+{
+	return bitc_sigcache_get(&e->sighash, &e->pk_buf, &e->sig_buf);
+}
+
+static void entry_add(const struct entry *e)
+{
+	bitc_sigcache_add(&e->sighash, &e->pk_buf, &e->sig_buf);
+}
+
+static void test_disabled(void)
+{
+	struct bitc_sigcache_stats st;
+	struct entry e;
+
+	make_entry(&e, 1);
+	assert(bitc_sigcache_enabled() == false);
+	entry_add(&e);
+	assert(entry_get(&e) == false);
+
+	bitc_sigcache_stats(&st);
+	assert(st.slots == 0 && st.hits == 0 && st.inserts == 0);
+}
+
+static void test_basics(void)
+{
+	enum { MAX_BYTES = 64 * 1024 };
+	struct bitc_sigcache_stats st;
+	struct entry e, other;
+	unsigned int i;
+
+	assert(bitc_sigcache_init(MAX_BYTES) == true);
+	assert(bitc_sigcache_enabled() == true);
+
+	bitc_sigcache_stats(&st);
+	assert(st.memory <= MAX_BYTES && st.memory > MAX_BYTES / 2);
+
+	make_entry(&e, 1);
+	assert(entry_get(&e) == false);
+	entry_add(&e);
+	assert(entry_get(&e) == true);
+
+	// each of sighash, pubkey and signature is part of the key
+	other = e;
+	other.sighash.dword[0] ^= 1;
+	assert(entry_get(&other) == false);
+	other = e;
+	other.pubkey[5] ^= 1;
+	other.pk_buf.p = other.pubkey;
+	other.sig_buf.p = other.sig;
+	assert(entry_get(&other) == false);
+	other.pubkey[5] ^= 1;
+	other.sig_buf.len--;
+	assert(entry_get(&other) == false);
+
+	bitc_sigcache_stats(&st);
+	assert(st.hits == 1 && st.misses == 4 && st.inserts == 1);
+
+	// a half-full table keeps everything
+	unsigned int n_half = st.slots / 2;
+	for (i = 0; i < n_half; i++) {
+		make_entry(&e, 1000 + i);
+		entry_add(&e);
+	}
+	for (i = 0; i < n_half; i++) {
+		make_entry(&e, 1000 + i);
+		assert(entry_get(&e) == true);
+	}
+	bitc_sigcache_stats(&st);
+	assert(st.evictions == 0);
+
+	// overfilling drops entries but stays within its memory
+	for (i = 0; i < st.slots * 4; i++) {
+		make_entry(&e, 100000 + i);
+		entry_add(&e);
+	}
+	bitc_sigcache_stats(&st);
+	assert(st.evictions >= st.slots * 2);
+	assert(st.memory <= MAX_BYTES);
+
+	// recent entries mostly survive
+	unsigned int hits = 0;
+	for (i = st.slots * 4 - 64; i < st.slots * 4; i++) {
+		make_entry(&e, 100000 + i);
+		hits += entry_get(&e);
+	}
+	assert(hits > 32);
+
+	bitc_sigcache_free();
+	assert(bitc_sigcache_enabled() == false);
+}
+
+enum { N_THREADS = 4, N_PER_THREAD = 20000 };
+
+static void *thread_main(void *arg)
+{
+	uint32_t base = (uintptr_t) arg * N_PER_THREAD;
+	struct entry e;
+	uint32_t i;
+
+	for (i = 0; i < N_PER_THREAD; i++) {
+		make_entry(&e, base + i);
+		if (!entry_get(&e))
+			entry_add(&e);
+
+		// another thread's entries; either answer is fine
+		make_entry(&e, (base + N_PER_THREAD + i) %
+			       (N_THREADS * N_PER_THREAD));
+		entry_get(&e);
+	}
+
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	pthread_t threads[N_THREADS];
+	struct bitc_sigcache_stats st;
+	uintptr_t i;
+
+	assert(bitc_sigcache_init(1024 * 1024) == true);
+
+	for (i = 0; i < N_THREADS; i++)
+		assert(pthread_create(&threads[i], NULL, thread_main,
+				      (void *) i) == 0);
+	for (i = 0; i < N_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	bitc_sigcache_stats(&st);
+	assert(st.inserts == N_THREADS * N_PER_THREAD);
+	assert(st.hits + st.misses == 2 * st.inserts);
+
+	bitc_sigcache_free();
+}
+
+int main(int argc, char *argv[])
+{
+	test_disabled();
+	test_basics();
+	test_threads();
+	return 0;
+}
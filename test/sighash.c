@@ -9,7 +9,9 @@
 #include <bitc/core.h>                  // for bitc_tx_free, bitc_tx_init, etc
 #include <bitc/cstr.h>                  // for cstr_free, cstring
 #include <bitc/hexcode.h>               // for hex2str
-#include <bitc/script/script.h>         // for bitc_tx_sighash
+#include <bitc/script/interpreter.h>    // for bitc_tx_sighash
+#include <bitc/script/script.h>         // for bsp_*
+#include <bitc/util.h>                  // for ARRAY_SIZE
 
 #include <cJSON.h>                      // for cJSON_GetArrayItem, cJSON, etc
 
@@ -17,6 +19,7 @@
 #include <stdbool.h>                    // for true
 #include <stdio.h>                      // for NULL
 #include <stdlib.h>                     // for free
+#include <string.h>                     // for memcmp
 
 
 static void runtest(const char* json_base_fn)
@@ -60,7 +63,7 @@ static void runtest(const char* json_base_fn)
 		    int nHashType = cJSON_GetArrayItem(test, 3)->valueint;
 
 		    bu256_t sighash;
-            bitc_tx_sighash(&sighash, scriptCode, &txTo, nIn, nHashType, 0, 0);
+            bitc_tx_sighash(&sighash, scriptCode, &txTo, nIn, nHashType, 0, 0, NULL);
 
             bu256_t sighash_res;
             hex_bu256(&sighash_res, cJSON_GetArrayItem(test, 4)->valuestring);
@@ -75,8 +78,62 @@ static void runtest(const char* json_base_fn)
     free(json_fn);
 }
 
+/* BIP143 native P2WPKH example; shared midstates must not change any hash */
+static void test_bip143(void)
+{
+    static const int hashtypes[] = {
+        SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE,
+        SIGHASH_ALL | SIGHASH_ANYONECANPAY,
+        SIGHASH_NONE | SIGHASH_ANYONECANPAY,
+        SIGHASH_SINGLE | SIGHASH_ANYONECANPAY,
+    };
+    cstring *tx_ser = hex2str(
+        "0100000002fff7f7881a8099afa6940d42d1e7f6362bec38171ea3edf433541db4"
+        "e4ad969f0000000000eeffffffef51e1b804cc89d182d279655c3aa89e815b1b30"
+        "9fe287d9b2b55d57b90ec68a0100000000ffffffff02202cb206000000001976a9"
+        "148280b37df378db99f66f85c95a783a76ac7a6d5988ac9093510d000000001976"
+        "a9143bde42dbee7e4dbe6a21b2d50ce2f0167faa815988ac11000000");
+    cstring *scriptCode = hex2str(
+        "76a9141d0f172a0ecb48aee1be1f2687d2963ae33f71a188ac");
+    cstring *expect = hex2str(
+        "c37af31116d1b27caf68aae9e3ac82f1477929014d5b917657d0eb49478cb670");
+    const int64_t amount = 600000000;
+
+    struct bitc_tx txTo;
+    bitc_tx_init(&txTo);
+    struct const_buffer buf = { tx_ser->str, tx_ser->len };
+    assert(deser_bitc_tx(&txTo, &buf) == true);
+
+    struct bitc_txdata txdata;
+    bitc_txdata_init(&txdata, &txTo);
+
+    bu256_t sighash, sighash_shared;
+    bitc_tx_sighash(&sighash, scriptCode, &txTo, 1, SIGHASH_ALL, amount,
+                    SIGVERSION_WITNESS_V0, &txdata);
+    assert(memcmp(&sighash, expect->str, sizeof(sighash)) == 0);
+    assert(txdata.have_prevouts && txdata.have_sequence && txdata.have_outputs);
+
+    unsigned int nIn, i;
+    for (nIn = 0; nIn < txTo.vin->len; nIn++) {
+        for (i = 0; i < ARRAY_SIZE(hashtypes); i++) {
+            bitc_tx_sighash(&sighash, scriptCode, &txTo, nIn, hashtypes[i],
+                            amount, SIGVERSION_WITNESS_V0, NULL);
+            bitc_tx_sighash(&sighash_shared, scriptCode, &txTo, nIn,
+                            hashtypes[i], amount, SIGVERSION_WITNESS_V0,
+                            &txdata);
+            assert(bu256_equal(&sighash, &sighash_shared));
+        }
+    }
+
+    bitc_tx_free(&txTo);
+    cstr_free(expect, true);
+    cstr_free(scriptCode, true);
+    cstr_free(tx_ser, true);
+}
+
 int main(int argc, char* argv[])
 {
     runtest("data/sighash.json");
+    test_bip143();
     return 0;
 }
@@ -0,0 +1,80 @@
+/* Copyright 2017 BitPay, Inc.
+ * Distributed under the MIT/X11 software license, see the accompanying
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.
+ */
+
+#include <bitc/spscq.h>                 // for bitc_spscq_push, etc
+
+#include <assert.h>                     // for assert
+#include <pthread.h>                    // for pthread_create, etc
+#include <stdint.h>                     // for uintptr_t
+#include <stdlib.h>                     // for NULL
+
+enum {
+	N_ITEMS		= 1000000,
+	QUEUE_SZ	= 100,
+};
+
+static void test_basics(void)
+{
+	struct bitc_spscq q;
+	uintptr_t i;
+
+	assert(bitc_spscq_init(&q, QUEUE_SZ));
+	assert(q.mask + 1 == 128);
+	assert(bitc_spscq_pop(&q) == NULL);
+
+	// fills, then empties in order
+	for (i = 1; i <= 128; i++)
+		assert(bitc_spscq_push(&q, (void *) i));
+	assert(bitc_spscq_push(&q, (void *) i) == false);
+
+	for (i = 1; i <= 128; i++)
+		assert(bitc_spscq_pop(&q) == (void *) i);
+	assert(bitc_spscq_pop(&q) == NULL);
+
+	bitc_spscq_free(&q);
+}
+
+static void *producer_main(void *arg)
+{
+	struct bitc_spscq *q = arg;
+	uintptr_t i;
+
+	for (i = 1; i <= N_ITEMS; i++)
+		while (!bitc_spscq_push(q, (void *) i))
+			;
+
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	struct bitc_spscq q;
+	pthread_t producer;
+	uintptr_t want = 1;
+
+	assert(bitc_spscq_init(&q, QUEUE_SZ));
+	assert(pthread_create(&producer, NULL, producer_main, &q) == 0);
+
+	// every item arrives once, in order
+	while (want <= N_ITEMS) {
+		void *p = bitc_spscq_pop(&q);
+
+		if (p) {
+			assert(p == (void *) want);
+			want++;
+		}
+	}
+
+	pthread_join(producer, NULL);
+	assert(bitc_spscq_pop(&q) == NULL);
+	bitc_spscq_free(&q);
+}
+
+int main(int argc, char *argv[])
+{
+	test_basics();
+	test_threads();
+	return 0;
+}
@@ -66,6 +66,20 @@ static void test_tx_valid(bool is_valid,
 
 	struct const_buffer buf = { tx_ser->str, tx_ser->len };
 	assert(deser_bitc_tx(&tx, &buf) == true);
+	assert(tx.sha256_valid && tx.wtxid_valid);
+
+	/* hashes taken from the wire must match re-serialization */
+	struct bitc_tx tx_copy;
+	bitc_tx_init(&tx_copy);
+	bitc_tx_copy(&tx_copy, &tx);
+	tx_copy.sha256_valid = false;
+	tx_copy.wtxid_valid = false;
+	bitc_tx_calc_sha256(&tx_copy);
+	bitc_tx_calc_wtxid(&tx_copy);
+	assert(bu256_equal(&tx_copy.sha256, &tx.sha256));
+	if (is_valid)
+		assert(bu256_equal(&tx_copy.wtxid, &tx.wtxid));
+	bitc_tx_free(&tx_copy);
 
 	if (is_valid) {
 		/* checking for valid tx; !bitc_tx_valid implies test fail */
@@ -82,6 +96,9 @@ static void test_tx_valid(bool is_valid,
 
 	bitc_tx_calc_sha256(&tx);
 
+	struct bitc_txdata txdata;
+	bitc_txdata_init(&txdata, &tx);
+
 	bool state = true;
 	unsigned int i;
 	for (i = 0; i < tx.vin->len; i++) {
@@ -114,7 +131,7 @@ static void test_tx_valid(bool is_valid,
 		}
 
         bool rc = bitc_script_verify(txin->scriptSig, scriptPubKey, &txin->scriptWitness,
-                    &tx, i, test_flags, *amount);
+                    &tx, i, test_flags, *amount, &txdata);
 
         state &= rc;
 
@@ -10,7 +10,7 @@
 #include <bitc/parr.h>                  // for parr
 #include <bitc/primitives/transaction.h>  // for bitc_tx, bitc_txout, etc
 #include <bitc/util.h>                  // for bu_read_file
-#include "libtest.h"                    // for test_filename
+#include "libtest.h"                    // for make_spend_tx, etc
 
 #include <cJSON.h>                      // for cJSON, cJSON_GetObjectItem, etc
 
@@ -90,9 +90,41 @@ static void runtest(const char *json_base_fn, const char *ser_base_fn)
 	cJSON_Delete(meta);
 }
 
+static void test_dup_inputs(void)
+{
+	static const unsigned int sizes[] = { 2, 8, 9, 128, 129, 24000 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		unsigned int n = sizes[i];
+		struct bitc_tx tx;
+
+		make_spend_tx(&tx, n);
+		assert(bitc_tx_valid(&tx) == true);
+
+		struct bitc_txin *first = parr_idx(tx.vin, 0);
+		struct bitc_txin *last = parr_idx(tx.vin, n - 1);
+		struct bitc_outpt saved = last->prevout;
+
+		// same output, spent by the first and last inputs
+		last->prevout = first->prevout;
+		assert(bitc_tx_valid(&tx) == false);
+
+		// same hash, other index
+		last->prevout.n ^= 1;
+		assert(bitc_tx_valid(&tx) == true);
+
+		last->prevout = saved;
+		assert(bitc_tx_valid(&tx) == true);
+
+		bitc_tx_free(&tx);
+	}
+}
+
 int main (int argc, char *argv[])
 {
 	runtest("data/tx3e0dc3da.json", "data/tx3e0dc3da.ser");
+	test_dup_inputs();
 
 	bitc_key_static_shutdown();
 	return 0;